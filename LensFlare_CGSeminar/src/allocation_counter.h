@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+
+// Heap allocations made through the global operator new on the calling thread since it started. The replaced operator new
+// (all plain, array, nothrow and aligned forms) lives in allocation_counter.cpp, which only the benchmark executable links.
+size_t getThreadAllocationCount();
+
+// Counts the allocations of the calling thread between construction and count(), e.g. to assert a steady-state call allocates nothing
+class AllocationCounter {
+public:
+    AllocationCounter() : m_start(getThreadAllocationCount()) {}
+    size_t count() const { return getThreadAllocationCount() - m_start; }
+
+private:
+    size_t m_start;
+};
@@ -15,11 +15,13 @@ DISABLE_WARNINGS_POP()
 #include <framework/shader.h>
 #include <framework/window.h>
 #include <functional>
+#include <memory>
 #include <iostream>
 #include <vector>
 #include <cmath>
 #include <limits>
 #include "lens_system.h"
+#include "ghost_table.h"
 #include "quad.h"
 #include "camera.h"
 #include "utils.h"
@@ -30,6 +32,8 @@ DISABLE_WARNINGS_POP()
 #include "lens_solver.h"
 #include "coating_solver.h"
 #include "aperture_maker.h"
+#include "fixed_lens_system.h"
+#include "spectral.h"
 
 /* GLOBAL PARAMS */
 HWND hwnd = GetConsoleWindow();
@@ -90,24 +94,15 @@ public:
 
     /* Method to update matrices and quads whenever there's a lens system change */
     void refreshMatricesAndQuads() {
-        m_default_Ma = m_lensSystem.getMa();
-        m_default_Ms = m_lensSystem.getMs();
-
-        m_preAptReflectionPairs = m_lensSystem.getPreAptReflections();
-        m_postAptReflectionPairs = m_lensSystem.getPostAptReflections();
-
-        for (FlareQuad &flareQuad : m_preAptQuads) {
-            flareQuad.releaseArrayAndBuffer();
+        // Rebuild in place unless a solver still holds on to the current ghosts
+        if (m_ghostTable.use_count() == 1) {
+            buildGhostTable(m_lensSystem, *m_ghostTable);
         }
-        for (FlareQuad& flareQuad : m_postAptQuads) {
-            flareQuad.releaseArrayAndBuffer();
+        else {
+            m_ghostTable = std::make_shared<GhostTable>(buildGhostTable(m_lensSystem));
         }
+        m_lensSystem.clearDirtyRange();
 
-        m_preAptQuads.clear();
-        m_postAptQuads.clear();
-        
-        m_preAptMas = m_lensSystem.getMa(m_preAptReflectionPairs);
-        m_postAptMss = m_lensSystem.getMs(m_postAptReflectionPairs);
         float ePHeight = 4 * (m_lensSystem.getEntrancePupilHeight() / 2);
         std::vector<glm::vec3> quad_points = {
                 {ePHeight, ePHeight, 0.0f},   //top right
@@ -115,14 +110,18 @@ public:
                 {-ePHeight, -ePHeight, 0.0f}, //bottom left
                 {-ePHeight, ePHeight, 0.0f}   //top left
         };
-        int quad_id = 0;
-        for (int i = 0; i < m_preAptReflectionPairs.size(); i++) {
-            m_preAptQuads.push_back(FlareQuad(quad_points, quad_id));
-            quad_id++;
+        // Keep the GL objects of existing quads, only the ghost count and the entrance pupil size matter
+        while (m_ghostQuads.size() > m_ghostTable->size()) {
+            m_ghostQuads.back().releaseArrayAndBuffer();
+            m_ghostQuads.pop_back();
+        }
+        for (FlareQuad& flareQuad : m_ghostQuads) {
+            if (flareQuad.getPoints() != quad_points) {
+                flareQuad.setPoints(quad_points);
+            }
         }
-        for (int i = 0; i < m_postAptReflectionPairs.size(); i++) {
-            m_postAptQuads.push_back(FlareQuad(quad_points, quad_id));
-            quad_id++;
+        for (int quad_id = m_ghostQuads.size(); quad_id < m_ghostTable->size(); quad_id++) {
+            m_ghostQuads.push_back(FlareQuad(quad_points, quad_id));
         }
 
         refreshTransmissions(glm::vec2(0.001f), m_quarterWaveCoating);
@@ -130,17 +129,31 @@ public:
         m_resetAnnotations = true;
     }
 
+    /* Method to update only the ghosts affected by the interfaces changed since the last refresh */
+    void refreshChangedGhosts() {
+        const LensDirtyRange& dirtyRange = m_lensSystem.getDirtyRange();
+        if (dirtyRange.ghostsChanged) {
+            refreshMatricesAndQuads();
+            return;
+        }
+        // Edits show the transmissions at the default angle, like a full refresh
+        bool traceReusable = m_spectralBins == 0 && m_ghostTable->traceYawAndPitch == glm::vec2(0.001f) && m_ghostTable->traceQuarterWaveCoating == (m_quarterWaveCoating != 0);
+        m_ghostTable->traceValid &= traceReusable;
+        m_ghostTable->update(m_lensSystem, dirtyRange);
+        m_lensSystem.clearDirtyRange();
+        if (!traceReusable) {
+            refreshTransmissions(glm::vec2(0.001f), m_quarterWaveCoating);
+        }
+    }
+
     void refreshTransmissions(glm::vec2 yawandPitch, bool quarterWaveCoating) {
-        glm::vec2 post_apt_center_ray_x = glm::vec2(-yawandPitch.x * m_default_Ma[1][0] / m_default_Ma[0][0], yawandPitch.x);
-        glm::vec2 post_apt_center_ray_y = glm::vec2(-yawandPitch.y * m_default_Ma[1][0] / m_default_Ma[0][0], yawandPitch.y);
-        std::vector<glm::vec2> pre_apt_center_ray_x;
-        std::vector<glm::vec2> pre_apt_center_ray_y;
-        for (auto& const preAptMa : m_preAptMas) {
-            pre_apt_center_ray_x.push_back(glm::vec2(-yawandPitch.x * preAptMa[1][0] / preAptMa[0][0], yawandPitch.x));
-            pre_apt_center_ray_y.push_back(glm::vec2(-yawandPitch.y * preAptMa[1][0] / preAptMa[0][0], yawandPitch.y));
+        if (m_spectralBins > 0) {
+            // Spectral transmissions are not traced, edits refresh them in full
+            m_ghostTable->computeTransmissions(m_lensSystem, yawandPitch, quarterWaveCoating, m_spectralSampling, m_ghostTable->transmission);
+            m_ghostTable->traceValid = false;
+            return;
         }
-        m_preAPTtransmissions = m_lensSystem.getTransmission(m_preAptReflectionPairs, pre_apt_center_ray_x, pre_apt_center_ray_y, quarterWaveCoating);
-        m_postAPTtransmissions = m_lensSystem.getTransmission(m_postAptReflectionPairs, post_apt_center_ray_x, post_apt_center_ray_y, quarterWaveCoating);
+        m_ghostTable->refreshTransmissions(m_lensSystem, yawandPitch, quarterWaveCoating);
     }
 
 	void updateStarburstTexture(GLuint texStarburst) {
@@ -535,6 +548,13 @@ public:
                     refreshTransmissions(m_yawandPitch, m_quarterWaveCoating);
                     m_calibrateLightSource = true;
                 }
+                if (ImGui::SliderInt("Spectral Bins (0 = RGB)", &m_spectralBins, 0, 64)) {
+                    if (m_spectralBins > 0) {
+                        m_spectralSampling = SpectralSampling(m_spectralBins);
+                    }
+                    refreshTransmissions(m_yawandPitch, m_quarterWaveCoating);
+                    m_calibrateLightSource = true;
+                }
 
                 if (!(m_optimizeInterfacesWithEA || m_optimizeCoatingsWithEA)) {
 
@@ -594,12 +614,12 @@ public:
 
                             if (ImGui::SliderFloat("Thickness", &lensInterface.di, 0.001f, 250.0f)) {
                                 m_lensSystem.setLensInterfaces(m_lens_interfaces);
-                                refreshMatricesAndQuads();
+                                refreshChangedGhosts();
                                 lensInterfaceRefresh = true;
                             }
                             if (ImGui::SliderFloat("Refractive Index", &lensInterface.ni, 1.0f, 2.5f)) {
                                 m_lensSystem.setLensInterfaces(m_lens_interfaces);
-                                refreshMatricesAndQuads();
+                                refreshChangedGhosts();
                                 lensInterfaceRefresh = true;
                             }
                             int convexLens = 0;
@@ -624,24 +644,24 @@ public:
                             }
                             if (ImGui::IsItemEdited() || radioButtonChange) {
                                 m_lensSystem.setLensInterfaces(m_lens_interfaces);
-                                refreshMatricesAndQuads();
+                                refreshChangedGhosts();
                                 lensInterfaceRefresh = true;
                             }
                             if (m_quarterWaveCoating) {
                                 if (ImGui::SliderFloat("Lambda0", &lensInterface.lambda0, 380.0f, 740.0f)) {
                                     m_lensSystem.setLensInterfaces(m_lens_interfaces);
-                                    refreshMatricesAndQuads();
+                                    refreshChangedGhosts();
                                     lensInterfaceRefresh = true;
                                 }
                             }
                             else {
                                 if (ImGui::SliderFloat("Coating Thickness", &lensInterface.c_di, 25, 750.0f)) {
                                     m_lensSystem.setLensInterfaces(m_lens_interfaces);
-                                    refreshMatricesAndQuads();
+                                    refreshChangedGhosts();
                                 }
                                 if (ImGui::SliderFloat("Coating Refractive Index", &lensInterface.c_ni, 1.38f, 1.9f)) {
                                     m_lensSystem.setLensInterfaces(m_lens_interfaces);
-                                    refreshMatricesAndQuads();
+                                    refreshChangedGhosts();
                                 }
                             }
                             
@@ -717,12 +737,7 @@ public:
                         selectedQuadId = m_selectedQuadIDs[m_selectedQuadIndex];
                         if (selectedQuadId != selectedQuadIdMemory || lensInterfaceRefresh == true) {
                             //update vals
-                            if (selectedQuadId < m_preAptReflectionPairs.size()) {
-                                selectedQuadReflectionInterfaces = m_preAptReflectionPairs[selectedQuadId];
-                            }
-                            else {
-                                selectedQuadReflectionInterfaces = m_postAptReflectionPairs[selectedQuadId - m_preAptReflectionPairs.size()];
-                            }
+                            selectedQuadReflectionInterfaces = m_ghostTable->reflectionPairs[selectedQuadId];
                             selectedQuadIdMemory = selectedQuadId;
                             lensInterfaceRefresh = false;
                             auto reflectivityData = computeReflectivityPerLambda(m_lensSystem, selectedQuadReflectionInterfaces, m_yawandPitch);
@@ -732,7 +747,15 @@ public:
 
                         if (m_quarterWaveCoating) {
 
-                            std::vector<float> lambda_values, reflectivityR, reflectivityG, reflectivityB;
+                            // Plot buffers are members so a steady frame does not allocate
+                            std::vector<float>& lambda_values = m_plotLambdaValues;
+                            std::vector<float>& reflectivityR = m_plotReflectivityR;
+                            std::vector<float>& reflectivityG = m_plotReflectivityG;
+                            std::vector<float>& reflectivityB = m_plotReflectivityB;
+                            lambda_values.clear();
+                            reflectivityR.clear();
+                            reflectivityG.clear();
+                            reflectivityB.clear();
                             if (selectedInterfaceInPair == 0) {
                                 for (const auto& entry : m_reflectivity_per_lambda_first_interface) {
                                     lambda_values.push_back(entry.first);  // Lambda
@@ -750,7 +773,8 @@ public:
                                 }
                             }
 
-                            std::vector<std::vector<glm::vec3>> colorGrid = computeCoatingColorGrid(m_lensSystem, selectedQuadReflectionInterfaces, m_yawandPitch);
+                            std::vector<std::vector<glm::vec3>>& colorGrid = m_coatingColorGrid;
+                            computeCoatingColorGrid(m_lensSystem, selectedQuadReflectionInterfaces, m_yawandPitch, colorGrid);
                             ImVec2 heatmapSize(350, 350);
                             float minLambda = 380.0f;
                             float maxLambda = 740.0f;
@@ -779,13 +803,7 @@ public:
 
                             ImGui::TextColored(ImVec4(0.7f, 0.7f, 0.0f, 1.0f), "Selected Ghost Color:");
 							ImGui::SameLine();
-                            glm::vec3 colorOfSelectedGhost;
-                            if (selectedQuadId < m_preAPTtransmissions.size()) {
-                                colorOfSelectedGhost = m_preAPTtransmissions[selectedQuadId];
-                            }
-                            else {
-                                colorOfSelectedGhost = m_postAPTtransmissions[selectedQuadId - m_preAPTtransmissions.size()];
-                            }
+                            glm::vec3 colorOfSelectedGhost = m_ghostTable->transmission[selectedQuadId];
                             colorOfSelectedGhost *= m_light_intensity;
                             colorOfSelectedGhost = normalizeRGB(colorOfSelectedGhost);
                             ImGui::ColorButton("Selected Ghost Color", ImVec4(colorOfSelectedGhost.x, colorOfSelectedGhost.y, colorOfSelectedGhost.z, 0.5f));
@@ -807,12 +825,12 @@ public:
 
                         if (ImGui::SliderFloat("Thickness ", &lensInterface.di, 0.001f, 200.0f)) {
                             m_lensSystem.setLensInterfaces(m_lens_interfaces);
-                            refreshMatricesAndQuads();
+                            refreshChangedGhosts();
 							lensInterfaceRefresh = true;
                         }
                         if (ImGui::SliderFloat("Refractive Index ", &lensInterface.ni, 1.0f, 2.5f)) {
                             m_lensSystem.setLensInterfaces(m_lens_interfaces);
-                            refreshMatricesAndQuads();
+                            refreshChangedGhosts();
 							lensInterfaceRefresh = true;
                         }
                         int convexLens = 0;
@@ -837,25 +855,25 @@ public:
                         }
                         if (ImGui::IsItemEdited() || radioButtonChange) {
                             m_lensSystem.setLensInterfaces(m_lens_interfaces);
-                            refreshMatricesAndQuads();
+                            refreshChangedGhosts();
                             lensInterfaceRefresh = true;
                         }
 
                         if (m_quarterWaveCoating) {
                             if (ImGui::SliderFloat("Lambda0 ", &lensInterface.lambda0, 380.0f, 740.0f)) {
                                 m_lensSystem.setLensInterfaces(m_lens_interfaces);
-                                refreshMatricesAndQuads();
+                                refreshChangedGhosts();
                                 lensInterfaceRefresh = true;
                             }
                         }
                         else {
                             if (ImGui::SliderFloat("Coating Thickness ", &lensInterface.c_di, 25, 750.0f)) {
                                 m_lensSystem.setLensInterfaces(m_lens_interfaces);
-                                refreshMatricesAndQuads();
+                                refreshChangedGhosts();
                             }
                             if (ImGui::SliderFloat("Coating Refractive Index ", &lensInterface.c_ni, 1.38f, 1.9f)) {
                                 m_lensSystem.setLensInterfaces(m_lens_interfaces);
-                                refreshMatricesAndQuads();
+                                refreshChangedGhosts();
                             }
                         }
 
@@ -924,6 +942,30 @@ public:
                         m_resetAnnotations = true;
                     }
                     ImGui::SliderFloat("Ghost Intensity", &ghostIntensity, 0.1, 2);
+                    ImGui::Text("Fitness On: ");
+                    ImGui::RadioButton("Auto", &m_batchEvaluator, static_cast<int>(BatchEvaluator::Auto));
+                    ImGui::SameLine();
+                    ImGui::RadioButton("CPU", &m_batchEvaluator, static_cast<int>(BatchEvaluator::Host));
+                    ImGui::SameLine();
+                    //RV-GOMEA evaluates its candidates one at a time on the host
+                    ImGui::BeginDisabled(m_lensOptimizer == static_cast<int>(LensOptimizer::RVGomea));
+                    ImGui::RadioButton("OpenCL", &m_batchEvaluator, static_cast<int>(BatchEvaluator::OpenCL));
+                    ImGui::SameLine();
+                    ImGui::RadioButton("CPU+OpenCL", &m_batchEvaluator, static_cast<int>(BatchEvaluator::Heterogeneous));
+                    ImGui::EndDisabled();
+                    ImGui::Text("Optimizer: ");
+                    ImGui::RadioButton("pso_gen", &m_lensOptimizer, static_cast<int>(LensOptimizer::PsoGen));
+                    ImGui::SameLine();
+                    if (ImGui::RadioButton("RV-GOMEA", &m_lensOptimizer, static_cast<int>(LensOptimizer::RVGomea)) && m_batchEvaluator != static_cast<int>(BatchEvaluator::Auto)) {
+                        m_batchEvaluator = static_cast<int>(BatchEvaluator::Host);
+                    }
+                    ImGui::SameLine();
+                    ImGui::BeginDisabled(m_lensOptimizer != static_cast<int>(LensOptimizer::RVGomea));
+                    ImGui::Checkbox("Partial Evaluation", &m_partialEvaluation);
+                    ImGui::EndDisabled();
+                    ImGui::Checkbox("Branch and Bound", &m_branchAndBound);
+                    ImGui::SameLine();
+                    ImGui::Checkbox("Surrogate", &m_surrogate);
                     if (ImGui::Button("Run EA")) {
                         m_takeSnapshot = 2;
                         optimizeLensSystemWithEA = true;
@@ -949,6 +991,7 @@ public:
                             m_colorAnnotations[selectedQuadId] = selected_ghost_color;
                         }
                     }
+                    ImGui::Checkbox("Surrogate", &m_surrogate);
                     if (ImGui::Button("Run EA")) {
                         optimizeLensCoatingsWithEA = true;
                         m_optimizeCoatingsWithEA = false;
@@ -1013,6 +1056,30 @@ public:
                 if (ImGui::Button("Reset Annotations")) {
                     m_resetAnnotations = true;
 				}
+                ImGui::Text("Fitness On: ");
+                ImGui::RadioButton("Auto##build", &m_batchEvaluator, static_cast<int>(BatchEvaluator::Auto));
+                ImGui::SameLine();
+                ImGui::RadioButton("CPU##build", &m_batchEvaluator, static_cast<int>(BatchEvaluator::Host));
+                ImGui::SameLine();
+                //RV-GOMEA evaluates its candidates one at a time on the host
+                ImGui::BeginDisabled(m_lensOptimizer == static_cast<int>(LensOptimizer::RVGomea));
+                ImGui::RadioButton("OpenCL##build", &m_batchEvaluator, static_cast<int>(BatchEvaluator::OpenCL));
+                ImGui::SameLine();
+                ImGui::RadioButton("CPU+OpenCL##build", &m_batchEvaluator, static_cast<int>(BatchEvaluator::Heterogeneous));
+                ImGui::EndDisabled();
+                ImGui::Text("Optimizer: ");
+                ImGui::RadioButton("pso_gen##build", &m_lensOptimizer, static_cast<int>(LensOptimizer::PsoGen));
+                ImGui::SameLine();
+                if (ImGui::RadioButton("RV-GOMEA##build", &m_lensOptimizer, static_cast<int>(LensOptimizer::RVGomea)) && m_batchEvaluator != static_cast<int>(BatchEvaluator::Auto)) {
+                    m_batchEvaluator = static_cast<int>(BatchEvaluator::Host);
+                }
+                ImGui::SameLine();
+                ImGui::BeginDisabled(m_lensOptimizer != static_cast<int>(LensOptimizer::RVGomea));
+                ImGui::Checkbox("Partial Evaluation##build", &m_partialEvaluation);
+                ImGui::EndDisabled();
+                ImGui::Checkbox("Branch and Bound##build", &m_branchAndBound);
+                ImGui::SameLine();
+                ImGui::Checkbox("Surrogate##build", &m_surrogate);
 				if (ImGui::Button("Build")) {
                     //RUN EA and reset params
                     optimizeLensSystemWithEA = true;
@@ -1056,7 +1123,7 @@ public:
                 m_colorAnnotations.clear();
 				int amount_ghosts = 0;
                 if (!m_buildFromScratch) {
-                    amount_ghosts = m_preAptReflectionPairs.size() + m_postAptReflectionPairs.size();
+                    amount_ghosts = m_ghostTable->size();
                 }
                 else {
                     amount_ghosts = m_lens_builder_quads.size();
@@ -1095,12 +1162,7 @@ public:
             if (!m_buildFromScratch) {
 
                 if (optimizeCoatings && m_selectedQuadIndex != -1 && m_quarterWaveCoating) {
-                    if (m_selectedQuadIDs[m_selectedQuadIndex] < m_preAptReflectionPairs.size()) {
-                        optimizeLensCoatingsGridSearch(m_lensSystem, selected_ghost_color, m_preAptReflectionPairs[m_selectedQuadIDs[m_selectedQuadIndex]], glm::vec2(0.001));
-                    }
-                    else {
-                        optimizeLensCoatingsGridSearch(m_lensSystem, selected_ghost_color, m_postAptReflectionPairs[m_selectedQuadIDs[m_selectedQuadIndex] - m_preAptReflectionPairs.size()], glm::vec2(0.001));
-                    }
+                    optimizeLensCoatingsGridSearch(m_lensSystem, selected_ghost_color, m_ghostTable->reflectionPairs[m_selectedQuadIDs[m_selectedQuadIndex]], glm::vec2(0.001));
                     m_lens_interfaces = m_lensSystem.getLensInterfaces();
                     refreshTransmissions(m_yawandPitch, m_quarterWaveCoating);
                     lensInterfaceRefresh = true;
@@ -1110,10 +1172,7 @@ public:
 
                 if (m_calibrateLightSource) {
                     double totalSum = 0.0;
-                    for (const auto& vec : m_preAPTtransmissions) {
-                        totalSum += vec.x + vec.y + vec.z;
-                    }
-                    for (const auto& vec : m_postAPTtransmissions) {
+                    for (const auto& vec : m_ghostTable->transmission) {
                         totalSum += vec.x + vec.y + vec.z;
                     }
 					m_light_intensity = (1.0f / (totalSum)) * 3;
@@ -1149,39 +1208,22 @@ public:
                 glUniform1i(7, 0);
 
                 /* Bind Quad Specific Variables */
-                for (int i = 0; i < m_preAptReflectionPairs.size(); i++) {
+                const GhostTable& ghostTable = *m_ghostTable;
+                for (int i = 0; i < ghostTable.size(); i++) {
                     if (m_selectedQuadIndex != -1 && m_selectedQuadIDs[m_selectedQuadIndex] == i && highlightSelectedQuad) {
-                        m_preAptQuads[i].drawQuad(m_preAptMas[i], m_default_Ms, selected_ghost_color, m_annotationData[i]);
+                        m_ghostQuads[i].drawQuad(ghostTable.layout[i], selected_ghost_color, m_annotationData[i]);
                     }
                     else if (m_optimizeInterfacesWithEA || renderGreyScale) {
                         glm::vec3 greyscaleColor = glm::vec3((1.f / m_annotationData.size()) * 2 * ghostIntensity);
-                        m_preAptQuads[i].drawQuad(m_preAptMas[i], m_default_Ms, greyscaleColor, m_annotationData[i]);
+                        m_ghostQuads[i].drawQuad(ghostTable.layout[i], greyscaleColor, m_annotationData[i]);
                     }
                     else {
                         if (m_optimizeCoatingsWithEA && m_colorAnnotations[i] != glm::vec3(-1.0f, -1.0f, -1.0f)) {
-							m_preAptQuads[i].drawQuad(m_preAptMas[i], m_default_Ms, m_colorAnnotations[i], m_annotationData[i]);
+							m_ghostQuads[i].drawQuad(ghostTable.layout[i], m_colorAnnotations[i], m_annotationData[i]);
 						}
                         else {
-                            glm::vec3 ghost_color = m_light_intensity * m_preAPTtransmissions[i];
-                            m_preAptQuads[i].drawQuad(m_preAptMas[i], m_default_Ms, ghost_color, m_annotationData[i]);
-                        }
-                    }
-                }
-                for (int i = 0; i < m_postAptReflectionPairs.size(); i++) {
-                    if (m_selectedQuadIndex != -1 && m_selectedQuadIDs[m_selectedQuadIndex] - m_preAptReflectionPairs.size() == i && highlightSelectedQuad) {
-                        m_postAptQuads[i].drawQuad(m_default_Ma, m_postAptMss[i], selected_ghost_color, m_annotationData[i + m_preAptReflectionPairs.size()]);
-                    }
-                    else if (m_optimizeInterfacesWithEA || renderGreyScale) {
-                        glm::vec3 greyscaleColor = glm::vec3((1.f / m_annotationData.size()) * 2 * ghostIntensity);
-                        m_postAptQuads[i].drawQuad(m_default_Ma, m_postAptMss[i], greyscaleColor, m_annotationData[i + m_preAptReflectionPairs.size()]);
-                    }
-                    else {
-                        if (m_optimizeCoatingsWithEA && m_colorAnnotations[i + m_preAptReflectionPairs.size()] != glm::vec3(-1.0f, -1.0f, -1.0f)) {
-                            m_postAptQuads[i].drawQuad(m_default_Ma, m_postAptMss[i], m_colorAnnotations[i + m_preAptReflectionPairs.size()], m_annotationData[i + m_preAptReflectionPairs.size()]);
-                        }
-                        else {
-                            glm::vec3 ghost_color = m_light_intensity * m_postAPTtransmissions[i];
-                            m_postAptQuads[i].drawQuad(m_default_Ma, m_postAptMss[i], ghost_color, m_annotationData[i + m_preAptReflectionPairs.size()]);
+                            glm::vec3 ghost_color = m_light_intensity * ghostTable.transmission[i];
+                            m_ghostQuads[i].drawQuad(ghostTable.layout[i], ghost_color, m_annotationData[i]);
                         }
                     }
                 }
@@ -1217,13 +1259,8 @@ public:
                     if (!m_selectedQuadIDs.empty()) {
                         m_selectedQuadIndex = 0;
                         std::cout << "Selected Ghost: " << m_selectedQuadIDs[m_selectedQuadIndex] << std::endl;
-                        if (m_selectedQuadIDs[m_selectedQuadIndex] < m_preAptReflectionPairs.size()) {
-                            std::cout << "Reflections at: " << m_preAptReflectionPairs[m_selectedQuadIDs[m_selectedQuadIndex]].x << ", " << m_preAptReflectionPairs[m_selectedQuadIDs[m_selectedQuadIndex]].y << std::endl;
-                        }
-                        else {
-                        
-                            std::cout << "Reflections at: " << m_postAptReflectionPairs[m_selectedQuadIDs[m_selectedQuadIndex] - m_preAptReflectionPairs.size()].x << ", " << m_postAptReflectionPairs[m_selectedQuadIDs[m_selectedQuadIndex] - m_preAptReflectionPairs.size()].y << std::endl;
-                        }
+                        glm::vec2 selectedReflectionPair = m_ghostTable->reflectionPairs[m_selectedQuadIDs[m_selectedQuadIndex]];
+                        std::cout << "Reflections at: " << selectedReflectionPair.x << ", " << selectedReflectionPair.y << std::endl;
 
                         m_quadcenter_points.clear();
 
@@ -1277,7 +1314,7 @@ public:
              
                 if (optimizeLensSystemWithEA) {
                     //Optimize
-                    eaTop5Systems = solveLensAnnotations(m_lensSystem, m_snapshotData, m_yawandPitch.x, m_yawandPitch.y);
+                    eaTop5Systems = solveLensAnnotations(m_lensSystem, m_snapshotData, m_yawandPitch.x, m_yawandPitch.y, static_cast<BatchEvaluator>(m_batchEvaluator), static_cast<LensOptimizer>(m_lensOptimizer), m_branchAndBound, m_surrogate, m_partialEvaluation);
                     eaTop5SystemsIndex = 0;
 					m_lensSystem = eaTop5Systems[0];
                     m_lens_interfaces = m_lensSystem.getLensInterfaces();
@@ -1300,16 +1337,11 @@ public:
                             renderObjective.push_back(m_colorAnnotations[i]);
                         }
                         else {
-							if (i < m_preAptReflectionPairs.size()) {
-								renderObjective.push_back(m_preAPTtransmissions[i] * m_light_intensity);
-							}
-							else {
-								renderObjective.push_back(m_postAPTtransmissions[i - m_preAptReflectionPairs.size()] * m_light_intensity);
-							}
+							renderObjective.push_back(m_ghostTable->transmission[i] * m_light_intensity);
                         }
                     }
 
-                    m_lensSystem = solveCoatingAnnotations(m_lensSystem, renderObjective, m_yawandPitch.x, m_yawandPitch.y, m_light_intensity, m_quarterWaveCoating);
+                    m_lensSystem = solveCoatingAnnotations(m_lensSystem, m_ghostTable, renderObjective, m_yawandPitch.x, m_yawandPitch.y, m_light_intensity, m_quarterWaveCoating, m_surrogate);
                     m_lens_interfaces = m_lensSystem.getLensInterfaces();
                     refreshMatricesAndQuads();
                     m_selectedQuadIndex = -1;
@@ -1409,7 +1441,7 @@ public:
 						snapshotData.push_back(conversion);
 					}
                     //Optimize
-                    eaTop5Systems = solveLensAnnotations(snapshotData, m_yawandPitch.x, m_yawandPitch.y);
+                    eaTop5Systems = solveLensAnnotations(snapshotData, m_yawandPitch.x, m_yawandPitch.y, static_cast<BatchEvaluator>(m_batchEvaluator), static_cast<LensOptimizer>(m_lensOptimizer), m_branchAndBound, m_surrogate, m_partialEvaluation);
                     eaTop5SystemsIndex = 0;
 					m_lensSystem = eaTop5Systems[0];
                     m_lens_interfaces = m_lensSystem.getLensInterfaces();
@@ -1688,19 +1720,18 @@ private:
     /* Lens System */
     LensSystem m_lensSystem = heliarTronerLens();
     std::vector<LensInterface> m_lens_interfaces;
-    glm::mat2x2 m_default_Ma = m_lensSystem.getMa();
-    glm::mat2x2 m_default_Ms = m_lensSystem.getMs();
-    std::vector<glm::vec2> m_preAptReflectionPairs = m_lensSystem.getPreAptReflections();
-    std::vector<glm::vec2> m_postAptReflectionPairs = m_lensSystem.getPostAptReflections();
-    std::vector<glm::mat2x2> m_preAptMas = m_lensSystem.getMa(m_preAptReflectionPairs);
-    std::vector<glm::mat2x2> m_postAptMss = m_lensSystem.getMs(m_postAptReflectionPairs);
-    std::vector<FlareQuad> m_preAptQuads;
-    std::vector<FlareQuad> m_postAptQuads;
-    std::vector<glm::vec3> m_preAPTtransmissions;
-    std::vector<glm::vec3> m_postAPTtransmissions;
+    std::shared_ptr<GhostTable> m_ghostTable = std::make_shared<GhostTable>(m_lensSystem);
+    std::vector<FlareQuad> m_ghostQuads;
     int m_quarterWaveCoating = true;
+    int m_spectralBins = 0;
+    SpectralSampling m_spectralSampling;
     std::vector<std::pair<float, glm::vec3>> m_reflectivity_per_lambda_first_interface;
     std::vector<std::pair<float, glm::vec3>> m_reflectivity_per_lambda_second_interface;
+    std::vector<float> m_plotLambdaValues;
+    std::vector<float> m_plotReflectivityR;
+    std::vector<float> m_plotReflectivityG;
+    std::vector<float> m_plotReflectivityB;
+    std::vector<std::vector<glm::vec3>> m_coatingColorGrid;
 
     std::vector<LensSystem> eaTop5Systems;
     int eaTop5SystemsIndex = 0;
@@ -1730,6 +1761,11 @@ private:
     bool m_buildFromScratch = false;
     bool m_optimizeInterfacesWithEA = false;
     bool m_optimizeCoatingsWithEA = false;
+    int m_batchEvaluator = static_cast<int>(BatchEvaluator::Auto);
+    int m_lensOptimizer = static_cast<int>(LensOptimizer::PsoGen);
+    bool m_branchAndBound = false;
+    bool m_surrogate = false;
+    bool m_partialEvaluation = true;
     std::vector<FlareQuad> m_lens_builder_quads;
 	int m_buildQuadIDCounter = 0;
 
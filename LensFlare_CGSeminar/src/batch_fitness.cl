@@ -1,4 +1,11 @@
-﻿#pragma OPENCL EXTENSION cl_khr_fp64 : enable  // Enable double precision
+﻿// Population, render objective and fitness are transferred as population_t: float when the host builds with
+// -D FLOAT_POPULATION, which needs no fp64 support on the device, and double otherwise. The math is float either way.
+#ifdef FLOAT_POPULATION
+typedef float population_t;
+#else
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable  // Enable double precision
+typedef double population_t;
+#endif
 
 //---------------------------------------------------------------------
 // Helper: Multiply two 2×2 matrices (in column‑major order).
@@ -581,20 +588,67 @@ inline void simulateDrawQuad(const float Ma[4],
 //=====================================================================
 // MAIN KERNEL
 //=====================================================================
-__kernel void batch_fitness_kernel(__global const double* d_population,
-    __global double* d_fitness,
-    __global const double* d_renderObj,
+// The host builds the program with -D NUM_INTERFACES=N for the problem size, so the private arrays below hold the ghosts
+// of N interfaces. Without it they are sized for up to 40 interfaces.
+#ifdef NUM_INTERFACES
+#define MAX_INTERFACES NUM_INTERFACES
+#else
+#define MAX_INTERFACES 40
+#endif
+#define MAX_INTERFACEPARAMS (MAX_INTERFACES * 3)
+#define MAX_GHOSTS ((MAX_INTERFACES * (MAX_INTERFACES - 1)) / 2)
+
+//=====================================================================
+// BRANCH AND BOUND
+//=====================================================================
+// Both kernels take an upper bound (INFINITY for none) and stop a candidate once its fitness is certain to exceed it,
+// writing the lower bound that exceeded it instead, like LensSystemProblem::computeFitness. A ghost that is not among
+// the num_render_obj smallest quad heights seen so far is never matched, so its extra ghost penalty is certain.
+// d_bound_stats counts the stopped candidates, the ghosts of all candidates and the ghosts left out (bounded calls only).
+// batch_fitness_kernel keeps the smallest heights in a private array of MAX_BOUND_MATCHES, more render objectives run
+// unbounded.
+#define MAX_BOUND_MATCHES 32
+
+// Adds the count-th ghost of a candidate to its smallest quad heights (the first min(count, matched) entries of heights,
+// largest at *largest), returns the extra ghost penalty that became certain. Same as FitnessLowerBound::addGhost.
+inline float addBoundGhost(float* heights, int* largest, int count, int matched, float height)
+{
+    if (isnan(height)) {
+        return NAN;
+    }
+    if (count <= matched) {
+        heights[count - 1] = height;
+        if (height > heights[*largest]) {
+            *largest = count - 1;
+        }
+        return 0.0f;
+    }
+    float unmatched = height;
+    if (height < heights[*largest]) {
+        unmatched = heights[*largest];
+        heights[*largest] = height;
+        for (int k = 0; k < matched; k++) {
+            if (heights[k] > heights[*largest]) {
+                *largest = k;
+            }
+        }
+    }
+    return 500.0f / unmatched;
+}
+
+__kernel void batch_fitness_kernel(__global const population_t* d_population,
+    __global population_t* d_fitness,
+    __global const population_t* d_renderObj,
     const int candidate_dim,
     const int num_render_obj,
     const float light_angle_x,
-    const float light_angle_y)
+    const float light_angle_y,
+    const float upper_bound,
+    __global int* d_bound_stats)
 {
     int idx = get_global_id(0);
     const int base_index = idx * candidate_dim;
     float fitness_value = 0.0f;
-    #define MAX_INTERFACES 40
-    #define MAX_INTERFACEPARAMS (40 * 3)
-    #define MAX_GHOSTS ((MAX_INTERFACES * (MAX_INTERFACES - 1)) / 2)
 
 
     // Reconstruct candidate parameters.
@@ -602,8 +656,12 @@ __kernel void batch_fitness_kernel(__global const double* d_population,
     // d_population[base_index + 1] = apt height.
     int apt_pos = (int)round((float)d_population[base_index + 0]);
     float apt_height = (float)d_population[base_index + 1];
-    // Number of interfaces reconstructed:
+    // Number of interfaces reconstructed, a compile time constant when the program is built for the problem size:
+#ifdef NUM_INTERFACES
+    const int num_interfaces = NUM_INTERFACES;
+#else
     int num_interfaces = (candidate_dim - 2) / 3;
+#endif
 
     // Build candidate’s interface array (repaired) in a local array.
     float interface_params[MAX_INTERFACEPARAMS];
@@ -645,7 +703,7 @@ __kernel void batch_fitness_kernel(__global const double* d_population,
     // If not enough ghost images are produced, assign a high penalty.
     if ((preAptCount + postAptCount) < num_render_obj) {
         fitness_value = 100000.0f;
-        d_fitness[idx] = (double)fitness_value;
+        d_fitness[idx] = (population_t)fitness_value;
         return;
     }
 
@@ -654,34 +712,54 @@ __kernel void batch_fitness_kernel(__global const double* d_population,
     computeMa(interface_params, num_interfaces, apt_pos, default_Ma);
     computeMs(interface_params, num_interfaces, apt_pos, default_Ms);
 
-    // Compute reflection–based matrices for ghost images.
-
-    float preAptMas[MAX_GHOSTS][4];
-    for (int i = 0; i < preAptCount; i++) {
-        int2 pair = preAptPairs[i];
-        computeMa_reflection(interface_params, num_interfaces, apt_pos, pair.x, pair.y, preAptMas[i]);
-    }
-    float postAptMss[MAX_GHOSTS][4];
-    for (int i = 0; i < postAptCount; i++) {
-        int2 pair = postAptPairs[i];
-        computeMs_reflection(interface_params, num_interfaces, apt_pos, pair.x, pair.y, postAptMss[i]);
-    }
-
-    // Create ghost snapshots.
+    // Create ghost snapshots one ghost at a time, so a bounded candidate stops as soon as it exceeds upper_bound.
+    // Pre-aperture ghosts use their reflection Ma with default_Ms, post-aperture ghosts default_Ma with their reflection Ms.
+    const int totalGhosts = preAptCount + postAptCount;
+    const int bounded = upper_bound < INFINITY && num_render_obj <= MAX_BOUND_MATCHES;
+    float boundHeights[MAX_BOUND_MATCHES];
+    int boundLargest = 0;
+    float boundPenalty = 0.0f;
+    int stopped = 0;
     float snapshots[MAX_GHOSTS][3];
     int ghostCount = 0;
-    // Pre–aperture ghosts: use the computed Ma (from reflections) with default_Ms.
-    for (int i = 0; i < preAptCount; i++) {
-        simulateDrawQuad(preAptMas[i], default_Ms, light_angle_x, light_angle_y, apt_height, snapshots[ghostCount]);
+    while (ghostCount < totalGhosts && !stopped) {
+        float M[4];
+        if (ghostCount < preAptCount) {
+            int2 pair = preAptPairs[ghostCount];
+            computeMa_reflection(interface_params, num_interfaces, apt_pos, pair.x, pair.y, M);
+            simulateDrawQuad(M, default_Ms, light_angle_x, light_angle_y, apt_height, snapshots[ghostCount]);
+        }
+        else {
+            int2 pair = postAptPairs[ghostCount - preAptCount];
+            computeMs_reflection(interface_params, num_interfaces, apt_pos, pair.x, pair.y, M);
+            simulateDrawQuad(default_Ma, M, light_angle_x, light_angle_y, apt_height, snapshots[ghostCount]);
+        }
         ghostCount++;
+        if (bounded) {
+            boundPenalty += addBoundGhost(boundHeights, &boundLargest, ghostCount, num_render_obj, snapshots[ghostCount - 1][2]);
+            stopped = boundPenalty / num_render_obj > upper_bound;
+        }
     }
-    // Post–aperture ghosts: use default_Ma with computed Ms from reflection.
-    for (int i = 0; i < postAptCount; i++) {
-        simulateDrawQuad(default_Ma, postAptMss[i], light_angle_x, light_angle_y, apt_height, snapshots[ghostCount]);
-        ghostCount++;
+    if (bounded) {
+        atomic_add(&d_bound_stats[1], totalGhosts);
+        if (stopped) {
+            atomic_inc(&d_bound_stats[0]);
+            atomic_add(&d_bound_stats[2], totalGhosts - ghostCount);
+        }
+    }
+    if (stopped) {
+        d_fitness[idx] = (population_t)(boundPenalty / num_render_obj);
+        return;
     }
 
-    // Sort ghosts by quad height (snapshot[2]) using a simple bubble sort.
+    // Not enough ghosts, same penalty as the host fitness
+    if (ghostCount < num_render_obj) {
+        d_fitness[idx] = 100000.0f;
+        return;
+    }
+
+#ifdef FULL_SNAPSHOT_SORT
+    // Sort ghosts by quad height (snapshot[2]) using a simple bubble sort, kept to benchmark against the selection below.
     for (int i = 0; i < ghostCount - 1; i++) {
         for (int j = 0; j < ghostCount - i - 1; j++) {
             if (snapshots[j][2] > snapshots[j + 1][2]) {
@@ -697,6 +775,29 @@ __kernel void batch_fitness_kernel(__global const double* d_population,
             }
         }
     }
+#else
+    // Only the num_render_obj smallest quad heights are matched in order, select them to the front. The other ghosts are
+    // only summed for the penalty, so their order does not matter.
+    for (int i = 0; i < num_render_obj; i++) {
+        int smallest = i;
+        for (int j = i + 1; j < ghostCount; j++) {
+            if (snapshots[j][2] < snapshots[smallest][2]) {
+                smallest = j;
+            }
+        }
+        if (smallest != i) {
+            float t0 = snapshots[i][0];
+            float t1 = snapshots[i][1];
+            float t2 = snapshots[i][2];
+            snapshots[i][0] = snapshots[smallest][0];
+            snapshots[i][1] = snapshots[smallest][1];
+            snapshots[i][2] = snapshots[smallest][2];
+            snapshots[smallest][0] = t0;
+            snapshots[smallest][1] = t1;
+            snapshots[smallest][2] = t2;
+        }
+    }
+#endif
 
     // Compute fitness: compare ghost snapshots with render objective data in d_renderObj.
     float f = 0.0f;
@@ -720,5 +821,379 @@ __kernel void batch_fitness_kernel(__global const double* d_population,
     fitness_value = f;
 
     // Write fitness result.
-    d_fitness[idx] = (double)fitness_value;
+    d_fitness[idx] = (population_t)fitness_value;
+}
+
+//=====================================================================
+// WORKGROUP KERNEL
+//=====================================================================
+// One workgroup of WORKGROUP_SIZE work-items evaluates one candidate, for large lens systems where the ghost arrays of
+// batch_fitness_kernel no longer fit in private memory. The work-items repair the interfaces and compute the ghost
+// matrices and snapshots in parallel into local memory, then select the num_render_obj smallest quad heights and reduce
+// the fitness together. The interfaces and their matrices are computed into local memory once per workgroup. The host launches num_candidates * WORKGROUP_SIZE work-items per chunk; candidates are
+// get_global_id(0) / WORKGROUP_SIZE within the buffers of the chunk. WORKGROUP_SIZE must be a power of two.
+// The penalty of the unmatched ghosts is summed in another order, so the fitness may differ in the last bits.
+#ifndef WORKGROUP_SIZE
+#define WORKGROUP_SIZE 64
+#endif
+
+// Interfaces i a ghost can reflect at, the same test getPreAptReflections and getPostAptReflections apply to both ends
+inline int isReflectingInterface(__local const float* lens_interfaces, int i)
+{
+    if (i > 0) {
+        return lens_interfaces[3 * i + 1] > 1.1f || lens_interfaces[3 * (i - 1) + 1] > 1.1f;
+    }
+    return lens_interfaces[3 * i + 1] > 1.1f;
+}
+
+// M = matrices[i] * M
+inline void mulLocalMatrix(__local const float4* matrices, int i, float M[4])
+{
+    float4 m = matrices[i];
+    float A[4] = { m.x, m.y, m.z, m.w };
+    float temp[4];
+    mat2_mul(A, M, temp);
+    M[0] = temp[0]; M[1] = temp[1]; M[2] = temp[2]; M[3] = temp[3];
+}
+
+// M = getTranslationMatrix(di) * getReflectionMatrix(Ri) * getTranslationMatrix(di) * M, the second reflection of a ghost
+inline void mulSecondReflection(float di, float Ri, float M[4])
+{
+    float T[4], Rf[4], temp[4];
+    getTranslationMatrix(di, T);
+    mat2_mul(T, M, temp);
+    getReflectionMatrix(Ri, Rf);
+    mat2_mul(Rf, temp, M);
+    mat2_mul(T, M, temp);
+    M[0] = temp[0]; M[1] = temp[1]; M[2] = temp[2]; M[3] = temp[3];
+}
+
+// Ghost matrices of the workgroup kernel, the products of computeMa_reflection and computeMs_reflection with the
+// per-interface matrices read from local memory. forward[i] is the translation-refraction matrix of interface i and
+// backward[i] the one that propagates back through it, both with the effective values of the aperture. The pairs of the
+// ghost list always pass the checks of computeMa_reflection and computeMs_reflection, so there is no fallback.
+inline void computeMa_reflection_local(__local const float* lens_interfaces,
+    __local const float4* forward,
+    __local const float4* backward,
+    int iris_pos,
+    int firstReflectionPos,
+    int secondReflectionPos,
+    float Ma[4])
+{
+    Ma[0] = 1.0f; Ma[1] = 0.0f; Ma[2] = 0.0f; Ma[3] = 1.0f;
+    for (int i = 0; i < firstReflectionPos; i++) {
+        mulLocalMatrix(forward, i, Ma);
+    }
+    float Rf[4], temp[4];
+    getReflectionMatrix(lens_interfaces[3 * firstReflectionPos + 2], Rf);
+    mat2_mul(Rf, Ma, temp);
+    Ma[0] = temp[0]; Ma[1] = temp[1]; Ma[2] = temp[2]; Ma[3] = temp[3];
+    for (int i = firstReflectionPos - 1; i > secondReflectionPos; i--) {
+        mulLocalMatrix(backward, i, Ma);
+    }
+    mulSecondReflection(lens_interfaces[3 * secondReflectionPos + 0], -lens_interfaces[3 * secondReflectionPos + 2], Ma);
+    for (int i = secondReflectionPos + 1; i < iris_pos; i++) {
+        mulLocalMatrix(forward, i, Ma);
+    }
+}
+
+inline void computeMs_reflection_local(__local const float* lens_interfaces,
+    __local const float4* forward,
+    __local const float4* backward,
+    int num_interfaces,
+    int iris_pos,
+    int firstReflectionPos,
+    int secondReflectionPos,
+    float Ms[4])
+{
+    Ms[0] = 1.0f; Ms[1] = 0.0f; Ms[2] = 0.0f; Ms[3] = 1.0f;
+    for (int i = iris_pos; i < firstReflectionPos; i++) {
+        mulLocalMatrix(forward, i, Ms);
+    }
+    float Rf[4], temp[4];
+    getReflectionMatrix(lens_interfaces[3 * firstReflectionPos + 2], Rf);
+    mat2_mul(Rf, Ms, temp);
+    Ms[0] = temp[0]; Ms[1] = temp[1]; Ms[2] = temp[2]; Ms[3] = temp[3];
+    for (int i = firstReflectionPos - 1; i > secondReflectionPos; i--) {
+        mulLocalMatrix(backward, i, Ms);
+    }
+    mulSecondReflection(lens_interfaces[3 * secondReflectionPos + 0], -lens_interfaces[3 * secondReflectionPos + 2], Ms);
+    for (int i = secondReflectionPos + 1; i < num_interfaces; i++) {
+        mulLocalMatrix(forward, i, Ms);
+    }
+}
+
+__kernel __attribute__((reqd_work_group_size(WORKGROUP_SIZE, 1, 1)))
+void batch_fitness_workgroup_kernel(__global const population_t* d_population,
+    __global population_t* d_fitness,
+    __global const population_t* d_renderObj,
+    const int candidate_dim,
+    const int num_render_obj,
+    const float light_angle_x,
+    const float light_angle_y,
+    const float upper_bound,
+    __global int* d_bound_stats)
+{
+    const int idx = get_global_id(0) / WORKGROUP_SIZE;
+    const int lid = get_local_id(0);
+    const int base_index = idx * candidate_dim;
+
+    __local float local_params[MAX_INTERFACEPARAMS];
+    __local float4 forwardMatrices[MAX_INTERFACES];
+    __local float4 backwardMatrices[MAX_INTERFACES];
+    __local int2 ghostPairs[MAX_GHOSTS];
+    __local float snapshots[MAX_GHOSTS][3];
+    __local int preAptCount;
+    __local int ghostCount;
+    __local float reduceValue[WORKGROUP_SIZE];
+    __local int reduceIndex[WORKGROUP_SIZE];
+    __local float boundValue[WORKGROUP_SIZE];
+
+    int apt_pos = (int)round((float)d_population[base_index + 0]);
+    float apt_height = (float)d_population[base_index + 1];
+#ifdef NUM_INTERFACES
+    const int num_interfaces = NUM_INTERFACES;
+#else
+    int num_interfaces = (candidate_dim - 2) / 3;
+#endif
+
+    // One interface per work-item, repaired like batch_fitness_kernel
+    for (int i = lid; i < num_interfaces; i += WORKGROUP_SIZE) {
+        int param_base = base_index + 2 + i * 3;
+        float di = (float)d_population[param_base + 0];
+        float ni = (float)d_population[param_base + 1];
+        float Ri = (float)d_population[param_base + 2];
+        if (ni <= 1.25f)
+            ni = 1.0f;
+        else
+            ni = ni + 0.25f;
+        if (ni != 1.0f)
+            di = 1.0f + ((di - 0.1f) / (100.0f - 0.1f)) * 9.0f;
+        if (Ri >= 0.0f) {
+            if (Ri < 5.0f) Ri = 5.0f;
+            if (Ri > 8000.0f) Ri = INFINITY;
+        }
+        else {
+            if (Ri > -5.0f) Ri = -5.0f;
+            if (Ri < -8000.0f) Ri = -INFINITY;
+        }
+        local_params[i * 3 + 0] = di;
+        local_params[i * 3 + 1] = ni;
+        local_params[i * 3 + 2] = Ri;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // One interface per work-item: the matrices computeMa, computeMs and their reflection variants multiply for it. Only
+    // the aperture differs between the effective values of computeMs and the interfaces, and the first interface and
+    // the aperture enter from air.
+    for (int i = lid; i < num_interfaces; i += WORKGROUP_SIZE) {
+        float di = local_params[3 * i + 0];
+        float ni = i == apt_pos ? 1.0f : local_params[3 * i + 1];
+        float Ri = i == apt_pos ? INFINITY : local_params[3 * i + 2];
+        float prev_ni = (i == 0 || i == apt_pos || i - 1 == apt_pos) ? 1.0f : local_params[3 * (i - 1) + 1];
+        float M[4];
+        getTranslationRefractionMatrix(di, prev_ni, ni, Ri, M);
+        forwardMatrices[i] = (float4)(M[0], M[1], M[2], M[3]);
+        if (i > 0) {
+            float backward_prev_ni = i - 1 == apt_pos ? 1.0f : local_params[3 * (i - 1) + 1];
+            getinverseRefractionBackwardsTranslationMatrix(di, backward_prev_ni, ni, Ri, M);
+            backwardMatrices[i] = (float4)(M[0], M[1], M[2], M[3]);
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // Ghost list in the order of getPreAptReflections followed by getPostAptReflections, so the selection below breaks
+    // ties between equal quad heights like batch_fitness_kernel
+    if (lid == 0) {
+        int count = 0;
+        for (int i = 1; i < apt_pos; i++) {
+            if (isReflectingInterface(local_params, i)) {
+                for (int j = i - 1; j >= 0; j--) {
+                    if (isReflectingInterface(local_params, j)) {
+                        ghostPairs[count++] = (int2)(i, j);
+                    }
+                }
+            }
+        }
+        preAptCount = count;
+        for (int i = apt_pos + 2; i < num_interfaces; i++) {
+            if (isReflectingInterface(local_params, i)) {
+                for (int j = i - 1; j > apt_pos; j--) {
+                    if (isReflectingInterface(local_params, j)) {
+                        ghostPairs[count++] = (int2)(i, j);
+                    }
+                }
+            }
+        }
+        ghostCount = count;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // Same for the whole workgroup, so the early return passes no barrier
+    const int ghosts = ghostCount;
+    if (ghosts < num_render_obj) {
+        if (lid == 0) {
+            d_fitness[idx] = 100000.0f;
+        }
+        return;
+    }
+
+    // One ghost per work-item: its reflection matrix and snapshot, in rounds of WORKGROUP_SIZE ghosts. A bounded candidate
+    // stops after the round its lower bound exceeds upper_bound. The bound takes the num_render_obj smallest of the
+    // work-items' smallest heights as threshold, at least num_render_obj ghosts are at or below it, so every ghost above
+    // it is unmatched. It is looser than the bound of batch_fitness_kernel but takes two reductions per round.
+    const int bounded = upper_bound < INFINITY && num_render_obj <= WORKGROUP_SIZE;
+    float ownSmallest = INFINITY;
+    float boundPenalty = 0.0f;
+    int stopped = 0;
+    int computed = 0;
+    float default_Ma[4] = { 1.0f, 0.0f, 0.0f, 1.0f };
+    float default_Ms[4] = { 1.0f, 0.0f, 0.0f, 1.0f };
+    for (int i = 0; i < apt_pos; i++) {
+        mulLocalMatrix(forwardMatrices, i, default_Ma);
+    }
+    for (int i = apt_pos; i < num_interfaces; i++) {
+        mulLocalMatrix(forwardMatrices, i, default_Ms);
+    }
+    while (computed < ghosts && !stopped) {
+        const int g = computed + lid;
+        computed = min(computed + WORKGROUP_SIZE, ghosts);
+        if (g < ghosts) {
+            int2 pair = ghostPairs[g];
+            float M[4], snap[3];
+            if (g < preAptCount) {
+                computeMa_reflection_local(local_params, forwardMatrices, backwardMatrices, apt_pos, pair.x, pair.y, M);
+                simulateDrawQuad(M, default_Ms, light_angle_x, light_angle_y, apt_height, snap);
+            }
+            else {
+                computeMs_reflection_local(local_params, forwardMatrices, backwardMatrices, num_interfaces, apt_pos, pair.x, pair.y, M);
+                simulateDrawQuad(default_Ma, M, light_angle_x, light_angle_y, apt_height, snap);
+            }
+            snapshots[g][0] = snap[0];
+            snapshots[g][1] = snap[1];
+            snapshots[g][2] = snap[2];
+            if (snap[2] < ownSmallest) {
+                ownSmallest = snap[2];
+            }
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+        // After the last round the exact fitness costs less than the bound
+        if (bounded && computed < ghosts) {
+            boundValue[lid] = ownSmallest;
+            barrier(CLK_LOCAL_MEM_FENCE);
+            int atOrBelow = 0;
+            for (int k = 0; k < WORKGROUP_SIZE; k++) {
+                atOrBelow += boundValue[k] <= ownSmallest;
+            }
+            reduceValue[lid] = atOrBelow >= num_render_obj ? ownSmallest : INFINITY;
+            barrier(CLK_LOCAL_MEM_FENCE);
+            for (int stride = WORKGROUP_SIZE / 2; stride > 0; stride /= 2) {
+                if (lid < stride) {
+                    reduceValue[lid] = fmin(reduceValue[lid], reduceValue[lid + stride]);
+                }
+                barrier(CLK_LOCAL_MEM_FENCE);
+            }
+            const float threshold = reduceValue[0];
+            barrier(CLK_LOCAL_MEM_FENCE);
+
+            // NaN heights are added too, a NaN bound never stops the candidate
+            float penalty = 0.0f;
+            for (int h = lid; h < computed; h += WORKGROUP_SIZE) {
+                if (!(snapshots[h][2] <= threshold)) {
+                    penalty += 500.0f / snapshots[h][2];
+                }
+            }
+            reduceValue[lid] = penalty;
+            barrier(CLK_LOCAL_MEM_FENCE);
+            for (int stride = WORKGROUP_SIZE / 2; stride > 0; stride /= 2) {
+                if (lid < stride) {
+                    reduceValue[lid] += reduceValue[lid + stride];
+                }
+                barrier(CLK_LOCAL_MEM_FENCE);
+            }
+            boundPenalty = reduceValue[0];
+            stopped = boundPenalty / num_render_obj > upper_bound;
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+    }
+    if (bounded && lid == 0) {
+        atomic_add(&d_bound_stats[1], ghosts);
+        if (stopped) {
+            atomic_inc(&d_bound_stats[0]);
+            atomic_add(&d_bound_stats[2], ghosts - computed);
+        }
+    }
+    if (stopped) {
+        if (lid == 0) {
+            d_fitness[idx] = (population_t)(boundPenalty / num_render_obj);
+        }
+        return;
+    }
+
+    // Selection of the num_render_obj smallest quad heights, one parallel arg min per position. Equal heights go to the
+    // lower index, which makes the swaps those of the selection sort in batch_fitness_kernel; NaN heights are never picked.
+    for (int i = 0; i < num_render_obj; i++) {
+        float smallestHeight = INFINITY;
+        int smallest = ghosts;
+        for (int g = i + lid; g < ghosts; g += WORKGROUP_SIZE) {
+            if (snapshots[g][2] < smallestHeight) {
+                smallestHeight = snapshots[g][2];
+                smallest = g;
+            }
+        }
+        reduceValue[lid] = smallestHeight;
+        reduceIndex[lid] = smallest;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        for (int stride = WORKGROUP_SIZE / 2; stride > 0; stride /= 2) {
+            if (lid < stride) {
+                float otherHeight = reduceValue[lid + stride];
+                int other = reduceIndex[lid + stride];
+                if (otherHeight < reduceValue[lid] || (otherHeight == reduceValue[lid] && other < reduceIndex[lid])) {
+                    reduceValue[lid] = otherHeight;
+                    reduceIndex[lid] = other;
+                }
+            }
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+        smallest = reduceIndex[0] < ghosts ? reduceIndex[0] : i;
+        if (lid == 0 && smallest != i) {
+            float t0 = snapshots[i][0];
+            float t1 = snapshots[i][1];
+            float t2 = snapshots[i][2];
+            snapshots[i][0] = snapshots[smallest][0];
+            snapshots[i][1] = snapshots[smallest][1];
+            snapshots[i][2] = snapshots[smallest][2];
+            snapshots[smallest][0] = t0;
+            snapshots[smallest][1] = t1;
+            snapshots[smallest][2] = t2;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    // Penalty of the unmatched ghosts, summed per work-item and reduced
+    float penalty = 0.0f;
+    for (int g = num_render_obj + lid; g < ghosts; g += WORKGROUP_SIZE) {
+        penalty += 500.0f / snapshots[g][2];
+    }
+    reduceValue[lid] = penalty;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (int stride = WORKGROUP_SIZE / 2; stride > 0; stride /= 2) {
+        if (lid < stride) {
+            reduceValue[lid] += reduceValue[lid + stride];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (lid == 0) {
+        float f = 0.0f;
+        for (int i = 0; i < num_render_obj; i++) {
+            float dx = (float)d_renderObj[i * 3 + 0] - snapshots[i][0];
+            float dy = (float)d_renderObj[i * 3 + 1] - snapshots[i][1];
+            float posError = sqrt(dx * dx + dy * dy);
+            float sizeError = (float)d_renderObj[i * 3 + 2] - snapshots[i][2];
+            f += posError * posError + sizeError * sizeError;
+        }
+        f += reduceValue[0];
+        d_fitness[idx] = (population_t)(f / num_render_obj);
+    }
 }
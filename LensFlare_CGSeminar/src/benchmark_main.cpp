@@ -0,0 +1,87 @@
+#include "benchmarks.h"
+#include "preset_lens_systems.h"
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+//Benchmarks by command line name, in the order "all" runs them
+static const std::vector<std::pair<std::string, std::function<void(const LensSystem&)>>> benchmarks = {
+    { "incremental-ghost-update", [](const LensSystem& lensSystem) { benchmarkIncrementalGhostUpdate(lensSystem); } },
+    { "fixed-lens-system", [](const LensSystem& lensSystem) { benchmarkFixedLensSystem(lensSystem); } },
+    { "allocations", [](const LensSystem& lensSystem) { benchmarkAllocations(lensSystem); } },
+    { "fresnel-ar", [](const LensSystem&) { benchmarkFresnelAR(); } },
+    { "spectral-transmission", [](const LensSystem& lensSystem) { benchmarkSpectralTransmission(lensSystem); } },
+    { "transmission-tree", [](const LensSystem& lensSystem) { benchmarkTransmissionTree(lensSystem); } },
+    { "host-batch-fitness", [](const LensSystem& lensSystem) { benchmarkHostBatchFitness(lensSystem); } },
+    { "simd-fitness", [](const LensSystem& lensSystem) { benchmarkSimdFitness(lensSystem); } },
+    { "opencl-batch-overhead", [](const LensSystem& lensSystem) { benchmarkOpenCLBatchOverhead(lensSystem); } },
+    { "opencl-pipeline", [](const LensSystem& lensSystem) { benchmarkOpenCLPipeline(lensSystem); } },
+    { "snapshot-selection", [](const LensSystem&) { benchmarkSnapshotSelection(); } },
+    { "opencl-kernels", [](const LensSystem&) { benchmarkOpenCLKernels(); } },
+    { "opencl-float-population", [](const LensSystem& lensSystem) { benchmarkOpenCLFloatPopulation(lensSystem); } },
+    { "heterogeneous-fitness", [](const LensSystem& lensSystem) { benchmarkHeterogeneousFitness(lensSystem); } },
+    { "concurrent-opencl", [](const LensSystem& lensSystem) { benchmarkConcurrentOpenCL(lensSystem); } },
+    { "lens-optimizers", [](const LensSystem& lensSystem) { benchmarkLensOptimizers(lensSystem); } },
+    { "branch-and-bound", [](const LensSystem& lensSystem) { benchmarkBranchAndBound(lensSystem); } },
+    { "surrogate", [](const LensSystem& lensSystem) { benchmarkSurrogate(lensSystem); } },
+    { "ghost-jacobian", [](const LensSystem& lensSystem) { benchmarkGhostJacobian(lensSystem); } },
+};
+
+static const std::vector<std::pair<std::string, LensSystem(*)()>> presets = {
+    { "heliar", heliarTronerLens },
+    { "canon", someCanonLens },
+    { "test", testLens },
+    { "patent", japanesePatent },
+};
+
+static void printUsage() {
+    std::cout << "Usage: LensFlareBenchmarks [--lens <preset>] <benchmark>... [--lens <preset>] <benchmark>..." << std::endl;
+    std::cout << "A --lens applies to the benchmarks after it, the default is heliar. \"all\" runs every benchmark." << std::endl;
+    std::cout << "Presets:";
+    for (const auto& preset : presets) {
+        std::cout << " " << preset.first;
+    }
+    std::cout << std::endl << "Benchmarks:" << std::endl;
+    for (const auto& benchmark : benchmarks) {
+        std::cout << "  " << benchmark.first << std::endl;
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        printUsage();
+        return 0;
+    }
+
+    LensSystem lensSystem = heliarTronerLens();
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--lens") {
+            auto preset = i + 1 < argc ? std::find_if(presets.begin(), presets.end(), [&](const auto& p) { return p.first == argv[i + 1]; }) : presets.end();
+            if (preset == presets.end()) {
+                std::cerr << "Unknown or missing lens preset" << std::endl;
+                printUsage();
+                return 1;
+            }
+            lensSystem = preset->second();
+            i++;
+            continue;
+        }
+        bool found = false;
+        for (const auto& benchmark : benchmarks) {
+            if (arg == "all" || arg == benchmark.first) {
+                benchmark.second(lensSystem);
+                found = true;
+            }
+        }
+        if (!found) {
+            std::cerr << "Unknown benchmark " << arg << std::endl;
+            printUsage();
+            return 1;
+        }
+    }
+    return 0;
+}
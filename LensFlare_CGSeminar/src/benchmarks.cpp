@@ -0,0 +1,1163 @@
+#include "benchmarks.h"
+#include "ghost_table.h"
+#include "fixed_lens_system.h"
+#include "allocation_counter.h"
+#include "lens_solver.h"
+#include "coating_solver.h"
+#include "reverse_coating.h"
+#include "fresnel_ar.h"
+#include "spectral.h"
+#include "transmission_tree.h"
+#include "simd_lanes.h"
+#include "preset_lens_systems.h"
+#include <pagmo/algorithm.hpp>
+#include <pagmo/algorithms/pso_gen.hpp>
+#include <pagmo/bfe.hpp>
+#include <pagmo/population.hpp>
+#include <pagmo/problem.hpp>
+#include <memory>
+#include <algorithm>
+#include <array>
+#include <type_traits>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <thread>
+
+std::ofstream openBenchmarkLog(const std::string& title) {
+    std::ofstream csvFile("benchmark_log.csv", std::ios::app);
+    if (!csvFile.is_open()) {
+        std::cerr << "Error opening CSV log file!" << std::endl;
+    }
+    csvFile << "######################################################################" << std::endl;
+    csvFile << title << std::endl;
+    return csvFile;
+}
+
+//Edit one interface at a time (radius for geometry, lambda0/coating for coatings) and compare GhostTable::update with a full rebuild
+void benchmarkIncrementalGhostUpdate(LensSystem lensSystem, int iterations) {
+    bool quarterWaveCoating = true;
+    glm::vec2 yawAndPitch = glm::vec2(0.001f);
+    std::vector<LensInterface> lensInterfaces = lensSystem.getLensInterfaces();
+    int num_interfaces = lensInterfaces.size();
+
+    GhostTable incrementalTable(lensSystem);
+    incrementalTable.refreshTransmissions(lensSystem, yawAndPitch, quarterWaveCoating);
+    lensSystem.clearDirtyRange();
+
+    std::ofstream csvFile = openBenchmarkLog("Incremental Ghost Update");
+    csvFile << "Interfaces," << num_interfaces << std::endl;
+    csvFile << "Ghosts," << incrementalTable.size() << std::endl;
+    csvFile << "Edit,Interface,Full Rebuild (us),Incremental (us)" << std::endl;
+
+    double totalFull[2] = { 0.0, 0.0 };
+    double totalIncremental[2] = { 0.0, 0.0 };
+    for (int it = 0; it < iterations; it++) {
+        int k = it % num_interfaces;
+        bool geometryEdit = (it / num_interfaces) % 2 == 0;
+        if (geometryEdit) {
+            lensInterfaces[k].Ri *= (it % 2 == 0) ? 1.01f : 1.f / 1.01f;
+        }
+        else if (quarterWaveCoating) {
+            lensInterfaces[k].lambda0 = 380.f + std::fmod(lensInterfaces[k].lambda0 + 7.f - 380.f, 360.f);
+        }
+        lensSystem.setLensInterfaces(lensInterfaces);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        GhostTable fullTable(lensSystem);
+        fullTable.refreshTransmissions(lensSystem, yawAndPitch, quarterWaveCoating);
+        auto mid = std::chrono::high_resolution_clock::now();
+        const LensDirtyRange& dirtyRange = lensSystem.getDirtyRange();
+        if (dirtyRange.ghostsChanged) {
+            incrementalTable = GhostTable(lensSystem);
+            incrementalTable.refreshTransmissions(lensSystem, yawAndPitch, quarterWaveCoating);
+        }
+        else {
+            incrementalTable.update(lensSystem, dirtyRange);
+        }
+        lensSystem.clearDirtyRange();
+        auto end = std::chrono::high_resolution_clock::now();
+
+        double fullUs = std::chrono::duration<double, std::micro>(mid - start).count();
+        double incrementalUs = std::chrono::duration<double, std::micro>(end - mid).count();
+        totalFull[geometryEdit] += fullUs;
+        totalIncremental[geometryEdit] += incrementalUs;
+        csvFile << (geometryEdit ? "Radius" : "Coating") << "," << k << "," << fullUs << "," << incrementalUs << std::endl;
+    }
+
+    std::cout << "Incremental ghost update, " << incrementalTable.size() << " ghosts, " << iterations << " edits" << std::endl;
+    std::cout << "Radius edits: full " << totalFull[1] << " us, incremental " << totalIncremental[1] << " us" << std::endl;
+    std::cout << "Coating edits: full " << totalFull[0] << " us, incremental " << totalIncremental[0] << " us" << std::endl;
+    csvFile << std::endl;
+    csvFile << "Total Radius Edits (us):," << totalFull[1] << "," << totalIncremental[1] << std::endl;
+    csvFile << "Total Coating Edits (us):," << totalFull[0] << "," << totalIncremental[0] << std::endl;
+    csvFile.close();
+}
+
+//Both paths evaluate the same slightly perturbed candidates, the differences between their results are logged as a sanity check
+void benchmarkFixedLensSystem(LensSystem lensSystem, int iterations) {
+    bool quarterWaveCoating = true;
+    glm::vec2 yawAndPitch = glm::vec2(0.001f);
+    int aptPos = lensSystem.getIrisAperturePos();
+    std::vector<LensInterface> lensInterfaces = lensSystem.getLensInterfaces();
+    int num_interfaces = lensInterfaces.size();
+
+    std::ofstream csvFile = openBenchmarkLog("Fixed Lens System");
+    csvFile << "Interfaces," << num_interfaces << std::endl;
+    bool hasSpecialization = withFixedLensSystem(aptPos, lensInterfaces, [](const auto&) {});
+    if (!hasSpecialization) {
+        std::cout << "No FixedLensSystem specialization for " << num_interfaces << " interfaces" << std::endl;
+        csvFile << "No specialization" << std::endl;
+        return;
+    }
+
+    std::vector<std::vector<LensInterface>> candidates(iterations, lensInterfaces);
+    for (int it = 0; it < iterations; it++) {
+        candidates[it][it % num_interfaces].Ri *= 1.f + 0.001f * (it % 7);
+    }
+
+    double checksum[2] = { 0.0, 0.0 };
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int it = 0; it < iterations; it++) {
+        LensSystem candidate(aptPos, lensSystem.getApertureHeight(), lensSystem.getEntrancePupilHeight(), candidates[it]);
+        GhostTable ghostTable(candidate);
+        for (size_t i = 0; i < ghostTable.size(); i++) {
+            checksum[0] += ghostTable.layout[i].centerCoeff + ghostTable.layout[i].heightCoeff;
+        }
+    }
+    auto mid = std::chrono::high_resolution_clock::now();
+    for (int it = 0; it < iterations; it++) {
+        withFixedLensSystem(aptPos, candidates[it], [&](const auto& fixedLensSystem) {
+            std::array<GhostLayout, std::decay_t<decltype(fixedLensSystem)>::MaxGhosts> layouts;
+            int ghostCount = fixedLensSystem.getGhostLayouts(layouts);
+            for (int i = 0; i < ghostCount; i++) {
+                checksum[1] += layouts[i].centerCoeff + layouts[i].heightCoeff;
+            }
+            });
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    double fitnessDynamicUs = std::chrono::duration<double, std::micro>(mid - start).count();
+    double fitnessFixedUs = std::chrono::duration<double, std::micro>(end - mid).count();
+    double checksumDifference = std::abs(checksum[0] - checksum[1]);
+
+    std::vector<glm::vec3> dynamicTransmissions;
+    std::vector<glm::vec3> fixedTransmissions;
+    GhostTable fixedTable;
+    start = std::chrono::high_resolution_clock::now();
+    for (int it = 0; it < iterations; it++) {
+        LensSystem candidate(aptPos, lensSystem.getApertureHeight(), lensSystem.getEntrancePupilHeight(), candidates[it]);
+        GhostTable ghostTable(candidate);
+        ghostTable.computeTransmissions(candidate, yawAndPitch, quarterWaveCoating, dynamicTransmissions);
+    }
+    mid = std::chrono::high_resolution_clock::now();
+    for (int it = 0; it < iterations; it++) {
+        withFixedLensSystem(aptPos, candidates[it], [&](const auto& fixedLensSystem) {
+            fixedLensSystem.fillGhostTable(fixedTable);
+            fixedLensSystem.computeTransmissions(fixedTable, yawAndPitch, quarterWaveCoating, fixedTransmissions);
+            });
+    }
+    end = std::chrono::high_resolution_clock::now();
+    double refreshDynamicUs = std::chrono::duration<double, std::micro>(mid - start).count();
+    double refreshFixedUs = std::chrono::duration<double, std::micro>(end - mid).count();
+    double maxDifference = 0.0;
+    for (size_t i = 0; i < std::min(dynamicTransmissions.size(), fixedTransmissions.size()); i++) {
+        glm::vec3 difference = glm::abs(dynamicTransmissions[i] - fixedTransmissions[i]);
+        maxDifference = std::max(maxDifference, (double)std::max(difference.x, std::max(difference.y, difference.z)));
+    }
+
+    std::cout << "Fixed lens system, " << num_interfaces << " interfaces, " << iterations << " candidates" << std::endl;
+    std::cout << "Fitness: LensSystem " << fitnessDynamicUs << " us, FixedLensSystem " << fitnessFixedUs << " us" << std::endl;
+    std::cout << "Ghost refresh: LensSystem " << refreshDynamicUs << " us, FixedLensSystem " << refreshFixedUs << " us" << std::endl;
+    std::cout << "Layout checksum difference: " << checksumDifference << ", max transmission difference: " << maxDifference << std::endl;
+    csvFile << "Candidates," << iterations << std::endl;
+    csvFile << "Path,LensSystem (us),FixedLensSystem (us)" << std::endl;
+    csvFile << "Fitness," << fitnessDynamicUs << "," << fitnessFixedUs << std::endl;
+    csvFile << "Ghost Refresh," << refreshDynamicUs << "," << refreshFixedUs << std::endl;
+    csvFile << "Layout Checksum Difference," << checksumDifference << std::endl;
+    csvFile << "Max Transmission Difference," << maxDifference << std::endl;
+    csvFile.close();
+}
+
+//Each call is measured after one warm-up call has sized its scratch buffers. The fitness functions are expected to allocate
+//once per call, for the pagmo::vector_double they return.
+void benchmarkAllocations(LensSystem lensSystem, int iterations) {
+    bool quarterWaveCoating = true;
+    glm::vec2 yawAndPitch = glm::vec2(0.001f);
+    const std::vector<LensInterface>& lensInterfaces = lensSystem.getLensInterfaces();
+    int num_interfaces = lensInterfaces.size();
+
+    std::ofstream csvFile = openBenchmarkLog("Allocations Per Call");
+    csvFile << "Interfaces," << num_interfaces << std::endl;
+    csvFile << "Call,Allocations Per Call,Time Per Call (us)" << std::endl;
+    std::cout << "Allocations per call, " << num_interfaces << " interfaces, " << iterations << " calls" << std::endl;
+
+    auto measure = [&](const char* name, auto&& call) {
+        call();
+        AllocationCounter allocationCounter;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int it = 0; it < iterations; it++) {
+            call();
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        double allocationsPerCall = (double)allocationCounter.count() / iterations;
+        double usPerCall = std::chrono::duration<double, std::micro>(end - start).count() / iterations;
+        std::cout << name << ": " << allocationsPerCall << " allocations, " << usPerCall << " us" << std::endl;
+        csvFile << name << "," << allocationsPerCall << "," << usPerCall << std::endl;
+    };
+
+    GhostTable ghostTable;
+    std::vector<glm::vec3> transmissions;
+    measure("Ghost Refresh", [&]() {
+        buildGhostTable(lensSystem, ghostTable);
+        ghostTable.computeTransmissions(lensSystem, yawAndPitch, quarterWaveCoating, transmissions);
+        });
+    if (ghostTable.size() == 0) {
+        csvFile.close();
+        return;
+    }
+
+    std::vector<std::vector<glm::vec3>> colorGrid;
+    measure("Coating Color Grid", [&]() {
+        computeCoatingColorGrid(lensSystem, ghostTable.reflectionPairs[0], yawAndPitch, colorGrid);
+        });
+
+    //Objective taken from the current lens, the candidate is the current lens itself
+    LensSystemProblem lensProblem;
+    lensProblem.init(num_interfaces, yawAndPitch.x, yawAndPitch.y);
+    std::vector<SnapshotData> lensObjective;
+    for (int i = 0; i < std::min<int>(3, ghostTable.size()); i++) {
+        lensObjective.push_back(lensProblem.simulateDrawQuad(ghostTable.layout[i], i, yawAndPitch.x, yawAndPitch.y, lensSystem.getApertureHeight()));
+    }
+    lensProblem.setRenderObjective(lensObjective);
+    pagmo::vector_double lensCandidate = { (double)lensSystem.getIrisAperturePos(), lensSystem.getApertureHeight() };
+    for (const LensInterface& lensInterface : lensInterfaces) {
+        lensCandidate.insert(lensCandidate.end(), { lensInterface.di, lensInterface.ni, lensInterface.Ri });
+    }
+    measure("Lens Fitness", [&]() {
+        lensProblem.fitness(lensCandidate);
+        });
+
+    LensCoatingProblem coatingProblem;
+    coatingProblem.init(num_interfaces, yawAndPitch.x, yawAndPitch.y, 1.f, quarterWaveCoating);
+    coatingProblem.setRenderObjective(transmissions);
+    coatingProblem.setLensSystem(lensSystem, std::make_shared<const GhostTable>(ghostTable));
+    pagmo::vector_double coatingCandidate;
+    for (const LensInterface& lensInterface : lensInterfaces) {
+        coatingCandidate.push_back(lensInterface.lambda0);
+    }
+    measure("Coating Fitness", [&]() {
+        coatingProblem.fitness(coatingCandidate);
+        });
+    csvFile.close();
+}
+
+//Coating on a typical glass surface, angles and quarter wave thicknesses spread over the ranges the EA and grid search use.
+//The per-call baseline for W wavelengths is ceil(W / 3) RGB calls, which is what covering W wavelengths costs without the
+//vectorized variant.
+void benchmarkFresnelAR(int pairs, int iterations) {
+    const float n0 = 1.0f;
+    const float n1 = 1.38f;
+    const float n2 = 1.62f;
+    std::vector<float> theta0(pairs);
+    std::vector<float> d1(pairs);
+    for (int i = 0; i < pairs; i++) {
+        theta0[i] = -0.5f + (i % 97) / 96.f;
+        d1[i] = (380.f + (i % 181) * 2.f) / 4.f / n1;
+    }
+    std::vector<glm::vec3> scalarReflectivity(pairs);
+    std::vector<glm::vec3> batchReflectivity(pairs);
+
+    std::ofstream csvFile = openBenchmarkLog("Fresnel AR");
+    csvFile << "Instruction Set," << getFresnelARInstructionSet() << std::endl;
+    csvFile << "Pairs," << pairs << std::endl;
+    csvFile << "Variant,Per Call (ns per pair),Vectorized (ns per pair),Speedup" << std::endl;
+    std::cout << "Fresnel AR (" << getFresnelARInstructionSet() << "), " << pairs << " pairs" << std::endl;
+
+    //Sink for results so the timed loops are not optimized away
+    float checksum = 0.f;
+    auto log = [&](const std::string& variant, double scalarTime, double vectorizedTime) {
+        double scalarNs = scalarTime * 1e9 / ((double)iterations * pairs);
+        double vectorizedNs = vectorizedTime * 1e9 / ((double)iterations * pairs);
+        std::cout << variant << ": per call " << scalarNs << " ns, vectorized " << vectorizedNs << " ns, speedup " << scalarNs / vectorizedNs << "x" << std::endl;
+        csvFile << variant << "," << scalarNs << "," << vectorizedNs << "," << scalarNs / vectorizedNs << std::endl;
+    };
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int it = 0; it < iterations; it++) {
+        for (int i = 0; i < pairs; i++) {
+            scalarReflectivity[i] = LensSystem::computeFresnelAR(theta0[i], d1[i], n0, n1, n2);
+        }
+        checksum += scalarReflectivity[it % pairs].x;
+    }
+    auto mid = std::chrono::high_resolution_clock::now();
+    for (int it = 0; it < iterations; it++) {
+        computeFresnelARBatch(theta0, d1, n0, n1, n2, batchReflectivity);
+        checksum += batchReflectivity[it % pairs].x;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    log("RGB Batch", std::chrono::duration<double>(mid - start).count(), std::chrono::duration<double>(end - mid).count());
+
+    float maxDifference = 0.f;
+    for (int i = 0; i < pairs; i++) {
+        glm::vec3 difference = glm::abs(scalarReflectivity[i] - batchReflectivity[i]);
+        maxDifference = std::max({ maxDifference, difference.x, difference.y, difference.z });
+    }
+
+    auto benchmarkWavelengths = [&]<int W>(std::integral_constant<int, W>) {
+        std::array<float, W> wavelengths;
+        for (int k = 0; k < W; k++) {
+            wavelengths[k] = 380.f + k * 360.f / (W - 1);
+        }
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int it = 0; it < iterations; it++) {
+            for (int i = 0; i < pairs; i++) {
+                for (int k = 0; k < W; k += 3) {
+                    checksum += LensSystem::computeFresnelAR(theta0[i], d1[i], n0, n1, n2).x;
+                }
+            }
+        }
+        auto mid = std::chrono::high_resolution_clock::now();
+        for (int it = 0; it < iterations; it++) {
+            for (int i = 0; i < pairs; i++) {
+                FresnelAmplitudes amplitudes = computeFresnelAmplitudes(theta0[i], d1[i], n0, n1, n2);
+                checksum += computeFresnelARWavelengths<W>(amplitudes, wavelengths)[0];
+            }
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        log(std::to_string(W) + " Wavelengths", std::chrono::duration<double>(mid - start).count(), std::chrono::duration<double>(end - mid).count());
+    };
+    benchmarkWavelengths(std::integral_constant<int, 4>());
+    benchmarkWavelengths(std::integral_constant<int, 8>());
+    benchmarkWavelengths(std::integral_constant<int, 16>());
+
+    std::cout << "Max RGB difference: " << maxDifference << " (checksum " << checksum << ")" << std::endl;
+    csvFile << "Max RGB Difference," << maxDifference << std::endl;
+    csvFile.close();
+}
+
+void benchmarkSpectralTransmission(LensSystem lensSystem, int iterations) {
+    bool quarterWaveCoating = true;
+    glm::vec2 yawAndPitch = glm::vec2(0.001f);
+    GhostTable ghostTable(lensSystem);
+    size_t ghostCount = std::max<size_t>(ghostTable.size(), 1);
+    std::vector<glm::vec3> rgbTransmissions;
+    std::vector<glm::vec3> spectralTransmissions;
+
+    std::ofstream csvFile = openBenchmarkLog("Spectral Transmission");
+    csvFile << "Interfaces," << lensSystem.getLensInterfaces().size() << std::endl;
+    csvFile << "Ghosts," << ghostTable.size() << std::endl;
+    csvFile << "Mode,Time Per Ghost (us),Relative To RGB,Mean RGB Difference To RGB Mode" << std::endl;
+    std::cout << "Spectral transmission, " << ghostTable.size() << " ghosts" << std::endl;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int it = 0; it < iterations; it++) {
+        ghostTable.computeTransmissions(lensSystem, yawAndPitch, quarterWaveCoating, rgbTransmissions);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    double rgbUs = std::chrono::duration<double, std::micro>(end - start).count() / ((double)iterations * ghostCount);
+    std::cout << "RGB: " << rgbUs << " us per ghost" << std::endl;
+    csvFile << "RGB," << rgbUs << ",1,0" << std::endl;
+
+    for (int bins : { 3, 16, 64 }) {
+        SpectralSampling sampling(bins);
+        start = std::chrono::high_resolution_clock::now();
+        for (int it = 0; it < iterations; it++) {
+            ghostTable.computeTransmissions(lensSystem, yawAndPitch, quarterWaveCoating, sampling, spectralTransmissions);
+        }
+        end = std::chrono::high_resolution_clock::now();
+        double spectralUs = std::chrono::duration<double, std::micro>(end - start).count() / ((double)iterations * ghostCount);
+        double meanDifference = 0.0;
+        for (size_t i = 0; i < ghostTable.size(); i++) {
+            meanDifference += glm::length(spectralTransmissions[i] - rgbTransmissions[i]) / ghostCount;
+        }
+        std::cout << "K = " << bins << ": " << spectralUs << " us per ghost (" << spectralUs / rgbUs << "x RGB)" << std::endl;
+        csvFile << "K = " << bins << "," << spectralUs << "," << spectralUs / rgbUs << "," << meanDifference << std::endl;
+    }
+    csvFile.close();
+}
+
+void benchmarkTransmissionTree(LensSystem lensSystem, int iterations) {
+    bool quarterWaveCoating = true;
+    glm::vec2 yawAndPitch = glm::vec2(0.001f);
+    GhostTable ghostTable(lensSystem);
+    std::vector<glm::vec3> pathTransmissions(ghostTable.size());
+    std::vector<glm::vec3> treeTransmissions;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int it = 0; it < iterations; it++) {
+        for (size_t i = 0; i < ghostTable.size(); i++) {
+            int first = ghostTable.reflectionPairs[i].x;
+            int second = ghostTable.reflectionPairs[i].y;
+            pathTransmissions[i] = lensSystem.propagateTransmission(first, second, ghostTable.getCenterRay(i, yawAndPitch.x), quarterWaveCoating)
+                + lensSystem.propagateTransmission(first, second, ghostTable.getCenterRay(i, yawAndPitch.y), quarterWaveCoating);
+        }
+    }
+    auto mid = std::chrono::high_resolution_clock::now();
+    for (int it = 0; it < iterations; it++) {
+        ghostTable.computeTransmissions(lensSystem, yawAndPitch, quarterWaveCoating, treeTransmissions);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    double pathUs = std::chrono::duration<double, std::micro>(mid - start).count() / iterations;
+    double treeUs = std::chrono::duration<double, std::micro>(end - mid).count() / iterations;
+
+    //Crossing counts for the x rays, the y rays share the same way
+    TransmissionTree tree;
+    tree.reset(getTransmissionPathData(lensSystem.getLensTable(), quarterWaveCoating));
+    bool identical = true;
+    for (size_t i = 0; i < ghostTable.size(); i++) {
+        tree.propagate(ghostTable.reflectionPairs[i].x, ghostTable.reflectionPairs[i].y, ghostTable.getCenterRay(i, yawAndPitch.x));
+        identical &= pathTransmissions[i] == treeTransmissions[i];
+    }
+
+    std::cout << "Transmission tree, " << ghostTable.size() << " ghosts (" << ghostTable.preAptCount << " pre-aperture)" << std::endl;
+    std::cout << "Per ghost paths " << pathUs << " us, tree " << treeUs << " us" << std::endl;
+    std::cout << "Crossings evaluated " << tree.getEvaluatedCrossings() << " of " << tree.getPathCrossings() << ", identical: " << identical << std::endl;
+    std::ofstream csvFile = openBenchmarkLog("Transmission Tree");
+    csvFile << "Interfaces," << lensSystem.getLensInterfaces().size() << std::endl;
+    csvFile << "Ghosts," << ghostTable.size() << std::endl;
+    csvFile << "Pre-Aperture Ghosts," << ghostTable.preAptCount << std::endl;
+    csvFile << "Per Ghost Paths (us),Tree (us),Crossings Evaluated,Path Crossings,Identical" << std::endl;
+    csvFile << pathUs << "," << treeUs << "," << tree.getEvaluatedCrossings() << "," << tree.getPathCrossings() << "," << identical << std::endl;
+    csvFile.close();
+}
+
+//Lens problem whose render objective is the three biggest ghosts of the lens system, and populationSize random candidates
+//within its bounds
+static pagmo::vector_double initBatchFitnessProblem(const LensSystem& lensSystem, int populationSize, LensSystemProblem& lensProblem) {
+    glm::vec2 yawAndPitch = glm::vec2(0.001f);
+    GhostTable ghostTable(lensSystem);
+    lensProblem.init(lensSystem.getLensInterfaces().size(), yawAndPitch.x, yawAndPitch.y);
+    std::vector<SnapshotData> lensObjective;
+    for (int i = 0; i < std::min<int>(3, ghostTable.size()); i++) {
+        lensObjective.push_back(lensProblem.simulateDrawQuad(ghostTable.layout[i], i, yawAndPitch.x, yawAndPitch.y, lensSystem.getApertureHeight()));
+    }
+    lensProblem.setRenderObjective(lensObjective);
+
+    std::mt19937 rng(42);
+    pagmo::vector_double population(static_cast<size_t>(populationSize) * lensProblem.m_dim);
+    for (int i = 0; i < populationSize; i++) {
+        for (unsigned int d = 0; d < lensProblem.m_dim; d++) {
+            std::uniform_real_distribution<double> dist(lensProblem.m_lb[d], lensProblem.m_ub[d]);
+            population[static_cast<size_t>(i) * lensProblem.m_dim + d] = dist(rng);
+        }
+    }
+    return population;
+}
+
+//Population evaluations per second of evaluate, after one warm up run for the per-thread scratch buffers and the OpenCL setup
+template<typename F>
+static double getEvaluationsPerSecond(int populationSize, int iterations, F&& evaluate) {
+    evaluate();
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int it = 0; it < iterations; it++) {
+        evaluate();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    return populationSize * iterations / std::chrono::duration<double>(end - start).count();
+}
+
+void benchmarkHostBatchFitness(LensSystem lensSystem, int populationSize, int iterations) {
+    int num_interfaces = lensSystem.getLensInterfaces().size();
+    LensSystemProblem lensProblem;
+    pagmo::vector_double population = initBatchFitnessProblem(lensSystem, populationSize, lensProblem);
+    auto evaluationsPerSecond = [&](auto&& evaluate) {
+        return getEvaluationsPerSecond(populationSize, iterations, evaluate);
+    };
+
+    pagmo::vector_double reference;
+    std::vector<int> threadCounts;
+    int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (int threads = 1; threads < maxThreads; threads *= 2) {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(maxThreads);
+
+    std::ofstream csvFile = openBenchmarkLog("Host Batch Fitness");
+    csvFile << "Interfaces," << num_interfaces << std::endl;
+    csvFile << "Population," << populationSize << std::endl;
+    csvFile << "Evaluator,Threads,Evaluations/s,Speedup,Identical" << std::endl;
+    std::cout << "Batch fitness, " << populationSize << " candidates of " << num_interfaces << " interfaces" << std::endl;
+    //Speedups are relative to the single-threaded scalar run, the SIMD lanes give the same fitness
+    double singleThreaded = 0.0;
+    for (bool simdFitness : { false, true }) {
+        lensProblem.m_simdFitness = simdFitness;
+        const char* name = simdFitness ? "Host SIMD" : "Host Scalar";
+        for (int threads : threadCounts) {
+            lensProblem.m_hostThreads = threads;
+            pagmo::vector_double result;
+            double rate = evaluationsPerSecond([&]() { result = lensProblem.batchFitnessHost(population); });
+            if (threads == 1 && !simdFitness) {
+                singleThreaded = rate;
+                reference = result;
+            }
+            bool identical = result == reference;
+            std::cout << name << ", " << threads << " threads: " << rate << " evaluations/s (" << rate / singleThreaded << "x), identical: " << identical << std::endl;
+            csvFile << name << "," << threads << "," << rate << "," << rate / singleThreaded << "," << identical << std::endl;
+        }
+    }
+    if (lensProblem.isOpenCLAvailable()) {
+        double rate = evaluationsPerSecond([&]() { lensProblem.batchFitnessOpenCL(population); });
+        std::cout << "OpenCL: " << rate << " evaluations/s (" << rate / singleThreaded << "x)" << std::endl;
+        csvFile << "OpenCL,," << rate << "," << rate / singleThreaded << "," << std::endl;
+    }
+    csvFile.close();
+}
+
+void benchmarkSimdFitness(LensSystem lensSystem, int populationSize, int iterations) {
+    int num_interfaces = lensSystem.getLensInterfaces().size();
+    LensSystemProblem lensProblem;
+    pagmo::vector_double population = initBatchFitnessProblem(lensSystem, populationSize, lensProblem);
+    const int width = LensSystemProblem::getFitnessLaneWidth();
+    pagmo::vector_double scalarFitness(populationSize);
+    pagmo::vector_double laneFitness(populationSize);
+
+    double scalarRate = getEvaluationsPerSecond(populationSize, iterations, [&]() {
+        for (int i = 0; i < populationSize; i++) {
+            scalarFitness[i] = lensProblem.computeFitness(population.data() + static_cast<size_t>(i) * lensProblem.m_dim);
+        }
+        });
+    double laneRate = getEvaluationsPerSecond(populationSize, iterations, [&]() {
+        for (int i = 0; i < populationSize; i += width) {
+            lensProblem.computeFitnessLanes(population.data() + static_cast<size_t>(i) * lensProblem.m_dim, std::min(width, populationSize - i), &laneFitness[i]);
+        }
+        });
+    lensProblem.m_simdFitness = false;
+    double threadedScalarRate = getEvaluationsPerSecond(populationSize, iterations, [&]() { lensProblem.batchFitnessHost(population); });
+    lensProblem.m_simdFitness = true;
+    pagmo::vector_double threadedLaneFitness;
+    double threadedLaneRate = getEvaluationsPerSecond(populationSize, iterations, [&]() { threadedLaneFitness = lensProblem.batchFitnessHost(population); });
+    bool identical = laneFitness == scalarFitness && threadedLaneFitness == scalarFitness;
+
+    std::cout << "Fitness lanes (" << getSimdInstructionSet() << ", " << width << " candidates per call), " << num_interfaces << " interfaces" << std::endl;
+    std::cout << "Scalar " << scalarRate << " evaluations/s, lanes " << laneRate << " (" << laneRate / scalarRate << "x)" << std::endl;
+    std::cout << "Threaded scalar " << threadedScalarRate << " evaluations/s, threaded lanes " << threadedLaneRate << " (" << threadedLaneRate / threadedScalarRate << "x), identical: " << identical << std::endl;
+    std::ofstream csvFile = openBenchmarkLog("SIMD Fitness");
+    csvFile << "Interfaces," << num_interfaces << std::endl;
+    csvFile << "Population," << populationSize << std::endl;
+    csvFile << "Instruction Set," << getSimdInstructionSet() << std::endl;
+    csvFile << "Scalar (eval/s),Lanes (eval/s),Threaded Scalar (eval/s),Threaded Lanes (eval/s),Identical" << std::endl;
+    csvFile << scalarRate << "," << laneRate << "," << threadedScalarRate << "," << threadedLaneRate << "," << identical << std::endl;
+    csvFile.close();
+}
+
+//Host overhead is the wall time of a call minus the device time of its kernel
+void benchmarkOpenCLBatchOverhead(LensSystem lensSystem, int populationSize, int iterations) {
+    LensSystemProblem lensProblem;
+    pagmo::vector_double population = initBatchFitnessProblem(lensSystem, populationSize, lensProblem);
+    if (!lensProblem.isOpenCLAvailable()) {
+        std::cout << "OpenCL batch overhead: no OpenCL device" << std::endl;
+        return;
+    }
+
+    std::ofstream csvFile = openBenchmarkLog("OpenCL Batch Overhead");
+    csvFile << "Interfaces," << lensSystem.getLensInterfaces().size() << std::endl;
+    csvFile << "Population," << populationSize << std::endl;
+    csvFile << "Buffers,Call (ms),Kernel (ms),Host Overhead (ms)" << std::endl;
+    pagmo::vector_double reference;
+    bool identical = true;
+    for (bool persistent : { false, true }) {
+        lensProblem.m_clPersistentBuffers = persistent;
+        pagmo::vector_double result = lensProblem.batchFitnessOpenCL(population); //warm up
+        double callMs = 0.0;
+        double kernelMs = 0.0;
+        for (int it = 0; it < iterations; it++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            result = lensProblem.batchFitnessOpenCL(population);
+            auto end = std::chrono::high_resolution_clock::now();
+            callMs += std::chrono::duration<double, std::milli>(end - start).count();
+            kernelMs += lensProblem.m_clBuffers.lastKernelMs;
+        }
+        callMs /= iterations;
+        kernelMs /= iterations;
+        if (persistent) {
+            identical = result == reference;
+        }
+        reference = result;
+        const char* name = persistent ? "Persistent" : "Per Call";
+        std::cout << "OpenCL " << name << " buffers: call " << callMs << " ms, kernel " << kernelMs << " ms, host overhead " << callMs - kernelMs << " ms" << std::endl;
+        csvFile << name << "," << callMs << "," << kernelMs << "," << callMs - kernelMs << std::endl;
+    }
+    std::cout << "Identical: " << identical << std::endl;
+    csvFile << "Identical," << identical << std::endl;
+    csvFile.close();
+}
+
+//GPU when there is one, otherwise a CPU OpenCL runtime such as PoCL
+static cl_device_type getBenchmarkDeviceType() {
+    try {
+        std::vector<cl::Platform> platforms;
+        cl::Platform::get(&platforms);
+        for (const cl::Platform& platform : platforms) {
+            std::vector<cl::Device> devices;
+            platform.getDevices(CL_DEVICE_TYPE_GPU, &devices);
+            if (!devices.empty()) {
+                return CL_DEVICE_TYPE_GPU;
+            }
+        }
+    }
+    catch (const cl::Error&) {
+    }
+    return CL_DEVICE_TYPE_CPU;
+}
+
+//Fixed chunk sizes against the autotuned one
+void benchmarkOpenCLPipeline(LensSystem lensSystem, int populationSize, int iterations) {
+    LensSystemProblem lensProblem;
+    pagmo::vector_double population = initBatchFitnessProblem(lensSystem, populationSize, lensProblem);
+    lensProblem.m_clDeviceType = getBenchmarkDeviceType();
+    if (!lensProblem.isOpenCLAvailable()) {
+        std::cout << "OpenCL pipeline: no OpenCL device" << std::endl;
+        return;
+    }
+    //load or autotune the chunk size of the device before timing
+    lensProblem.batchFitnessOpenCL(population);
+    const int tunedChunkSize = lensProblem.m_clChunkSize;
+
+    std::ofstream csvFile = openBenchmarkLog("OpenCL Pipeline");
+    csvFile << "Device," << lensProblem.getOpenCLDeviceKey() << std::endl;
+    csvFile << "Interfaces," << lensSystem.getLensInterfaces().size() << std::endl;
+    csvFile << "Population," << populationSize << std::endl;
+    csvFile << "Queues," << OPENCL_PIPELINE_QUEUES << std::endl;
+    csvFile << "Chunk Size,Call (ms),Speedup,Identical" << std::endl;
+    std::cout << "OpenCL pipeline on " << lensProblem.getOpenCLDeviceKey() << ", " << populationSize << " candidates" << std::endl;
+    pagmo::vector_double reference;
+    double unchunkedMs = 0.0;
+    for (int chunkSize : { populationSize, populationSize / 4, populationSize / 16, tunedChunkSize }) {
+        lensProblem.m_clChunkSize = std::max(chunkSize, 1);
+        pagmo::vector_double result = lensProblem.batchFitnessOpenCL(population);
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int it = 0; it < iterations; it++) {
+            result = lensProblem.batchFitnessOpenCL(population);
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        double callMs = std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+        if (chunkSize == populationSize) {
+            reference = result;
+            unchunkedMs = callMs;
+        }
+        bool identical = result == reference;
+        std::cout << "Chunk size " << lensProblem.m_clChunkSize << (chunkSize == tunedChunkSize ? " (tuned)" : "") << ": " << callMs << " ms (" << unchunkedMs / callMs << "x), identical: " << identical << std::endl;
+        csvFile << lensProblem.m_clChunkSize << (chunkSize == tunedChunkSize ? " (tuned)" : "") << "," << callMs << "," << unchunkedMs / callMs << "," << identical << std::endl;
+    }
+    csvFile.close();
+}
+
+//Kernel time of the bubble sort build (FULL_SNAPSHOT_SORT) against the selection build for the preset lens systems, which
+//cover 5 to 28 interfaces. Runs on a CPU OpenCL runtime when there is no GPU.
+void benchmarkSnapshotSelection(int populationSize, int iterations) {
+    std::ofstream csvFile = openBenchmarkLog("Snapshot Selection");
+    csvFile << "Population," << populationSize << std::endl;
+    csvFile << "Interfaces,Ghosts,Full Sort Kernel (ms),Selection Kernel (ms),Speedup" << std::endl;
+    for (LensSystem lensSystem : { testLens(), heliarTronerLens(), someCanonLens(), japanesePatent() }) {
+        double kernelMs[2] = { 0.0, 0.0 };
+        for (int selection = 0; selection < 2; selection++) {
+            LensSystemProblem lensProblem;
+            pagmo::vector_double population = initBatchFitnessProblem(lensSystem, populationSize, lensProblem);
+            lensProblem.m_clBuildOptions = selection ? "" : "-D FULL_SNAPSHOT_SORT";
+            lensProblem.m_clChunkSize = populationSize; //one kernel per call
+            lensProblem.m_clDeviceType = getBenchmarkDeviceType();
+            if (!lensProblem.isOpenCLAvailable()) {
+                std::cout << "Snapshot selection: no OpenCL device" << std::endl;
+                return;
+            }
+            lensProblem.batchFitnessOpenCL(population);
+            for (int it = 0; it < iterations; it++) {
+                lensProblem.batchFitnessOpenCL(population);
+                kernelMs[selection] += lensProblem.m_clBuffers.lastKernelMs / iterations;
+            }
+        }
+        int num_interfaces = lensSystem.getLensInterfaces().size();
+        size_t ghosts = GhostTable(lensSystem).size();
+        std::cout << "Snapshot selection, " << num_interfaces << " interfaces (" << ghosts << " ghosts): full sort " << kernelMs[0] << " ms, selection " << kernelMs[1] << " ms (" << kernelMs[0] / kernelMs[1] << "x)" << std::endl;
+        csvFile << num_interfaces << "," << ghosts << "," << kernelMs[0] << "," << kernelMs[1] << "," << kernelMs[0] / kernelMs[1] << std::endl;
+    }
+    csvFile.close();
+}
+
+void benchmarkOpenCLKernels(int populationSize, int iterations) {
+    std::ofstream csvFile = openBenchmarkLog("OpenCL Kernels");
+    csvFile << "Population," << populationSize << std::endl;
+    csvFile << "Interfaces,Ghosts,Candidate Kernel (ms),Workgroup Kernel (ms),Speedup" << std::endl;
+    std::vector<LensSystem> lensSystems = { testLens(), heliarTronerLens(), someCanonLens(), japanesePatent() };
+    std::sort(lensSystems.begin(), lensSystems.end(), [](const LensSystem& a, const LensSystem& b) {
+        return a.getLensInterfaces().size() < b.getLensInterfaces().size();
+    });
+    std::string deviceKey;
+    //Smallest interface count from which the workgroup kernel won on every larger system, 0 while it lost on the last one
+    unsigned int crossover = 0;
+    for (const LensSystem& lensSystem : lensSystems) {
+        const OpenCLFitnessKernel kernels[2] = { OpenCLFitnessKernel::Candidate, OpenCLFitnessKernel::Workgroup };
+        double kernelMs[2] = { 0.0, 0.0 };
+        for (int k = 0; k < 2; k++) {
+            LensSystemProblem lensProblem;
+            pagmo::vector_double population = initBatchFitnessProblem(lensSystem, populationSize, lensProblem);
+            lensProblem.m_clKernel = kernels[k];
+            lensProblem.m_clChunkSize = populationSize; //one kernel per call
+            lensProblem.m_clDeviceType = getBenchmarkDeviceType();
+            if (!lensProblem.isOpenCLAvailable()) {
+                std::cout << "OpenCL kernels: no OpenCL device" << std::endl;
+                return;
+            }
+            if (lensProblem.m_clShared->activeKernel != kernels[k]) {
+                kernelMs[k] = std::numeric_limits<double>::infinity();
+                continue;
+            }
+            deviceKey = lensProblem.getOpenCLDeviceKey();
+            lensProblem.batchFitnessOpenCL(population);
+            for (int it = 0; it < iterations; it++) {
+                lensProblem.batchFitnessOpenCL(population);
+                kernelMs[k] += lensProblem.m_clBuffers.lastKernelMs / iterations;
+            }
+        }
+        unsigned int num_interfaces = lensSystem.getLensInterfaces().size();
+        size_t ghosts = GhostTable(lensSystem).size();
+        if (kernelMs[1] >= kernelMs[0]) {
+            crossover = 0;
+        }
+        else if (crossover == 0) {
+            crossover = num_interfaces;
+        }
+        std::cout << "OpenCL kernels, " << num_interfaces << " interfaces (" << ghosts << " ghosts): work-item per candidate " << kernelMs[0] << " ms, workgroup per candidate " << kernelMs[1] << " ms (" << kernelMs[0] / kernelMs[1] << "x)" << std::endl;
+        csvFile << num_interfaces << "," << ghosts << "," << kernelMs[0] << "," << kernelMs[1] << "," << kernelMs[0] / kernelMs[1] << std::endl;
+    }
+    if (crossover == 0) {
+        //the workgroup kernel lost on the largest system, keep it off for every measured size
+        crossover = lensSystems.back().getLensInterfaces().size() + 1;
+    }
+    std::cout << "OpenCL workgroup kernel from " << crossover << " interfaces on " << deviceKey << std::endl;
+    csvFile << "Crossover Interfaces," << crossover << std::endl;
+    csvFile.close();
+    saveOpenCLDeviceSetting(OPENCL_KERNEL_CROSSOVER_FILE, deviceKey, crossover);
+}
+
+void benchmarkOpenCLFloatPopulation(LensSystem lensSystem, int populationSize, int iterations) {
+    std::ofstream csvFile = openBenchmarkLog("OpenCL Float Population");
+    csvFile << "Interfaces," << lensSystem.getLensInterfaces().size() << std::endl;
+    csvFile << "Population," << populationSize << std::endl;
+    csvFile << "Transfer,Call (ms),Kernel (ms),Host Overhead (ms)" << std::endl;
+    pagmo::vector_double reference;
+    double maxRelativeDifference = 0.0;
+    for (bool floatPopulation : { false, true }) {
+        LensSystemProblem lensProblem;
+        pagmo::vector_double population = initBatchFitnessProblem(lensSystem, populationSize, lensProblem);
+        lensProblem.m_clFloatPopulation = floatPopulation;
+        lensProblem.m_clDeviceType = getBenchmarkDeviceType();
+        if (!lensProblem.isOpenCLAvailable()) {
+            std::cout << "OpenCL float population: no OpenCL device" << std::endl;
+            return;
+        }
+        if (lensProblem.m_clShared->floatTransfer != floatPopulation) {
+            std::cout << "OpenCL float population: " << lensProblem.getOpenCLDeviceKey() << " has no fp64" << std::endl;
+            return;
+        }
+        pagmo::vector_double result = lensProblem.batchFitnessOpenCL(population); //warm up
+        double callMs = 0.0;
+        double kernelMs = 0.0;
+        for (int it = 0; it < iterations; it++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            result = lensProblem.batchFitnessOpenCL(population);
+            auto end = std::chrono::high_resolution_clock::now();
+            callMs += std::chrono::duration<double, std::milli>(end - start).count();
+            kernelMs += lensProblem.m_clBuffers.lastKernelMs;
+        }
+        callMs /= iterations;
+        kernelMs /= iterations;
+        if (floatPopulation) {
+            for (size_t i = 0; i < result.size(); i++) {
+                if (result[i] != reference[i]) {
+                    maxRelativeDifference = std::max(maxRelativeDifference, std::abs(result[i] - reference[i]) / std::abs(reference[i]));
+                }
+            }
+        }
+        reference = result;
+        const char* name = floatPopulation ? "Float" : "Double";
+        std::cout << "OpenCL " << name << " population: call " << callMs << " ms, kernel " << kernelMs << " ms, host overhead " << callMs - kernelMs << " ms" << std::endl;
+        csvFile << name << "," << callMs << "," << kernelMs << "," << callMs - kernelMs << std::endl;
+    }
+    std::cout << "Max relative difference: " << maxRelativeDifference << std::endl;
+    csvFile << "Max Relative Difference," << maxRelativeDifference << std::endl;
+    csvFile.close();
+}
+
+void benchmarkHeterogeneousFitness(LensSystem lensSystem, int populationSize, int iterations) {
+    int num_interfaces = lensSystem.getLensInterfaces().size();
+    LensSystemProblem lensProblem;
+    pagmo::vector_double population = initBatchFitnessProblem(lensSystem, populationSize, lensProblem);
+    lensProblem.m_clDeviceType = getBenchmarkDeviceType();
+    if (!lensProblem.isOpenCLAvailable()) {
+        std::cout << "Heterogeneous fitness: no OpenCL device" << std::endl;
+        return;
+    }
+    if (lensProblem.m_clShared->cpuDevice) {
+        std::cout << "Heterogeneous fitness: the OpenCL device is a CPU, batchFitnessHeterogeneous evaluates on the host alone" << std::endl;
+        return;
+    }
+    auto evaluationsPerSecond = [&](auto&& evaluate) {
+        return getEvaluationsPerSecond(populationSize, iterations, evaluate);
+    };
+
+    pagmo::vector_double hostResult, openCLResult, heterogeneousResult;
+    double hostRate = evaluationsPerSecond([&]() { hostResult = lensProblem.batchFitnessHost(population); });
+    double openCLRate = evaluationsPerSecond([&]() { openCLResult = lensProblem.batchFitnessOpenCL(population); });
+    double heterogeneousRate = evaluationsPerSecond([&]() { heterogeneousResult = lensProblem.batchFitnessHeterogeneous(population); });
+    //the share of the last call, each candidate has to come back in its own place
+    double openCLShare = lensProblem.m_heterogeneousSplit.getOpenCLShare();
+    int openCLCandidates = static_cast<int>(std::lround(openCLShare * populationSize));
+    bool inOrder = std::equal(heterogeneousResult.begin(), heterogeneousResult.begin() + openCLCandidates, openCLResult.begin())
+        && std::equal(heterogeneousResult.begin() + openCLCandidates, heterogeneousResult.end(), hostResult.begin() + openCLCandidates);
+
+    std::ofstream csvFile = openBenchmarkLog("Heterogeneous Fitness");
+    csvFile << "Interfaces," << num_interfaces << std::endl;
+    csvFile << "Population," << populationSize << std::endl;
+    csvFile << "Evaluator,Evaluations/s" << std::endl;
+    csvFile << "Host," << hostRate << std::endl;
+    csvFile << "OpenCL," << openCLRate << std::endl;
+    csvFile << "Heterogeneous," << heterogeneousRate << std::endl;
+    csvFile << "OpenCL Share," << openCLShare << std::endl;
+    csvFile << "In Order," << inOrder << std::endl;
+    csvFile.close();
+    std::cout << "Heterogeneous fitness, " << populationSize << " candidates of " << num_interfaces << " interfaces: host " << hostRate << ", OpenCL " << openCLRate << ", host+OpenCL " << heterogeneousRate << " evaluations/s (" << heterogeneousRate / std::max(hostRate, openCLRate) << "x the faster one), OpenCL share " << openCLShare << ", in order: " << inOrder << std::endl;
+}
+
+void benchmarkConcurrentOpenCL(LensSystem lensSystem, int threads, int populationSize, int iterations) {
+    int num_interfaces = lensSystem.getLensInterfaces().size();
+    LensSystemProblem lensProblem;
+    pagmo::vector_double population = initBatchFitnessProblem(lensSystem, populationSize, lensProblem);
+    lensProblem.m_clDeviceType = getBenchmarkDeviceType();
+    //copies like pagmo makes for its islands, made before OpenCL is set up so they race for the initialization
+    std::vector<LensSystemProblem> islands(threads, lensProblem);
+
+    std::vector<pagmo::vector_double> results(threads);
+    std::vector<int> mismatches(threads, 0);
+    auto evaluateIslands = [&](bool sameProblem) {
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; t++) {
+            workers.emplace_back([&, t]() {
+                const LensSystemProblem& problem = sameProblem ? islands[0] : islands[t];
+                for (int it = 0; it < iterations; it++) {
+                    pagmo::vector_double result = problem.batch_fitness(population);
+                    if (it > 0 && result != results[t]) {
+                        mismatches[t]++;
+                    }
+                    results[t] = result;
+                }
+            });
+        }
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    };
+
+    auto start = std::chrono::high_resolution_clock::now();
+    evaluateIslands(false);
+    double islandsMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    if (!islands[0].isOpenCLAvailable()) {
+        std::cout << "Concurrent OpenCL: no OpenCL device" << std::endl;
+        return;
+    }
+    pagmo::vector_double reference = islands[0].batchFitnessOpenCL(population);
+    bool identical = true;
+    for (int t = 0; t < threads; t++) {
+        identical = identical && results[t] == reference;
+    }
+    start = std::chrono::high_resolution_clock::now();
+    evaluateIslands(true);
+    double sharedMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    for (int t = 0; t < threads; t++) {
+        identical = identical && results[t] == reference && mismatches[t] == 0;
+    }
+    double islandRate = 1000.0 * threads * iterations * populationSize / islandsMs;
+    double sharedRate = 1000.0 * threads * iterations * populationSize / sharedMs;
+
+    std::ofstream csvFile = openBenchmarkLog("Concurrent OpenCL");
+    csvFile << "Interfaces," << num_interfaces << std::endl;
+    csvFile << "Population," << populationSize << std::endl;
+    csvFile << "Threads," << threads << std::endl;
+    csvFile << "Problem,Evaluations/s" << std::endl;
+    csvFile << "Copy Per Thread," << islandRate << std::endl;
+    csvFile << "Shared," << sharedRate << std::endl;
+    csvFile << "Identical," << identical << std::endl;
+    csvFile.close();
+    std::cout << "Concurrent OpenCL, " << threads << " threads: copy per thread " << islandRate << " evaluations/s, one shared problem " << sharedRate << " evaluations/s, identical: " << identical << std::endl;
+}
+
+//pso_gen and RV-GOMEA one generation at a time from the same seeds, until the champion reaches targetFitness or the
+//problem has done maxEvaluations evaluations. RV-GOMEA runs with and without its partial evaluator, all evaluations are on
+//the host cores.
+void benchmarkLensOptimizers(LensSystem lensSystem, double targetFitness, unsigned long long maxEvaluations) {
+    int num_interfaces = lensSystem.getLensInterfaces().size();
+    LensSystemProblem lensProblem;
+    initBatchFitnessProblem(lensSystem, 0, lensProblem);
+    lensProblem.m_batchEvaluator = BatchEvaluator::Host;
+    const std::vector<unsigned> seeds = { 100, 200, 300, 400, 500 };
+    const char* optimizerNames[] = { "pso_gen", "RV-GOMEA (partial evaluations)", "RV-GOMEA (full evaluations)" };
+
+    std::ofstream csvFile = openBenchmarkLog("Lens Optimizers");
+    csvFile << "Interfaces," << num_interfaces << std::endl;
+    csvFile << "Target Fitness," << targetFitness << std::endl;
+    csvFile << "Evaluation Budget," << maxEvaluations << std::endl;
+    csvFile << "Optimizer,Seed,Population,Reached,Evaluations,Time (sec),Best Fitness" << std::endl;
+    for (int optimizer = 0; optimizer < 3; optimizer++) {
+        int reached = 0;
+        double totalSeconds = 0.0;
+        unsigned long long totalEvaluations = 0;
+        for (unsigned seed : seeds) {
+            pagmo::problem prob{ lensProblem };
+            pagmo::bfe bfe{};
+            pagmo::algorithm algo;
+            size_t populationSize = 200 * lensProblem.m_dim;
+            if (optimizer == 0) {
+                pagmo::pso_gen pso(1u, 0.7298, 2.05, 2.05, 0.5, 5u, 2u, 4u, true, seed);
+                pso.set_bfe(bfe);
+                algo = pagmo::algorithm{ pso };
+            }
+            else {
+                RVGomea gomea = makeLensRVGomea(lensProblem, 1u, seed, optimizer == 1);
+                algo = pagmo::algorithm{ gomea };
+                populationSize = RVGomea::getPopulationSizeGuideline(lensProblem.m_dim);
+            }
+
+            auto start = std::chrono::high_resolution_clock::now();
+            pagmo::population pop(prob, bfe, populationSize, seed);
+            while (pop.champion_f()[0] > targetFitness && pop.get_problem().get_fevals() < maxEvaluations) {
+                pop = algo.evolve(pop);
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+            unsigned long long evaluations = pop.get_problem().get_fevals();
+            bool hit = pop.champion_f()[0] <= targetFitness;
+            if (hit) {
+                reached++;
+                totalSeconds += seconds;
+                totalEvaluations += evaluations;
+            }
+            csvFile << optimizerNames[optimizer] << "," << seed << "," << populationSize << "," << hit << "," << evaluations << "," << seconds << "," << pop.champion_f()[0] << std::endl;
+        }
+        //averages over the runs that reached the target
+        std::cout << "Lens optimizers, " << num_interfaces << " interfaces, " << optimizerNames[optimizer] << ": reached " << targetFitness << " in " << reached << "/" << seeds.size() << " runs";
+        if (reached > 0) {
+            std::cout << ", " << totalEvaluations / reached << " evaluations and " << totalSeconds / reached << " s on average";
+        }
+        std::cout << std::endl;
+    }
+    csvFile.close();
+}
+
+void benchmarkBranchAndBound(LensSystem lensSystem, unsigned evolves, unsigned generations) {
+    int num_interfaces = lensSystem.getLensInterfaces().size();
+    LensSystemProblem lensProblem;
+    initBatchFitnessProblem(lensSystem, 0, lensProblem);
+    lensProblem.m_batchEvaluator = BatchEvaluator::Host;
+    const std::vector<unsigned> seeds = { 100, 200, 300 };
+
+    std::ofstream csvFile = openBenchmarkLog("Branch and Bound");
+    csvFile << "Interfaces," << num_interfaces << std::endl;
+    csvFile << "Evolves," << evolves << std::endl;
+    csvFile << "Generations," << generations << std::endl;
+    csvFile << "Seed,Unbounded (sec),Bounded (sec),Stopped Early,Ghosts Skipped,Identical" << std::endl;
+    for (unsigned seed : seeds) {
+        //Same seed with and without the bound, pso_gen discards every stopped candidate so the runs must match
+        double seconds[2];
+        pagmo::vector_double champion[2];
+        std::shared_ptr<FitnessBranchAndBound> branchAndBound = std::make_shared<FitnessBranchAndBound>();
+        for (int bounded = 0; bounded < 2; bounded++) {
+            lensProblem.m_branchAndBound = bounded ? branchAndBound : nullptr;
+            pagmo::problem prob{ lensProblem };
+            pagmo::bfe bfe{};
+            pagmo::pso_gen pso(generations, 0.7298, 2.05, 2.05, 0.5, 5u, 2u, 4u, false, seed);
+            pso.set_bfe(bfe);
+            pagmo::algorithm algo{ pso };
+            auto start = std::chrono::high_resolution_clock::now();
+            pagmo::population pop(prob, bfe, 200 * lensProblem.m_dim, seed);
+            for (unsigned i = 0; i < evolves; i++) {
+                if (bounded) {
+                    double upperBound = 0.0;
+                    for (const auto& f : pop.get_f()) {
+                        upperBound = std::max(upperBound, f[0]);
+                    }
+                    branchAndBound->upperBound = upperBound;
+                }
+                pop = algo.evolve(pop);
+            }
+            seconds[bounded] = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+            champion[bounded] = pop.champion_x();
+        }
+        FitnessBoundStats stats = branchAndBound->takeStats();
+        double stoppedEarly = stats.candidates > 0 ? static_cast<double>(stats.stopped) / stats.candidates : 0.0;
+        double ghostsSkipped = stats.ghosts > 0 ? static_cast<double>(stats.skippedGhosts) / stats.ghosts : 0.0;
+        bool identical = champion[0] == champion[1];
+        csvFile << seed << "," << seconds[0] << "," << seconds[1] << "," << stoppedEarly << "," << ghostsSkipped << "," << identical << std::endl;
+        std::cout << "Branch and bound, " << num_interfaces << " interfaces, seed " << seed << ": " << seconds[0] << " s unbounded, " << seconds[1] << " s bounded, " << stoppedEarly << " stopped early, " << ghostsSkipped << " of the ghosts skipped" << (identical ? "" : ", champions differ") << std::endl;
+    }
+    csvFile.close();
+}
+
+void benchmarkSurrogate(LensSystem lensSystem, double targetFitness, unsigned long long maxEvaluations) {
+    int num_interfaces = lensSystem.getLensInterfaces().size();
+    LensSystemProblem lensProblem;
+    initBatchFitnessProblem(lensSystem, 0, lensProblem);
+    lensProblem.m_batchEvaluator = BatchEvaluator::Host;
+    const std::vector<unsigned> seeds = { 100, 200, 300, 400, 500 };
+
+    std::ofstream csvFile = openBenchmarkLog("Surrogate");
+    csvFile << "Interfaces," << num_interfaces << std::endl;
+    csvFile << "Target Fitness," << targetFitness << std::endl;
+    csvFile << "Evaluation Budget," << maxEvaluations << std::endl;
+    csvFile << "Surrogate,Seed,Reached,Exact Evaluations,Time (sec),Best Fitness,Surrogate Error" << std::endl;
+    for (int screened = 0; screened < 2; screened++) {
+        int reached = 0;
+        double totalSeconds = 0.0;
+        unsigned long long totalEvaluations = 0;
+        for (unsigned seed : seeds) {
+            std::shared_ptr<FitnessSurrogate> surrogate = screened ? std::make_shared<FitnessSurrogate>(lensProblem.m_lb, lensProblem.m_ub) : nullptr;
+            lensProblem.m_surrogate = surrogate;
+            pagmo::problem prob{ lensProblem };
+            pagmo::bfe bfe{};
+            pagmo::pso_gen pso(1u, 0.7298, 2.05, 2.05, 0.5, 5u, 2u, 4u, true, seed);
+            pso.set_bfe(bfe);
+            pagmo::algorithm algo{ pso };
+
+            auto start = std::chrono::high_resolution_clock::now();
+            pagmo::population pop(prob, bfe, 200 * lensProblem.m_dim, seed);
+            //pagmo counts the screened candidates as evaluations too
+            unsigned long long evaluations = screened ? 0 : pop.get_problem().get_fevals();
+            double error = 0.0;
+            unsigned long long predicted = 0;
+            auto takeStats = [&]() {
+                FitnessSurrogate::Stats stats = surrogate->takeStats();
+                evaluations += stats.exact;
+                error += stats.absoluteError;
+                predicted += stats.predicted;
+            };
+            if (screened) {
+                takeStats();
+            }
+            while (pop.champion_f()[0] > targetFitness && evaluations < maxEvaluations) {
+                if (screened) {
+                    //Same discard value as runEA, above the worst personal best
+                    double worst = 0.0;
+                    for (const auto& f : pop.get_f()) {
+                        worst = std::max(worst, f[0]);
+                    }
+                    surrogate->screenedFitness = std::nextafter(worst, std::numeric_limits<double>::infinity());
+                }
+                pop = algo.evolve(pop);
+                if (screened) {
+                    takeStats();
+                }
+                else {
+                    evaluations = pop.get_problem().get_fevals();
+                }
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+            bool hit = pop.champion_f()[0] <= targetFitness;
+            if (hit) {
+                reached++;
+                totalSeconds += seconds;
+                totalEvaluations += evaluations;
+            }
+            csvFile << screened << "," << seed << "," << hit << "," << evaluations << "," << seconds << "," << pop.champion_f()[0] << "," << (predicted > 0 ? error / predicted : 0.0) << std::endl;
+        }
+        //averages over the runs that reached the target
+        std::cout << "Surrogate, " << num_interfaces << " interfaces, " << (screened ? "pre-screened" : "exact") << ": reached " << targetFitness << " in " << reached << "/" << seeds.size() << " runs";
+        if (reached > 0) {
+            std::cout << ", " << totalEvaluations / reached << " exact evaluations and " << totalSeconds / reached << " s on average";
+        }
+        std::cout << std::endl;
+    }
+    csvFile.close();
+}
+
+//Snapshot of every ghost of the candidate at dv in float, the way computeFitness simulates it
+static void getCandidateSnapshot(const LensSystemProblem& lensProblem, const double* dv, std::vector<SnapshotData>& snapshot) {
+    static thread_local std::vector<LensInterface> lensInterfaces;
+    lensProblem.getLensInterfaces(dv, lensInterfaces);
+    snapshot.clear();
+    withFixedLensSystem(std::round(dv[0]), lensInterfaces, [&](const auto& fixedLensSystem) {
+        fixedLensSystem.forEachGhostLayout([&](const GhostLayout& layout) {
+            snapshot.push_back(lensProblem.simulateDrawQuad(layout, snapshot.size(), lensProblem.m_light_angle_x, lensProblem.m_light_angle_y, dv[1]));
+            return true;
+            });
+        });
+}
+
+void benchmarkGhostJacobian(LensSystem lensSystem, int candidates) {
+    int num_interfaces = lensSystem.getLensInterfaces().size();
+    LensSystemProblem lensProblem;
+    pagmo::vector_double population = initBatchFitnessProblem(lensSystem, candidates, lensProblem);
+    const unsigned int dim = lensProblem.m_dim;
+    std::vector<std::vector<SnapshotData>> snapshots(candidates);
+    std::vector<std::vector<double>> jacobians(candidates);
+    if (!lensProblem.computeSnapshotJacobian(population.data(), snapshots[0], jacobians[0])) {
+        std::cout << "Ghost Jacobian: no FixedLensSystem for " << num_interfaces << " interfaces" << std::endl;
+        return;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < candidates; i++) {
+        lensProblem.computeSnapshotJacobian(population.data() + static_cast<size_t>(i) * dim, snapshots[i], jacobians[i]);
+    }
+    double dualSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+    std::vector<SnapshotData> snapshot;
+    start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < candidates; i++) {
+        getCandidateSnapshot(lensProblem, population.data() + static_cast<size_t>(i) * dim, snapshot);
+    }
+    double snapshotSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+    //Central differences on the float snapshot, the aperture position is left out like in the Jacobian. A candidate whose
+    //ghost count changes within a step is not compared.
+    std::vector<double> differences;
+    std::vector<SnapshotData> forward;
+    std::vector<SnapshotData> backward;
+    pagmo::vector_double dv(dim);
+    start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < candidates; i++) {
+        const std::vector<double>& jacobian = jacobians[i];
+        std::copy_n(population.begin() + static_cast<size_t>(i) * dim, dim, dv.begin());
+        for (unsigned int j = 1; j < dim; j++) {
+            double step = 1e-3 * (lensProblem.m_ub[j] - lensProblem.m_lb[j]);
+            double x = dv[j];
+            dv[j] = x + step;
+            getCandidateSnapshot(lensProblem, dv.data(), forward);
+            dv[j] = x - step;
+            getCandidateSnapshot(lensProblem, dv.data(), backward);
+            dv[j] = x;
+            if (forward.size() != snapshots[i].size() || backward.size() != snapshots[i].size()) {
+                continue;
+            }
+            for (size_t g = 0; g < forward.size(); g++) {
+                double finiteDifferences[3] = {
+                    (forward[g].quadCenterPos.x - backward[g].quadCenterPos.x) / (2.0 * step),
+                    (forward[g].quadCenterPos.y - backward[g].quadCenterPos.y) / (2.0 * step),
+                    (forward[g].quadHeight - backward[g].quadHeight) / (2.0 * step) };
+                for (int k = 0; k < 3; k++) {
+                    double exact = jacobian[(3 * g + k) * dim + j];
+                    double scale = std::max({ std::abs(exact), std::abs(finiteDifferences[k]), 1e-3 });
+                    differences.push_back(std::abs(exact - finiteDifferences[k]) / scale);
+                }
+            }
+        }
+    }
+    double finiteDifferenceSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    std::sort(differences.begin(), differences.end());
+    double median = differences.empty() ? 0.0 : differences[differences.size() / 2];
+    double percentile99 = differences.empty() ? 0.0 : differences[differences.size() * 99 / 100];
+
+    double dualRate = candidates / dualSeconds;
+    double finiteDifferenceRate = candidates / finiteDifferenceSeconds;
+    double snapshotRate = candidates / snapshotSeconds;
+    std::cout << "Ghost Jacobian, " << num_interfaces << " interfaces, " << dim - 1 << " parameters" << std::endl;
+    std::cout << "Dual numbers " << dualRate << " Jacobians/s (" << snapshotRate / dualRate << " snapshots each), central differences " << finiteDifferenceRate
+        << " Jacobians/s (" << 2 * (dim - 1) << " snapshots each), " << dualRate / finiteDifferenceRate << "x" << std::endl;
+    std::cout << "Relative difference median " << median << ", 99th percentile " << percentile99 << std::endl;
+    std::ofstream csvFile = openBenchmarkLog("Ghost Jacobian");
+    csvFile << "Interfaces," << num_interfaces << std::endl;
+    csvFile << "Parameters," << dim - 1 << std::endl;
+    csvFile << "Candidates," << candidates << std::endl;
+    csvFile << "Snapshot (eval/s),Dual Numbers (Jacobians/s),Central Differences (Jacobians/s),Speedup,Median Relative Difference,99th Percentile Relative Difference" << std::endl;
+    csvFile << snapshotRate << "," << dualRate << "," << finiteDifferenceRate << "," << dualRate / finiteDifferenceRate << "," << median << "," << percentile99 << std::endl;
+    csvFile.close();
+}
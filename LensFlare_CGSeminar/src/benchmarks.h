@@ -0,0 +1,51 @@
+#pragma once
+
+#include "lens_system.h"
+
+// Timing runs of LensFlareBenchmarks (benchmark_main.cpp), results are printed and appended to benchmark_log.csv
+void benchmarkIncrementalGhostUpdate(LensSystem lensSystem, int iterations = 200);
+// Fitness evaluation (ghost layouts of a candidate lens) and ghost refresh (ghost table and transmissions), LensSystem against FixedLensSystem
+void benchmarkFixedLensSystem(LensSystem lensSystem, int iterations = 1000);
+// Heap allocations per steady-state call of the ghost refresh, the coating heatmap and both fitness functions
+void benchmarkAllocations(LensSystem lensSystem, int iterations = 100);
+// computeFresnelAR called per pair against the vectorized wavelength and (theta0, d1) batch variants
+void benchmarkFresnelAR(int pairs = 4096, int iterations = 100);
+// Cost per ghost of the RGB transmissions against the spectral mode with K = 3, 16 and 64 bins
+void benchmarkSpectralTransmission(LensSystem lensSystem, int iterations = 20);
+// Ghost transmissions walked ghost by ghost against the shared-prefix TransmissionTree
+void benchmarkTransmissionTree(LensSystem lensSystem, int iterations = 200);
+// Evaluations per second of LensSystemProblem::batchFitnessHost against the number of threads, with the scalar and the SIMD
+// fitness, and of OpenCL when available
+void benchmarkHostBatchFitness(LensSystem lensSystem, int populationSize = 1024, int iterations = 5);
+// LensSystemProblem::computeFitness against computeFitnessLanes, single threaded and through batchFitnessHost
+void benchmarkSimdFitness(LensSystem lensSystem, int populationSize = 1024, int iterations = 5);
+// Host overhead per batchFitnessOpenCL call with the buffers and kernel created per call against the persistent ones
+void benchmarkOpenCLBatchOverhead(LensSystem lensSystem, int populationSize = 4096, int iterations = 20);
+// batchFitnessOpenCL with the population in one chunk against smaller pipelined chunks and the autotuned chunk size
+void benchmarkOpenCLPipeline(LensSystem lensSystem, int populationSize = 16384, int iterations = 10);
+// OpenCL kernel time with the snapshots bubble sorted against selecting the matched ones, across interface counts
+void benchmarkSnapshotSelection(int populationSize = 4096, int iterations = 10);
+// OpenCL kernel time of one work-item per candidate against one workgroup per candidate, across interface counts. The
+// interface count from which the workgroup kernel wins is saved as the crossover of the device.
+void benchmarkOpenCLKernels(int populationSize = 4096, int iterations = 10);
+// batchFitnessOpenCL transferring the population and fitness as double against float, and the largest fitness difference
+void benchmarkOpenCLFloatPopulation(LensSystem lensSystem, int populationSize = 16384, int iterations = 10);
+// Evaluations per second of the host, OpenCL and the population split between both, with the split it settled on
+void benchmarkHeterogeneousFitness(LensSystem lensSystem, int populationSize = 16384, int iterations = 20);
+// Threads batch evaluating concurrently on copies of one problem, like pagmo islands, and on one shared problem, checking
+// every result against a single-threaded one. Build with ENABLE_SANITIZER_THREAD to check the evaluator for data races.
+void benchmarkConcurrentOpenCL(LensSystem lensSystem, int threads = 4, int populationSize = 4096, int iterations = 10);
+// Wall-clock time and evaluations pso_gen and RV-GOMEA (with and without partial evaluation) take to reach targetFitness,
+// over the same seeds
+void benchmarkLensOptimizers(LensSystem lensSystem, double targetFitness = 1.0, unsigned long long maxEvaluations = 5000000);
+// pso_gen run for evolves calls of generations each with and without a FitnessBranchAndBound on the same seeds, the bound
+// set before every evolve as runEA does: time, candidates stopped early, ghosts skipped, and whether both runs end on the
+// same champion
+void benchmarkBranchAndBound(LensSystem lensSystem, unsigned evolves = 5, unsigned generations = 10);
+// Exact evaluations and wall-clock time pso_gen takes to reach targetFitness with and without a FitnessSurrogate, over the
+// same seeds, and the best fitness either reaches within maxEvaluations exact evaluations
+void benchmarkSurrogate(LensSystem lensSystem, double targetFitness = 1.0, unsigned long long maxEvaluations = 5000000);
+// Exact Jacobians of the ghost snapshots of random candidates from LensSystemProblem::computeSnapshotJacobian against
+// central differences of the float snapshot: Jacobians per second, their cost in snapshot evaluations, and the relative
+// difference between both
+void benchmarkGhostJacobian(LensSystem lensSystem, int candidates = 256);
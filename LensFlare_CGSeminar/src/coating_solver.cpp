@@ -1,4 +1,5 @@
 #include "coating_solver.h"
+#include "fixed_lens_system.h"
 
 #include <cmath>
 #include <pagmo/algorithm.hpp>
@@ -52,27 +53,30 @@ void LensCoatingProblem::setRenderObjective(std::vector<glm::vec3>& renderObject
     m_renderObjective = renderObjective;
 }
 
-void LensCoatingProblem::setLensSystem(LensSystem& lensSystem) {
+void LensCoatingProblem::setLensSystem(LensSystem& lensSystem, std::shared_ptr<const GhostTable> ghostTable) {
     m_lensSystem.push_back(lensSystem);
-    m_preAptReflectionPairs = lensSystem.getPreAptReflections();
-    m_postAptReflectionPairs = lensSystem.getPostAptReflections();
-
-    m_default_Ma = m_lensSystem[0].getMa();
-    m_preAptMas = m_lensSystem[0].getMa(m_preAptReflectionPairs);
-    m_post_apt_center_ray_x = glm::vec2(-m_light_angle_x * m_default_Ma[1][0] / m_default_Ma[0][0], m_light_angle_x);
-    m_post_apt_center_ray_y = glm::vec2(-m_light_angle_y * m_default_Ma[1][0] / m_default_Ma[0][0], m_light_angle_y);
-    for (auto& const preAptMa : m_preAptMas) {
-        m_pre_apt_center_ray_x.push_back(glm::vec2(-m_light_angle_x * preAptMa[1][0] / preAptMa[0][0], m_light_angle_x));
-        m_pre_apt_center_ray_y.push_back(glm::vec2(-m_light_angle_y * preAptMa[1][0] / preAptMa[0][0], m_light_angle_y));
-    }
-
+    m_ghostTable = ghostTable;
 }
 
 pagmo::vector_double LensCoatingProblem::fitness(const pagmo::vector_double& dv) const {
-    //Construct lens system
-    std::vector<LensInterface> newLensInterfaces;
-    newLensInterfaces.reserve(m_num_interfaces);
-    std::vector<LensInterface> currentLensInterfaces = m_lensSystem[0].getLensInterfaces();
+    if (!m_surrogate) {
+        return { computeFitness(dv) };
+    }
+    double prediction;
+    if (!m_surrogate->screen(dv.data(), prediction)) {
+        return { m_surrogate->screenedFitness.load() };
+    }
+    double f = computeFitness(dv);
+    m_surrogate->addEvaluation(dv.data(), f, prediction);
+    return { f };
+}
+
+double LensCoatingProblem::computeFitness(const pagmo::vector_double& dv) const {
+    //Construct lens system, the scratch buffers are per thread since the islands evaluate concurrently
+    static thread_local std::vector<LensInterface> newLensInterfaces;
+    static thread_local std::vector<glm::vec3> transmissions;
+    newLensInterfaces.clear();
+    const std::vector<LensInterface>& currentLensInterfaces = m_lensSystem[0].getLensInterfaces();
     for (int i = 0; i < m_num_interfaces; i++) {
         LensInterface lens;
         lens.di = currentLensInterfaces[i].di;
@@ -87,29 +91,30 @@ pagmo::vector_double LensCoatingProblem::fitness(const pagmo::vector_double& dv)
         }
         newLensInterfaces.push_back(lens);
     }
-    LensSystem newLensSystem = LensSystem(m_lensSystem[0].getIrisAperturePos(), m_lensSystem[0].getApertureHeight(), m_lensSystem[0].getEntrancePupilHeight(), newLensInterfaces);
-
-    std::vector<glm::vec3> preAPTtransmissions = newLensSystem.getTransmission(m_preAptReflectionPairs, m_pre_apt_center_ray_x, m_pre_apt_center_ray_y, m_quarterWaveCoating);
-    std::vector<glm::vec3> postAPTtransmissions = newLensSystem.getTransmission(m_postAptReflectionPairs, m_post_apt_center_ray_x, m_post_apt_center_ray_y, m_quarterWaveCoating);
+    glm::vec2 yawAndPitch = glm::vec2(m_light_angle_x, m_light_angle_y);
+    bool fixed = withFixedLensSystem(m_lensSystem[0].getIrisAperturePos(), newLensInterfaces, [&](const auto& fixedLensSystem) {
+        fixedLensSystem.computeTransmissions(*m_ghostTable, yawAndPitch, m_quarterWaveCoating, transmissions);
+    });
+    if (!fixed) {
+        LensSystem newLensSystem = LensSystem(m_lensSystem[0].getIrisAperturePos(), m_lensSystem[0].getApertureHeight(), m_lensSystem[0].getEntrancePupilHeight(), newLensInterfaces);
+        m_ghostTable->computeTransmissions(newLensSystem, yawAndPitch, m_quarterWaveCoating, transmissions);
+    }
 
     double f = 0.0;
 
-    for (size_t i = 0; i < preAPTtransmissions.size(); i++) {
+    for (size_t i = 0; i < transmissions.size(); i++) {
         glm::vec3 normalizedObjective = normalizeRGB(m_renderObjective[i]);
-        glm::vec3 normalizedTransmitted = normalizeRGB(preAPTtransmissions[i] * m_light_intensity);
-
-        f += glm::length(normalizedObjective - normalizedTransmitted);
-    }
-
-    for (size_t i = 0; i < postAPTtransmissions.size(); i++) {
-        glm::vec3 normalizedObjective = normalizeRGB(m_renderObjective[i + preAPTtransmissions.size()]);
-        glm::vec3 normalizedTransmitted = normalizeRGB(postAPTtransmissions[i] * m_light_intensity);
+        glm::vec3 normalizedTransmitted = normalizeRGB(transmissions[i] * m_light_intensity);
 
         f += glm::length(normalizedObjective - normalizedTransmitted);
     }
 
     f = f / dv.size();
-    return { f };
+    return f;
+}
+
+double LensCoatingProblem::getMaxFitness() const {
+    return std::sqrt(2.0) * m_ghostTable->size() / m_dim;
 }
 
 std::pair<pagmo::vector_double, pagmo::vector_double> LensCoatingProblem::get_bounds() const {
@@ -135,14 +140,18 @@ pagmo::vector_double convertLensSystemCustom(const std::vector<LensInterface>& l
     return decision;
 }
 
-std::vector<double> runEACoatings(pagmo::archipelago archi) {
+std::vector<double> runEACoatings(pagmo::archipelago archi, std::shared_ptr<FitnessSurrogate> surrogate) {
     std::ofstream csvFile("ea_log.csv", std::ios::app);
     if (!csvFile.is_open()) {
         std::cerr << "Error opening CSV log file!" << std::endl;
     }
     csvFile << "######################################################################" << std::endl;
     csvFile << "EA Coatings Run" << std::endl;
-    csvFile << "Generation,Elapsed Time (sec),Total Evaluations,Best Fitness" << std::endl;
+    csvFile << "Generation,Elapsed Time (sec),Total Evaluations,Best Fitness";
+    if (surrogate) {
+        csvFile << ",Exact Evaluations,Screened,Surrogate Error";
+    }
+    csvFile << std::endl;
 
     std::vector<double> c_solution = archi.get_champions_x()[0];
     double c_fitness = archi.get_champions_f()[0][0];
@@ -155,6 +164,11 @@ std::vector<double> runEACoatings(pagmo::archipelago archi) {
 
     auto start = std::chrono::high_resolution_clock::now();
     unsigned long long total_fevals = 0;
+    // pagmo counts the screened candidates as evaluations too
+    unsigned long long exactEvaluations = 0;
+    if (surrogate) {
+        surrogate->takeStats();
+    }
 
     for (int gen = 0; gen < 100; ++gen) {
         std::cout << "EVOLVING GEN " << gen << std::endl;
@@ -181,7 +195,14 @@ std::vector<double> runEACoatings(pagmo::archipelago archi) {
         csvFile << gen << ","
             << elapsed_secs << ","
             << total_fevals << ","
-            << best_fitness << std::endl;
+            << best_fitness;
+        if (surrogate) {
+            FitnessSurrogate::Stats stats = surrogate->takeStats();
+            exactEvaluations += stats.exact;
+            std::cout << "Surrogate: " << stats.screened << " screened, " << stats.exact << " evaluated exactly, mean log error " << stats.getMeanError() << std::endl;
+            csvFile << "," << exactEvaluations << "," << stats.getScreenedFraction() << "," << stats.getMeanError();
+        }
+        csvFile << std::endl;
     }
 
     auto end = std::chrono::high_resolution_clock::now();
@@ -192,6 +213,9 @@ std::vector<double> runEACoatings(pagmo::archipelago archi) {
     csvFile << std::endl;
     csvFile << "Final Computation Time (min:sec):," << minutes << ":" << seconds << std::endl;
     csvFile << "Total Function Evaluations:," << total_fevals << std::endl;
+    if (surrogate) {
+        csvFile << "Exact Function Evaluations:," << exactEvaluations << std::endl;
+    }
 
     double best_fitness = std::numeric_limits<double>::max();
     std::vector<double> best_champion;
@@ -215,7 +239,7 @@ std::vector<double> runEACoatings(pagmo::archipelago archi) {
 }
 
 
-LensSystem solveCoatingAnnotations(LensSystem& currentLensSystem, std::vector<glm::vec3>& renderObjective, float light_angle_x, float light_angle_y, float lightIntensity, bool quarterWaveCoating) {
+LensSystem solveCoatingAnnotations(LensSystem& currentLensSystem, std::shared_ptr<const GhostTable> ghostTable, std::vector<glm::vec3>& renderObjective, float light_angle_x, float light_angle_y, float lightIntensity, bool quarterWaveCoating, bool surrogate) {
     
     std::vector<LensInterface> currentLensInterfaces = currentLensSystem.getLensInterfaces();
     unsigned int num_interfaces = currentLensInterfaces.size();
@@ -223,7 +247,11 @@ LensSystem solveCoatingAnnotations(LensSystem& currentLensSystem, std::vector<gl
     LensCoatingProblem my_problem;
     my_problem.init(num_interfaces, 0.001f, 0.001f, lightIntensity, quarterWaveCoating);
     my_problem.setRenderObjective(renderObjective);
-    my_problem.setLensSystem(currentLensSystem);
+    my_problem.setLensSystem(currentLensSystem, ghostTable);
+    if (surrogate) {
+        // Retrained once per island population of exact evaluations
+        my_problem.m_surrogate = std::make_shared<FitnessSurrogate>(my_problem.m_lb, my_problem.m_ub, 0.3, 15 * num_interfaces);
+    }
     pagmo::problem prob{ my_problem };
     
     std::cout << "Created Pagmo UDP" << std::endl;
@@ -243,6 +271,10 @@ LensSystem solveCoatingAnnotations(LensSystem& currentLensSystem, std::vector<gl
     pagmo::algorithm algo{ pagmo::sade(5, 1u, 1u, 1e-6, 1e-6, false,pagmo::random_device::next()) };
     std::vector<double> best_champion;
     for (int i_run = 0; i_run < 5; i_run++) {
+        // The initial populations are evaluated exactly
+        if (surrogate) {
+            my_problem.m_surrogate->screenedFitness = std::numeric_limits<double>::infinity();
+        }
         pagmo::archipelago archi;
         // Add islands 
         for (int i = 0; i < 15; ++i) {
@@ -254,7 +286,10 @@ LensSystem solveCoatingAnnotations(LensSystem& currentLensSystem, std::vector<gl
             archi.push_back(pagmo::island{ algo, pop });
         }
 
-        best_champion = runEACoatings(archi);
+        if (surrogate) {
+            my_problem.m_surrogate->screenedFitness = std::nextafter(my_problem.getMaxFitness(), std::numeric_limits<double>::infinity());
+        }
+        best_champion = runEACoatings(archi, my_problem.m_surrogate);
     }
 
     //Convert the best decision vector back into a vector of LensInterface
@@ -4,8 +4,11 @@
 #include <pagmo/types.hpp>
 #include <pagmo/problem.hpp>
 #include <vector>
+#include <memory>
 #include "lens_system.h"
+#include "ghost_table.h"
 #include "quad.h"
+#include "fitness_surrogate.h"
 #include <glm/glm.hpp>
 
 struct LensCoatingProblem {
@@ -19,27 +22,25 @@ struct LensCoatingProblem {
     bool m_quarterWaveCoating;
     std::vector<glm::vec3> m_renderObjective;
     std::vector<LensSystem> m_lensSystem;
-    std::vector<glm::vec2> m_preAptReflectionPairs;
-    std::vector<glm::vec2> m_postAptReflectionPairs;
-
-    glm::mat2x2 m_default_Ma;
-    std::vector<glm::mat2x2> m_preAptMas;
-    glm::vec2 m_post_apt_center_ray_x;
-    glm::vec2 m_post_apt_center_ray_y;
-    std::vector<glm::vec2> m_pre_apt_center_ray_x;
-    std::vector<glm::vec2> m_pre_apt_center_ray_y;
+    std::shared_ptr<const GhostTable> m_ghostTable; // coatings do not change the ghosts, shared by all islands
+    // Pre-screening of fitness shared by all islands, null when disabled. A screened candidate gets the surrogate's
+    // screenedFitness, solveCoatingAnnotations sets it above getMaxFitness so sade discards it.
+    std::shared_ptr<FitnessSurrogate> m_surrogate;
 
 
     // Set the problem dimension and bounds
     void init(unsigned int num_interfaces, float light_angle_x, float light_angle_y, float lightIntensity, bool quarterWaveCoating);
     // Set the render objectives for the fitness function
     void setRenderObjective(std::vector<glm::vec3>& renderObjective);
-    // Set the current lens system
-    void setLensSystem(LensSystem& lensSystem);
+    // Set the current lens system and its ghosts
+    void setLensSystem(LensSystem& lensSystem, std::shared_ptr<const GhostTable> ghostTable);
     // This function computes the fitness (objective) value.
     pagmo::vector_double fitness(const pagmo::vector_double& dv) const;
+    double computeFitness(const pagmo::vector_double& dv) const;
+    // No candidate is worse: normalized colors lie on the plane r + g + b = 1 in the positive octant, at most sqrt(2) apart
+    double getMaxFitness() const;
     // Get the lower and upper bounds of the decision vector.
     std::pair<pagmo::vector_double, pagmo::vector_double> get_bounds() const;
 };
 
-LensSystem solveCoatingAnnotations(LensSystem& currentLensSystem, std::vector<glm::vec3>& renderObjective, float light_angle_x, float light_angle_y, float lightIntensity, bool quarterWaveCoating);
+LensSystem solveCoatingAnnotations(LensSystem& currentLensSystem, std::shared_ptr<const GhostTable> ghostTable, std::vector<glm::vec3>& renderObjective, float light_angle_x, float light_angle_y, float lightIntensity, bool quarterWaveCoating, bool surrogate = false);
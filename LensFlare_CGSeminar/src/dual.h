@@ -0,0 +1,114 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <type_traits>
+#include <glm/mat2x2.hpp>
+
+// Forward-mode dual number: a value and its partial derivatives with respect to P inputs. Every operation applies the
+// chain rule to all partials at once, so one evaluation of a function of P inputs over Dual gives its value and its
+// gradient. Comparisons only look at the value, a branch is taken the way the value takes it and the partials are those
+// of the branch taken. Seed an input by setting its partial to 1 (see seed).
+template<typename T, int P>
+struct Dual {
+	T value;
+	std::array<T, P> partials;
+
+	// Uninitialized like a float, glm keeps its vector components in a union
+	Dual() = default;
+	Dual(T value) : value(value), partials{} {}
+
+	// Input number i of the function
+	static Dual seed(T value, int i, T partial = T(1)) {
+		Dual x(value);
+		x.partials[i] = partial;
+		return x;
+	}
+
+	Dual operator-() const {
+		Dual r(-value);
+		for (int i = 0; i < P; i++) {
+			r.partials[i] = -partials[i];
+		}
+		return r;
+	}
+	Dual& operator+=(const Dual& b) {
+		value += b.value;
+		for (int i = 0; i < P; i++) {
+			partials[i] += b.partials[i];
+		}
+		return *this;
+	}
+	Dual& operator-=(const Dual& b) {
+		value -= b.value;
+		for (int i = 0; i < P; i++) {
+			partials[i] -= b.partials[i];
+		}
+		return *this;
+	}
+	Dual& operator*=(const Dual& b) {
+		for (int i = 0; i < P; i++) {
+			partials[i] = partials[i] * b.value + value * b.partials[i];
+		}
+		value *= b.value;
+		return *this;
+	}
+	// Dividing by an infinite constant, a flat interface's radius, gives 0 with zero partials
+	Dual& operator/=(const Dual& b) {
+		value /= b.value;
+		for (int i = 0; i < P; i++) {
+			partials[i] = (partials[i] - value * b.partials[i]) / b.value;
+		}
+		return *this;
+	}
+
+	friend Dual operator+(Dual a, const Dual& b) { return a += b; }
+	friend Dual operator-(Dual a, const Dual& b) { return a -= b; }
+	friend Dual operator*(Dual a, const Dual& b) { return a *= b; }
+	friend Dual operator/(Dual a, const Dual& b) { return a /= b; }
+
+	friend bool operator==(const Dual& a, const Dual& b) { return a.value == b.value; }
+	friend bool operator!=(const Dual& a, const Dual& b) { return a.value != b.value; }
+	friend bool operator<(const Dual& a, const Dual& b) { return a.value < b.value; }
+	friend bool operator>(const Dual& a, const Dual& b) { return a.value > b.value; }
+	friend bool operator<=(const Dual& a, const Dual& b) { return a.value <= b.value; }
+	friend bool operator>=(const Dual& a, const Dual& b) { return a.value >= b.value; }
+	// Against a constant in its own type, like a float compared with a double literal
+	template<typename S, typename = std::enable_if_t<std::is_arithmetic_v<S>>>
+	friend bool operator<(const Dual& a, S b) { return a.value < b; }
+	template<typename S, typename = std::enable_if_t<std::is_arithmetic_v<S>>>
+	friend bool operator>(const Dual& a, S b) { return a.value > b; }
+
+	// Found through ADL, generic code calls them unqualified after using std::abs and std::sqrt
+	friend Dual abs(const Dual& x) { return x.value < T(0) ? -x : x; }
+	friend Dual sqrt(const Dual& x) {
+		Dual r(std::sqrt(x.value));
+		for (int i = 0; i < P; i++) {
+			r.partials[i] = x.partials[i] / (T(2) * r.value);
+		}
+		return r;
+	}
+	friend bool isinf(const Dual& x) { return std::isinf(x.value); }
+};
+
+// a * b + c * d in one pass over the partials
+template<typename T, int P>
+Dual<T, P> multiplyAdd(const Dual<T, P>& a, const Dual<T, P>& b, const Dual<T, P>& c, const Dual<T, P>& d) {
+	Dual<T, P> r(a.value * b.value + c.value * d.value);
+	for (int i = 0; i < P; i++) {
+		r.partials[i] = a.partials[i] * b.value + a.value * b.partials[i] + c.partials[i] * d.value + c.value * d.partials[i];
+	}
+	return r;
+}
+
+// glm's mat2 product without the temporaries of the generic one, found through ADL on the Dual entries. The matrix
+// chains of the ghost layout are almost all of the work of its derivatives.
+template<typename T, int P, glm::qualifier Q>
+glm::mat<2, 2, Dual<T, P>, Q> operator*(const glm::mat<2, 2, Dual<T, P>, Q>& m1, const glm::mat<2, 2, Dual<T, P>, Q>& m2) {
+	glm::mat<2, 2, Dual<T, P>, Q> r;
+	r[0][0] = multiplyAdd(m1[0][0], m2[0][0], m1[1][0], m2[0][1]);
+	r[0][1] = multiplyAdd(m1[0][1], m2[0][0], m1[1][1], m2[0][1]);
+	r[1][0] = multiplyAdd(m1[0][0], m2[1][0], m1[1][0], m2[1][1]);
+	r[1][1] = multiplyAdd(m1[0][1], m2[1][0], m1[1][1], m2[1][1]);
+	return r;
+}
@@ -0,0 +1,229 @@
+#include "fitness_surrogate.h"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <utility>
+#include <Eigen/Dense>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+RbfModel::RbfModel(std::vector<double> points, const std::vector<double>& values, size_t dim)
+    : m_dim(dim), m_count(values.size()), m_points(std::move(points)) {
+    const Eigen::Index n = static_cast<Eigen::Index>(m_count);
+    const Eigen::Index d = static_cast<Eigen::Index>(m_dim);
+    Eigen::MatrixXd A = Eigen::MatrixXd::Zero(n + d + 1, n + d + 1);
+    Eigen::VectorXd b = Eigen::VectorXd::Zero(n + d + 1);
+    for (Eigen::Index i = 0; i < n; i++) {
+        Eigen::Map<const Eigen::VectorXd> xi(&m_points[i * m_dim], d);
+        for (Eigen::Index j = 0; j < i; j++) {
+            double r = (xi - Eigen::Map<const Eigen::VectorXd>(&m_points[j * m_dim], d)).norm();
+            A(i, j) = A(j, i) = r * r * r;
+        }
+        A(i, n) = A(n, i) = 1.0;
+        A.block(i, n + 1, 1, d) = xi.transpose();
+        A.block(n + 1, i, d, 1) = xi;
+        b(i) = values[i];
+    }
+    Eigen::VectorXd w = A.partialPivLu().solve(b);
+    // Partial pivoting does not report a singular system, the residual does
+    m_valid = w.allFinite() && (A * w - b).norm() <= 1e-6 * std::max(1.0, b.norm());
+    m_weights.assign(w.data(), w.data() + w.size());
+}
+
+double RbfModel::predict(const double* x) const {
+    double s = m_weights[m_count];
+    for (size_t k = 0; k < m_dim; k++) {
+        s += m_weights[m_count + 1 + k] * x[k];
+    }
+    for (size_t i = 0; i < m_count; i++) {
+        const double* xi = &m_points[i * m_dim];
+        double r2 = 0.0;
+        for (size_t k = 0; k < m_dim; k++) {
+            double dx = x[k] - xi[k];
+            r2 += dx * dx;
+        }
+        s += m_weights[i] * r2 * std::sqrt(r2);
+    }
+    return s;
+}
+
+FitnessSurrogate::FitnessSurrogate(pagmo::vector_double lb, pagmo::vector_double ub, double exactFraction, size_t retrainInterval, size_t capacity)
+    : exactFraction(exactFraction), retrainInterval(retrainInterval), capacity(capacity), m_lb(std::move(lb)), m_ub(std::move(ub)) {}
+
+void FitnessSurrogate::scale(const double* dv, double* out) const {
+    for (size_t k = 0; k < m_lb.size(); k++) {
+        double range = m_ub[k] - m_lb[k];
+        out[k] = range > 0.0 ? (dv[k] - m_lb[k]) / range : 0.0;
+    }
+}
+
+std::shared_ptr<const RbfModel> FitnessSurrogate::getModel() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_model;
+}
+
+double FitnessSurrogate::predict(const RbfModel* model, const double* dv) const {
+    if (!model) {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    static thread_local std::vector<double> scaled;
+    scaled.resize(m_lb.size());
+    scale(dv, scaled.data());
+    return std::expm1(std::max(model->predict(scaled.data()), 0.0));
+}
+
+double FitnessSurrogate::predict(const double* dv) const {
+    return predict(getModel().get(), dv);
+}
+
+std::vector<int> FitnessSurrogate::screen(const double* pop, int count, std::vector<double>& predictions) {
+    std::shared_ptr<const RbfModel> model = getModel();
+    predictions.resize(count);
+    tbb::parallel_for(tbb::blocked_range<int>(0, count, 64), [&](const tbb::blocked_range<int>& range) {
+        for (int i = range.begin(); i < range.end(); i++) {
+            predictions[i] = predict(model.get(), pop + static_cast<size_t>(i) * m_lb.size());
+        }
+    });
+    std::vector<int> exact(count);
+    std::iota(exact.begin(), exact.end(), 0);
+    if (model && count > 0 && screenedFitness.load() < std::numeric_limits<double>::infinity()) {
+        size_t exactCount = std::max<size_t>(1, static_cast<size_t>(std::ceil(exactFraction * count)));
+        std::nth_element(exact.begin(), exact.begin() + (exactCount - 1), exact.end(), [&](int a, int b) {
+            return predictions[a] < predictions[b];
+        });
+        exact.resize(exactCount);
+        std::sort(exact.begin(), exact.end());
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stats.screened += count - exact.size();
+    return exact;
+}
+
+bool FitnessSurrogate::screen(const double* dv, double& prediction) {
+    prediction = predict(dv);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    bool exact = true;
+    if (!std::isnan(prediction)) {
+        m_recentPredictions.push_back(prediction);
+        exact = !(screenedFitness.load() < std::numeric_limits<double>::infinity()) || prediction <= m_threshold;
+    }
+    if (!exact) {
+        m_stats.screened++;
+    }
+    return exact;
+}
+
+void FitnessSurrogate::addEvaluations(const std::vector<const double*>& dvs, const std::vector<double>& fitness, const std::vector<double>& predictions) {
+    const size_t dim = m_lb.size();
+    std::vector<size_t> order(dvs.size());
+    std::iota(order.begin(), order.end(), 0);
+    if (order.size() > capacity) {
+        // NaN fitness sorts last and is left out below anyway
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return fitness[a] < fitness[b] || (!std::isnan(fitness[a]) && std::isnan(fitness[b]));
+        });
+        std::vector<size_t> spaced(capacity);
+        for (size_t i = 0; i < capacity; i++) {
+            spaced[i] = order[i * (order.size() - 1) / std::max<size_t>(capacity - 1, 1)];
+        }
+        order = std::move(spaced);
+    }
+
+    bool fit = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (size_t i = 0; i < dvs.size(); i++) {
+            m_stats.exact++;
+            if (!std::isnan(predictions[i]) && std::isfinite(fitness[i])) {
+                m_stats.predicted++;
+                m_stats.absoluteError += std::abs(std::log1p(predictions[i]) - std::log1p(std::max(fitness[i], 0.0)));
+            }
+        }
+        std::vector<double> scaled(dim);
+        for (size_t i : order) {
+            if (!std::isfinite(fitness[i])) {
+                continue;
+            }
+            scale(dvs[i], scaled.data());
+            // A repeated candidate would make the interpolation system singular
+            size_t stored = m_values.size();
+            bool repeated = false;
+            for (size_t j = 0; j < stored && !repeated; j++) {
+                repeated = std::equal(scaled.begin(), scaled.end(), &m_points[j * dim]);
+            }
+            if (repeated) {
+                continue;
+            }
+            if (stored < capacity) {
+                m_points.insert(m_points.end(), scaled.begin(), scaled.end());
+                m_values.push_back(std::log1p(std::max(fitness[i], 0.0)));
+            }
+            else {
+                std::copy(scaled.begin(), scaled.end(), &m_points[m_next * dim]);
+                m_values[m_next] = std::log1p(std::max(fitness[i], 0.0));
+                m_next = (m_next + 1) % capacity;
+            }
+            m_added++;
+        }
+        fit = retrainInterval > 0 && m_added >= retrainInterval;
+    }
+    if (fit) {
+        retrain();
+    }
+}
+
+void FitnessSurrogate::addEvaluation(const double* dv, double fitness, double prediction) {
+    addEvaluations({ dv }, { fitness }, { prediction });
+}
+
+void FitnessSurrogate::retrain() {
+    std::vector<double> points;
+    std::vector<double> values;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // The linear tail needs dim + 1 points, one more leaves a degree of freedom to the RBF
+        if (m_added == 0 || m_values.size() < m_lb.size() + 2) {
+            return;
+        }
+        m_added = 0;
+        points = m_points;
+        values = m_values;
+    }
+    // Fitted without the lock, a concurrent fit only replaces the model twice
+    std::shared_ptr<const RbfModel> model = std::make_shared<RbfModel>(std::move(points), values, m_lb.size());
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (model->isValid()) {
+        m_model = model;
+    }
+    if (!m_recentPredictions.empty()) {
+        size_t rank = std::min(m_recentPredictions.size() - 1, static_cast<size_t>(exactFraction * m_recentPredictions.size()));
+        std::nth_element(m_recentPredictions.begin(), m_recentPredictions.begin() + rank, m_recentPredictions.end());
+        m_threshold = m_recentPredictions[rank];
+        m_recentPredictions.clear();
+    }
+}
+
+void FitnessSurrogate::clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_model.reset();
+    m_points.clear();
+    m_values.clear();
+    m_next = 0;
+    m_added = 0;
+    m_recentPredictions.clear();
+    m_threshold = std::numeric_limits<double>::infinity();
+}
+
+double FitnessSurrogate::Stats::getScreenedFraction() const {
+    return exact + screened > 0 ? static_cast<double>(screened) / (exact + screened) : 0.0;
+}
+
+double FitnessSurrogate::Stats::getMeanError() const {
+    return predicted > 0 ? absoluteError / predicted : 0.0;
+}
+
+FitnessSurrogate::Stats FitnessSurrogate::takeStats() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return std::exchange(m_stats, Stats());
+}
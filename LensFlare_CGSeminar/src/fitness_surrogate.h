@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <pagmo/types.hpp>
+
+// Cubic radial basis function interpolant with a linear tail, s(x) = sum w_i |x - x_i|^3 + c_0 + c^T x, through count
+// points of dim variables stored back to back
+class RbfModel {
+public:
+    RbfModel(std::vector<double> points, const std::vector<double>& values, size_t dim);
+    // False when the interpolation system was singular, e.g. the points lie in a hyperplane
+    bool isValid() const { return m_valid; }
+    double predict(const double* x) const;
+
+private:
+    size_t m_dim;
+    size_t m_count;
+    std::vector<double> m_points;
+    std::vector<double> m_weights; //count RBF weights, c_0, then c
+    bool m_valid = false;
+};
+
+// Surrogate of an expensive fitness to pre-screen the candidates of an optimizer, so only the most promising fraction is
+// evaluated exactly. The model is an RbfModel of log(1 + f) over the exactly evaluated candidates, with the variables
+// scaled to [0, 1] by the problem bounds. The log keeps the penalty of broken candidates from flattening the rest of the
+// landscape, non-finite fitness is left out. It keeps the capacity most recent distinct candidates and refits from
+// scratch, which takes milliseconds for the default capacity. A problem and its copies share it and may use it
+// concurrently.
+class FitnessSurrogate {
+public:
+    FitnessSurrogate(pagmo::vector_double lb, pagmo::vector_double ub, double exactFraction = 0.3, size_t retrainInterval = 0, size_t capacity = 256);
+
+    // Predicted fitness of the candidate at dv, NaN without a model
+    double predict(const double* dv) const;
+    // Predictions of the count candidates back to back at pop, returns the ascending indices of the candidates to evaluate
+    // exactly: the exactFraction with the lowest predictions, or all of them without a model or screenedFitness
+    std::vector<int> screen(const double* pop, int count, std::vector<double>& predictions);
+    // Whether to evaluate the candidate at dv exactly, for optimizers that evaluate one candidate at a time: its prediction
+    // is within the exactFraction lowest predictions made between the last two fits
+    bool screen(const double* dv, double& prediction);
+    // Adds exactly evaluated candidates with their predictions (NaN for none) to the training set and the prediction
+    // error. More than capacity candidates add capacity of them at evenly spaced fitness ranks, the best included.
+    void addEvaluations(const std::vector<const double*>& dvs, const std::vector<double>& fitness, const std::vector<double>& predictions);
+    void addEvaluation(const double* dv, double fitness, double prediction);
+    // Refits the model on the training set, addEvaluations calls it every retrainInterval candidates unless it is 0
+    void retrain();
+    // Drops the training set and the model, for a new render objective
+    void clear();
+
+    // Counters since the last takeStats, which resets them. The error is the mean absolute difference of log(1 + f)
+    // between prediction and evaluation.
+    struct Stats {
+        unsigned long long exact = 0;
+        unsigned long long screened = 0;
+        unsigned long long predicted = 0; //exact evaluations that had a prediction
+        double absoluteError = 0.0;
+        double getScreenedFraction() const;
+        double getMeanError() const;
+    };
+    Stats takeStats();
+
+    // Fitness of a screened candidate, one the optimizer is certain to discard. The owner sets it, nothing is screened
+    // while it is infinite.
+    std::atomic<double> screenedFitness = std::numeric_limits<double>::infinity();
+    const double exactFraction;
+    const size_t retrainInterval;
+    const size_t capacity;
+
+private:
+    std::shared_ptr<const RbfModel> getModel() const;
+    double predict(const RbfModel* model, const double* dv) const;
+    void scale(const double* dv, double* out) const;
+
+    pagmo::vector_double m_lb;
+    pagmo::vector_double m_ub;
+    mutable std::mutex m_mutex;
+    std::shared_ptr<const RbfModel> m_model;
+    std::vector<double> m_points; //ring buffer of capacity scaled candidates
+    std::vector<double> m_values; //log(1 + f) of m_points
+    size_t m_next = 0;
+    size_t m_added = 0; //since the last fit
+    std::vector<double> m_recentPredictions; //of screen(dv) since the last fit
+    double m_threshold = std::numeric_limits<double>::infinity();
+    Stats m_stats;
+};
@@ -0,0 +1,16 @@
+#include "fixed_lens_system.h"
+
+GhostTable buildGhostTable(const LensSystem& lensSystem) {
+	GhostTable ghostTable;
+	buildGhostTable(lensSystem, ghostTable);
+	return ghostTable;
+}
+
+void buildGhostTable(const LensSystem& lensSystem, GhostTable& ghostTable) {
+	bool fixed = withFixedLensSystem(lensSystem.getIrisAperturePos(), lensSystem.getLensInterfaces(), [&](const auto& fixedLensSystem) {
+		fixedLensSystem.fillGhostTable(ghostTable);
+		});
+	if (!fixed) {
+		ghostTable.rebuild(lensSystem);
+	}
+}
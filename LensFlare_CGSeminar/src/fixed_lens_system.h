@@ -0,0 +1,370 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <array>
+#include <span>
+#include <type_traits>
+#include <vector>
+#include "lens_system.h"
+#include "lens_table.h"
+#include "ghost_table.h"
+#include "transmission_tree.h"
+#include "ray_transfer_matrices.h"
+
+struct ReflectionPairIndex {
+	int first;
+	int second;
+};
+
+// Every (first, second) interface pair with first > second, in the order getPreAptReflections and getPostAptReflections list them
+template<int N>
+constexpr std::array<ReflectionPairIndex, N * (N - 1) / 2> makeReflectionPairIndices() {
+	std::array<ReflectionPairIndex, N * (N - 1) / 2> pairs{};
+	int k = 0;
+	for (int first = 1; first < N; first++) {
+		for (int second = first - 1; second >= 0; second--) {
+			pairs[k++] = { first, second };
+		}
+	}
+	return pairs;
+}
+
+// Interface matrices and matrix chains of a lens with N interfaces over the scalar type T, the ghost geometry of
+// FixedLensSystem. T is float there and a Dual for the derivatives of the ghost layouts (see
+// LensSystemProblem::computeSnapshotJacobian).
+template<int N, typename T>
+struct FixedGhostChains {
+	using Matrix = glm::mat<2, 2, T>;
+
+	// Fills the interface matrices from the repaired thickness, index and radius of each interface and builds the chains
+	void build(int aperturePos, const T* d, const T* n, const T* R);
+	// Builds the chains from the interface matrices and glass flags already set, apertureForward enters the aperture from air
+	void buildChains(int aperturePos, const Matrix& apertureForward);
+	bool bordersGlass(int i) const { return glass[i] || (i > 0 && glass[i - 1]); }
+	// Calls f(pair, Ma, Ms) for every ghost, in GhostTable order, until f returns false
+	template<typename F>
+	bool forEachGhost(F&& f) const;
+	// Calls f(layout) for every ghost in the same order until f returns false
+	template<typename F>
+	bool forEachGhostLayout(F&& f) const;
+	int getGhostCount() const;
+
+	int irisAperturePos = 0;
+	int aptPos = 0; //aperture position clamped to the interface count
+	std::array<bool, N> glass; //raw ni > 1.1, decides which pairs are ghosts
+	std::array<Matrix, N> forward;
+	std::array<Matrix, N> backward;
+	std::array<Matrix, N> reflection;
+	std::array<Matrix, N> reflectionBack;
+
+	// Same chains as the LensSystem cache, see LensSystem::updateChainCache
+	std::array<Matrix, N + 1> chainPrefix;
+	std::array<Matrix, N + 1> chainPreAptSuffix;
+	std::array<Matrix, N + 1> chainPostAptPrefix;
+	std::array<Matrix, N + 1> chainSuffix;
+	std::array<Matrix, N * N> chainBackward;
+	Matrix defaultMa = Matrix(T(1));
+	Matrix defaultMs = Matrix(T(1));
+};
+
+template<int N, typename T>
+void FixedGhostChains<N, T>::build(int aperturePos, const T* d, const T* n, const T* R) {
+	BasicRayTransferMatrixBuilder<T> rayTransferMatrixBuilder;
+	const int A = std::clamp(aperturePos, 0, N);
+	Matrix apertureForward = Matrix(T(1));
+	T nPrev = T(1);
+	for (int i = 0; i < N; i++) {
+		LensInterfaceMatrices<T> entry = getLensInterfaceMatrices(d[i], n[i], R[i], nPrev, i == 0, i == aperturePos);
+		glass[i] = n[i] > 1.1;
+		forward[i] = entry.forward;
+		backward[i] = entry.backward;
+		reflection[i] = entry.reflection;
+		reflectionBack[i] = entry.reflectionBack;
+		if (i == A) {
+			apertureForward = rayTransferMatrixBuilder.getTranslationRefractionMatrix(entry.d, T(1), entry.n, entry.R);
+		}
+		nPrev = entry.n;
+	}
+	buildChains(aperturePos, apertureForward);
+}
+
+template<int N, typename T>
+void FixedGhostChains<N, T>::buildChains(int aperturePos, const Matrix& apertureForward) {
+	irisAperturePos = aperturePos;
+	const int A = std::clamp(aperturePos, 0, N);
+	aptPos = A;
+
+	chainPrefix.fill(Matrix(T(1)));
+	chainPreAptSuffix.fill(Matrix(T(1)));
+	chainPostAptPrefix.fill(Matrix(T(1)));
+	chainSuffix.fill(Matrix(T(1)));
+	chainBackward.fill(Matrix(T(1)));
+	for (int k = 1; k <= A; k++) {
+		chainPrefix[k] = forward[k - 1] * chainPrefix[k - 1];
+	}
+	for (int k = A - 1; k >= 0; k--) {
+		chainPreAptSuffix[k] = chainPreAptSuffix[k + 1] * forward[k];
+	}
+	for (int k = A + 1; k <= N; k++) {
+		chainPostAptPrefix[k - A] = ((k - 1 == A) ? apertureForward : forward[k - 1]) * chainPostAptPrefix[k - 1 - A];
+	}
+	for (int k = N - 1; k >= A; k--) {
+		chainSuffix[k - A] = chainSuffix[k + 1 - A] * ((k == A) ? apertureForward : forward[k]);
+	}
+	for (int s = 0; s < N; s++) {
+		for (int f = s + 2; f < N; f++) {
+			chainBackward[s * N + f] = chainBackward[s * N + f - 1] * backward[f - 1];
+		}
+	}
+
+	defaultMa = chainPrefix[A];
+	defaultMs = Matrix(T(1));
+	if (A < N) {
+		defaultMs = chainSuffix[1] * forward[A];
+	}
+}
+
+template<int N, typename T>
+template<typename F>
+bool FixedGhostChains<N, T>::forEachGhost(F&& f) const {
+	constexpr std::array<ReflectionPairIndex, N * (N - 1) / 2> reflectionPairs = makeReflectionPairIndices<N>();
+	for (const ReflectionPairIndex& pair : reflectionPairs) {
+		if (pair.first < irisAperturePos && bordersGlass(pair.first) && bordersGlass(pair.second)) {
+			Matrix core = reflectionBack[pair.second] * chainBackward[pair.second * N + pair.first] * reflection[pair.first];
+			if (!f(pair, chainPreAptSuffix[pair.second + 1] * core * chainPrefix[pair.first], defaultMs)) {
+				return false;
+			}
+		}
+	}
+	for (const ReflectionPairIndex& pair : reflectionPairs) {
+		if (pair.second > irisAperturePos && bordersGlass(pair.first) && bordersGlass(pair.second)) {
+			Matrix core = reflectionBack[pair.second] * chainBackward[pair.second * N + pair.first] * reflection[pair.first];
+			if (!f(pair, defaultMa, chainSuffix[pair.second + 1 - aptPos] * core * chainPostAptPrefix[pair.first - aptPos])) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+template<int N, typename T>
+template<typename F>
+bool FixedGhostChains<N, T>::forEachGhostLayout(F&& f) const {
+	return forEachGhost([&](const ReflectionPairIndex&, const Matrix& Ma, const Matrix& Ms) {
+		return f(makeGhostLayout(Ma, Ms));
+		});
+}
+
+template<int N, typename T>
+int FixedGhostChains<N, T>::getGhostCount() const {
+	constexpr std::array<ReflectionPairIndex, N * (N - 1) / 2> reflectionPairs = makeReflectionPairIndices<N>();
+	int ghostCount = 0;
+	for (const ReflectionPairIndex& pair : reflectionPairs) {
+		if ((pair.first < irisAperturePos || pair.second > irisAperturePos) && bordersGlass(pair.first) && bordersGlass(pair.second)) {
+			ghostCount++;
+		}
+	}
+	return ghostCount;
+}
+
+// Lens system with an interface count fixed at compile time, for evaluating many candidate lenses of the same size.
+// Tables and matrix chains live in std::arrays, so building one allocates nothing and every loop over the interfaces or
+// the candidate reflection pairs has a constant trip count. Results match LensSystem/GhostTable for the same interfaces.
+// Use withFixedLensSystem to get the specialization for a runtime interface count.
+template<int N>
+class FixedLensSystem {
+public:
+	static constexpr int InterfaceCount = N;
+	static constexpr int MaxGhosts = N * (N - 1) / 2;
+	static constexpr std::array<ReflectionPairIndex, MaxGhosts> ReflectionPairs = makeReflectionPairIndices<N>();
+
+	FixedLensSystem(int irisAperturePos, const LensInterface* lensInterfaces);
+	int getIrisAperturePos() const { return m_chains.irisAperturePos; }
+	// Layouts of all ghosts, pre-aperture ghosts first like GhostTable, returns the ghost count
+	int getGhostLayouts(std::array<GhostLayout, MaxGhosts>& layouts) const;
+	// Calls f(layout) for every ghost in the same order until f returns false, returns false when f stopped the walk
+	template<typename F>
+	bool forEachGhostLayout(F&& f) const;
+	// Ghost count without computing the ghosts
+	int getGhostCount() const;
+	// Overwrites the ghosts of ghostTable (keeping its capacity), transmissions and traces are left empty
+	void fillGhostTable(GhostTable& ghostTable) const;
+	glm::vec3 propagateTransmission(int firstReflectionPos, int secondReflectionPos, glm::vec2 ray, bool quarterWaveCoating) const;
+	// Same as GhostTable::computeTransmissions, ghostTable must have been filled by this lens system
+	void computeTransmissions(const GhostTable& ghostTable, glm::vec2 yawAndPitch, bool quarterWaveCoating, std::vector<glm::vec3>& out) const;
+	TransmissionPathData getTransmissionPathData(bool quarterWaveCoating) const;
+
+private:
+	FixedGhostChains<N, float> m_chains;
+	std::array<float, N> m_n;
+	std::array<float, N> m_n_prev;
+	std::array<float, N> m_quarter_wave_coating_n;
+	std::array<float, N> m_quarter_wave_coating_d;
+	std::array<float, N> m_custom_coating_n;
+	std::array<float, N> m_custom_coating_d;
+};
+
+template<int N>
+FixedLensSystem<N>::FixedLensSystem(int irisAperturePos, const LensInterface* lensInterfaces) {
+	RayTransferMatrixBuilder rayTransferMatrixBuilder;
+	const int A = std::clamp(irisAperturePos, 0, N);
+
+	glm::mat2x2 apertureForward = glm::mat2(1.0f);
+	for (int i = 0; i < N; i++) {
+		LensTableEntry entry = getLensTableEntry(lensInterfaces[i], (i == 0) ? 1.0f : m_n[i - 1], i == 0, i == irisAperturePos);
+		m_chains.glass[i] = lensInterfaces[i].ni > 1.1;
+		m_n[i] = entry.n;
+		m_n_prev[i] = entry.nPrev;
+		m_quarter_wave_coating_n[i] = entry.quarterWaveCoatingN;
+		m_quarter_wave_coating_d[i] = entry.quarterWaveCoatingD;
+		m_custom_coating_n[i] = entry.customCoatingN;
+		m_custom_coating_d[i] = entry.customCoatingD;
+		m_chains.forward[i] = entry.forward;
+		m_chains.backward[i] = entry.backward;
+		m_chains.reflection[i] = entry.reflection;
+		m_chains.reflectionBack[i] = entry.reflectionBack;
+		// Propagation starting at the aperture enters it from air
+		if (i == A) {
+			apertureForward = rayTransferMatrixBuilder.getTranslationRefractionMatrix(entry.d, 1.0f, entry.n, entry.R);
+		}
+	}
+	m_chains.buildChains(irisAperturePos, apertureForward);
+}
+
+template<int N>
+int FixedLensSystem<N>::getGhostLayouts(std::array<GhostLayout, MaxGhosts>& layouts) const {
+	int ghostCount = 0;
+	m_chains.forEachGhost([&](const ReflectionPairIndex&, const glm::mat2x2& Ma, const glm::mat2x2& Ms) {
+		layouts[ghostCount++] = LensSystem::getGhostLayout(Ma, Ms);
+		return true;
+		});
+	return ghostCount;
+}
+
+template<int N>
+template<typename F>
+bool FixedLensSystem<N>::forEachGhostLayout(F&& f) const {
+	return m_chains.forEachGhostLayout(f);
+}
+
+template<int N>
+int FixedLensSystem<N>::getGhostCount() const {
+	return m_chains.getGhostCount();
+}
+
+template<int N>
+void FixedLensSystem<N>::fillGhostTable(GhostTable& ghostTable) const {
+	ghostTable.preAptCount = 0;
+	ghostTable.reflectionPairs.clear();
+	ghostTable.Ma.clear();
+	ghostTable.Ms.clear();
+	ghostTable.M.clear();
+	ghostTable.layout.clear();
+	ghostTable.transmission.clear();
+	ghostTable.traceOffset.clear();
+	ghostTable.trace.clear();
+	ghostTable.traceValid = false;
+	m_chains.forEachGhost([&](const ReflectionPairIndex& pair, const glm::mat2x2& Ma, const glm::mat2x2& Ms) {
+		if (pair.first < m_chains.irisAperturePos) {
+			ghostTable.preAptCount++;
+		}
+		ghostTable.reflectionPairs.push_back(glm::vec2(pair.first, pair.second));
+		ghostTable.Ma.push_back(Ma);
+		ghostTable.Ms.push_back(Ms);
+		ghostTable.M.push_back(Ms * Ma);
+		ghostTable.layout.push_back(LensSystem::getGhostLayout(Ma, Ms));
+		return true;
+		});
+}
+
+//Same walk as LensSystem::propagateTransmission
+template<int N>
+glm::vec3 FixedLensSystem<N>::propagateTransmission(int firstReflectionPos, int secondReflectionPos, glm::vec2 ray, bool quarterWaveCoating) const {
+	const std::array<float, N>& coatingN = quarterWaveCoating ? m_quarter_wave_coating_n : m_custom_coating_n;
+	const std::array<float, N>& coatingD = quarterWaveCoating ? m_quarter_wave_coating_d : m_custom_coating_d;
+	glm::vec3 transmissions(1.f);
+	glm::vec2 propagated_ray = ray;
+
+	for (int i = 0; i < firstReflectionPos; i++) {
+		transmissions *= glm::vec3(1.f) - LensSystem::computeFresnelAR(propagated_ray.y, coatingD[i], m_n_prev[i], coatingN[i], m_n[i]);
+		propagated_ray = m_chains.forward[i] * propagated_ray;
+	}
+	transmissions *= LensSystem::computeFresnelAR(propagated_ray.y, coatingD[firstReflectionPos], m_n_prev[firstReflectionPos], coatingN[firstReflectionPos], m_n[firstReflectionPos]);
+	propagated_ray = m_chains.reflection[firstReflectionPos] * propagated_ray;
+	for (int i = firstReflectionPos - 1; i > secondReflectionPos; i--) {
+		transmissions *= glm::vec3(1.f) - LensSystem::computeFresnelAR(propagated_ray.y, coatingD[i], m_n[i], coatingN[i], m_n_prev[i]);
+		propagated_ray = m_chains.backward[i] * propagated_ray;
+	}
+	transmissions *= LensSystem::computeFresnelAR(propagated_ray.y, coatingD[secondReflectionPos], m_n[secondReflectionPos], coatingN[secondReflectionPos], m_n_prev[secondReflectionPos]);
+	propagated_ray = m_chains.reflectionBack[secondReflectionPos] * propagated_ray;
+	for (int i = secondReflectionPos + 1; i < N; i++) {
+		transmissions *= glm::vec3(1.f) - LensSystem::computeFresnelAR(propagated_ray.y, coatingD[i], m_n_prev[i], coatingN[i], m_n[i]);
+		propagated_ray = m_chains.forward[i] * propagated_ray;
+	}
+	return transmissions;
+}
+
+template<int N>
+void FixedLensSystem<N>::computeTransmissions(const GhostTable& ghostTable, glm::vec2 yawAndPitch, bool quarterWaveCoating, std::vector<glm::vec3>& out) const {
+	static thread_local TransmissionTree xTree;
+	static thread_local TransmissionTree yTree;
+	xTree.reset(getTransmissionPathData(quarterWaveCoating));
+	yTree.reset(getTransmissionPathData(quarterWaveCoating));
+	out.resize(ghostTable.size());
+	for (size_t i = 0; i < ghostTable.size(); i++) {
+		int first = ghostTable.reflectionPairs[i].x;
+		int second = ghostTable.reflectionPairs[i].y;
+		out[i] = xTree.propagate(first, second, ghostTable.getCenterRay(i, yawAndPitch.x))
+			+ yTree.propagate(first, second, ghostTable.getCenterRay(i, yawAndPitch.y));
+	}
+}
+
+template<int N>
+TransmissionPathData FixedLensSystem<N>::getTransmissionPathData(bool quarterWaveCoating) const {
+	TransmissionPathData path;
+	path.size = N;
+	path.coatingN = quarterWaveCoating ? m_quarter_wave_coating_n.data() : m_custom_coating_n.data();
+	path.coatingD = quarterWaveCoating ? m_quarter_wave_coating_d.data() : m_custom_coating_d.data();
+	path.n = m_n.data();
+	path.nPrev = m_n_prev.data();
+	path.forward = m_chains.forward.data();
+	path.backward = m_chains.backward.data();
+	path.reflection = m_chains.reflection.data();
+	path.reflectionBack = m_chains.reflectionBack.data();
+	return path;
+}
+
+// Calls f(std::integral_constant<int, N>()) for the interface counts FixedLensSystem is specialized for: the presets (5, 7,
+// 9 and 28 interfaces) and the counts interfacesNeeded picks for up to 30 ghosts. Returns false without calling f otherwise.
+template<typename F>
+bool withFixedInterfaceCount(size_t interfaceCount, F&& f) {
+	switch (interfaceCount) {
+	case 4: f(std::integral_constant<int, 4>()); return true;
+	case 5: f(std::integral_constant<int, 5>()); return true;
+	case 6: f(std::integral_constant<int, 6>()); return true;
+	case 7: f(std::integral_constant<int, 7>()); return true;
+	case 8: f(std::integral_constant<int, 8>()); return true;
+	case 9: f(std::integral_constant<int, 9>()); return true;
+	case 10: f(std::integral_constant<int, 10>()); return true;
+	case 11: f(std::integral_constant<int, 11>()); return true;
+	case 12: f(std::integral_constant<int, 12>()); return true;
+	case 13: f(std::integral_constant<int, 13>()); return true;
+	case 28: f(std::integral_constant<int, 28>()); return true;
+	default: return false;
+	}
+}
+
+// Calls f(fixedLensSystem) with the FixedLensSystem specialization for the interface count.
+// Returns false without calling f when there is none, the caller then falls back to LensSystem.
+template<typename F>
+bool withFixedLensSystem(int irisAperturePos, std::span<const LensInterface> lensInterfaces, F&& f) {
+	return withFixedInterfaceCount(lensInterfaces.size(), [&](auto interfaceCount) {
+		f(FixedLensSystem<decltype(interfaceCount)::value>(irisAperturePos, lensInterfaces.data()));
+		});
+}
+
+// GhostTable of the lens, built through FixedLensSystem when there is a specialization for its interface count
+GhostTable buildGhostTable(const LensSystem& lensSystem);
+// Same, rebuilding ghostTable in place so its arrays keep their capacity
+void buildGhostTable(const LensSystem& lensSystem, GhostTable& ghostTable);
@@ -0,0 +1,210 @@
+#include "fresnel_ar.h"
+
+#include "lens_system.h"
+#include "simd_lanes.h"
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+#include <type_traits>
+
+namespace {
+
+constexpr float PI = std::numbers::pi_v<float>;
+
+//cos for any argument: reduce to [-pi, pi], fold onto [0, pi/2] with cos(x) = -cos(pi - x) and evaluate the Taylor series
+//up to x^12, which is accurate to about 1e-7 there
+template<class Lanes>
+Lanes cosLanes(Lanes x) {
+	Lanes y = abs(x - Lanes::set(2 * PI) * round(x * Lanes::set(1 / (2 * PI))));
+	Lanes folded = greater(y, Lanes::set(PI / 2));
+	y = select(folded, Lanes::set(PI) - y, y);
+	Lanes y2 = y * y;
+	Lanes p = Lanes::set(1.f / 479001600.f);
+	p = p * y2 - Lanes::set(1.f / 3628800.f);
+	p = p * y2 + Lanes::set(1.f / 40320.f);
+	p = p * y2 - Lanes::set(1.f / 720.f);
+	p = p * y2 + Lanes::set(1.f / 24.f);
+	p = p * y2 - Lanes::set(1.f / 2.f);
+	p = p * y2 + Lanes::set(1.f);
+	return select(folded, Lanes::set(0.f) - p, p);
+}
+
+//sin with the same reduction, folded with sin(x) = sin(pi - x) and the sign restored afterwards. Kept separate from cosLanes
+//so small angles keep their relative accuracy.
+template<class Lanes>
+Lanes sinLanes(Lanes x) {
+	Lanes y = x - Lanes::set(2 * PI) * round(x * Lanes::set(1 / (2 * PI)));
+	Lanes negative = greater(Lanes::set(0.f), y);
+	y = abs(y);
+	y = select(greater(y, Lanes::set(PI / 2)), Lanes::set(PI) - y, y);
+	Lanes y2 = y * y;
+	Lanes p = Lanes::set(1.f / 6227020800.f);
+	p = p * y2 - Lanes::set(1.f / 39916800.f);
+	p = p * y2 + Lanes::set(1.f / 362880.f);
+	p = p * y2 - Lanes::set(1.f / 5040.f);
+	p = p * y2 + Lanes::set(1.f / 120.f);
+	p = p * y2 - Lanes::set(1.f / 6.f);
+	p = p * y2 + Lanes::set(1.f);
+	p = p * y;
+	return select(negative, Lanes::set(0.f) - p, p);
+}
+
+template<class Lanes>
+Lanes reflectivityLanes(Lanes rs01, Lanes rp01, Lanes ris, Lanes rip, Lanes relPhase) {
+	Lanes c = cosLanes(relPhase);
+	Lanes two = Lanes::set(2.f);
+	Lanes out_s2 = rs01 * rs01 + ris * ris + two * rs01 * ris * c;
+	Lanes out_p2 = rp01 * rp01 + rip * rip + two * rp01 * rip * c;
+	return min((out_s2 + out_p2) * Lanes::set(0.5f), Lanes::set(1.f));
+}
+
+template<class Lanes>
+void multiplyFresnelARLanes(const FresnelAmplitudes& amplitudes, const float* wavelengths, bool reflected, float* spectrum) {
+	Lanes relPhase = Lanes::set(4 * PI * amplitudes.pathDifference) / Lanes::load(wavelengths);
+	Lanes reflectivity = reflectivityLanes(Lanes::set(amplitudes.rs01), Lanes::set(amplitudes.rp01), Lanes::set(amplitudes.ris), Lanes::set(amplitudes.rip), relPhase);
+	Lanes factor = reflected ? reflectivity : Lanes::set(1.f) - reflectivity;
+	(Lanes::load(spectrum) * factor).store(spectrum);
+}
+
+//Same amplitudes as computeFresnelAmplitudes, written with sines and cosines of the refraction angles so no asin or tan is needed
+template<class Lanes>
+void computeFresnelARLanes(const float* theta0, const float* d1, float n0, float n1, float n2, const float* wavelengths, float* const* reflectivity) {
+	Lanes zero = Lanes::set(0.f);
+	Lanes one = Lanes::set(1.f);
+	Lanes minusOne = Lanes::set(-1.f);
+	Lanes t0 = Lanes::load(theta0);
+	Lanes sin0 = sinLanes(t0);
+	Lanes cos0 = cosLanes(t0);
+	Lanes sin1 = min(max(sin0 * Lanes::set(n0 / n1), minusOne), one);
+	Lanes cos1 = sqrt(max(one - sin1 * sin1, zero));
+	Lanes sin2 = min(max(sin0 * Lanes::set(n0 / n2), minusOne), one);
+	Lanes cos2 = sqrt(max(one - sin2 * sin2, zero));
+
+	Lanes sin01Minus = sin0 * cos1 - cos0 * sin1;
+	Lanes sin01Plus = sin0 * cos1 + cos0 * sin1;
+	Lanes cos01Minus = cos0 * cos1 + sin0 * sin1;
+	Lanes cos01Plus = cos0 * cos1 - sin0 * sin1;
+	Lanes sin12Minus = sin1 * cos2 - cos1 * sin2;
+	Lanes sin12Plus = sin1 * cos2 + cos1 * sin2;
+	Lanes cos12Minus = cos1 * cos2 + sin1 * sin2;
+	Lanes cos12Plus = cos1 * cos2 - sin1 * sin2;
+
+	Lanes rs01 = zero - sin01Minus / sin01Plus;
+	Lanes rp01 = (sin01Minus * cos01Plus) / (cos01Minus * sin01Plus);
+	Lanes ts01 = Lanes::set(2.f) * sin1 * cos0 / sin01Plus;
+	Lanes tp01 = ts01 * cos01Minus;
+	Lanes rs12 = zero - sin12Minus / sin12Plus;
+	Lanes rp12 = (sin12Minus * cos12Plus) / (cos12Minus * sin12Plus);
+	Lanes ris = ts01 * ts01 * rs12;
+	Lanes rip = tp01 * tp01 * rp12;
+
+	Lanes dy = Lanes::load(d1) * Lanes::set(n1);
+	Lanes dx = sin1 / cos1 * dy;
+	Lanes pathDifference = sqrt(dx * dx + dy * dy) - dx * sin0;
+	for (int k = 0; k < 3; k++) {
+		Lanes relPhase = Lanes::set(4 * PI / wavelengths[k]) * pathDifference;
+		reflectivityLanes(rs01, rp01, ris, rip, relPhase).store(reflectivity[k]);
+	}
+}
+
+}
+
+//compute per lens interface, adapted code from "Supplemental Material - Physically-Based Real-Time Lens Flare Rendering"
+FresnelAmplitudes computeFresnelAmplitudes(float theta0, float d1, float n0, float n1, float n2) {
+	// refraction angles in coating and the 2nd medium
+	float theta1 = std::asin(std::clamp(std::sin(theta0) * n0 / n1, -1.f, 1.f));
+	float theta2 = std::asin(std::clamp(std::sin(theta0) * n0 / n2, -1.f, 1.f));
+	FresnelAmplitudes amplitudes;
+	// amplitude for outer refl. / transmission on topmost interface
+	amplitudes.rs01 = -std::sin(theta0 - theta1) / std::sin(theta0 + theta1);
+	amplitudes.rp01 = std::tan(theta0 - theta1) / std::tan(theta0 + theta1);
+	float ts01 = 2 * std::sin(theta1) * std::cos(theta0) / std::sin(theta0 + theta1);
+	float tp01 = ts01 * std::cos(theta0 - theta1);
+	// amplitude for inner reflection
+	float rs12 = -std::sin(theta1 - theta2) / std::sin(theta1 + theta2);
+	float rp12 = std::tan(theta1 - theta2) / std::tan(theta1 + theta2);
+	// after passing through first surface twice: 2 transmissions and 1 reflection
+	amplitudes.ris = ts01 * ts01 * rs12;
+	amplitudes.rip = tp01 * tp01 * rp12;
+	// phase difference between outer and inner reflections
+	float dy = d1 * n1;
+	float dx = std::tan(theta1) * dy;
+	float delay = std::sqrt(dx * dx + dy * dy);
+	amplitudes.pathDifference = delay - dx * std::sin(theta0);
+	return amplitudes;
+}
+
+template<int W>
+std::array<float, W> computeFresnelARWavelengths(const FresnelAmplitudes& amplitudes, const std::array<float, W>& wavelengths) {
+	//the widest lanes that divide W, AVX leaves W = 4 to SSE
+	using Lanes = std::conditional_t<W % WideLanes::width == 0, WideLanes, NarrowLanes>;
+	static_assert(W % Lanes::width == 0, "wavelength count must be a multiple of the lane width");
+	Lanes rs01 = Lanes::set(amplitudes.rs01);
+	Lanes rp01 = Lanes::set(amplitudes.rp01);
+	Lanes ris = Lanes::set(amplitudes.ris);
+	Lanes rip = Lanes::set(amplitudes.rip);
+	Lanes phaseScale = Lanes::set(4 * PI * amplitudes.pathDifference);
+
+	std::array<float, W> reflectivity;
+	for (int i = 0; i < W; i += Lanes::width) {
+		Lanes relPhase = phaseScale / Lanes::load(&wavelengths[i]);
+		reflectivityLanes(rs01, rp01, ris, rip, relPhase).store(&reflectivity[i]);
+	}
+	return reflectivity;
+}
+
+template std::array<float, 4> computeFresnelARWavelengths<4>(const FresnelAmplitudes&, const std::array<float, 4>&);
+template std::array<float, 8> computeFresnelARWavelengths<8>(const FresnelAmplitudes&, const std::array<float, 8>&);
+template std::array<float, 16> computeFresnelARWavelengths<16>(const FresnelAmplitudes&, const std::array<float, 16>&);
+
+glm::vec3 computeFresnelARRGB(const FresnelAmplitudes& amplitudes) {
+	//the fourth lane repeats green
+	std::array<float, 4> reflectivity = computeFresnelARWavelengths<4>(amplitudes, { RED_WAVELENGTH, GREEN_WAVELENGTH, BLUE_WAVELENGTH, GREEN_WAVELENGTH });
+	return glm::vec3(reflectivity[0], reflectivity[1], reflectivity[2]);
+}
+
+void multiplyFresnelAR(const FresnelAmplitudes& amplitudes, std::span<const float> wavelengths, bool reflected, std::span<float> spectrum) {
+	int count = static_cast<int>(std::min(wavelengths.size(), spectrum.size()));
+	int i = 0;
+	for (; i + WideLanes::width <= count; i += WideLanes::width) {
+		multiplyFresnelARLanes<WideLanes>(amplitudes, &wavelengths[i], reflected, &spectrum[i]);
+	}
+	for (; i < count; i++) {
+		multiplyFresnelARLanes<ScalarLanes>(amplitudes, &wavelengths[i], reflected, &spectrum[i]);
+	}
+}
+
+void computeFresnelARBatch(std::span<const float> theta0, std::span<const float> d1, float n0, float n1, float n2, std::span<glm::vec3> reflectivity) {
+	using Lanes = WideLanes;
+	const float wavelengths[3] = { RED_WAVELENGTH, GREEN_WAVELENGTH, BLUE_WAVELENGTH };
+	float red[Lanes::width];
+	float green[Lanes::width];
+	float blue[Lanes::width];
+	float* const channels[3] = { red, green, blue };
+
+	int count = static_cast<int>(std::min({ theta0.size(), d1.size(), reflectivity.size() }));
+	for (int i = 0; i < count; i += Lanes::width) {
+		int lanes = std::min(Lanes::width, count - i);
+		const float* theta0Lanes = &theta0[i];
+		const float* d1Lanes = &d1[i];
+		//pad the last partial chunk by repeating its first pair
+		float theta0Tail[Lanes::width];
+		float d1Tail[Lanes::width];
+		if (lanes < Lanes::width) {
+			for (int lane = 0; lane < Lanes::width; lane++) {
+				theta0Tail[lane] = theta0[i + (lane < lanes ? lane : 0)];
+				d1Tail[lane] = d1[i + (lane < lanes ? lane : 0)];
+			}
+			theta0Lanes = theta0Tail;
+			d1Lanes = d1Tail;
+		}
+		computeFresnelARLanes<Lanes>(theta0Lanes, d1Lanes, n0, n1, n2, wavelengths, channels);
+		for (int lane = 0; lane < lanes; lane++) {
+			reflectivity[i + lane] = glm::vec3(red[lane], green[lane], blue[lane]);
+		}
+	}
+}
+
+const char* getFresnelARInstructionSet() {
+	return getSimdInstructionSet();
+}
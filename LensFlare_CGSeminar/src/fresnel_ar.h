@@ -0,0 +1,33 @@
+#pragma once
+
+#include <array>
+#include <span>
+#include <glm/glm.hpp>
+
+//Angle dependent part of the AR coating reflectivity, shared by every wavelength
+struct FresnelAmplitudes {
+	float rs01; //outer reflection, s and p polarized
+	float rp01;
+	float ris; //inner reflection after passing the top surface twice
+	float rip;
+	float pathDifference; //between the outer and inner reflection, the relative phase is 4 * pi / lambda * pathDifference
+};
+
+FresnelAmplitudes computeFresnelAmplitudes(float theta0, float d1, float n0, float n1, float n2);
+
+//Reflectivity at W wavelengths (nm) for one set of amplitudes, vectorized over the wavelengths. W is 4, 8 or 16.
+template<int W>
+std::array<float, W> computeFresnelARWavelengths(const FresnelAmplitudes& amplitudes, const std::array<float, W>& wavelengths);
+
+//Reflectivity at RED_WAVELENGTH, GREEN_WAVELENGTH and BLUE_WAVELENGTH, what LensSystem::computeFresnelAR returns
+glm::vec3 computeFresnelARRGB(const FresnelAmplitudes& amplitudes);
+
+//Multiplies each spectrum sample by the reflectivity (reflected) or transmittance (1 - reflectivity) at its wavelength (nm),
+//any sample count
+void multiplyFresnelAR(const FresnelAmplitudes& amplitudes, std::span<const float> wavelengths, bool reflected, std::span<float> spectrum);
+
+//RGB reflectivity of one coating (n0 | n1 | n2) for many (theta0, d1) pairs, vectorized over the pairs
+void computeFresnelARBatch(std::span<const float> theta0, std::span<const float> d1, float n0, float n1, float n2, std::span<glm::vec3> reflectivity);
+
+//Name of the instruction set the kernels were compiled for, for the benchmark log
+const char* getFresnelARInstructionSet();
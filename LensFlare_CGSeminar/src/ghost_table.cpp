@@ -0,0 +1,141 @@
+#include "ghost_table.h"
+#include "spectral.h"
+#include "transmission_tree.h"
+#include <cmath>
+#include <algorithm>
+
+GhostTable::GhostTable(const LensSystem& lensSystem) {
+	rebuild(lensSystem);
+}
+
+void GhostTable::rebuild(const LensSystem& lensSystem) {
+	reflectionPairs.clear();
+	lensSystem.getPreAptReflections(reflectionPairs);
+	preAptCount = reflectionPairs.size();
+	lensSystem.getPostAptReflections(reflectionPairs);
+
+	size_t count = reflectionPairs.size();
+	Ma.resize(count);
+	Ms.resize(count);
+	M.resize(count);
+	layout.resize(count);
+	transmission.clear();
+	traceOffset.clear();
+	trace.clear();
+	traceValid = false;
+
+	glm::mat2x2 default_Ma = lensSystem.getMa();
+	glm::mat2x2 default_Ms = lensSystem.getMs();
+	for (size_t i = 0; i < count; i++) {
+		Ma[i] = isPreApt(i) ? lensSystem.getMa(reflectionPairs[i].x, reflectionPairs[i].y) : default_Ma;
+		Ms[i] = isPreApt(i) ? default_Ms : lensSystem.getMs(reflectionPairs[i].x, reflectionPairs[i].y);
+		updateLayout(i);
+	}
+}
+
+void GhostTable::updateLayout(size_t ghost) {
+	M[ghost] = Ms[ghost] * Ma[ghost];
+	layout[ghost] = LensSystem::getGhostLayout(Ma[ghost], Ms[ghost]);
+}
+
+//ray through the center of the aperture
+glm::vec2 GhostTable::getCenterRay(size_t ghost, float lightAngle) const {
+	return glm::vec2(-lightAngle * Ma[ghost][1][0] / Ma[ghost][0][0], lightAngle);
+}
+
+void GhostTable::computeTransmissions(const LensSystem& lensSystem, glm::vec2 yawAndPitch, bool quarterWaveCoating, std::vector<glm::vec3>& out) const {
+	//one tree per light angle, the post-aperture ghosts all enter with the same center ray
+	static thread_local TransmissionTree xTree;
+	static thread_local TransmissionTree yTree;
+	TransmissionPathData path = getTransmissionPathData(lensSystem.getLensTable(), quarterWaveCoating);
+	xTree.reset(path);
+	yTree.reset(path);
+	out.resize(size());
+	for (size_t i = 0; i < size(); i++) {
+		out[i] = xTree.propagate(reflectionPairs[i].x, reflectionPairs[i].y, getCenterRay(i, yawAndPitch.x))
+			+ yTree.propagate(reflectionPairs[i].x, reflectionPairs[i].y, getCenterRay(i, yawAndPitch.y));
+	}
+}
+
+void GhostTable::computeTransmissions(const LensSystem& lensSystem, glm::vec2 yawAndPitch, bool quarterWaveCoating, const SpectralSampling& sampling, std::vector<glm::vec3>& out) const {
+	static thread_local std::vector<float> spectrum;
+	spectrum.resize(sampling.bins());
+	out.resize(size());
+	for (size_t i = 0; i < size(); i++) {
+		lensSystem.propagateTransmission(reflectionPairs[i].x, reflectionPairs[i].y, getCenterRay(i, yawAndPitch.x), quarterWaveCoating, sampling, spectrum);
+		out[i] = sampling.toRGB(spectrum);
+		lensSystem.propagateTransmission(reflectionPairs[i].x, reflectionPairs[i].y, getCenterRay(i, yawAndPitch.y), quarterWaveCoating, sampling, spectrum);
+		out[i] += sampling.toRGB(spectrum);
+	}
+}
+
+void GhostTable::refreshTransmissions(const LensSystem& lensSystem, glm::vec2 yawAndPitch, bool quarterWaveCoating) {
+	traceOffset.resize(size() + 1);
+	traceOffset[0] = 0;
+	for (size_t i = 0; i < size(); i++) {
+		traceOffset[i + 1] = traceOffset[i] + 2 * lensSystem.getCrossingCount(reflectionPairs[i].x, reflectionPairs[i].y);
+	}
+	trace.resize(traceOffset[size()]);
+	transmission.resize(size());
+	static thread_local TransmissionTree xTree;
+	static thread_local TransmissionTree yTree;
+	TransmissionPathData path = getTransmissionPathData(lensSystem.getLensTable(), quarterWaveCoating);
+	xTree.reset(path);
+	yTree.reset(path);
+	for (size_t i = 0; i < size(); i++) {
+		int crossingCount = (traceOffset[i + 1] - traceOffset[i]) / 2;
+		TransmissionCrossing* xTrace = trace.data() + traceOffset[i];
+		transmission[i] = xTree.propagate(reflectionPairs[i].x, reflectionPairs[i].y, getCenterRay(i, yawAndPitch.x), xTrace)
+			+ yTree.propagate(reflectionPairs[i].x, reflectionPairs[i].y, getCenterRay(i, yawAndPitch.y), xTrace + crossingCount);
+	}
+	traceYawAndPitch = yawAndPitch;
+	traceQuarterWaveCoating = quarterWaveCoating;
+	traceValid = true;
+}
+
+void GhostTable::update(const LensSystem& lensSystem, const LensDirtyRange& dirtyRange) {
+	if (dirtyRange.begin >= dirtyRange.end) {
+		return;
+	}
+
+	if (dirtyRange.geometryChanged) {
+		//every ghost path crosses all interfaces, but only one half of its matrices contains the changed ones
+		int aptPos = std::clamp(lensSystem.getIrisAperturePos(), 0, (int)lensSystem.getLensInterfaces().size());
+		bool maChanged = dirtyRange.begin < aptPos;
+		bool msChanged = dirtyRange.end >= aptPos; //the default Ms refracts from interface aptPos - 1
+		glm::mat2x2 default_Ma = lensSystem.getMa();
+		glm::mat2x2 default_Ms = lensSystem.getMs();
+		for (size_t i = 0; i < size(); i++) {
+			if (maChanged) {
+				Ma[i] = isPreApt(i) ? lensSystem.getMa(reflectionPairs[i].x, reflectionPairs[i].y) : default_Ma;
+			}
+			if (msChanged) {
+				Ms[i] = isPreApt(i) ? default_Ms : lensSystem.getMs(reflectionPairs[i].x, reflectionPairs[i].y);
+			}
+			updateLayout(i);
+		}
+	}
+
+	if (!traceValid) {
+		return;
+	}
+
+	for (size_t i = 0; i < size(); i++) {
+		int first = reflectionPairs[i].x;
+		int second = reflectionPairs[i].y;
+		int crossingCount = (traceOffset[i + 1] - traceOffset[i]) / 2;
+		TransmissionCrossing* xTrace = trace.data() + traceOffset[i];
+		TransmissionCrossing* yTrace = xTrace + crossingCount;
+		if (!dirtyRange.geometryChanged) {
+			transmission[i] = lensSystem.retraceCoatings(first, second, traceQuarterWaveCoating, xTrace, dirtyRange.begin, dirtyRange.end)
+				+ lensSystem.retraceCoatings(first, second, traceQuarterWaveCoating, yTrace, dirtyRange.begin, dirtyRange.end);
+			continue;
+		}
+		//the path is unchanged up to the first crossing of a changed interface, unless the center ray itself moved
+		int fromCrossing = dirtyRange.begin <= first ? dirtyRange.begin : dirtyRange.begin + 2 * (first - second);
+		glm::vec2 xRay = getCenterRay(i, traceYawAndPitch.x);
+		glm::vec2 yRay = getCenterRay(i, traceYawAndPitch.y);
+		transmission[i] = lensSystem.traceTransmission(first, second, xRay, traceQuarterWaveCoating, xTrace, xRay == xTrace[0].ray ? fromCrossing : 0)
+			+ lensSystem.traceTransmission(first, second, yRay, traceQuarterWaveCoating, yTrace, yRay == yTrace[0].ray ? fromCrossing : 0);
+	}
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include "lens_system.h"
+
+// All ghosts of a lens system in one structure-of-arrays, pre-aperture ghosts first.
+// Ghost i is the same index everywhere (quad id, annotation, transmission), so no pre/post aperture offset is needed.
+// Built once per lens change and shared (std::shared_ptr) between the renderer and the solvers.
+struct GhostTable {
+	GhostTable() = default;
+	explicit GhostTable(const LensSystem& lensSystem);
+	// Same as constructing a new table, but keeps the capacity of the arrays
+	void rebuild(const LensSystem& lensSystem);
+
+	size_t size() const { return reflectionPairs.size(); }
+	bool isPreApt(int ghost) const { return ghost < preAptCount; }
+	// Transmission of every ghost for the given light angles, written into out (resized to size()).
+	void computeTransmissions(const LensSystem& lensSystem, glm::vec2 yawAndPitch, bool quarterWaveCoating, std::vector<glm::vec3>& out) const;
+	// Spectral mode, each ghost's spectrum is converted to RGB with sampling.toRGB
+	void computeTransmissions(const LensSystem& lensSystem, glm::vec2 yawAndPitch, bool quarterWaveCoating, const SpectralSampling& sampling, std::vector<glm::vec3>& out) const;
+	void refreshTransmissions(const LensSystem& lensSystem, glm::vec2 yawAndPitch, bool quarterWaveCoating);
+	// Recomputes only what the interfaces in dirtyRange affect, the set of ghosts must be unchanged (no dirtyRange.ghostsChanged).
+	void update(const LensSystem& lensSystem, const LensDirtyRange& dirtyRange);
+	// Ray through the aperture center of the ghost for one light angle, the ray its transmission is traced with
+	glm::vec2 getCenterRay(size_t ghost, float lightAngle) const;
+
+	int preAptCount = 0;
+	std::vector<glm::vec2> reflectionPairs; //(first, second) reflection interface
+	std::vector<glm::mat2x2> Ma; //default Ma for post-aperture ghosts
+	std::vector<glm::mat2x2> Ms; //default Ms for pre-aperture ghosts
+	std::vector<glm::mat2x2> M; //fused Ms * Ma
+	std::vector<GhostLayout> layout; //sensor position and size for any light angle
+	std::vector<glm::vec3> transmission; //RGB transmission, see refreshTransmissions
+
+	// Crossings recorded by refreshTransmissions, ghost i owns [traceOffset[i], traceOffset[i + 1]): its x ray path followed by its y ray path
+	std::vector<int> traceOffset;
+	std::vector<TransmissionCrossing> trace;
+	glm::vec2 traceYawAndPitch = glm::vec2(0.f);
+	bool traceQuarterWaveCoating = false;
+	bool traceValid = false;
+
+private:
+	void updateLayout(size_t ghost);
+};
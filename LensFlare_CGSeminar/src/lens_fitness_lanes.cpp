@@ -0,0 +1,310 @@
+#include "lens_solver.h"
+#include "lens_table.h"
+#include "ray_transfer_matrices.h"
+#include "simd_lanes.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <vector>
+
+// LensSystemProblem::computeFitness with one candidate per SIMD lane. Candidates of a population have the same interface
+// count, so the matrix chains of FixedLensSystem and the ghost layouts are computed for all lanes at once, with the
+// aperture position and the glass interfaces of each lane turned into masks. The per-interface tables, the snapshot
+// sort and the scoring stay scalar per lane. Every lane performs the same float operations in the same order as
+// FixedLensSystem and simulateDrawQuad, so the fitness values are identical.
+
+namespace {
+
+using Lanes = WideLanes;
+constexpr int W = Lanes::width;
+
+// glm layout, aRC is column R, row C of the glm matrix m[R][C]
+struct Mat2Lanes {
+    Lanes a00, a01, a10, a11;
+};
+
+Mat2Lanes identityLanes() {
+    return { Lanes::set(1.f), Lanes::set(0.f), Lanes::set(0.f), Lanes::set(1.f) };
+}
+
+// Same products and sums as glm's mat2 * mat2
+Mat2Lanes operator*(const Mat2Lanes& m1, const Mat2Lanes& m2) {
+    return {
+        m1.a00 * m2.a00 + m1.a10 * m2.a01,
+        m1.a01 * m2.a00 + m1.a11 * m2.a01,
+        m1.a00 * m2.a10 + m1.a10 * m2.a11,
+        m1.a01 * m2.a10 + m1.a11 * m2.a11 };
+}
+
+Mat2Lanes select(Lanes mask, const Mat2Lanes& ifTrue, const Mat2Lanes& ifFalse) {
+    return { select(mask, ifTrue.a00, ifFalse.a00), select(mask, ifTrue.a01, ifFalse.a01),
+        select(mask, ifTrue.a10, ifFalse.a10), select(mask, ifTrue.a11, ifFalse.a11) };
+}
+
+// Transposes one matrix per lane into lanes
+Mat2Lanes loadLanes(const std::array<glm::mat2x2, W>& matrices) {
+    alignas(32) float a[4][W];
+    for (int lane = 0; lane < W; lane++) {
+        a[0][lane] = matrices[lane][0][0];
+        a[1][lane] = matrices[lane][0][1];
+        a[2][lane] = matrices[lane][1][0];
+        a[3][lane] = matrices[lane][1][1];
+    }
+    return { Lanes::load(a[0]), Lanes::load(a[1]), Lanes::load(a[2]), Lanes::load(a[3]) };
+}
+
+Lanes loadLanes(const std::array<float, W>& values) {
+    return Lanes::load(values.data());
+}
+
+// Mask of the lanes where the flag is set
+Lanes loadMask(const std::array<bool, W>& flags) {
+    std::array<float, W> values;
+    for (int lane = 0; lane < W; lane++) {
+        values[lane] = flags[lane] ? 1.f : 0.f;
+    }
+    return greater(loadLanes(values), Lanes::set(0.5f));
+}
+
+// Per thread, the buffers keep their capacity between calls
+struct LaneScratch {
+    std::vector<LensInterface> lensInterfaces;
+    std::vector<std::array<LensTableEntry, W>> entries; //[interface][lane]
+    std::vector<std::array<bool, W>> glass; //raw ni > 1.1
+    std::vector<Lanes> bordersGlass; //[interface], mask of the lanes where the interface borders glass
+    std::vector<Mat2Lanes> forward;
+    std::vector<Mat2Lanes> backward;
+    std::vector<Mat2Lanes> reflection;
+    std::vector<Mat2Lanes> reflectionBack;
+    // FixedLensSystem chains indexed on the interface instead of the offset to the aperture
+    std::vector<Mat2Lanes> prefix;
+    std::vector<Mat2Lanes> preAptSuffix;
+    std::vector<Mat2Lanes> postAptPrefix;
+    std::vector<Mat2Lanes> suffix;
+    std::vector<Mat2Lanes> chainBackward; //[second * N + first]
+    std::array<std::vector<SnapshotData>, W> snapshots;
+    std::array<FitnessLowerBound, W> lowerBounds;
+};
+
+// Smallest float with (double)threshold >= 1e-6, so abs(x) < threshold in float matches getGhostLayout's double comparison
+float getCenterThreshold() {
+    float threshold = 1e-6f;
+    if (static_cast<double>(threshold) < 1e-6) {
+        threshold = std::nextafter(threshold, 1.f);
+    }
+    return threshold;
+}
+
+}
+
+int LensSystemProblem::getFitnessLaneWidth() {
+    return W;
+}
+
+void LensSystemProblem::computeFitnessLanes(const double* dv, int count, double* out, double upperBound, FitnessBoundStats* stats) const {
+    static thread_local LaneScratch scratch;
+    static const float centerThreshold = getCenterThreshold();
+    const int N = m_num_interfaces;
+    RayTransferMatrixBuilder rayTransferMatrixBuilder;
+
+    //Per lane tables, padding lanes repeat the first candidate
+    std::array<int, W> irisAperturePos;
+    std::array<float, W> apertureHeight;
+    std::array<float, W> irisLanes;
+    std::array<float, W> aptLanes;
+    std::array<glm::mat2x2, W> apertureForward;
+    scratch.entries.resize(N);
+    scratch.glass.resize(N);
+    for (int lane = 0; lane < W; lane++) {
+        const double* candidate = dv + static_cast<size_t>(lane < count ? lane : 0) * m_dim;
+        getLensInterfaces(candidate, scratch.lensInterfaces);
+        irisAperturePos[lane] = std::round(candidate[0]);
+        apertureHeight[lane] = candidate[1];
+        const int A = std::clamp(irisAperturePos[lane], 0, N);
+        irisLanes[lane] = irisAperturePos[lane];
+        aptLanes[lane] = A;
+        apertureForward[lane] = glm::mat2(1.0f);
+        for (int i = 0; i < N; i++) {
+            LensTableEntry entry = getLensTableEntry(scratch.lensInterfaces[i], (i == 0) ? 1.0f : scratch.entries[i - 1][lane].n, i == 0, i == irisAperturePos[lane]);
+            scratch.entries[i][lane] = entry;
+            scratch.glass[i][lane] = scratch.lensInterfaces[i].ni > 1.1;
+            if (i == A) {
+                apertureForward[lane] = rayTransferMatrixBuilder.getTranslationRefractionMatrix(entry.d, 1.0f, entry.n, entry.R);
+            }
+        }
+    }
+
+    //Transpose into lanes
+    scratch.bordersGlass.resize(N);
+    scratch.forward.resize(N);
+    scratch.backward.resize(N);
+    scratch.reflection.resize(N);
+    scratch.reflectionBack.resize(N);
+    std::array<glm::mat2x2, W> matrices;
+    for (int i = 0; i < N; i++) {
+        std::array<bool, W> bordersGlass;
+        for (int lane = 0; lane < W; lane++) {
+            bordersGlass[lane] = scratch.glass[i][lane] || (i > 0 && scratch.glass[i - 1][lane]);
+        }
+        scratch.bordersGlass[i] = loadMask(bordersGlass);
+        for (int lane = 0; lane < W; lane++) matrices[lane] = scratch.entries[i][lane].forward;
+        scratch.forward[i] = loadLanes(matrices);
+        for (int lane = 0; lane < W; lane++) matrices[lane] = scratch.entries[i][lane].backward;
+        scratch.backward[i] = loadLanes(matrices);
+        for (int lane = 0; lane < W; lane++) matrices[lane] = scratch.entries[i][lane].reflection;
+        scratch.reflection[i] = loadLanes(matrices);
+        for (int lane = 0; lane < W; lane++) matrices[lane] = scratch.entries[i][lane].reflectionBack;
+        scratch.reflectionBack[i] = loadLanes(matrices);
+    }
+    const Lanes iris = loadLanes(irisLanes);
+    const Lanes apt = loadLanes(aptLanes);
+    const Mat2Lanes aptForward = loadLanes(apertureForward);
+    const Mat2Lanes identity = identityLanes();
+    auto beforeAperture = [&](int k) { return greater(apt, Lanes::set(k)); }; //k < A
+    auto afterAperture = [&](int k) { return greater(Lanes::set(k), apt); }; //k > A
+    auto atAperture = [&](int k) { return greater(apt, Lanes::set(k - 0.5f)) & greater(Lanes::set(k + 0.5f), apt); };
+
+    //Chains, lanes outside the range FixedLensSystem fills keep the identity it is filled with
+    scratch.prefix.resize(N + 1);
+    scratch.preAptSuffix.resize(N + 1);
+    scratch.postAptPrefix.resize(N + 1);
+    scratch.suffix.resize(N + 1);
+    scratch.prefix[0] = identity;
+    for (int k = 1; k <= N; k++) {
+        scratch.prefix[k] = scratch.forward[k - 1] * scratch.prefix[k - 1];
+    }
+    scratch.preAptSuffix[N] = identity;
+    for (int k = N - 1; k >= 0; k--) {
+        scratch.preAptSuffix[k] = select(beforeAperture(k), scratch.preAptSuffix[k + 1] * scratch.forward[k], identity);
+    }
+    scratch.postAptPrefix[0] = identity;
+    for (int k = 1; k <= N; k++) {
+        Mat2Lanes next = select(atAperture(k - 1), aptForward, scratch.forward[k - 1]) * scratch.postAptPrefix[k - 1];
+        scratch.postAptPrefix[k] = select(afterAperture(k), next, identity);
+    }
+    scratch.suffix[N] = identity;
+    for (int k = N - 1; k >= 0; k--) {
+        Mat2Lanes next = scratch.suffix[k + 1] * select(atAperture(k), aptForward, scratch.forward[k]);
+        scratch.suffix[k] = select(beforeAperture(k), identity, next);
+    }
+    scratch.chainBackward.resize(N * N);
+    for (int s = 0; s < N; s++) {
+        if (s + 1 < N) {
+            scratch.chainBackward[s * N + s + 1] = identity;
+        }
+        for (int f = s + 2; f < N; f++) {
+            scratch.chainBackward[s * N + f] = scratch.chainBackward[s * N + f - 1] * scratch.backward[f - 1];
+        }
+    }
+    Mat2Lanes defaultMa = identity;
+    Mat2Lanes defaultMs = identity;
+    for (int k = 0; k <= N; k++) {
+        defaultMa = select(atAperture(k), scratch.prefix[k], defaultMa);
+        if (k < N) {
+            defaultMs = select(atAperture(k), scratch.suffix[k + 1] * scratch.forward[k], defaultMs);
+        }
+    }
+
+    //Ghost layouts and simulateDrawQuad
+    const Lanes lightX = Lanes::set(m_light_angle_x);
+    const Lanes lightY = Lanes::set(m_light_angle_y);
+    const Lanes aptHeight = loadLanes(apertureHeight);
+    const Lanes halfEntrancePupil = Lanes::set(m_entrance_pupil_height / 2.f);
+    for (std::vector<SnapshotData>& snapshot : scratch.snapshots) {
+        snapshot.clear();
+    }
+    //Lanes still simulating ghosts, a lane drops out once its lower bound exceeds upperBound. Padding lanes are not drawn.
+    const bool bounded = upperBound < std::numeric_limits<double>::infinity();
+    int active = (1 << count) - 1;
+    for (FitnessLowerBound& lowerBound : scratch.lowerBounds) {
+        lowerBound.reset(m_renderObjective.size());
+    }
+    auto drawQuads = [&](int bits, const Mat2Lanes& Ma, const Mat2Lanes& Ms) {
+        Mat2Lanes M = Ms * Ma;
+        Lanes centerCoeff = select(greater(Lanes::set(centerThreshold), abs(Ma.a00)), M.a10, M.a10 - M.a00 * Ma.a10 / Ma.a00);
+        Lanes heightCoeff = abs(M.a00 / Ma.a00) / Lanes::set(2.f);
+
+        Lanes centerX = centerCoeff * lightX;
+        Lanes centerY = centerCoeff * lightY;
+        Lanes height = heightCoeff * aptHeight;
+        Lanes entrancePupilHeight = abs(M.a00) * halfEntrancePupil;
+        Lanes entrancePupilX = M.a10 * lightX;
+        Lanes entrancePupilY = M.a10 * lightY;
+        Lanes dx = entrancePupilX - centerX;
+        Lanes dy = entrancePupilY - centerY;
+        Lanes dist = sqrt(dx * dx + dy * dy);
+        Lanes clipped = greater(dist, entrancePupilHeight) & greater(dist, height);
+        Lanes entrancePupilSmaller = greater(height, entrancePupilHeight);
+
+        alignas(32) float quadHeight[W];
+        alignas(32) float quadX[W];
+        alignas(32) float quadY[W];
+        select(clipped, Lanes::set(100000), select(entrancePupilSmaller, entrancePupilHeight, height)).store(quadHeight);
+        select(clipped, centerX, select(entrancePupilSmaller, entrancePupilX, centerX)).store(quadX);
+        select(clipped, centerY, select(entrancePupilSmaller, entrancePupilY, centerY)).store(quadY);
+        for (int lane = 0; lane < W; lane++) {
+            if (bits & (1 << lane)) {
+                SnapshotData snap;
+                snap.quadID = scratch.snapshots[lane].size();
+                snap.quadCenterPos = glm::vec2(quadX[lane], quadY[lane]);
+                snap.quadHeight = quadHeight[lane];
+                scratch.snapshots[lane].push_back(snap);
+                if (bounded) {
+                    scratch.lowerBounds[lane].addGhost(snap.quadHeight);
+                    if (scratch.lowerBounds[lane].get() > upperBound) {
+                        active &= ~(1 << lane);
+                    }
+                }
+            }
+        }
+    };
+    //Same pair order as FixedLensSystem::forEachGhost, pre-aperture ghosts first
+    for (int first = 1; first < N && active != 0; first++) {
+        for (int second = first - 1; second >= 0; second--) {
+            Lanes mask = greater(iris, Lanes::set(first)) & scratch.bordersGlass[first] & scratch.bordersGlass[second];
+            int bits = laneMask(mask) & active;
+            if (bits == 0) {
+                continue;
+            }
+            Mat2Lanes core = scratch.reflectionBack[second] * scratch.chainBackward[second * N + first] * scratch.reflection[first];
+            drawQuads(bits, scratch.preAptSuffix[second + 1] * core * scratch.prefix[first], defaultMs);
+        }
+    }
+    for (int first = 1; first < N && active != 0; first++) {
+        for (int second = first - 1; second >= 0; second--) {
+            Lanes mask = greater(Lanes::set(second), iris) & scratch.bordersGlass[first] & scratch.bordersGlass[second];
+            int bits = laneMask(mask) & active;
+            if (bits == 0) {
+                continue;
+            }
+            Mat2Lanes core = scratch.reflectionBack[second] * scratch.chainBackward[second * N + first] * scratch.reflection[first];
+            drawQuads(bits, defaultMa, scratch.suffix[second + 1] * core * scratch.postAptPrefix[first]);
+        }
+    }
+
+    for (int lane = 0; lane < count; lane++) {
+        const bool finished = active & (1 << lane);
+        out[lane] = finished ? scoreSnapshot(scratch.snapshots[lane]) : scratch.lowerBounds[lane].get();
+        if (stats) {
+            //Ghost count of the lane, the pairs of the loops above that reflect at glass on its side of the aperture
+            int ghostCount = scratch.snapshots[lane].size();
+            if (!finished) {
+                ghostCount = 0;
+                for (int first = 1; first < N; first++) {
+                    for (int second = first - 1; second >= 0; second--) {
+                        bool bordersGlassBoth = (scratch.glass[first][lane] || scratch.glass[first - 1][lane]) && (scratch.glass[second][lane] || (second > 0 && scratch.glass[second - 1][lane]));
+                        if (bordersGlassBoth && (first < irisAperturePos[lane] || second > irisAperturePos[lane])) {
+                            ghostCount++;
+                        }
+                    }
+                }
+            }
+            stats->candidates++;
+            stats->ghosts += ghostCount;
+            if (!finished) {
+                stats->stopped++;
+                stats->skippedGhosts += ghostCount - scratch.snapshots[lane].size();
+            }
+        }
+    }
+}
@@ -1,5 +1,9 @@
 #include "lens_solver.h"
+#include "fixed_lens_system.h"
+#include "dual.h"
 #include <vector>
+#include <array>
+#include <type_traits>
 #include <pagmo/algorithm.hpp>
 #include <pagmo/algorithms/de.hpp>
 #include <pagmo/algorithms/cmaes.hpp>
@@ -17,7 +21,12 @@
 #include <chrono>
 #include <fstream>
 #include <sstream>
+#include <filesystem>
 #include <pagmo/bfe.hpp>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/task_arena.h>
+#include <tbb/task_group.h>
 
 int const PARAMS_PER_INTERFACE = 3;
 
@@ -52,57 +61,103 @@ void LensSystemProblem::init(unsigned int num_interfaces, float light_angle_x, f
 void LensSystemProblem::setRenderObjective(std::vector<SnapshotData> &renderObjective) {
     sortByQuadHeight(renderObjective);
     m_renderObjective = renderObjective;
+    if (m_surrogate) {
+        m_surrogate->clear();
+    }
+    std::lock_guard<std::mutex> lock(m_clBuffers.mutex);
+    m_clBuffers.renderObjectiveUploaded = false;
 }
 
-SnapshotData LensSystemProblem::simulateDrawQuad(int quadId, glm::mat2x2& Ma, glm::mat2x2& Ms, float light_angle_x, float light_angle_y, float irisApertureHeight) const {
+template<typename T>
+void LensSystemProblem::simulateDrawQuad(const BasicGhostLayout<T>& layout, float light_angle_x, float light_angle_y, T irisApertureHeight, glm::vec<2, T>& quadCenterPos, T& quadHeight) const {
+    using std::sqrt;
+    glm::vec<2, T> light_angles = glm::vec<2, T>(T(light_angle_x), T(light_angle_y));
 
     //Projection of the aperture center onto the sensor
-    glm::vec2 ghost_center_x = glm::vec2(-light_angle_x * Ma[1][0] / Ma[0][0], light_angle_x);
-    glm::vec2 ghost_center_y = glm::vec2(-light_angle_y * Ma[1][0] / Ma[0][0], light_angle_y);
-
-    glm::vec2 ghost_center_x_s = Ms * Ma * ghost_center_x;
-    glm::vec2 ghost_center_y_s = Ms * Ma * ghost_center_y;
-    glm::vec2 ghost_center_pos = glm::vec2(ghost_center_x_s.x, ghost_center_y_s.x);
-
-    glm::vec2 apt_h_x = glm::vec2(((irisApertureHeight / 2.0) - (light_angle_x * Ma[1][0])) / Ma[0][0], light_angle_x);
-    glm::vec2 apt_h_x_s = Ms * Ma * apt_h_x;
-    float ghost_height = abs(apt_h_x_s.x - ghost_center_pos.x);
+    glm::vec<2, T> ghost_center_pos = layout.getCenter(light_angles);
+    T ghost_height = layout.getHeight(irisApertureHeight);
 
-	glm::vec2 entrance_pupil_h_x_s = Ms * Ma * glm::vec2((m_entrance_pupil_height / 2.0), light_angle_x);
-    glm::vec2 entrance_pupil_center_x_s = Ms * Ma * glm::vec2(0.f, light_angle_x);
-    glm::vec2 entrance_pupil_center_y_s = Ms * Ma * glm::vec2(0.f, light_angle_y);
-	float entrance_pupil_height = abs(entrance_pupil_h_x_s.x - entrance_pupil_center_x_s.x);
-	glm::vec2 entrance_pupil_center_pos = glm::vec2(entrance_pupil_center_x_s.x, entrance_pupil_center_y_s.x);
+    T entrance_pupil_height = layout.getEntrancePupilHeight(T(m_entrance_pupil_height));
+    glm::vec<2, T> entrance_pupil_center_pos = layout.getEntrancePupilCenter(light_angles);
 
     bool ghost_center_clipped = false;
-    float dist_between_centers = glm::length(entrance_pupil_center_pos - ghost_center_pos);
+    glm::vec<2, T> between_centers = entrance_pupil_center_pos - ghost_center_pos;
+    T dist_between_centers = sqrt(between_centers.x * between_centers.x + between_centers.y * between_centers.y);
     if (entrance_pupil_height < dist_between_centers && ghost_height < dist_between_centers) {
         ghost_center_clipped = true;
     }
 
-    SnapshotData snap;
-    snap.quadID = quadId;
     if (ghost_center_clipped) {
-        snap.quadCenterPos = ghost_center_pos;
-		snap.quadHeight = 100000; //since we sort on quad height, this will be the last one
+        quadCenterPos = ghost_center_pos;
+        quadHeight = T(100000); //since we sort on quad height, this will be the last one
     }
     else if (entrance_pupil_height < ghost_height) {
-        snap.quadCenterPos = entrance_pupil_center_pos;
-        snap.quadHeight = entrance_pupil_height;
+        quadCenterPos = entrance_pupil_center_pos;
+        quadHeight = entrance_pupil_height;
     }
     else {
-        snap.quadCenterPos = ghost_center_pos;
-        snap.quadHeight = ghost_height;
+        quadCenterPos = ghost_center_pos;
+        quadHeight = ghost_height;
     }
+}
 
+SnapshotData LensSystemProblem::simulateDrawQuad(const GhostLayout& layout, int quadId, float light_angle_x, float light_angle_y, float irisApertureHeight) const {
+    SnapshotData snap;
+    snap.quadID = quadId;
+    simulateDrawQuad(layout, light_angle_x, light_angle_y, irisApertureHeight, snap.quadCenterPos, snap.quadHeight);
     return snap;
 }
 
+bool LensSystemProblem::computeSnapshotJacobian(const double* dv, std::vector<SnapshotData>& snapshot, std::vector<double>& jacobian) const {
+    static thread_local std::vector<LensInterface> lensInterfaces;
+    getLensInterfaces(dv, lensInterfaces);
+    snapshot.clear();
+    jacobian.clear();
+    const int irisAperturePos = std::round(dv[0]);
+    return withFixedInterfaceCount(lensInterfaces.size(), [&](auto interfaceCount) {
+        constexpr int N = decltype(interfaceCount)::value;
+        //Partial k is the derivative with respect to dv[1 + k], the aperture position has none. The values take the float
+        //operations of simulateDrawQuad on a FixedLensSystem, so they are the ones computeFitness sees.
+        using Scalar = Dual<float, 1 + (N * PARAMS_PER_INTERFACE)>;
+        std::array<Scalar, N> d, n, R;
+        for (int i = 0; i < N; i++) {
+            const LensInterface& lens = lensInterfaces[i];
+            const double rawR = dv[2 + (PARAMS_PER_INTERFACE * i) + 2];
+            const int column = 1 + (PARAMS_PER_INTERFACE * i);
+            //Derivatives of the repair in getLensInterfaces
+            const bool glass = lens.ni != 1.0f;
+            d[i] = Scalar::seed(lens.di, column, glass ? 9.f / (100.0f - 0.1f) : 1.f);
+            n[i] = Scalar::seed(lens.ni, column + 1, glass ? 1.f : 0.f);
+            R[i] = Scalar::seed(lens.Ri, column + 2, (std::abs(rawR) > 5.0 && std::abs(rawR) < 8000.0) ? 1.f : 0.f);
+        }
+        //Per thread and on the heap, with 28 interfaces the chains of Dual matrices take about 1 MB
+        static thread_local std::unique_ptr<FixedGhostChains<N, Scalar>> chains = std::make_unique<FixedGhostChains<N, Scalar>>();
+        chains->build(irisAperturePos, d.data(), n.data(), R.data());
+        const Scalar apertureHeight = Scalar::seed(static_cast<float>(dv[1]), 0);
+        chains->forEachGhostLayout([&](const BasicGhostLayout<Scalar>& layout) {
+            glm::vec<2, Scalar> quadCenterPos;
+            Scalar quadHeight;
+            simulateDrawQuad(layout, m_light_angle_x, m_light_angle_y, apertureHeight, quadCenterPos, quadHeight);
+            SnapshotData snap;
+            snap.quadID = snapshot.size();
+            snap.quadCenterPos = glm::vec2(quadCenterPos.x.value, quadCenterPos.y.value);
+            snap.quadHeight = quadHeight.value;
+            snapshot.push_back(snap);
+            for (const Scalar* row : { &quadCenterPos.x, &quadCenterPos.y, &quadHeight }) {
+                jacobian.push_back(0.0);
+                jacobian.insert(jacobian.end(), row->partials.begin(), row->partials.end());
+            }
+            return true;
+            });
+        });
+}
+
 pagmo::vector_double LensSystemProblem::fitness(const pagmo::vector_double& dv) const {
+    return { computeFitness(dv.data()) };
+}
 
-    //Construct lens system
-    std::vector<LensInterface> newLensInterfaces;
-    newLensInterfaces.reserve(m_num_interfaces);
+void LensSystemProblem::getLensInterfaces(const double* dv, std::vector<LensInterface>& out) const {
+    out.clear();
     for (int i = 0; i < m_num_interfaces; i++) {
         LensInterface lens;
         lens.di = dv[2 + (PARAMS_PER_INTERFACE * i)];
@@ -134,36 +189,17 @@ pagmo::vector_double LensSystemProblem::fitness(const pagmo::vector_double& dv)
             lens.Ri = -std::numeric_limits<float>::infinity();
         }
 
-        newLensInterfaces.push_back(lens);
+        out.push_back(lens);
     }
+}
 
-    LensSystem newLensSystem = LensSystem(std::round(dv[0]), dv[1], m_entrance_pupil_height, newLensInterfaces);
-
-    //"Render"
-    glm::mat2x2 default_Ma = newLensSystem.getMa();
-    glm::mat2x2 default_Ms = newLensSystem.getMs();
-    std::vector<glm::vec2> preAptReflectionPairs = newLensSystem.getPreAptReflections();
-    std::vector<glm::vec2> postAptReflectionPairs = newLensSystem.getPostAptReflections();
-
-    // not enough ghosts, discard
-	if (preAptReflectionPairs.size() + postAptReflectionPairs.size() < m_renderObjective.size()) {
-		return { 100000.0 };
-	}
-
-    std::vector<glm::mat2x2> preAptMas = newLensSystem.getMa(preAptReflectionPairs);
-    std::vector<glm::mat2x2> postAptMss = newLensSystem.getMs(postAptReflectionPairs);
-
-    std::vector<SnapshotData> newSnapshot;
-    
-    for (int i = 0; i < preAptReflectionPairs.size(); i++) {
-        newSnapshot.push_back(simulateDrawQuad(i, preAptMas[i], default_Ms, m_light_angle_x, m_light_angle_y, dv[1]));
-    }
-    for (int i = 0; i < postAptReflectionPairs.size(); i++) {
-        newSnapshot.push_back(simulateDrawQuad(i + preAptReflectionPairs.size(), default_Ma, postAptMss[i], m_light_angle_x, m_light_angle_y, dv[1]));
+double LensSystemProblem::scoreSnapshot(std::vector<SnapshotData>& newSnapshot) const {
+    if (newSnapshot.size() < m_renderObjective.size()) {
+        return 100000.0;
     }
 
-    // Compare ghosts on size (directly related to intensity)
-    sortByQuadHeight(newSnapshot);
+    // Compare ghosts on size (directly related to intensity), only the ones matched to the objective need to be in order
+    selectSmallestQuadHeights(newSnapshot, m_renderObjective.size());
 
     //Compute fitness
     double f = 0.0;
@@ -182,7 +218,147 @@ pagmo::vector_double LensSystemProblem::fitness(const pagmo::vector_double& dv)
 
     f = f / m_renderObjective.size();
 
-    return { f };
+    return f;
+}
+
+double LensSystemProblem::computeFitness(const double* dv, double upperBound, FitnessBoundStats* stats) const {
+
+    //Construct lens system, the scratch buffers are per thread since pagmo may evaluate candidates concurrently
+    static thread_local std::vector<LensInterface> newLensInterfaces;
+    static thread_local std::vector<SnapshotData> newSnapshot;
+    static thread_local FitnessLowerBound lowerBound;
+    newSnapshot.clear();
+    getLensInterfaces(dv, newLensInterfaces);
+    const bool bounded = upperBound < std::numeric_limits<double>::infinity();
+    lowerBound.reset(m_renderObjective.size());
+
+    //"Render" ghost by ghost, so a candidate stops as soon as its lower bound exceeds upperBound. Without enough ghosts
+    //scoreSnapshot discards it.
+    auto simulateNextQuad = [&](const GhostLayout& layout) {
+        newSnapshot.push_back(simulateDrawQuad(layout, newSnapshot.size(), m_light_angle_x, m_light_angle_y, dv[1]));
+        if (!bounded) {
+            return true;
+        }
+        lowerBound.addGhost(newSnapshot.back().quadHeight);
+        return !(lowerBound.get() > upperBound);
+    };
+    //Through the fixed size lens system when there is one for this interface count
+    bool finished = true;
+    int ghostCount = 0;
+    bool fixed = withFixedLensSystem(std::round(dv[0]), newLensInterfaces, [&](const auto& fixedLensSystem) {
+        finished = fixedLensSystem.forEachGhostLayout(simulateNextQuad);
+        ghostCount = finished ? newSnapshot.size() : fixedLensSystem.getGhostCount();
+    });
+    if (!fixed) {
+        LensSystem newLensSystem = LensSystem(std::round(dv[0]), dv[1], m_entrance_pupil_height, newLensInterfaces);
+        GhostTable ghostTable(newLensSystem);
+        ghostCount = ghostTable.size();
+        for (int i = 0; i < ghostTable.size() && finished; i++) {
+            finished = simulateNextQuad(ghostTable.layout[i]);
+        }
+    }
+
+    if (stats) {
+        stats->candidates++;
+        stats->ghosts += ghostCount;
+        if (!finished) {
+            stats->stopped++;
+            stats->skippedGhosts += ghostCount - newSnapshot.size();
+        }
+    }
+    return finished ? scoreSnapshot(newSnapshot) : lowerBound.get();
+}
+
+void FitnessLowerBound::reset(size_t matched) {
+    m_smallest.clear();
+    m_matched = matched;
+    m_largestSmallest = 0;
+    m_penalty = 0.0;
+}
+
+void FitnessLowerBound::addGhost(float quadHeight) {
+    if (m_matched == 0) {
+        return;
+    }
+    if (std::isnan(quadHeight)) {
+        m_penalty = std::numeric_limits<double>::quiet_NaN();
+        return;
+    }
+    if (m_smallest.size() < m_matched) {
+        m_smallest.push_back(quadHeight);
+        if (quadHeight > m_smallest[m_largestSmallest]) {
+            m_largestSmallest = m_smallest.size() - 1;
+        }
+        return;
+    }
+    //Of the new ghost and the largest of the smallest, the higher one is certain to stay unmatched. On a tie either one
+    //is matched, the penalty is the same.
+    float unmatched = quadHeight;
+    if (quadHeight < m_smallest[m_largestSmallest]) {
+        unmatched = m_smallest[m_largestSmallest];
+        m_smallest[m_largestSmallest] = quadHeight;
+        m_largestSmallest = std::max_element(m_smallest.begin(), m_smallest.end()) - m_smallest.begin();
+    }
+    m_penalty += 500 / unmatched; //same extra ghost penalty as scoreSnapshot
+}
+
+void FitnessBranchAndBound::record(const FitnessBoundStats& stats) {
+    candidates += stats.candidates;
+    stopped += stats.stopped;
+    ghosts += stats.ghosts;
+    skippedGhosts += stats.skippedGhosts;
+}
+
+FitnessBoundStats FitnessBranchAndBound::takeStats() {
+    FitnessBoundStats stats;
+    stats.candidates = candidates.exchange(0);
+    stats.stopped = stopped.exchange(0);
+    stats.ghosts = ghosts.exchange(0);
+    stats.skippedGhosts = skippedGhosts.exchange(0);
+    return stats;
+}
+
+LensPartialEvaluator::LensPartialEvaluator(std::shared_ptr<const LensSystemProblem> problem) : m_problem(std::move(problem)) {}
+
+void LensPartialEvaluator::resize(size_t populationSize) {
+    m_individuals.resize(populationSize);
+}
+
+double LensPartialEvaluator::evaluate(size_t individual, const pagmo::vector_double& x) {
+    static thread_local std::vector<LensInterface> newLensInterfaces;
+    static thread_local std::vector<SnapshotData> newSnapshot;
+    const LensSystemProblem& problem = *m_problem;
+    Individual& state = m_individuals[individual];
+    problem.getLensInterfaces(x.data(), newLensInterfaces);
+    int aperturePos = std::round(x[0]);
+
+    //Only what differs from the last evaluation of the individual is recomputed, the lens system tracks it
+    if (!state.lensSystem) {
+        state.lensSystem.emplace(aperturePos, x[1], problem.m_entrance_pupil_height, newLensInterfaces);
+        state.ghostTable.rebuild(*state.lensSystem);
+    }
+    else {
+        state.lensSystem->setIrisAperturePos(aperturePos);
+        state.lensSystem->setLensInterfaces(newLensInterfaces);
+        const LensDirtyRange& dirtyRange = state.lensSystem->getDirtyRange();
+        if (dirtyRange.ghostsChanged) {
+            state.ghostTable.rebuild(*state.lensSystem);
+        }
+        else {
+            state.ghostTable.update(*state.lensSystem, dirtyRange);
+        }
+    }
+    state.lensSystem->clearDirtyRange();
+
+    newSnapshot.clear();
+    const GhostTable& ghostTable = state.ghostTable;
+    if (ghostTable.size() >= problem.m_renderObjective.size()) {
+        newSnapshot.reserve(ghostTable.size());
+        for (int i = 0; i < ghostTable.size(); i++) {
+            newSnapshot.push_back(problem.simulateDrawQuad(ghostTable.layout[i], i, problem.m_light_angle_x, problem.m_light_angle_y, x[1]));
+        }
+    }
+    return problem.scoreSnapshot(newSnapshot);
 }
 
 std::pair<pagmo::vector_double, pagmo::vector_double> LensSystemProblem::get_bounds() const {
@@ -192,8 +368,7 @@ std::pair<pagmo::vector_double, pagmo::vector_double> LensSystemProblem::get_bou
 std::string read_kernel_code(const std::string& filename) {
     std::ifstream file(filename);
     if (!file.is_open()) {
-        std::cerr << "Error: Could not open file: " << filename << std::endl;
-        std::exit(EXIT_FAILURE);
+        throw std::runtime_error("Could not open file: " + filename);
     }
     std::stringstream buffer;
     buffer << file.rdbuf();
@@ -201,45 +376,631 @@ std::string read_kernel_code(const std::string& filename) {
 }
 
 void LensSystemProblem::initializeOpenCL() const {
-    if (m_clInitialized)
+    OpenCLSharedState& shared = *m_clShared;
+    if (shared.initialized)
+        return;
+    // The first caller builds the program, the others wait for it here and return
+    std::lock_guard<std::mutex> lock(shared.mutex);
+    if (shared.initialized)
         return;
 
     // Get available platforms, pick one (for example, the first), then pick a GPU device
     std::vector<cl::Platform> platforms;
     cl::Platform::get(&platforms);
+    if (platforms.empty()) {
+        throw std::runtime_error("No OpenCL platforms found.");
+    }
     std::vector<cl::Device> devices;
-    platforms[0].getDevices(CL_DEVICE_TYPE_GPU, &devices);
+    for (const cl::Platform& platform : platforms) {
+        platform.getDevices(m_clDeviceType, &devices);
+        if (!devices.empty()) {
+            break;
+        }
+    }
     if (devices.empty()) {
-        throw std::runtime_error("No GPU devices found.");
+        throw std::runtime_error(m_clDeviceType == CL_DEVICE_TYPE_GPU ? "No GPU devices found." : "No OpenCL devices found.");
     }
-    m_clDevice = devices[0];
-    m_clContext = cl::Context(m_clDevice);
-    m_clQueue = cl::CommandQueue(m_clContext, m_clDevice);
+    shared.device = devices[0];
+    shared.context = cl::Context(shared.device);
 
     std::string kernel_filename = "batch_fitness.cl";
     std::string kernel_code = read_kernel_code(kernel_filename);
 
-    cl::Program::Sources sources;
-    sources.push_back({ kernel_code.c_str(), kernel_code.length() });
-    m_clProgram = cl::Program(m_clContext, sources);
+    // Specialize the private arrays of the kernel for the problem size
+    std::string options = m_clBuildOptions + " -D WORKGROUP_SIZE=" + std::to_string(OPENCL_WORKGROUP_SIZE);
+    if (m_num_interfaces >= 2) {
+        options += " -D NUM_INTERFACES=" + std::to_string(m_num_interfaces);
+    }
+    // Without fp64 the kernel only builds with float transfers
+    shared.floatTransfer = m_clFloatPopulation || shared.device.getInfo<CL_DEVICE_DOUBLE_FP_CONFIG>() == 0;
+    shared.cpuDevice = (shared.device.getInfo<CL_DEVICE_TYPE>() & CL_DEVICE_TYPE_CPU) != 0;
+    if (shared.floatTransfer) {
+        options += " -D FLOAT_POPULATION";
+    }
+
+    // Reuse the binary of an earlier run for the same device, source and options
+    auto start = std::chrono::high_resolution_clock::now();
+    std::filesystem::path cachePath = getProgramCachePath(getOpenCLDeviceKey(), kernel_code, options);
+    bool cached = loadProgramBinary(cachePath, options);
+
+    if (!cached) {
+        cl::Program::Sources sources;
+        sources.push_back({ kernel_code.c_str(), kernel_code.length() });
+        shared.program = cl::Program(shared.context, sources);
+
+        // Build the program for the selected device.
+        try {
+            shared.program.build({ shared.device }, options.c_str());
+        }
+        catch (const cl::Error& err) {
+            std::cerr << "OpenCL Program Build Error: " << err.what() << "(" << err.err() << ")" << std::endl;
+            std::cerr << shared.program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(shared.device) << std::endl;
+            throw;
+        }
+        saveProgramBinary(cachePath);
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    std::cout << "OpenCL program for " << m_num_interfaces << " interfaces " << (cached ? "loaded from " + cachePath.string() : "built") << " in " << ms << " ms" << std::endl;
+
+    shared.activeKernel = selectOpenCLKernel();
+    shared.initialized = true;
+}
+
+OpenCLFitnessKernel LensSystemProblem::selectOpenCLKernel() const {
+    OpenCLFitnessKernel kernel = m_clKernel;
+    if (kernel == OpenCLFitnessKernel::Auto) {
+        int crossover = loadOpenCLDeviceSetting(OPENCL_KERNEL_CROSSOVER_FILE, getOpenCLDeviceKey());
+        unsigned int minInterfaces = crossover > 0 ? crossover : OPENCL_WORKGROUP_KERNEL_MIN_INTERFACES;
+        kernel = m_num_interfaces >= minInterfaces ? OpenCLFitnessKernel::Workgroup : OpenCLFitnessKernel::Candidate;
+    }
+    if (kernel == OpenCLFitnessKernel::Workgroup) {
+        cl::Kernel workgroupKernel(m_clShared->program, getOpenCLKernelName(kernel));
+        size_t workgroupSize = workgroupKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(m_clShared->device);
+        cl_ulong localMemory = workgroupKernel.getWorkGroupInfo<CL_KERNEL_LOCAL_MEM_SIZE>(m_clShared->device);
+        if (workgroupSize < OPENCL_WORKGROUP_SIZE || localMemory > m_clShared->device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>()) {
+            std::cerr << "OpenCL workgroup kernel does not fit " << getOpenCLDeviceKey() << ", using one work-item per candidate" << std::endl;
+            kernel = OpenCLFitnessKernel::Candidate;
+        }
+    }
+    std::cout << "OpenCL fitness kernel: " << getOpenCLKernelName(kernel) << std::endl;
+    return kernel;
+}
+
+const char* LensSystemProblem::getOpenCLKernelName(OpenCLFitnessKernel kernel) {
+    return kernel == OpenCLFitnessKernel::Workgroup ? "batch_fitness_workgroup_kernel" : "batch_fitness_kernel";
+}
+
+// FNV-1a, only used to name cache files
+static uint64_t hashString(const std::string& text, uint64_t hash = 14695981039346656037ull) {
+    for (unsigned char c : text) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+std::filesystem::path LensSystemProblem::getProgramCachePath(const std::string& deviceKey, const std::string& source, const std::string& options) {
+    uint64_t hash = hashString(source, hashString(options, hashString(deviceKey)));
+    std::ostringstream name;
+    name << std::hex << hash << ".bin";
+    return std::filesystem::path(OPENCL_PROGRAM_CACHE_DIR) / name.str();
+}
 
-    // Build the program for the selected device.
+bool LensSystemProblem::loadProgramBinary(const std::filesystem::path& path, const std::string& options) const {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+    std::vector<unsigned char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
     try {
-        m_clProgram.build({ m_clDevice });
+        m_clShared->program = cl::Program(m_clShared->context, { m_clShared->device }, cl::Program::Binaries{ binary });
+        m_clShared->program.build({ m_clShared->device }, options.c_str());
     }
     catch (const cl::Error& err) {
-        std::cerr << "OpenCL Program Build Error: " << err.what() << "(" << err.err() << ")" << std::endl;
-        std::cerr << m_clProgram.getBuildInfo<CL_PROGRAM_BUILD_LOG>(m_clDevice) << std::endl;
-        throw;
+        //stale or foreign binary, rebuild from source
+        std::cerr << "Ignoring cached OpenCL program " << path.string() << ": " << err.what() << "(" << err.err() << ")" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void LensSystemProblem::saveProgramBinary(const std::filesystem::path& path) const {
+    std::vector<std::vector<unsigned char>> binaries = m_clShared->program.getInfo<CL_PROGRAM_BINARIES>();
+    if (binaries.empty() || binaries[0].empty()) {
+        return;
+    }
+    std::error_code error;
+    std::filesystem::create_directories(path.parent_path(), error);
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Error: Could not write " << path.string() << std::endl;
+        return;
+    }
+    file.write(reinterpret_cast<const char*>(binaries[0].data()), binaries[0].size());
+}
+
+bool LensSystemProblem::isOpenCLAvailable() const {
+    if (m_clShared->initialized) {
+        return true;
     }
+    if (m_clShared->unavailable) {
+        return false;
+    }
+    try {
+        initializeOpenCL();
+    }
+    catch (const std::exception& err) {
+        std::cerr << "OpenCL unavailable, evaluating on the host: " << err.what() << std::endl;
+        m_clShared->unavailable = true;
+    }
+    return m_clShared->initialized;
+}
 
-    m_clInitialized = true;
+BatchEvaluator LensSystemProblem::getActiveBatchEvaluator() const {
+    if (m_batchEvaluator == BatchEvaluator::Auto) {
+        return isOpenCLAvailable() ? BatchEvaluator::OpenCL : BatchEvaluator::Host;
+    }
+    if (m_batchEvaluator == BatchEvaluator::Heterogeneous && (!isOpenCLAvailable() || m_clShared->cpuDevice)) {
+        return BatchEvaluator::Host;
+    }
+    return m_batchEvaluator;
 }
 
 pagmo::vector_double LensSystemProblem::batch_fitness(const pagmo::vector_double& pop) const {
+    if (!m_surrogate) {
+        return batchFitnessExact(pop);
+    }
+    FitnessSurrogate& surrogate = *m_surrogate;
+    const int num_candidates = pop.size() / m_dim;
+    std::vector<double> predictions;
+    std::vector<int> exact = surrogate.screen(pop.data(), num_candidates, predictions);
+    const bool screened = exact.size() < static_cast<size_t>(num_candidates);
+    pagmo::vector_double exactPop;
+    std::vector<const double*> dvs(exact.size());
+    std::vector<double> exactPredictions(exact.size());
+    if (screened) {
+        exactPop.resize(exact.size() * m_dim);
+    }
+    for (size_t j = 0; j < exact.size(); j++) {
+        dvs[j] = &pop[static_cast<size_t>(exact[j]) * m_dim];
+        exactPredictions[j] = predictions[exact[j]];
+        if (screened) {
+            std::copy_n(dvs[j], m_dim, &exactPop[j * m_dim]);
+        }
+    }
+    pagmo::vector_double exactFitness = batchFitnessExact(screened ? exactPop : pop);
+
+    pagmo::vector_double pop_fitness(num_candidates, surrogate.screenedFitness.load());
+    for (size_t j = 0; j < exact.size(); j++) {
+        pop_fitness[exact[j]] = exactFitness[j];
+    }
+    //Above the upper bound a value may be the lower bound a stopped evaluation returned, the surrogate does not train on it
+    const double upperBound = getUpperBound();
+    for (size_t j = 0; j < exact.size(); j++) {
+        if (exactFitness[j] > upperBound) {
+            exactFitness[j] = std::numeric_limits<double>::quiet_NaN();
+        }
+    }
+    surrogate.addEvaluations(dvs, exactFitness, exactPredictions);
+    surrogate.retrain();
+    return pop_fitness;
+}
+
+pagmo::vector_double LensSystemProblem::batchFitnessExact(const pagmo::vector_double& pop) const {
+    switch (getActiveBatchEvaluator()) {
+    case BatchEvaluator::Host:
+        return batchFitnessHost(pop);
+    case BatchEvaluator::Heterogeneous:
+        return batchFitnessHeterogeneous(pop);
+    default:
+        return batchFitnessOpenCL(pop);
+    }
+}
+
+const char* getBatchEvaluatorName(BatchEvaluator batchEvaluator) {
+    switch (batchEvaluator) {
+    case BatchEvaluator::Host:
+        return "host";
+    case BatchEvaluator::OpenCL:
+        return "OpenCL";
+    case BatchEvaluator::Heterogeneous:
+        return "host+OpenCL";
+    default:
+        return "auto";
+    }
+}
+
+pagmo::vector_double LensSystemProblem::batchFitnessHost(const pagmo::vector_double& pop) const {
+    const int num_candidates = pop.size() / m_dim;
+    pagmo::vector_double pop_fitness(num_candidates);
+    batchFitnessHost(pop.data(), num_candidates, pop_fitness.data());
+    return pop_fitness;
+}
+
+void LensSystemProblem::batchFitnessHost(const double* pop, int num_candidates, double* pop_fitness) const {
+    const double upperBound = getUpperBound();
+    auto evaluate = [&]() {
+        //Chunks of candidates per task, computeFitness keeps its scratch buffers per thread
+        tbb::parallel_for(tbb::blocked_range<int>(0, num_candidates, 16), [&](const tbb::blocked_range<int>& range) {
+            FitnessBoundStats stats;
+            FitnessBoundStats* rangeStats = m_branchAndBound ? &stats : nullptr;
+            if (m_simdFitness) {
+                for (int i = range.begin(); i < range.end(); i += getFitnessLaneWidth()) {
+                    computeFitnessLanes(pop + static_cast<size_t>(i) * m_dim, std::min(getFitnessLaneWidth(), range.end() - i), &pop_fitness[i], upperBound, rangeStats);
+                }
+            }
+            else {
+                for (int i = range.begin(); i < range.end(); i++) {
+                    pop_fitness[i] = computeFitness(pop + static_cast<size_t>(i) * m_dim, upperBound, rangeStats);
+                }
+            }
+            if (m_branchAndBound) {
+                m_branchAndBound->record(stats);
+            }
+        });
+    };
+    if (m_hostThreads > 0) {
+        tbb::task_arena arena(m_hostThreads);
+        arena.execute(evaluate);
+    }
+    else {
+        evaluate();
+    }
+}
+
+OpenCLBatchBuffers& OpenCLBatchBuffers::operator=(const OpenCLBatchBuffers&) {
+    releasePopulation();
+    queues.clear(); //may belong to the context of another problem
+    renderObjective = cl::Buffer();
+    renderObjectiveUploaded = false;
+    return *this;
+}
+
+void OpenCLBatchBuffers::releasePopulation() {
+    if (populationHost) {
+        try {
+            queues[0].queue.enqueueUnmapMemObject(populationStaging, populationHost);
+            queues[0].queue.enqueueUnmapMemObject(fitnessStaging, fitnessHost);
+            queues[0].queue.finish();
+        }
+        catch (const cl::Error& err) {
+            std::cerr << "OpenCL Unmap Error: " << err.what() << "(" << err.err() << ")" << std::endl;
+        }
+    }
+    populationHost = nullptr;
+    fitnessHost = nullptr;
+    for (OpenCLQueueBuffers& queue : queues) {
+        queue.population = cl::Buffer();
+        queue.fitness = cl::Buffer();
+        queue.capacity = 0;
+    }
+    populationStaging = cl::Buffer();
+    fitnessStaging = cl::Buffer();
+    capacity = 0;
+}
+
+void LensSystemProblem::prepareOpenCLBuffers(int num_candidates) const {
+    const int candidate_dim = m_dim;
+    const int num_render_obj = m_renderObjective.size();
+    OpenCLBatchBuffers& buffers = m_clBuffers;
+    std::vector<OpenCLQueueBuffers>& queues = getOpenCLQueues();
+    cl::CommandQueue& mapQueue = queues[0].queue;
+
+    // Grow the staging buffers to the population, pso_gen keeps the population size so this happens once per run. The
+    // device buffers of the queues grow to the chunk size in runOpenCLChunks.
+    if (static_cast<size_t>(num_candidates) > buffers.capacity) {
+        buffers.releasePopulation();
+        size_t populationBytes = getOpenCLScalarSize() * num_candidates * candidate_dim;
+        size_t fitnessBytes = getOpenCLScalarSize() * num_candidates;
+        buffers.populationStaging = cl::Buffer(m_clShared->context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, populationBytes);
+        buffers.fitnessStaging = cl::Buffer(m_clShared->context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, fitnessBytes);
+        buffers.populationHost = mapQueue.enqueueMapBuffer(buffers.populationStaging, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, populationBytes);
+        buffers.fitnessHost = mapQueue.enqueueMapBuffer(buffers.fitnessStaging, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, fitnessBytes);
+        buffers.capacity = num_candidates;
+    }
+
+    // The render objective only changes through setRenderObjective
+    if (!buffers.renderObjectiveUploaded) {
+        std::vector<double> h_renderObj(std::max(num_render_obj, 1) * 3);
+        for (int i = 0; i < num_render_obj; ++i) {
+            h_renderObj[i * 3 + 0] = m_renderObjective[i].quadCenterPos.x;
+            h_renderObj[i * 3 + 1] = m_renderObjective[i].quadCenterPos.y;
+            h_renderObj[i * 3 + 2] = m_renderObjective[i].quadHeight;
+        }
+        std::vector<float> h_renderObjFloat(h_renderObj.begin(), h_renderObj.end());
+        void* renderObjData = m_clShared->floatTransfer ? static_cast<void*>(h_renderObjFloat.data()) : h_renderObj.data();
+        buffers.renderObjective = cl::Buffer(m_clShared->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+            getOpenCLScalarSize() * h_renderObj.size(), renderObjData);
+        buffers.renderObjectiveUploaded = true;
+    }
+
+    for (OpenCLQueueBuffers& queue : queues) {
+        int arg = 2;
+        queue.kernel.setArg(arg++, buffers.renderObjective);
+        queue.kernel.setArg(arg++, candidate_dim);
+        queue.kernel.setArg(arg++, num_render_obj);
+        queue.kernel.setArg(arg++, m_light_angle_x);
+        queue.kernel.setArg(arg++, m_light_angle_y);
+        queue.kernel.setArg(arg++, getOpenCLUpperBound());
+        queue.kernel.setArg(arg++, queue.boundStats);
+    }
+}
+
+float LensSystemProblem::getOpenCLUpperBound() const {
+    // Rounded up, so no candidate below the bound stops on the float comparison
+    double upperBound = getUpperBound();
+    float upperBoundFloat = static_cast<float>(upperBound);
+    if (upperBoundFloat < upperBound) {
+        upperBoundFloat = std::nextafter(upperBoundFloat, std::numeric_limits<float>::infinity());
+    }
+    return upperBoundFloat;
+}
+
+void LensSystemProblem::runOpenCLChunks(int num_candidates, int chunk_size) const {
+    OpenCLBatchBuffers& buffers = m_clBuffers;
+    const size_t scalarSize = getOpenCLScalarSize();
+    const size_t candidateBytes = scalarSize * m_dim;
+    char* populationHost = static_cast<char*>(buffers.populationHost);
+    char* fitnessHost = static_cast<char*>(buffers.fitnessHost);
+    buffers.kernelEvents.resize((num_candidates + chunk_size - 1) / chunk_size);
+    // Work-items per candidate and per workgroup of the active kernel
+    const bool workgroupKernel = m_clShared->activeKernel == OpenCLFitnessKernel::Workgroup;
+    const size_t itemsPerCandidate = workgroupKernel ? OPENCL_WORKGROUP_SIZE : 1;
+    const cl::NDRange local = workgroupKernel ? cl::NDRange(OPENCL_WORKGROUP_SIZE) : cl::NullRange;
+    std::vector<OpenCLQueueBuffers>& queues = getOpenCLQueues();
+    // Grow the device buffers of the queues that get a chunk, chunks index their candidates from 0 within them
+    const size_t chunkCapacity = std::min(chunk_size, num_candidates);
+    const size_t usedQueues = std::min(buffers.kernelEvents.size(), queues.size());
+    for (size_t q = 0; q < usedQueues; q++) {
+        OpenCLQueueBuffers& queue = queues[q];
+        if (queue.capacity < chunkCapacity) {
+            queue.population = cl::Buffer(m_clShared->context, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, candidateBytes * chunkCapacity);
+            queue.fitness = cl::Buffer(m_clShared->context, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, scalarSize * chunkCapacity);
+            queue.kernel.setArg(0, queue.population);
+            queue.kernel.setArg(1, queue.fitness);
+            queue.capacity = chunkCapacity;
+        }
+    }
+    // Each queue is in order, so a chunk's upload, kernel and read back follow each other and the next chunk of the queue
+    // overwrites its buffers only after them, while the other queues work on the neighbouring chunks in theirs
+    for (int chunk = 0; chunk * chunk_size < num_candidates; chunk++) {
+        const int start = chunk * chunk_size;
+        const int count = std::min(chunk_size, num_candidates - start);
+        OpenCLQueueBuffers& queue = queues[chunk % queues.size()];
+        queue.queue.enqueueWriteBuffer(queue.population, CL_FALSE, 0, count * candidateBytes, populationHost + start * candidateBytes);
+        queue.queue.enqueueNDRangeKernel(queue.kernel, cl::NullRange, cl::NDRange(count * itemsPerCandidate), local, nullptr, &buffers.kernelEvents[chunk]);
+        queue.queue.enqueueReadBuffer(queue.fitness, CL_FALSE, 0, scalarSize * count, fitnessHost + scalarSize * start);
+    }
+    for (OpenCLQueueBuffers& queue : queues) {
+        queue.queue.finish();
+    }
+    buffers.lastKernelMs = 0.0;
+    for (cl::Event& kernelEvent : buffers.kernelEvents) {
+        buffers.lastKernelMs += (kernelEvent.getProfilingInfo<CL_PROFILING_COMMAND_END>() - kernelEvent.getProfilingInfo<CL_PROFILING_COMMAND_START>()) / 1e6;
+    }
+}
+
+std::string LensSystemProblem::getOpenCLDeviceKey() const {
+    return m_clShared->device.getInfo<CL_DEVICE_NAME>() + " (" + m_clShared->device.getInfo<CL_DRIVER_VERSION>() + ")";
+}
+
+std::vector<OpenCLQueueBuffers>& LensSystemProblem::getOpenCLQueues() const {
+    std::vector<OpenCLQueueBuffers>& queues = m_clBuffers.queues;
+    while (queues.size() < OPENCL_PIPELINE_QUEUES) {
+        OpenCLQueueBuffers queue;
+        queue.queue = cl::CommandQueue(m_clShared->context, m_clShared->device, CL_QUEUE_PROFILING_ENABLE);
+        queue.kernel = cl::Kernel(m_clShared->program, getOpenCLKernelName(m_clShared->activeKernel));
+        queue.boundStats = cl::Buffer(m_clShared->context, CL_MEM_READ_WRITE, 3 * sizeof(cl_int));
+        queues.push_back(queue);
+    }
+    return queues;
+}
+
+int loadOpenCLDeviceSetting(const char* fileName, const std::string& deviceKey) {
+    std::ifstream file(fileName);
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t tab = line.rfind('\t');
+        if (tab != std::string::npos && line.substr(0, tab) == deviceKey) {
+            return std::max(1, std::atoi(line.c_str() + tab + 1));
+        }
+    }
+    return 0;
+}
+
+void saveOpenCLDeviceSetting(const char* fileName, const std::string& deviceKey, int value) {
+    std::vector<std::string> lines;
+    std::ifstream inFile(fileName);
+    std::string line;
+    while (std::getline(inFile, line)) {
+        if (line.substr(0, line.rfind('\t')) != deviceKey) {
+            lines.push_back(line);
+        }
+    }
+    inFile.close();
+    lines.push_back(deviceKey + "\t" + std::to_string(value));
+    std::ofstream outFile(fileName);
+    if (!outFile.is_open()) {
+        std::cerr << "Error: Could not write " << fileName << std::endl;
+        return;
+    }
+    for (const std::string& l : lines) {
+        outFile << l << std::endl;
+    }
+}
+
+int LensSystemProblem::getOpenCLChunkSize(int num_candidates) const {
+    if (m_clChunkSize == 0) {
+        m_clChunkSize = m_clShared->chunkSize;
+    }
+    if (m_clChunkSize == 0) {
+        // One copy autotunes, the others wait for its chunk size instead of loading the device with their own runs
+        std::lock_guard<std::mutex> lock(m_clShared->mutex);
+        if (m_clShared->chunkSize == 0) {
+            int chunkSize = loadOpenCLDeviceSetting(OPENCL_CHUNK_SIZE_FILE, getOpenCLDeviceKey());
+            m_clShared->chunkSize = chunkSize > 0 ? chunkSize : autotuneChunkSize(num_candidates);
+        }
+        m_clChunkSize = m_clShared->chunkSize;
+    }
+    return m_clChunkSize;
+}
+
+int LensSystemProblem::autotuneChunkSize(int num_candidates) const {
+    int bestChunkSize = num_candidates;
+    double bestMs = std::numeric_limits<double>::infinity();
+    // Powers of two from 256 candidates up to the whole population, best of three runs each
+    for (int chunkSize = 256;; chunkSize *= 2) {
+        chunkSize = std::min(chunkSize, num_candidates);
+        for (int run = 0; run < 3; run++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            runOpenCLChunks(num_candidates, chunkSize);
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+            if (ms < bestMs) {
+                bestMs = ms;
+                bestChunkSize = chunkSize;
+            }
+        }
+        if (chunkSize == num_candidates) {
+            break;
+        }
+    }
+    std::cout << "OpenCL chunk size for " << getOpenCLDeviceKey() << ": " << bestChunkSize << " candidates (" << bestMs << " ms for " << num_candidates << ")" << std::endl;
+    saveOpenCLDeviceSetting(OPENCL_CHUNK_SIZE_FILE, getOpenCLDeviceKey(), bestChunkSize);
+    return bestChunkSize;
+}
+
+pagmo::vector_double LensSystemProblem::batchFitnessOpenCL(const pagmo::vector_double& pop) const {
+    const int num_candidates = pop.size() / m_dim;
+    pagmo::vector_double pop_fitness(num_candidates);
+    batchFitnessOpenCL(pop.data(), num_candidates, pop_fitness.data());
+    return pop_fitness;
+}
+
+void LensSystemProblem::batchFitnessOpenCL(const double* pop, int num_candidates, double* out) const {
     // Ensure OpenCL is initialized
     initializeOpenCL();
+    if (num_candidates == 0) {
+        return;
+    }
+    const double* popEnd = pop + static_cast<size_t>(num_candidates) * m_dim;
+    if (!m_clPersistentBuffers) {
+        pagmo::vector_double pop_fitness = batchFitnessOpenCLPerCall(pagmo::vector_double(pop, popEnd));
+        std::copy(pop_fitness.begin(), pop_fitness.end(), out);
+        return;
+    }
+
+    OpenCLBatchBuffers& buffers = m_clBuffers;
+    std::lock_guard<std::mutex> lock(buffers.mutex);
+    try {
+        prepareOpenCLBuffers(num_candidates);
+        // Converted to the transfer precision while filling the pinned staging buffer
+        if (m_clShared->floatTransfer) {
+            std::copy(pop, popEnd, static_cast<float*>(buffers.populationHost));
+        }
+        else {
+            std::copy(pop, popEnd, static_cast<double*>(buffers.populationHost));
+        }
+        const bool bounded = m_branchAndBound && getUpperBound() < std::numeric_limits<double>::infinity();
+        const int chunkSize = getOpenCLChunkSize(num_candidates);
+        if (bounded) {
+            // Each queue clears its counters before its first chunk, the kernels of the queue add to them
+            for (OpenCLQueueBuffers& queue : getOpenCLQueues()) {
+                queue.queue.enqueueFillBuffer(queue.boundStats, cl_int(0), 0, 3 * sizeof(cl_int));
+            }
+        }
+        runOpenCLChunks(num_candidates, chunkSize);
+        if (bounded) {
+            FitnessBoundStats stats;
+            stats.candidates = num_candidates;
+            for (OpenCLQueueBuffers& queue : getOpenCLQueues()) {
+                cl_int boundStats[3];
+                queue.queue.enqueueReadBuffer(queue.boundStats, CL_TRUE, 0, sizeof(boundStats), boundStats);
+                stats.stopped += boundStats[0];
+                stats.ghosts += boundStats[1];
+                stats.skippedGhosts += boundStats[2];
+            }
+            m_branchAndBound->record(stats);
+        }
+    }
+    catch (const cl::Error& err) {
+        std::cerr << "OpenCL Kernel Error: " << err.what() << "(" << err.err() << ")" << std::endl;
+        throw;
+    }
+
+    if (m_clShared->floatTransfer) {
+        const float* fitnessHost = static_cast<const float*>(buffers.fitnessHost);
+        std::copy(fitnessHost, fitnessHost + num_candidates, out);
+    }
+    else {
+        const double* fitnessHost = static_cast<const double*>(buffers.fitnessHost);
+        std::copy(fitnessHost, fitnessHost + num_candidates, out);
+    }
+}
+
+pagmo::vector_double LensSystemProblem::batchFitnessHeterogeneous(const pagmo::vector_double& pop) const {
+    const int num_candidates = pop.size() / m_dim;
+    pagmo::vector_double pop_fitness(num_candidates);
+    if (!isOpenCLAvailable() || m_clShared->cpuDevice) {
+        batchFitnessHost(pop.data(), num_candidates, pop_fitness.data());
+        return pop_fitness;
+    }
+
+    // The front of the population goes to OpenCL and the back to the host, both write their part of pop_fitness
+    const int openCLCandidates = static_cast<int>(std::lround(m_heterogeneousSplit.getOpenCLShare() * num_candidates));
+    const int hostCandidates = num_candidates - openCLCandidates;
+    // The OpenCL part is a task a TBB worker picks up, instead of a thread created per call. The worker blocks until the
+    // queues finish, and some drivers spin while waiting, so it may take a core from the host evaluation; the split then
+    // sees a slower host. The host part is isolated, so this thread does not run the OpenCL task inside it; when no worker
+    // took the task, wait() runs it after the host part.
+    double openCLMs = 0.0;
+    tbb::task_group openCLTask;
+    openCLTask.run([&]() {
+        auto start = std::chrono::high_resolution_clock::now();
+        batchFitnessOpenCL(pop.data(), openCLCandidates, pop_fitness.data());
+        openCLMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    });
+    auto start = std::chrono::high_resolution_clock::now();
+    tbb::this_task_arena::isolate([&]() {
+        batchFitnessHost(pop.data() + static_cast<size_t>(openCLCandidates) * m_dim, hostCandidates, pop_fitness.data() + openCLCandidates);
+    });
+    double hostMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    openCLTask.wait();
+    m_heterogeneousSplit.update(openCLCandidates, openCLMs, hostCandidates, hostMs);
+    return pop_fitness;
+}
+
+double HeterogeneousSplit::getOpenCLShare() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return openCLShare;
+}
+
+void HeterogeneousSplit::update(int openCLCandidates, double openCLMs, int hostCandidates, double hostMs) {
+    std::lock_guard<std::mutex> lock(mutex);
+    //the first call includes the OpenCL setup and chunk size autotuning
+    if (!measured) {
+        measured = true;
+        return;
+    }
+    if (openCLCandidates == 0 || hostCandidates == 0) {
+        return;
+    }
+    // Both sides finish together when the share matches their throughput ratio. Half a step per call, so one slow call
+    // does not swing the split, and both sides keep some candidates to stay measured.
+    double openCLRate = openCLCandidates / std::max(openCLMs, 1e-3);
+    double hostRate = hostCandidates / std::max(hostMs, 1e-3);
+    double target = openCLRate / (openCLRate + hostRate);
+    openCLShare = std::clamp(0.5 * openCLShare + 0.5 * target, HETEROGENEOUS_MIN_SHARE, 1.0 - HETEROGENEOUS_MIN_SHARE);
+}
+
+HeterogeneousSplit& HeterogeneousSplit::operator=(const HeterogeneousSplit& other) {
+    double share = other.getOpenCLShare();
+    std::lock_guard<std::mutex> lock(mutex);
+    openCLShare = share;
+    return *this;
+}
 
+//Buffers and kernel created for every call, kept to measure what the persistent ones save
+pagmo::vector_double LensSystemProblem::batchFitnessOpenCLPerCall(const pagmo::vector_double& pop) const {
     const int num_candidates = pop.size() / m_dim;
     const int candidate_dim = m_dim; // your dimension per candidate
     const int num_render_obj = m_renderObjective.size();
@@ -257,15 +1018,23 @@ pagmo::vector_double LensSystemProblem::batch_fitness(const pagmo::vector_double
         h_renderObj[i * 3 + 2] = m_renderObjective[i].quadHeight;
     }
 
+    // Float copies for the float transfer path
+    std::vector<float> h_populationFloat, h_renderObjFloat;
+    if (m_clShared->floatTransfer) {
+        h_populationFloat.assign(h_population.begin(), h_population.end());
+        h_renderObjFloat.assign(h_renderObj.begin(), h_renderObj.end());
+    }
+    const size_t scalarSize = getOpenCLScalarSize();
+
     // Create OpenCL buffers.
-    cl::Buffer d_population(m_clContext, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-        sizeof(double) * h_population.size(), h_population.data());
-    cl::Buffer d_renderObj(m_clContext, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-        sizeof(double) * h_renderObj.size(), h_renderObj.data());
-    cl::Buffer d_fitness(m_clContext, CL_MEM_WRITE_ONLY, sizeof(double) * num_candidates);
+    cl::Buffer d_population(m_clShared->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+        scalarSize * h_population.size(), m_clShared->floatTransfer ? static_cast<void*>(h_populationFloat.data()) : h_population.data());
+    cl::Buffer d_renderObj(m_clShared->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+        scalarSize * h_renderObj.size(), m_clShared->floatTransfer ? static_cast<void*>(h_renderObjFloat.data()) : h_renderObj.data());
+    cl::Buffer d_fitness(m_clShared->context, CL_MEM_WRITE_ONLY, scalarSize * num_candidates);
 
     // Create the kernel.
-    cl::Kernel kernel(m_clProgram, "batch_fitness_kernel");
+    cl::Kernel kernel(m_clShared->program, getOpenCLKernelName(m_clShared->activeKernel));
 
     // Set kernel arguments.
     int arg = 0;
@@ -276,12 +1045,23 @@ pagmo::vector_double LensSystemProblem::batch_fitness(const pagmo::vector_double
     kernel.setArg(arg++, num_render_obj);
     kernel.setArg(arg++, m_light_angle_x);
     kernel.setArg(arg++, m_light_angle_y);
+    // No bound, this path measures the host overhead of the evaluation
+    cl::Buffer d_boundStats(m_clShared->context, CL_MEM_READ_WRITE, 3 * sizeof(cl_int));
+    kernel.setArg(arg++, std::numeric_limits<float>::infinity());
+    kernel.setArg(arg++, d_boundStats);
 
     // Launch the kernel.
-    cl::NDRange global(num_candidates);
+    const bool workgroupKernel = m_clShared->activeKernel == OpenCLFitnessKernel::Workgroup;
+    cl::NDRange global(workgroupKernel ? num_candidates * OPENCL_WORKGROUP_SIZE : num_candidates);
+    cl::NDRange local = workgroupKernel ? cl::NDRange(OPENCL_WORKGROUP_SIZE) : cl::NullRange;
+    cl::Event kernelEvent;
+    // The queues belong to m_clBuffers
+    std::lock_guard<std::mutex> lock(m_clBuffers.mutex);
+    cl::CommandQueue& queue = getOpenCLQueues()[0].queue;
     try {
-        m_clQueue.enqueueNDRangeKernel(kernel, cl::NullRange, global, cl::NullRange);
-        m_clQueue.finish();
+        queue.enqueueNDRangeKernel(kernel, cl::NullRange, global, local, nullptr, &kernelEvent);
+        queue.finish();
+        m_clBuffers.lastKernelMs = (kernelEvent.getProfilingInfo<CL_PROFILING_COMMAND_END>() - kernelEvent.getProfilingInfo<CL_PROFILING_COMMAND_START>()) / 1e6;
     }
     catch (const cl::Error& err) {
         std::cerr << "OpenCL Kernel Error: " << err.what() << "(" << err.err() << ")" << std::endl;
@@ -290,7 +1070,14 @@ pagmo::vector_double LensSystemProblem::batch_fitness(const pagmo::vector_double
 
     // Read back the fitness results.
     std::vector<double> h_fitness(num_candidates);
-    m_clQueue.enqueueReadBuffer(d_fitness, CL_TRUE, 0, sizeof(double) * num_candidates, h_fitness.data());
+    if (m_clShared->floatTransfer) {
+        std::vector<float> h_fitnessFloat(num_candidates);
+        queue.enqueueReadBuffer(d_fitness, CL_TRUE, 0, scalarSize * num_candidates, h_fitnessFloat.data());
+        h_fitness.assign(h_fitnessFloat.begin(), h_fitnessFloat.end());
+    }
+    else {
+        queue.enqueueReadBuffer(d_fitness, CL_TRUE, 0, scalarSize * num_candidates, h_fitness.data());
+    }
 
     // Convert to pagmo vector_double format.
     pagmo::vector_double pop_fitness;
@@ -326,6 +1113,13 @@ void sortByQuadHeight(std::vector<SnapshotData>& snapshotDataUnsorted) {
         });
 }
 
+void selectSmallestQuadHeights(std::vector<SnapshotData>& snapshotData, size_t count) {
+    std::partial_sort(snapshotData.begin(), snapshotData.begin() + std::min(count, snapshotData.size()), snapshotData.end(),
+        [](const SnapshotData& a, const SnapshotData& b) {
+            return a.quadHeight < b.quadHeight;
+        });
+}
+
 std::vector<std::vector<double>> runEA(pagmo::population pop,
     float light_angle_x,
     float light_angle_y,
@@ -339,7 +1133,20 @@ std::vector<std::vector<double>> runEA(pagmo::population pop,
     csvFile << "######################################################################" << std::endl;
     csvFile << "Light Angle X," << light_angle_x << std::endl;
     csvFile << "Light Angle Y," << light_angle_y << std::endl;
-    csvFile << "Generation,Elapsed Time (sec),Total Evaluations,Best Fitness" << std::endl;
+    // Statistics of the problem's branch and bound and surrogate, when it has them
+    const LensSystemProblem* lensProblem = pop.get_problem().extract<LensSystemProblem>();
+    // Branch and bound and the surrogate only for pso_gen, see FitnessBranchAndBound
+    const bool psoGen = algo.extract<pagmo::pso_gen>() != nullptr;
+    std::shared_ptr<FitnessBranchAndBound> branchAndBound = lensProblem && psoGen ? lensProblem->m_branchAndBound : nullptr;
+    std::shared_ptr<FitnessSurrogate> surrogate = lensProblem && psoGen ? lensProblem->m_surrogate : nullptr;
+    csvFile << "Generation,Elapsed Time (sec),Total Evaluations,Best Fitness";
+    if (branchAndBound) {
+        csvFile << ",Upper Bound,Stopped Early,Ghosts Skipped";
+    }
+    if (surrogate) {
+        csvFile << ",Exact Evaluations,Screened,Surrogate Error";
+    }
+    csvFile << std::endl;
 
     // Get initial champion.
     std::vector<double> c_solution = pop.champion_x();
@@ -353,10 +1160,29 @@ std::vector<std::vector<double>> runEA(pagmo::population pop,
 
     auto start = std::chrono::high_resolution_clock::now();
     unsigned long long total_fevals = 0;
+    // pagmo counts the screened candidates as evaluations too
+    unsigned long long exactEvaluations = 0;
+    if (surrogate) {
+        surrogate->takeStats();
+    }
 
     // Evolution loop for 40 generations.
     for (int gen = 0; gen < 10; ++gen) {
         std::cout << "EVOLVING GEN " << gen << std::endl;
+        // The personal bests only improve during an evolve, a candidate above the worst of them is always discarded
+        double upperBound = 0.0;
+        if (branchAndBound || surrogate) {
+            for (const auto& f : pop.get_f()) {
+                upperBound = std::max(upperBound, f[0]);
+            }
+        }
+        if (branchAndBound) {
+            branchAndBound->upperBound = upperBound;
+            branchAndBound->takeStats();
+        }
+        if (surrogate) {
+            surrogate->screenedFitness = std::nextafter(upperBound, std::numeric_limits<double>::infinity());
+        }
         // Evolve the population using the provided algorithm.
         pop = algo.evolve(pop);
 
@@ -374,7 +1200,28 @@ std::vector<std::vector<double>> runEA(pagmo::population pop,
         csvFile << gen << ","
             << elapsed_secs << ","
             << total_fevals << ","
-            << best_fitness << std::endl;
+            << best_fitness;
+        if (branchAndBound) {
+            FitnessBoundStats stats = branchAndBound->takeStats();
+            double stoppedEarly = stats.candidates > 0 ? static_cast<double>(stats.stopped) / stats.candidates : 0.0;
+            double ghostsSkipped = stats.ghosts > 0 ? static_cast<double>(stats.skippedGhosts) / stats.ghosts : 0.0;
+            std::cout << "Branch and bound: " << stats.stopped << " of " << stats.candidates << " candidates stopped early, "
+                << stats.skippedGhosts << " of " << stats.ghosts << " ghosts skipped" << std::endl;
+            csvFile << "," << upperBound << "," << stoppedEarly << "," << ghostsSkipped;
+        }
+        if (surrogate) {
+            FitnessSurrogate::Stats stats = surrogate->takeStats();
+            exactEvaluations += stats.exact;
+            std::cout << "Surrogate: " << stats.screened << " screened, " << stats.exact << " evaluated exactly, mean log error " << stats.getMeanError() << std::endl;
+            csvFile << "," << exactEvaluations << "," << stats.getScreenedFraction() << "," << stats.getMeanError();
+        }
+        csvFile << std::endl;
+    }
+    if (branchAndBound) {
+        branchAndBound->upperBound = std::numeric_limits<double>::infinity();
+    }
+    if (surrogate) {
+        surrogate->screenedFitness = std::numeric_limits<double>::infinity();
     }
 
     // Final time computations.
@@ -387,6 +1234,10 @@ std::vector<std::vector<double>> runEA(pagmo::population pop,
     csvFile << std::endl;
     csvFile << "Final Computation Time (min:sec):," << minutes << ":" << seconds << std::endl;
     csvFile << "Total Function Evaluations:," << total_fevals << std::endl;
+    if (surrogate) {
+        std::cout << "Surrogate: " << exactEvaluations << " exact evaluations" << std::endl;
+        csvFile << "Exact Function Evaluations:," << exactEvaluations << std::endl;
+    }
 
     // Gather all individuals in the population and sort them by fitness.
     auto xs = pop.get_x();
@@ -432,10 +1283,57 @@ std::vector<std::vector<double>> runEA(pagmo::population pop,
 }
 
 
+const char* getLensOptimizerName(LensOptimizer optimizer) {
+    switch (optimizer) {
+    case LensOptimizer::PsoGen:
+        return "pso_gen";
+    case LensOptimizer::RVGomea:
+        return "RV-GOMEA";
+    }
+    return "unknown";
+}
+
+RVGomea makeLensRVGomea(const LensSystemProblem& problem, unsigned gen, unsigned seed, bool partialEvaluation) {
+    RVGomea gomea(gen, seed);
+    std::vector<std::vector<int>> linkageGroups = { { 0, 1 } };
+    for (int i = 0; i < static_cast<int>(problem.m_num_interfaces); i++) {
+        linkageGroups.push_back({ 2 + (PARAMS_PER_INTERFACE * i), 2 + (PARAMS_PER_INTERFACE * i) + 1, 2 + (PARAMS_PER_INTERFACE * i) + 2 });
+    }
+    gomea.setLinkageGroups(linkageGroups);
+    if (partialEvaluation) {
+        auto evaluatorProblem = std::make_shared<const LensSystemProblem>(problem);
+        gomea.setPartialEvaluator([evaluatorProblem]() { return std::make_unique<LensPartialEvaluator>(evaluatorProblem); });
+    }
+    return gomea;
+}
+
+//Algorithm and initial population of solveLensAnnotations, psoPopulationPerVariable candidates per decision variable for
+//pso_gen and the population size guideline for RV-GOMEA
+static pagmo::population initLensOptimizer(const LensSystemProblem& problem, const pagmo::problem& prob, LensOptimizer optimizer, unsigned int psoPopulationPerVariable, bool partialEvaluation, pagmo::algorithm& algo) {
+    pagmo::bfe my_bfe(my_udbfe);
+    if (optimizer == LensOptimizer::RVGomea) {
+        algo = pagmo::algorithm{ makeLensRVGomea(problem, 25u, pagmo::random_device::next(), partialEvaluation) };
+        return pagmo::population(prob, my_bfe, RVGomea::getPopulationSizeGuideline(problem.m_dim));
+    }
+    pagmo::pso_gen pso_geny(200u);
+    pso_geny.set_bfe(my_bfe);
+    algo = pagmo::algorithm{ pso_geny };
+    return pagmo::population(prob, my_bfe, psoPopulationPerVariable * problem.m_dim);
+}
+
+static const char* getLensOptimizerLogFile(LensOptimizer optimizer) {
+    return optimizer == LensOptimizer::RVGomea ? "rv_gomea.csv" : "pso_gen_gpu.csv";
+}
+
 std::vector<LensSystem> solveLensAnnotations(LensSystem& currentLensSystem,
     std::vector<SnapshotData>& renderObjective,
     float light_angle_x,
-    float light_angle_y) {
+    float light_angle_y,
+    BatchEvaluator batchEvaluator,
+    LensOptimizer optimizer,
+    bool branchAndBound,
+    bool surrogate,
+    bool partialEvaluation) {
     // Retrieve current lens interfaces and the number of interfaces.
     std::vector<LensInterface> currentLensInterfaces = currentLensSystem.getLensInterfaces();
     unsigned int num_interfaces = currentLensInterfaces.size();
@@ -444,6 +1342,19 @@ std::vector<LensSystem> solveLensAnnotations(LensSystem& currentLensSystem,
     LensSystemProblem my_problem;
     my_problem.init(num_interfaces, light_angle_x, light_angle_y);
     my_problem.setRenderObjective(renderObjective);
+    //RV-GOMEA evaluates on the host, its initial population too so the whole run compares computeFitness values
+    my_problem.m_batchEvaluator = optimizer == LensOptimizer::RVGomea ? BatchEvaluator::Host : batchEvaluator;
+    if (branchAndBound) {
+        my_problem.m_branchAndBound = std::make_shared<FitnessBranchAndBound>();
+    }
+    if (surrogate && optimizer == LensOptimizer::PsoGen) {
+        my_problem.m_surrogate = std::make_shared<FitnessSurrogate>(my_problem.m_lb, my_problem.m_ub);
+    }
+    std::cout << "Batch evaluator: " << getBatchEvaluatorName(my_problem.getActiveBatchEvaluator()) << std::endl;
+    std::cout << "Optimizer: " << getLensOptimizerName(optimizer)
+        << (branchAndBound && optimizer == LensOptimizer::PsoGen ? " with branch and bound" : "")
+        << (my_problem.m_surrogate ? " with surrogate pre-screening" : "")
+        << (partialEvaluation && optimizer == LensOptimizer::RVGomea ? " with partial evaluation" : "") << std::endl;
     pagmo::problem prob{ my_problem };
     
     std::cout << "Created Pagmo UDP" << prob.has_batch_fitness() << std::endl;
@@ -463,16 +1374,12 @@ std::vector<LensSystem> solveLensAnnotations(LensSystem& currentLensSystem,
 
     std::vector<unsigned> seeds = {100, 200, 300, 400, 500, 600, 700, 800, 900, 4747, 6969};
      
-    unsigned int amount_dv = current_point.size();
     std::vector<std::vector<double>> top5_decision_vectors;
 
-    pagmo::bfe my_bfe(my_udbfe);
-    pagmo::pso_gen pso_geny(200u);
-	pso_geny.set_bfe(my_bfe);
-    pagmo::algorithm algo{ pso_geny };
-    pagmo::population pop(prob, my_bfe, 500 * amount_dv);
+    pagmo::algorithm algo;
+    pagmo::population pop = initLensOptimizer(my_problem, prob, optimizer, 500u, partialEvaluation, algo);
 
-    top5_decision_vectors = runEA(pop, light_angle_x, light_angle_y, "pso_gen_gpu.csv", algo);
+    top5_decision_vectors = runEA(pop, light_angle_x, light_angle_y, getLensOptimizerLogFile(optimizer), algo);
 
 
     std::vector<LensSystem> top5_lens_systems;
@@ -566,27 +1473,40 @@ int interfacesNeeded(int ghostsWanted) {
 
 std::vector<LensSystem> solveLensAnnotations(std::vector<SnapshotData>& renderObjective,
     float light_angle_x,
-    float light_angle_y) {
+    float light_angle_y,
+    BatchEvaluator batchEvaluator,
+    LensOptimizer optimizer,
+    bool branchAndBound,
+    bool surrogate,
+    bool partialEvaluation) {
 
     unsigned int num_interfaces = interfacesNeeded(renderObjective.size());
 
     LensSystemProblem my_problem;
     my_problem.init(num_interfaces, light_angle_x, light_angle_y);
     my_problem.setRenderObjective(renderObjective);
+    //RV-GOMEA evaluates on the host, its initial population too so the whole run compares computeFitness values
+    my_problem.m_batchEvaluator = optimizer == LensOptimizer::RVGomea ? BatchEvaluator::Host : batchEvaluator;
+    if (branchAndBound) {
+        my_problem.m_branchAndBound = std::make_shared<FitnessBranchAndBound>();
+    }
+    if (surrogate && optimizer == LensOptimizer::PsoGen) {
+        my_problem.m_surrogate = std::make_shared<FitnessSurrogate>(my_problem.m_lb, my_problem.m_ub);
+    }
+    std::cout << "Batch evaluator: " << getBatchEvaluatorName(my_problem.getActiveBatchEvaluator()) << std::endl;
+    std::cout << "Optimizer: " << getLensOptimizerName(optimizer)
+        << (branchAndBound && optimizer == LensOptimizer::PsoGen ? " with branch and bound" : "")
+        << (my_problem.m_surrogate ? " with surrogate pre-screening" : "")
+        << (partialEvaluation && optimizer == LensOptimizer::RVGomea ? " with partial evaluation" : "") << std::endl;
     pagmo::problem prob{ my_problem };
     std::cout << "Created Pagmo UDP" << std::endl;
 
     //pagmo::algorithm algo{ pagmo::pso{200} };
 
-    unsigned int amount_dv = 2 + (num_interfaces * PARAMS_PER_INTERFACE);
-
-    pagmo::bfe my_bfe(my_udbfe);
-    pagmo::pso_gen pso_geny(200u);
-    pso_geny.set_bfe(my_bfe);
-    pagmo::algorithm algo{ pso_geny };
-    pagmo::population pop(prob, my_bfe, 200 * amount_dv);
+    pagmo::algorithm algo;
+    pagmo::population pop = initLensOptimizer(my_problem, prob, optimizer, 200u, partialEvaluation, algo);
 
-    std::vector<std::vector<double>> top5_champions = runEA(pop, light_angle_x, light_angle_y, "pso_gen_gpu.csv", algo);
+    std::vector<std::vector<double>> top5_champions = runEA(pop, light_angle_x, light_angle_y, getLensOptimizerLogFile(optimizer), algo);
 
     std::vector<LensSystem> top5_lens_systems;
     for (const auto& candidate : top5_champions) {
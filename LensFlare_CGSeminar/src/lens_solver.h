@@ -1,13 +1,167 @@
 #pragma once
 
 #include <iostream>
+#include <filesystem>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <chrono>
+#include <limits>
 #include <pagmo/types.hpp>
 #include <pagmo/problem.hpp>
 #include "lens_system.h"
+#include "ghost_table.h"
 #include "quad.h"
+#include "rv_gomea.h"
+#include "fitness_surrogate.h"
 #define CL_HPP_ENABLE_EXCEPTIONS
 #include <CL/opencl.hpp>
 
+// Where LensSystemProblem::batch_fitness evaluates a population. Auto uses OpenCL when a GPU device and the kernel can be
+// set up, and the host otherwise. Heterogeneous splits every population between OpenCL and the host cores, it uses the
+// host alone when the OpenCL device is a CPU.
+enum class BatchEvaluator {
+    Auto,
+    Host,
+    OpenCL,
+    Heterogeneous
+};
+
+const char* getBatchEvaluatorName(BatchEvaluator batchEvaluator);
+
+// Share of every population batchFitnessHeterogeneous sends to OpenCL, moved after each call towards the throughput ratio
+// of the OpenCL device and the host. A copy keeps the share.
+struct HeterogeneousSplit {
+    HeterogeneousSplit() = default;
+    HeterogeneousSplit(const HeterogeneousSplit& other) : openCLShare(other.getOpenCLShare()) {}
+    HeterogeneousSplit& operator=(const HeterogeneousSplit& other);
+    double getOpenCLShare() const;
+    // Time both sides took for their candidates in the last call
+    void update(int openCLCandidates, double openCLMs, int hostCandidates, double hostMs);
+
+    mutable std::mutex mutex; //batch_fitness may be called concurrently on the same problem
+    double openCLShare = 0.5;
+    bool measured = false;
+};
+
+// Smallest share of the population either side of batchFitnessHeterogeneous gets
+constexpr double HETEROGENEOUS_MIN_SHARE = 0.01;
+
+// Device side of one of the queues batchFitnessOpenCL pipelines the chunks over. The chunks of a queue run one after the
+// other, so they reuse its buffers; commands of different queues may overlap, so no buffer a kernel writes is shared.
+struct OpenCLQueueBuffers {
+    cl::CommandQueue queue; //in order, with profiling
+    cl::Kernel kernel; //bound to the buffers below
+    cl::Buffer population;
+    cl::Buffer fitness;
+    cl::Buffer boundStats; //stopped candidates, ghosts and skipped ghosts of a bounded call, see FitnessBoundStats
+    size_t capacity = 0; //candidates of a chunk
+};
+
+// Pinned staging buffers, queues and render objective batchFitnessOpenCL keeps between calls. The buffers grow to the
+// largest population seen. A copy starts out empty, since pagmo copies the problem into every island and the copies may
+// evaluate concurrently; the context and program are shared between copies through OpenCLSharedState.
+struct OpenCLBatchBuffers {
+    OpenCLBatchBuffers() = default;
+    OpenCLBatchBuffers(const OpenCLBatchBuffers&) {}
+    OpenCLBatchBuffers& operator=(const OpenCLBatchBuffers&);
+    ~OpenCLBatchBuffers() { releasePopulation(); }
+    // Unmaps the staging buffers and drops the population and fitness buffers of the queues
+    void releasePopulation();
+
+    std::mutex mutex; //batch_fitness may be called concurrently on the same problem
+    std::vector<OpenCLQueueBuffers> queues; //OPENCL_PIPELINE_QUEUES, the staging buffers are mapped on the first
+    cl::Buffer renderObjective; //only read by the kernels, so the queues share it
+    cl::Buffer populationStaging; //CL_MEM_ALLOC_HOST_PTR, mapped for the lifetime of the buffers
+    cl::Buffer fitnessStaging;
+    void* populationHost = nullptr; //float or double values, see LensSystemProblem::getOpenCLScalarSize
+    void* fitnessHost = nullptr;
+    size_t capacity = 0; //candidates
+    bool renderObjectiveUploaded = false;
+    std::vector<cl::Event> kernelEvents; //one per chunk of the last call
+    double lastKernelMs = 0.0; //device time of the kernels of the last call, from the profiling events
+};
+
+// The kernel batchFitnessOpenCL launches. Candidate runs one work-item per candidate (batch_fitness_kernel), Workgroup one
+// workgroup of OPENCL_WORKGROUP_SIZE work-items per candidate with the ghosts spread over the work-items
+// (batch_fitness_workgroup_kernel). Auto takes Workgroup from the crossover interface count of the device on.
+enum class OpenCLFitnessKernel {
+    Auto,
+    Candidate,
+    Workgroup
+};
+
+// Context, device and program a problem shares with all its copies. initializeOpenCL builds them once under the mutex,
+// they are read-only once initialized is set. Each copy evaluates on its own queues (OpenCLBatchBuffers), so islands
+// evaluating concurrently only share the device.
+struct OpenCLSharedState {
+    std::mutex mutex;
+    std::atomic<bool> initialized = false;
+    std::atomic<bool> unavailable = false;
+    cl::Context context;
+    cl::Device device;
+    cl::Program program;
+    OpenCLFitnessKernel activeKernel = OpenCLFitnessKernel::Candidate; //m_clKernel resolved by initializeOpenCL
+    bool floatTransfer = false; //m_clFloatPopulation resolved by initializeOpenCL
+    bool cpuDevice = false; //the device runs on the cores of the host evaluator, e.g. PoCL
+    std::atomic<int> chunkSize = 0; //chunk size loaded or autotuned by the first copy that needed one
+};
+
+constexpr int OPENCL_WORKGROUP_SIZE = 64;
+// Crossover interface counts measured by benchmarkOpenCLKernels, one device per line
+constexpr const char* OPENCL_KERNEL_CROSSOVER_FILE = "opencl_kernel_crossover.txt";
+// Crossover for devices that have not been measured. 16 is a guess, not a measurement: from 16 interfaces (120 ghosts)
+// the private ghost arrays of batch_fitness_kernel likely spill out of registers. benchmarkOpenCLKernels
+// (LensFlareBenchmarks opencl-kernels) measures the crossover of a device.
+constexpr unsigned int OPENCL_WORKGROUP_KERNEL_MIN_INTERFACES = 16;
+
+// In-order queues batchFitnessOpenCL pipelines the chunks over, three keep an upload, a kernel and a read back in flight
+constexpr int OPENCL_PIPELINE_QUEUES = 3;
+constexpr const char* OPENCL_CHUNK_SIZE_FILE = "opencl_chunk_sizes.txt";
+// Compiled programs, one file per device, kernel source and build options
+constexpr const char* OPENCL_PROGRAM_CACHE_DIR = "opencl_cache";
+
+// Lower bound of LensSystemProblem::scoreSnapshot while the ghosts of a candidate are simulated one by one. A ghost that is
+// not among the render objective count smallest quad heights seen so far is never matched whatever follows, so its extra
+// ghost penalty is certain, and the errors of the matched ghosts are at least 0. A NaN quad height disables the bound.
+class FitnessLowerBound {
+public:
+    void reset(size_t matched);
+    void addGhost(float quadHeight);
+    double get() const { return m_matched > 0 ? m_penalty / m_matched : 0.0; }
+
+private:
+    std::vector<float> m_smallest; //smallest quad heights so far, unordered
+    size_t m_matched = 0;
+    size_t m_largestSmallest = 0; //index of the largest of m_smallest
+    double m_penalty = 0.0;
+};
+
+// Work branch and bound evaluations skipped, summed per thread or per call before it goes into FitnessBranchAndBound
+struct FitnessBoundStats {
+    unsigned long long candidates = 0;
+    unsigned long long stopped = 0; //candidates that stopped early
+    unsigned long long ghosts = 0; //ghosts of all candidates
+    unsigned long long skippedGhosts = 0; //ghosts the stopped candidates did not simulate
+};
+
+// Upper bound for batch_fitness, shared by the problem and its copies. A candidate stops as soon as its fitness is certain
+// to exceed upperBound and gets the lower bound that exceeded it instead of its fitness. Only an optimizer that discards
+// every candidate above upperBound may use it: runEA sets it to the worst personal best before every pso_gen evolve, as a
+// particle only keeps a position that beats its personal best.
+struct FitnessBranchAndBound {
+    void record(const FitnessBoundStats& stats);
+    // Counters since the last call, which resets them
+    FitnessBoundStats takeStats();
+
+    std::atomic<double> upperBound = std::numeric_limits<double>::infinity();
+    std::atomic<unsigned long long> candidates = 0;
+    std::atomic<unsigned long long> stopped = 0;
+    std::atomic<unsigned long long> ghosts = 0;
+    std::atomic<unsigned long long> skippedGhosts = 0;
+};
+
 struct LensSystemProblem {
 public:
     unsigned int m_num_interfaces;  // number of lens interfaces
@@ -19,15 +173,81 @@ public:
     pagmo::vector_double m_ub;       // upper bounds for each variable
     std::vector<SnapshotData> m_renderObjective;
     //Simulate drawing a quad, only necessary info for snapshot
-    SnapshotData simulateDrawQuad(int quadId, glm::mat2x2& Ma, glm::mat2x2& Ms, float light_angle_x, float light_angle_y, float irisApertureHeight) const;
+    SnapshotData simulateDrawQuad(const GhostLayout& layout, int quadId, float light_angle_x, float light_angle_y, float irisApertureHeight) const;
+    // simulateDrawQuad over the scalar type of the layout, for the derivatives of the snapshot
+    template<typename T>
+    void simulateDrawQuad(const BasicGhostLayout<T>& layout, float light_angle_x, float light_angle_y, T irisApertureHeight, glm::vec<2, T>& quadCenterPos, T& quadHeight) const;
+    // Snapshot of every ghost of the candidate at dv, in the order computeFitness simulates them, and the exact Jacobian of
+    // the center x, center y and height of each ghost with respect to dv, in one forward pass over Dual numbers. jacobian
+    // holds 3 rows of m_dim values per ghost. The derivatives are those of the repaired lens, so they are 0 for the
+    // aperture position, the index of an air gap and a clamped radius. False without a FixedLensSystem specialization for
+    // the interface count.
+    bool computeSnapshotJacobian(const double* dv, std::vector<SnapshotData>& snapshot, std::vector<double>& jacobian) const;
     // Set the problem dimension and bounds
     void init(unsigned int num_interfaces, float light_angle_x, float light_angle_y);
     // Set the render objectives for the fitness function
     void setRenderObjective(std::vector<SnapshotData> &renderObjective);
     // This function computes the fitness (objective) value.
     pagmo::vector_double fitness(const pagmo::vector_double& dv) const;
+    // Fitness of the m_dim values at dv, allocation-free once the per-thread scratch buffers have grown. Stops once the
+    // fitness is certain to exceed upperBound, returning the lower bound that exceeded it (see FitnessLowerBound), and adds
+    // the candidate to stats when given.
+    double computeFitness(const double* dv, double upperBound = std::numeric_limits<double>::infinity(), FitnessBoundStats* stats = nullptr) const;
+    // computeFitness of count candidates (at most getFitnessLaneWidth()) stored back to back at dv, one candidate per SIMD
+    // lane. The values are identical to computeFitness, the lanes that exceed upperBound drop out of the ghost loop.
+    void computeFitnessLanes(const double* dv, int count, double* out, double upperBound = std::numeric_limits<double>::infinity(), FitnessBoundStats* stats = nullptr) const;
+    static int getFitnessLaneWidth();
+    // Repaired lens interfaces of the candidate at dv
+    void getLensInterfaces(const double* dv, std::vector<LensInterface>& out) const;
+    // Fitness of the ghosts a candidate renders against the render objective, sorts snapshot on quad height
+    double scoreSnapshot(std::vector<SnapshotData>& snapshot) const;
+    // Sets up m_clShared once for the problem and its copies, concurrent callers wait for the first one. The OpenCL
+    // settings below must be set before the first evaluation.
     void initializeOpenCL() const;
+    // Tries initializeOpenCL once and remembers the outcome
+    bool isOpenCLAvailable() const;
+    // The evaluator batch_fitness uses, Auto resolved
+    BatchEvaluator getActiveBatchEvaluator() const;
+    // Pre-screens the population with m_surrogate when it is set, the screened candidates get its screenedFitness and the
+    // others batchFitnessExact, which the surrogate then trains on
     pagmo::vector_double batch_fitness(const pagmo::vector_double& pop) const;
+    // Evaluates the population with the active evaluator
+    pagmo::vector_double batchFitnessExact(const pagmo::vector_double& pop) const;
+    // Splits the population over m_hostThreads cores (all of them when 0) with oneTBB, evaluating with computeFitnessLanes
+    // when m_simdFitness is set
+    pagmo::vector_double batchFitnessHost(const pagmo::vector_double& pop) const;
+    void batchFitnessHost(const double* pop, int num_candidates, double* out) const;
+    pagmo::vector_double batchFitnessOpenCL(const pagmo::vector_double& pop) const;
+    void batchFitnessOpenCL(const double* pop, int num_candidates, double* out) const;
+    // Evaluates the front of the population with batchFitnessOpenCL while the host evaluates the rest, splitting by
+    // m_heterogeneousSplit. Falls back to the host when OpenCL is unavailable or its device is a CPU, which would only
+    // take cores from the host evaluation.
+    pagmo::vector_double batchFitnessHeterogeneous(const pagmo::vector_double& pop) const;
+    pagmo::vector_double batchFitnessOpenCLPerCall(const pagmo::vector_double& pop) const;
+    // Grows m_clBuffers to num_candidates and uploads the render objective when it changed, m_clBuffers.mutex must be held
+    void prepareOpenCLBuffers(int num_candidates) const;
+    // Queues of m_clBuffers with their kernels, created on first use, m_clBuffers.mutex must be held
+    std::vector<OpenCLQueueBuffers>& getOpenCLQueues() const;
+    // Evaluates the population in the staging buffer in chunks of chunk_size candidates spread round robin over the queues,
+    // so the upload of one chunk overlaps the kernel and the read back of the chunks before it. Each queue evaluates its
+    // chunks in its own buffers.
+    void runOpenCLChunks(int num_candidates, int chunk_size) const;
+    // m_branchAndBound's upper bound rounded up to the float the kernels compare in
+    float getOpenCLUpperBound() const;
+    // Fastest chunk size for the population in the staging buffer, which is persisted per device in OPENCL_CHUNK_SIZE_FILE
+    int autotuneChunkSize(int num_candidates) const;
+    // m_clChunkSize, or the one of m_clShared which the first copy to get here loads or autotunes
+    int getOpenCLChunkSize(int num_candidates) const;
+    std::string getOpenCLDeviceKey() const;
+    static std::filesystem::path getProgramCachePath(const std::string& deviceKey, const std::string& source, const std::string& options);
+    // Builds the program of m_clShared from the cached binary at path, false when there is none or the device rejects it
+    bool loadProgramBinary(const std::filesystem::path& path, const std::string& options) const;
+    void saveProgramBinary(const std::filesystem::path& path) const;
+    // Resolves m_clKernel for the built program, Workgroup needs the workgroup size and local memory of the device
+    OpenCLFitnessKernel selectOpenCLKernel() const;
+    static const char* getOpenCLKernelName(OpenCLFitnessKernel kernel);
+    // Bytes of a population, render objective or fitness value on the device
+    size_t getOpenCLScalarSize() const { return m_clShared->floatTransfer ? sizeof(float) : sizeof(double); }
     bool has_batch_fitness() const {
         return true; 
     }
@@ -38,15 +258,76 @@ public:
     // Get the lower and upper bounds of the decision vector.
     std::pair<pagmo::vector_double, pagmo::vector_double> get_bounds() const;
 
-    // OpenCL objects for the batch evaluator:
-    mutable cl::Context       m_clContext;
-    mutable cl::Device        m_clDevice;
-    mutable cl::CommandQueue  m_clQueue;
-    mutable cl::Program       m_clProgram;
-    mutable bool              m_clInitialized = false;
+    BatchEvaluator m_batchEvaluator = BatchEvaluator::Auto;
+    int m_hostThreads = 0;
+    mutable HeterogeneousSplit m_heterogeneousSplit;
+    bool m_simdFitness = true;
+
+    // Device type initializeOpenCL takes the first device of, on any platform. CL_DEVICE_TYPE_CPU runs the OpenCL evaluator
+    // on a CPU runtime such as PoCL.
+    cl_device_type m_clDeviceType = CL_DEVICE_TYPE_GPU;
+    // Extra options for building batch_fitness.cl, e.g. -D FULL_SNAPSHOT_SORT
+    std::string m_clBuildOptions;
+    OpenCLFitnessKernel m_clKernel = OpenCLFitnessKernel::Auto;
+    // Transfer the population, render objective and fitness as float (-D FLOAT_POPULATION). The kernel converts every
+    // value to float anyway, so the fitness is the same as with double transfers at half the bandwidth. Devices without
+    // fp64 always use it.
+    bool m_clFloatPopulation = true;
+    // Candidates per chunk of batchFitnessOpenCL, 0 loads the persisted chunk size of the device or autotunes it
+    mutable int m_clChunkSize = 0;
+
+    // OpenCL objects for the batch evaluator, shared by the copies pagmo makes
+    std::shared_ptr<OpenCLSharedState> m_clShared = std::make_shared<OpenCLSharedState>();
+    mutable OpenCLBatchBuffers m_clBuffers;
+    // When false, batchFitnessOpenCL creates the buffers and the kernel on every call (batchFitnessOpenCLPerCall), for
+    // benchmarking the host overhead
+    bool m_clPersistentBuffers = true;
 
+    // Pre-screening of batch_fitness shared by the copies pagmo makes, null when disabled. setRenderObjective clears it.
+    std::shared_ptr<FitnessSurrogate> m_surrogate;
+    // Upper bound batch_fitness evaluates against and the work it saved, shared by the copies pagmo makes, null when
+    // disabled
+    std::shared_ptr<FitnessBranchAndBound> m_branchAndBound;
+    double getUpperBound() const { return m_branchAndBound ? m_branchAndBound->upperBound.load() : std::numeric_limits<double>::infinity(); }
+
+};
+
+// PartialEvaluator of RVGomea for LensSystemProblem. Keeps a LensSystem and GhostTable per individual, so a changed
+// linkage group only recomputes the matrix chain products through its interfaces and the ghost matrices on its side of
+// the aperture. The fitness is the one computeFitness gives, on the host whatever m_batchEvaluator is.
+class LensPartialEvaluator : public PartialEvaluator {
+public:
+    explicit LensPartialEvaluator(std::shared_ptr<const LensSystemProblem> problem);
+    void resize(size_t populationSize) override;
+    double evaluate(size_t individual, const pagmo::vector_double& x) override;
+
+private:
+    struct Individual {
+        std::optional<LensSystem> lensSystem;
+        GhostTable ghostTable;
+    };
+    std::shared_ptr<const LensSystemProblem> m_problem;
+    std::vector<Individual> m_individuals;
 };
 
+// Algorithm solveLensAnnotations evolves the lens with
+enum class LensOptimizer {
+    PsoGen,
+    RVGomea
+};
+
+const char* getLensOptimizerName(LensOptimizer optimizer);
+// RV-GOMEA for the problem, the aperture (position, height) and the (d, n, R) of each interface are the linkage groups.
+// It evaluates one candidate at a time on the host whatever m_batchEvaluator is: with a LensPartialEvaluator when
+// partialEvaluation is set, which gives the fitness of a full evaluation, otherwise through the problem's fitness.
+RVGomea makeLensRVGomea(const LensSystemProblem& problem, unsigned gen, unsigned seed = pagmo::random_device::next(), bool partialEvaluation = false);
+
+// Per device values stored one device per line, the device key and the value separated by a tab. 0 when the file has none.
+int loadOpenCLDeviceSetting(const char* fileName, const std::string& deviceKey);
+void saveOpenCLDeviceSetting(const char* fileName, const std::string& deviceKey, int value);
+
 void sortByQuadHeight(std::vector<SnapshotData>& snapshotDataUnsorted);
-std::vector<LensSystem> solveLensAnnotations(LensSystem& currentLensSystem, std::vector<SnapshotData>& renderObjective, float light_angle_x, float light_angle_y);
-std::vector<LensSystem> solveLensAnnotations(std::vector<SnapshotData>& renderObjective, float light_angle_x, float light_angle_y);
+// Moves the count smallest quad heights to the front in ascending order, the rest follow in unspecified order
+void selectSmallestQuadHeights(std::vector<SnapshotData>& snapshotData, size_t count);
+std::vector<LensSystem> solveLensAnnotations(LensSystem& currentLensSystem, std::vector<SnapshotData>& renderObjective, float light_angle_x, float light_angle_y, BatchEvaluator batchEvaluator = BatchEvaluator::Auto, LensOptimizer optimizer = LensOptimizer::PsoGen, bool branchAndBound = false, bool surrogate = false, bool partialEvaluation = true);
+std::vector<LensSystem> solveLensAnnotations(std::vector<SnapshotData>& renderObjective, float light_angle_x, float light_angle_y, BatchEvaluator batchEvaluator = BatchEvaluator::Auto, LensOptimizer optimizer = LensOptimizer::PsoGen, bool branchAndBound = false, bool surrogate = false, bool partialEvaluation = true);
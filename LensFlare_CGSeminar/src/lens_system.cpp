@@ -1,10 +1,14 @@
 #include "lens_system.h"
 
 #include "ray_transfer_matrices.h"
+#include "fresnel_ar.h"
+#include "spectral.h"
+#include "transmission_tree.h"
 #include <iostream>
 #include <string>
 #include <numbers>
 #include <algorithm> 
+#include <limits>
 
 float RED_WAVELENGTH = 650;
 float GREEN_WAVELENGTH = 510;
@@ -15,10 +19,17 @@ LensSystem::LensSystem(int irisAperturePos, float apertureHeight, float entrance
 	m_aperture_height = apertureHeight;
 	m_entrance_pupil_height = entrancePupilHeight;
 	m_lens_interfaces = lensInterfaces;
+	updateChainCache();
 }
 
 void LensSystem::setIrisAperturePos(int newPos) {
+	if (newPos == m_iris_aperture_pos) {
+		return;
+	}
+	m_dirty_range.ghostsChanged = true;
 	m_iris_aperture_pos = newPos;
+	m_chain_dirty = true;
+	updateChainCache();
 }
 
 int LensSystem::getIrisAperturePos() const {
@@ -41,53 +52,66 @@ float LensSystem::getEntrancePupilHeight() const {
 	return m_entrance_pupil_height;
 }
 
-std::vector<LensInterface> LensSystem::getLensInterfaces() const {
+const std::vector<LensInterface>& LensSystem::getLensInterfaces() const {
 	return m_lens_interfaces;
 }
 
-void LensSystem::setLensInterfaces(std::vector<LensInterface> newLensInterfaces) {
-	m_lens_interfaces = newLensInterfaces;
+void LensSystem::setLensInterfaces(std::span<const LensInterface> newLensInterfaces) {
+	if (newLensInterfaces.data() == m_lens_interfaces.data() && newLensInterfaces.size() == m_lens_interfaces.size()) {
+		return;
+	}
+	//grow the dirty range by every interface that differs from the current one
+	if (newLensInterfaces.size() != m_lens_interfaces.size()) {
+		m_dirty_range.ghostsChanged = true;
+		m_dirty_range.geometryChanged = true;
+		m_chain_dirty = true;
+	}
+	int count = std::min(newLensInterfaces.size(), m_lens_interfaces.size());
+	for (int i = 0; i < count; i++) {
+		const LensInterface& oldInterface = m_lens_interfaces[i];
+		const LensInterface& newInterface = newLensInterfaces[i];
+		bool geometryChanged = oldInterface.di != newInterface.di || oldInterface.ni != newInterface.ni || oldInterface.Ri != newInterface.Ri;
+		bool coatingChanged = oldInterface.lambda0 != newInterface.lambda0 || oldInterface.c_di != newInterface.c_di || oldInterface.c_ni != newInterface.c_ni;
+		if (!geometryChanged && !coatingChanged) {
+			continue;
+		}
+		if (m_dirty_range.begin >= m_dirty_range.end) {
+			m_dirty_range.begin = i;
+			m_dirty_range.end = i + 1;
+		}
+		else {
+			m_dirty_range.begin = std::min(m_dirty_range.begin, i);
+			m_dirty_range.end = std::max(m_dirty_range.end, i + 1);
+		}
+		m_dirty_range.geometryChanged |= geometryChanged;
+		//the table entry of the next interface refracts from this one
+		m_chain_dirty_begin = std::min(m_chain_dirty_begin, i);
+		m_chain_dirty_end = std::max(m_chain_dirty_end, std::min(i + 2, (int)newLensInterfaces.size()));
+		//the reflection pairs only depend on which interfaces border glass
+		if ((oldInterface.ni > 1.1) != (newInterface.ni > 1.1)) {
+			m_dirty_range.ghostsChanged = true;
+		}
+	}
+
+	m_lens_interfaces.assign(newLensInterfaces.begin(), newLensInterfaces.end()); //keeps the capacity
+	updateChainCache();
 }
 
-std::vector<glm::mat2x2> LensSystem::getRayTransferMatrices() {
-	std::vector<glm::mat2x2> rayTransferMatrices;
-	RayTransferMatrixBuilder rayTransferMatrixBuilder;
+const LensDirtyRange& LensSystem::getDirtyRange() const {
+	return m_dirty_range;
+}
 
-	auto effective_ni = [this](int idx) -> float {
-		if (idx == m_iris_aperture_pos)
-			return 1.0f;
-		return m_lens_interfaces[idx].ni;
-		};
+void LensSystem::clearDirtyRange() {
+	m_dirty_range = LensDirtyRange();
+}
 
-	auto effective_Ri = [this](int idx) -> float {
-		if (idx == m_iris_aperture_pos)
-			return std::numeric_limits<float>::infinity();
-		return m_lens_interfaces[idx].Ri;
-		};
+const LensTable& LensSystem::getLensTable() const {
+	return m_lens_table;
+}
 
-	for (int i = 0; i < m_lens_interfaces.size(); i++) {
-		if (i == 0) {
-			rayTransferMatrices.push_back(
-				rayTransferMatrixBuilder.getTranslationRefractionMatrix(
-					m_lens_interfaces[i].di,
-					1.0f,
-					effective_ni(i),
-					effective_Ri(i)
-				)
-			);
-		}
-		else {
-			rayTransferMatrices.push_back(
-				rayTransferMatrixBuilder.getTranslationRefractionMatrix(
-					m_lens_interfaces[i].di,
-					effective_ni(i - 1),
-					effective_ni(i),
-					effective_Ri(i)
-				)
-			);
-		}
-	}
-	return rayTransferMatrices;
+std::vector<glm::mat2x2> LensSystem::getRayTransferMatrices() {
+	const LensTable& table = getLensTable();
+	return std::vector<glm::mat2x2>(table.forward.begin(), table.forward.end());
 }
 
 std::vector<glm::mat2x2> LensSystem::getRayTransferMatricesWithReflection(int firstReflectionPos, int secondReflectionPos) {
@@ -102,282 +126,158 @@ std::vector<glm::mat2x2> LensSystem::getRayTransferMatricesWithReflection(int fi
 		// assert that it lies either at or before secondReflectionPos or at or after firstReflectionPos.
 		assert(m_iris_aperture_pos <= secondReflectionPos || m_iris_aperture_pos >= firstReflectionPos);
 
-		// Helper lambdas: if the interface index equals m_iris_aperture_pos, override its parameters.
-		auto effective_ni = [this](int idx) -> float {
-			if (idx == m_iris_aperture_pos)
-				return 1.0f;
-			return m_lens_interfaces[idx].ni;
-			};
-
-		auto effective_Ri = [this](int idx) -> float {
-			if (idx == m_iris_aperture_pos)
-				return std::numeric_limits<float>::infinity();
-			return m_lens_interfaces[idx].Ri;
-			};
+		const LensTable& table = getLensTable();
 
 		// --- Segment A: Forward propagation until the first reflection ---
-		for (int i = 0; i < firstReflectionPos; i++) {
-			if (i == 0) {
-				rayTransferMatrices.push_back(
-					rayTransferMatrixBuilder.getTranslationRefractionMatrix(
-						m_lens_interfaces[i].di,
-						1.f,
-						effective_ni(i),
-						effective_Ri(i)
-					)
-				);
-			}
-			else {
-				rayTransferMatrices.push_back(
-					rayTransferMatrixBuilder.getTranslationRefractionMatrix(
-						m_lens_interfaces[i].di,
-						effective_ni(i - 1),
-						effective_ni(i),
-						effective_Ri(i)
-					)
-				);
-			}
-		}
+		rayTransferMatrices.insert(rayTransferMatrices.end(), table.forward.begin(), table.forward.begin() + firstReflectionPos);
 
 		// --- Reflection at firstReflectionPos ---
-		rayTransferMatrices.push_back(
-			rayTransferMatrixBuilder.getReflectionMatrix(effective_Ri(firstReflectionPos))
-		);
+		rayTransferMatrices.push_back(table.reflection[firstReflectionPos]);
 
 		// --- Segment B: Backward propagation until the second reflection ---
 		for (int i = firstReflectionPos - 1; i > secondReflectionPos; i--) {
-			rayTransferMatrices.push_back(
-				rayTransferMatrixBuilder.getinverseRefractionBackwardsTranslationMatrix(
-					m_lens_interfaces[i].di,
-					effective_ni(i - 1),
-					effective_ni(i),
-					effective_Ri(i)
-				)
-			);
+			rayTransferMatrices.push_back(table.backward[i]);
 		}
 
 		// --- Second reflection handling: translation, reflection, and translation ---
-		rayTransferMatrices.push_back(
-			rayTransferMatrixBuilder.getTranslationMatrix(m_lens_interfaces[secondReflectionPos].di)
-		);
-		rayTransferMatrices.push_back(
-			rayTransferMatrixBuilder.getReflectionMatrix(-effective_Ri(secondReflectionPos))
-		);
-		rayTransferMatrices.push_back(
-			rayTransferMatrixBuilder.getTranslationMatrix(m_lens_interfaces[secondReflectionPos].di)
-		);
+		rayTransferMatrices.push_back(rayTransferMatrixBuilder.getTranslationMatrix(table.d[secondReflectionPos]));
+		rayTransferMatrices.push_back(rayTransferMatrixBuilder.getReflectionMatrix(-table.R[secondReflectionPos]));
+		rayTransferMatrices.push_back(rayTransferMatrixBuilder.getTranslationMatrix(table.d[secondReflectionPos]));
 
 		// --- Segment C: Forward propagation after the second reflection ---
-		for (int i = secondReflectionPos + 1; i < m_lens_interfaces.size(); i++) {
-			rayTransferMatrices.push_back(
-				rayTransferMatrixBuilder.getTranslationRefractionMatrix(
-					m_lens_interfaces[i].di,
-					effective_ni(i - 1),
-					effective_ni(i),
-					effective_Ri(i)
-				)
-			);
-		}
+		rayTransferMatrices.insert(rayTransferMatrices.end(), table.forward.begin() + secondReflectionPos + 1, table.forward.end());
 	}
 	return rayTransferMatrices;
 }
 
 
-glm::mat2x2 LensSystem::getMa() const {
-	glm::mat2x2 Ma = glm::mat2(1.0f);
-	RayTransferMatrixBuilder rayTransferMatrixBuilder;
-	for (int i = 0; i < m_iris_aperture_pos; i++) {
-		if (i == 0) {
-			Ma = rayTransferMatrixBuilder.getTranslationRefractionMatrix(m_lens_interfaces[i].di, 1.f, m_lens_interfaces[i].ni, m_lens_interfaces[i].Ri) * Ma;
-		}
-		else {
-			Ma = rayTransferMatrixBuilder.getTranslationRefractionMatrix(m_lens_interfaces[i].di, m_lens_interfaces[i - 1].ni, m_lens_interfaces[i].ni, m_lens_interfaces[i].Ri) * Ma;
-		}
+void LensSystem::updateChainCache() {
+	if (m_chain_dirty) {
+		rebuildChainCache();
+	}
+	else if (m_chain_dirty_begin < m_chain_dirty_end) {
+		updateChainCache(m_chain_dirty_begin, m_chain_dirty_end);
 	}
-	return Ma;
+	m_chain_dirty = false;
+	m_chain_dirty_begin = std::numeric_limits<int>::max();
+	m_chain_dirty_end = 0;
 }
 
-glm::mat2x2 LensSystem::getMs() {
-	glm::mat2x2 Ms = glm::mat2(1.0f);
-	RayTransferMatrixBuilder rayTransferMatrixBuilder;
+void LensSystem::rebuildChainCache() {
+	const int N = m_lens_interfaces.size();
+	const int A = std::clamp(m_iris_aperture_pos, 0, N);
+	m_chain_apt_pos = A;
+	m_lens_table.build(m_lens_interfaces, m_iris_aperture_pos);
+	m_chain_prefix.assign(A + 1, glm::mat2(1.0f));
+	m_chain_pre_apt_suffix.assign(A + 1, glm::mat2(1.0f));
+	m_chain_post_apt_prefix.assign(N - A + 1, glm::mat2(1.0f));
+	m_chain_suffix.assign(N - A + 1, glm::mat2(1.0f));
+	m_chain_backward.assign(N * N, glm::mat2(1.0f));
+	updateChainCache(0, N);
+}
 
-	// Helper lambdas that return forced parameters when at the iris aperture index
-	auto effective_ni = [this](int idx) -> float {
-		if (idx == m_iris_aperture_pos)
-			return 1.0f;
-		return m_lens_interfaces[idx].ni;
+//Only the products containing an interface in [begin, end) change, every other one is kept. The products are formed in the
+//same order as a full rebuild, so the result is identical.
+void LensSystem::updateChainCache(int begin, int end) {
+	RayTransferMatrixBuilder rayTransferMatrixBuilder;
+	const int N = m_lens_interfaces.size();
+	const int A = m_chain_apt_pos;
+	m_lens_table.update(m_lens_interfaces, m_iris_aperture_pos, begin, end);
+	const LensTable& table = m_lens_table;
+
+	// Propagation starting at the aperture enters it from air, every other interface uses the table matrices.
+	auto forward = [&](int i) -> glm::mat2x2 {
+		return (i == A) ? rayTransferMatrixBuilder.getTranslationRefractionMatrix(table.d[i], 1.0f, table.n[i], table.R[i]) : table.forward[i];
 		};
 
-	auto effective_Ri = [this](int idx) -> float {
-		if (idx == m_iris_aperture_pos)
-			return std::numeric_limits<float>::infinity();
-		return m_lens_interfaces[idx].Ri;
-		};
+	//prefixes from the first changed interface on, suffixes from the last changed interface back
+	for (int k = std::max(begin + 1, 1); k <= A; k++) {
+		m_chain_prefix[k] = table.forward[k - 1] * m_chain_prefix[k - 1];
+	}
+	for (int k = std::min(end, A) - 1; k >= 0; k--) {
+		m_chain_pre_apt_suffix[k] = m_chain_pre_apt_suffix[k + 1] * table.forward[k];
+	}
+	for (int k = std::max(begin + 1, A + 1); k <= N; k++) {
+		m_chain_post_apt_prefix[k - A] = forward(k - 1) * m_chain_post_apt_prefix[k - 1 - A];
+	}
+	for (int k = end - 1; k >= A; k--) {
+		m_chain_suffix[k - A] = m_chain_suffix[k + 1 - A] * forward(k);
+	}
 
-	// Loop over propagation starting from the iris aperture position.
-	for (int i = m_iris_aperture_pos; i < m_lens_interfaces.size(); i++) {
-		if (i == m_iris_aperture_pos) {
-			// For the first propagation step, the "incoming" medium is 1.0f (or effective_ni(i-1) if m_iris_aperture_pos == 0)
-			float previousNi = (i == 0) ? 1.0f : effective_ni(i - 1);
-			Ms = rayTransferMatrixBuilder.getTranslationRefractionMatrix(
-				m_lens_interfaces[i].di,
-				previousNi,
-				effective_ni(i),
-				effective_Ri(i)
-			) * Ms;
-		}
-		else {
-			Ms = rayTransferMatrixBuilder.getTranslationRefractionMatrix(
-				m_lens_interfaces[i].di,
-				effective_ni(i - 1),
-				effective_ni(i),
-				effective_Ri(i)
-			) * Ms;
+	//[s * N + f] holds B_{s+1} ... B_{f-1}, so it changed when s + 1 < end and f - 1 >= begin
+	for (int s = 0; s < std::min(end - 1, N); s++) {
+		for (int f = std::max(s + 2, begin + 1); f < N; f++) {
+			m_chain_backward[s * N + f] = m_chain_backward[s * N + f - 1] * table.backward[f - 1];
 		}
 	}
-	return Ms;
-}
-
 
-glm::mat2x2 LensSystem::getMa(int firstReflectionPos, int secondReflectionPos) const {
-	glm::mat2x2 Ma = glm::mat2(1.0f);
-	RayTransferMatrixBuilder rayTransferMatrixBuilder;
-	//check if reflection makes sense
-	if (firstReflectionPos > secondReflectionPos && secondReflectionPos >= 0 && firstReflectionPos < m_lens_interfaces.size()) {
-		//check if reflection happens before aperture
-		if (firstReflectionPos < m_iris_aperture_pos && secondReflectionPos < m_iris_aperture_pos) {
-			for (int i = 0; i < firstReflectionPos; i++) {
-				if (i == 0) {
-					Ma = rayTransferMatrixBuilder.getTranslationRefractionMatrix(m_lens_interfaces[i].di, 1.f, m_lens_interfaces[i].ni, m_lens_interfaces[i].Ri) * Ma;
-				}
-				else {
-					Ma = rayTransferMatrixBuilder.getTranslationRefractionMatrix(m_lens_interfaces[i].di, m_lens_interfaces[i - 1].ni, m_lens_interfaces[i].ni, m_lens_interfaces[i].Ri) * Ma;
-				}
-			}
-			Ma = rayTransferMatrixBuilder.getReflectionMatrix(m_lens_interfaces[firstReflectionPos].Ri) * Ma; //reflection step
-			for (int i = firstReflectionPos - 1; i > secondReflectionPos; i--) {
-				Ma = rayTransferMatrixBuilder.getinverseRefractionBackwardsTranslationMatrix(m_lens_interfaces[i].di, m_lens_interfaces[i - 1].ni, m_lens_interfaces[i].ni, m_lens_interfaces[i].Ri) * Ma;
-			}
-			Ma = rayTransferMatrixBuilder.getTranslationMatrix(m_lens_interfaces[secondReflectionPos].di) * Ma;
-			Ma = rayTransferMatrixBuilder.getReflectionMatrix(-m_lens_interfaces[secondReflectionPos].Ri) * Ma; //reflection step
-			Ma = rayTransferMatrixBuilder.getTranslationMatrix(m_lens_interfaces[secondReflectionPos].di) * Ma;
-			for (int i = secondReflectionPos + 1; i < m_iris_aperture_pos; i++) {
-				Ma = rayTransferMatrixBuilder.getTranslationRefractionMatrix(m_lens_interfaces[i].di, m_lens_interfaces[i - 1].ni, m_lens_interfaces[i].ni, m_lens_interfaces[i].Ri) * Ma;
-			}
-		}
-		else {
-			for (int i = 0; i < m_iris_aperture_pos; i++) {
-				if (i == 0) {
-					Ma = rayTransferMatrixBuilder.getTranslationRefractionMatrix(m_lens_interfaces[i].di, 1.f, m_lens_interfaces[i].ni, m_lens_interfaces[i].Ri) * Ma;
-				}
-				else {
-					Ma = rayTransferMatrixBuilder.getTranslationRefractionMatrix(m_lens_interfaces[i].di, m_lens_interfaces[i - 1].ni, m_lens_interfaces[i].ni, m_lens_interfaces[i].Ri) * Ma;
-				}
-			}
-		}
+	// The unreflected system matrix refracts into the aperture from the medium in front of it.
+	m_chain_default_Ms = glm::mat2(1.0f);
+	if (A < N) {
+		m_chain_default_Ms = m_chain_suffix[1] * table.forward[A];
 	}
+}
 
-	return Ma;
+//Reflection at firstReflectionPos, backward propagation and the reflection at secondReflectionPos
+glm::mat2x2 LensSystem::getReflectionCore(int firstReflectionPos, int secondReflectionPos) const {
+	const int N = m_lens_interfaces.size();
+	return m_lens_table.reflectionBack[secondReflectionPos]
+		* m_chain_backward[secondReflectionPos * N + firstReflectionPos]
+		* m_lens_table.reflection[firstReflectionPos];
 }
 
-glm::mat2x2 LensSystem::getMs(int firstReflectionPos, int secondReflectionPos) {
-	glm::mat2x2 Ms = glm::mat2(1.0f);
-	RayTransferMatrixBuilder rayTransferMatrixBuilder;
+glm::mat2x2 LensSystem::getMa() const {
+	return m_chain_prefix[m_chain_apt_pos];
+}
 
-	// Check if reflection positions make sense:
-	if (firstReflectionPos > secondReflectionPos &&
-		secondReflectionPos >= 0 &&
-		firstReflectionPos < m_lens_interfaces.size()) {
-
-		// Helper lambdas: If the current interface index equals m_iris_aperture_pos, force a refractive index 
-		// of 1.0f and a curvature of infinity.
-		auto effective_ni = [this](int idx) -> float {
-			return (idx == m_iris_aperture_pos) ? 1.0f : m_lens_interfaces[idx].ni;
-			};
-		auto effective_Ri = [this](int idx) -> float {
-			return (idx == m_iris_aperture_pos) ? std::numeric_limits<float>::infinity() : m_lens_interfaces[idx].Ri;
-			};
-
-		// If both reflections happen after the iris aperture...
-		if (firstReflectionPos > m_iris_aperture_pos && secondReflectionPos > m_iris_aperture_pos) {
-			// Forward propagation from the iris aperture (m_iris_aperture_pos) until first reflection.
-			for (int i = m_iris_aperture_pos; i < firstReflectionPos; i++) {
-				if (i == m_iris_aperture_pos) {
-					Ms = rayTransferMatrixBuilder.getTranslationRefractionMatrix(
-						m_lens_interfaces[i].di,
-						1.f,
-						effective_ni(i),
-						effective_Ri(i)
-					) * Ms;
-				}
-				else {
-					Ms = rayTransferMatrixBuilder.getTranslationRefractionMatrix(
-						m_lens_interfaces[i].di,
-						effective_ni(i - 1),
-						effective_ni(i),
-						effective_Ri(i)
-					) * Ms;
-				}
-			}
+glm::mat2x2 LensSystem::getMs() const {
+	return m_chain_default_Ms;
+}
 
-			// Reflection at firstReflectionPos.
-			Ms = rayTransferMatrixBuilder.getReflectionMatrix(effective_Ri(firstReflectionPos)) * Ms;
-
-			// Backward propagation until the second reflection.
-			for (int i = firstReflectionPos - 1; i > secondReflectionPos; i--) {
-				Ms = rayTransferMatrixBuilder.getinverseRefractionBackwardsTranslationMatrix(
-					m_lens_interfaces[i].di,
-					effective_ni(i - 1),
-					effective_ni(i),
-					effective_Ri(i)
-				) * Ms;
-			}
 
-			// Second reflection handling:
-			Ms = rayTransferMatrixBuilder.getTranslationMatrix(m_lens_interfaces[secondReflectionPos].di) * Ms;
-			Ms = rayTransferMatrixBuilder.getReflectionMatrix(-effective_Ri(secondReflectionPos)) * Ms;
-			Ms = rayTransferMatrixBuilder.getTranslationMatrix(m_lens_interfaces[secondReflectionPos].di) * Ms;
-
-			// Forward propagation after the second reflection.
-			for (int i = secondReflectionPos + 1; i < m_lens_interfaces.size(); i++) {
-				Ms = rayTransferMatrixBuilder.getTranslationRefractionMatrix(
-					m_lens_interfaces[i].di,
-					effective_ni(i - 1),
-					effective_ni(i),
-					effective_Ri(i)
-				) * Ms;
-			}
-		}
-		// Otherwise, reflection does not occur after the iris aperture.
-		else {
-			// Propagate from the iris aperture through to the last interface.
-			for (int i = m_iris_aperture_pos; i < m_lens_interfaces.size(); i++) {
-				if (i == m_iris_aperture_pos) {
-					Ms = rayTransferMatrixBuilder.getTranslationRefractionMatrix(
-						m_lens_interfaces[i].di,
-						1.f,
-						effective_ni(i),
-						effective_Ri(i)
-					) * Ms;
-				}
-				else {
-					Ms = rayTransferMatrixBuilder.getTranslationRefractionMatrix(
-						m_lens_interfaces[i].di,
-						effective_ni(i - 1),
-						effective_ni(i),
-						effective_Ri(i)
-					) * Ms;
-				}
-			}
-		}
+glm::mat2x2 LensSystem::getMa(int firstReflectionPos, int secondReflectionPos) const {
+	//check if reflection makes sense
+	if (!(firstReflectionPos > secondReflectionPos && secondReflectionPos >= 0 && firstReflectionPos < m_lens_interfaces.size())) {
+		return glm::mat2(1.0f);
+	}
+	//check if reflection happens before aperture
+	if (firstReflectionPos < m_iris_aperture_pos && secondReflectionPos < m_iris_aperture_pos) {
+		return m_chain_pre_apt_suffix[secondReflectionPos + 1]
+			* getReflectionCore(firstReflectionPos, secondReflectionPos)
+			* m_chain_prefix[firstReflectionPos];
 	}
+	return m_chain_prefix[m_chain_apt_pos];
+}
 
-	return Ms;
+glm::mat2x2 LensSystem::getMs(int firstReflectionPos, int secondReflectionPos) const {
+	// Check if reflection positions make sense:
+	if (!(firstReflectionPos > secondReflectionPos && secondReflectionPos >= 0 && firstReflectionPos < m_lens_interfaces.size())) {
+		return glm::mat2(1.0f);
+	}
+	// If both reflections happen after the iris aperture...
+	if (firstReflectionPos > m_iris_aperture_pos && secondReflectionPos > m_iris_aperture_pos) {
+		return m_chain_suffix[secondReflectionPos + 1 - m_chain_apt_pos]
+			* getReflectionCore(firstReflectionPos, secondReflectionPos)
+			* m_chain_post_apt_prefix[firstReflectionPos - m_chain_apt_pos];
+	}
+	// Otherwise, propagate from the iris aperture through to the last interface.
+	return m_chain_suffix[0];
 }
 
 
-std::vector<glm::vec2> LensSystem::getPreAptReflections() {
+std::vector<glm::vec2> LensSystem::getPreAptReflections() const {
+	std::vector<glm::vec2> reflectionPairs;
+	getPreAptReflections(reflectionPairs);
+	return reflectionPairs;
+}
+
+std::vector<glm::vec2> LensSystem::getPostAptReflections() const {
 	std::vector<glm::vec2> reflectionPairs;
+	getPostAptReflections(reflectionPairs);
+	return reflectionPairs;
+}
+
+void LensSystem::getPreAptReflections(std::vector<glm::vec2>& reflectionPairs) const {
 	for (int i = 1; i < m_iris_aperture_pos; i++) {
 		for (int j = i - 1; j >= 0; j--) {
 
@@ -392,11 +292,9 @@ std::vector<glm::vec2> LensSystem::getPreAptReflections() {
 			}
 		}
 	}
-	return reflectionPairs;
 }
 
-std::vector<glm::vec2> LensSystem::getPostAptReflections() {
-	std::vector<glm::vec2> reflectionPairs;
+void LensSystem::getPostAptReflections(std::vector<glm::vec2>& reflectionPairs) const {
 	for (int i = m_iris_aperture_pos + 2; i < m_lens_interfaces.size(); i++) {
 		for (int j = i - 1; j > m_iris_aperture_pos; j--) {
 
@@ -411,22 +309,43 @@ std::vector<glm::vec2> LensSystem::getPostAptReflections() {
 			}
 		}
 	}
-	return reflectionPairs;
 }
 
-std::vector<glm::mat2x2> LensSystem::getMa(std::vector<glm::vec2> reflectionPos) const {
+std::vector<glm::mat2x2> LensSystem::getMa(std::span<const glm::vec2> reflectionPos) const {
 	std::vector<glm::mat2x2> Mas;
+	getMa(reflectionPos, Mas);
+	return Mas;
+}
+
+std::vector<glm::mat2x2> LensSystem::getMs(std::span<const glm::vec2> reflectionPos) const {
+	std::vector<glm::mat2x2> Mss;
+	getMs(reflectionPos, Mss);
+	return Mss;
+}
+
+void LensSystem::getMa(std::span<const glm::vec2> reflectionPos, std::vector<glm::mat2x2>& Mas) const {
+	Mas.reserve(Mas.size() + reflectionPos.size());
 	for (glm::vec2 reflectionPair : reflectionPos) {
 		Mas.push_back(this->getMa(reflectionPair.x, reflectionPair.y));
 	}
-	return Mas;
 }
-std::vector<glm::mat2x2> LensSystem::getMs(std::vector<glm::vec2> reflectionPos) {
-	std::vector<glm::mat2x2> Mss;
+
+void LensSystem::getMs(std::span<const glm::vec2> reflectionPos, std::vector<glm::mat2x2>& Mss) const {
+	Mss.reserve(Mss.size() + reflectionPos.size());
 	for (glm::vec2 reflectionPair : reflectionPos) {
 		Mss.push_back(this->getMs(reflectionPair.x, reflectionPair.y));
 	}
-	return Mss;
+}
+
+GhostLayout LensSystem::getGhostLayout(int firstReflectionPos, int secondReflectionPos) const {
+	if (firstReflectionPos < m_iris_aperture_pos) {
+		return getGhostLayout(getMa(firstReflectionPos, secondReflectionPos), getMs());
+	}
+	return getGhostLayout(getMa(), getMs(firstReflectionPos, secondReflectionPos));
+}
+
+GhostLayout LensSystem::getGhostLayout(const glm::mat2x2& Ma, const glm::mat2x2& Ms) {
+	return makeGhostLayout(Ma, Ms);
 }
 
 std::vector<float> LensSystem::getInterfacePositions() {
@@ -469,213 +388,231 @@ glm::vec3 LensSystem::computeFresnelAR (
 	float n0,		// RI of 1st medium
 	float n1,		// RI of coating layer
 	float n2		// RI of the 2nd medium
-) const {
+) {
 	// No coating between two air layers
 	//if (n0 < 1.1f && n2 < 1.1f) {
 	//	return glm::vec3(0.f);
 	//}
 
-	// refraction angles in coating and the 2nd medium
-	float theta1 = asin(std::clamp(sin(theta0) * n0 / n1, -1.f, 1.f));
-	float theta2 = asin(std::clamp(sin(theta0) * n0 / n2, -1.f, 1.f));
-	// amplitude for outer refl. / transmission on topmost interface
-	float rs01 = -sin(theta0-theta1) / sin(theta0 + theta1);
-	float rp01 = tan(theta0-theta1) / tan(theta0 + theta1);
-	float ts01 = 2 * sin(theta1) * cos(theta0) / sin(theta0 + theta1);
-	float tp01 = ts01 * cos(theta0-theta1);
-	// amplitude for inner reflection
-	float rs12 = -sin(theta1-theta2) / sin(theta1 + theta2);
-	float rp12 = tan(theta1-theta2) / tan(theta1 + theta2);
-	// after passing through first surface twice :
-	// 2 transmissions and 1 reflection
-	float ris = ts01 * ts01 * rs12;
-	float rip = tp01 * tp01 * rp12;
-	// phase difference between outer and inner reflections
-	float dy = d1 * n1;
-	float dx = tan(theta1) * dy;
-	float delay = sqrt(dx * dx + dy * dy);
-	/* RED */
-	float r_relPhase = 4 * std::numbers::pi / RED_WAVELENGTH * (delay - dx * sin(theta0));
-	// Add up sines of different phase and amplitude
-	float r_out_s2 = rs01 * rs01 + ris * ris +
-		2 * rs01 * ris * cos(r_relPhase);
-	float r_out_p2 = rp01 * rp01 + rip * rip +
-		2 * rp01 * rip * cos(r_relPhase);
-	float r_res = std::min((r_out_s2 + r_out_p2) / 2, 1.f); // reflectivity
-	/* GREEN */
-	float g_relPhase = 4 * std::numbers::pi / GREEN_WAVELENGTH * (delay - dx * sin(theta0));
-	// Add up sines of different phase and amplitude
-	float g_out_s2 = rs01 * rs01 + ris * ris +
-		2 * rs01 * ris * cos(g_relPhase);
-	float g_out_p2 = rp01 * rp01 + rip * rip +
-		2 * rp01 * rip * cos(g_relPhase);
-	float g_res = std::min((g_out_s2 + g_out_p2) / 2, 1.f); // reflectivity
-	/* BLUE */
-	float b_relPhase = 4 * std::numbers::pi / BLUE_WAVELENGTH * (delay - dx * sin(theta0));
-	// Add up sines of different phase and amplitude
-	float b_out_s2 = rs01 * rs01 + ris * ris +
-		2 * rs01 * ris * cos(b_relPhase);
-	float b_out_p2 = rp01 * rp01 + rip * rip +
-		2 * rp01 * rip * cos(b_relPhase);
-	float b_res = std::min((b_out_s2 + b_out_p2) / 2, 1.f); // reflectivity
-
-	return  glm::vec3(r_res, g_res, b_res);
+	// The angle dependent amplitudes once, the phase term of the three wavelengths in one vector
+	return computeFresnelARRGB(computeFresnelAmplitudes(theta0, d1, n0, n1, n2));
+}
+
+//A ghost path crosses the interfaces forward up to the first reflection, backward up to the second and forward again to the sensor
+int LensSystem::getCrossingCount(int firstReflectionPos, int secondReflectionPos) const {
+	return 2 * (firstReflectionPos - secondReflectionPos) + m_lens_interfaces.size();
+}
+
+int LensSystem::getCrossingInterface(int firstReflectionPos, int secondReflectionPos, int crossing) const {
+	int secondReflectionCrossing = 2 * firstReflectionPos - secondReflectionPos;
+	if (crossing <= firstReflectionPos) {
+		return crossing;
+	}
+	else if (crossing <= secondReflectionCrossing) {
+		return 2 * firstReflectionPos - crossing;
+	}
+	return crossing - 2 * (firstReflectionPos - secondReflectionPos);
+}
+
+glm::vec3 LensSystem::getCrossingFactor(int firstReflectionPos, int secondReflectionPos, int crossing, glm::vec2 ray, bool quarterWaveCoating) const {
+	const LensTable& table = getLensTable();
+	int i = getCrossingInterface(firstReflectionPos, secondReflectionPos, crossing);
+	float n1 = quarterWaveCoating ? table.quarterWaveCoatingN[i] : table.customCoatingN[i];
+	float d1 = quarterWaveCoating ? table.quarterWaveCoatingD[i] : table.customCoatingD[i];
+	int secondReflectionCrossing = 2 * firstReflectionPos - secondReflectionPos;
+
+	if (crossing == firstReflectionPos) {
+		// First reflection
+		return computeFresnelAR(ray.y, d1, table.nPrev[i], n1, table.n[i]);
+	}
+	else if (crossing == secondReflectionCrossing) {
+		// Second reflection
+		return computeFresnelAR(ray.y, d1, table.n[i], n1, table.nPrev[i]);
+	}
+	else if (crossing > firstReflectionPos && crossing < secondReflectionCrossing) {
+		// Backward propagation
+		return glm::vec3(1.f) - computeFresnelAR(ray.y, d1, table.n[i], n1, table.nPrev[i]);
+	}
+	// Forward propagation
+	return glm::vec3(1.f) - computeFresnelAR(ray.y, d1, table.nPrev[i], n1, table.n[i]);
+}
+
+glm::vec2 LensSystem::propagateCrossing(int firstReflectionPos, int secondReflectionPos, int crossing, glm::vec2 ray) const {
+	const LensTable& table = getLensTable();
+	int i = getCrossingInterface(firstReflectionPos, secondReflectionPos, crossing);
+	int secondReflectionCrossing = 2 * firstReflectionPos - secondReflectionPos;
+
+	if (crossing == firstReflectionPos) {
+		return table.reflection[i] * ray;
+	}
+	else if (crossing == secondReflectionCrossing) {
+		return table.reflectionBack[i] * ray;
+	}
+	else if (crossing > firstReflectionPos && crossing < secondReflectionCrossing) {
+		return table.backward[i] * ray;
+	}
+	return table.forward[i] * ray;
 }
 
+//Walks the three segments of the ghost path over the lens table, the crossing type is fixed per segment
 glm::vec3 LensSystem::propagateTransmission(int firstReflectionPos, int secondReflectionPos, glm::vec2 ray, bool quarterWaveCoating) const {
+	const LensTable& table = getLensTable();
+	const float* coatingN = quarterWaveCoating ? table.quarterWaveCoatingN.data() : table.customCoatingN.data();
+	const float* coatingD = quarterWaveCoating ? table.quarterWaveCoatingD.data() : table.customCoatingD.data();
+	const float* n = table.n.data();
+	const float* nPrev = table.nPrev.data();
 	glm::vec3 transmissions(1.f);
-	RayTransferMatrixBuilder rayTransferMatrixBuilder;
 	glm::vec2 propagated_ray = ray;
 
-	auto effective_ni = [this](int idx) -> float {
-		if (idx == m_iris_aperture_pos)
-			return 1.0f;
-		return m_lens_interfaces[idx].ni;
-		};
+	for (int i = 0; i < firstReflectionPos; i++) {
+		transmissions *= glm::vec3(1.f) - computeFresnelAR(propagated_ray.y, coatingD[i], nPrev[i], coatingN[i], n[i]);
+		propagated_ray = table.forward[i] * propagated_ray;
+	}
+	transmissions *= computeFresnelAR(propagated_ray.y, coatingD[firstReflectionPos], nPrev[firstReflectionPos], coatingN[firstReflectionPos], n[firstReflectionPos]);
+	propagated_ray = table.reflection[firstReflectionPos] * propagated_ray;
+	for (int i = firstReflectionPos - 1; i > secondReflectionPos; i--) {
+		transmissions *= glm::vec3(1.f) - computeFresnelAR(propagated_ray.y, coatingD[i], n[i], coatingN[i], nPrev[i]);
+		propagated_ray = table.backward[i] * propagated_ray;
+	}
+	transmissions *= computeFresnelAR(propagated_ray.y, coatingD[secondReflectionPos], n[secondReflectionPos], coatingN[secondReflectionPos], nPrev[secondReflectionPos]);
+	propagated_ray = table.reflectionBack[secondReflectionPos] * propagated_ray;
+	for (int i = secondReflectionPos + 1; i < table.size; i++) {
+		transmissions *= glm::vec3(1.f) - computeFresnelAR(propagated_ray.y, coatingD[i], nPrev[i], coatingN[i], n[i]);
+		propagated_ray = table.forward[i] * propagated_ray;
+	}
+	return transmissions;
+}
 
-	auto effective_Ri = [this](int idx) -> float {
-		if (idx == m_iris_aperture_pos)
-			return std::numeric_limits<float>::infinity();
-		return m_lens_interfaces[idx].Ri;
-		};
+void LensSystem::propagateTransmission(int firstReflectionPos, int secondReflectionPos, glm::vec2 ray, bool quarterWaveCoating, const SpectralSampling& sampling, std::span<float> spectrum) const {
+	const LensTable& table = getLensTable();
+	const float* coatingN = quarterWaveCoating ? table.quarterWaveCoatingN.data() : table.customCoatingN.data();
+	const float* coatingD = quarterWaveCoating ? table.quarterWaveCoatingD.data() : table.customCoatingD.data();
+	const float* n = table.n.data();
+	const float* nPrev = table.nPrev.data();
+	std::span<const float> wavelengths = sampling.getWavelengths();
+	std::fill(spectrum.begin(), spectrum.end(), 1.f);
+	glm::vec2 propagated_ray = ray;
 
-	// Modify computeOpticalParams to use effective_ni when appropriate.
-	auto computeOpticalParams = [&](int i) -> std::pair<float, float> {
-		float n;
-		if (i == m_iris_aperture_pos) {
-			n = 1.0f;
-		}
-		else {
-			n = quarterWaveCoating
-				? std::max(sqrt((i == 0 ? 1.0f : effective_ni(i - 1)) * effective_ni(i)), 1.38f)
-				: m_lens_interfaces[i].c_ni;
-		}
-		float d = quarterWaveCoating
-			? m_lens_interfaces[i].lambda0 / (4 * n)
-			: m_lens_interfaces[i].c_di;
-		return { n, d };
-		};
+	//the angle dependent amplitudes are computed once per crossing, only the phase term is evaluated per wavelength
+	for (int i = 0; i < firstReflectionPos; i++) {
+		multiplyFresnelAR(computeFresnelAmplitudes(propagated_ray.y, coatingD[i], nPrev[i], coatingN[i], n[i]), wavelengths, false, spectrum);
+		propagated_ray = table.forward[i] * propagated_ray;
+	}
+	multiplyFresnelAR(computeFresnelAmplitudes(propagated_ray.y, coatingD[firstReflectionPos], nPrev[firstReflectionPos], coatingN[firstReflectionPos], n[firstReflectionPos]), wavelengths, true, spectrum);
+	propagated_ray = table.reflection[firstReflectionPos] * propagated_ray;
+	for (int i = firstReflectionPos - 1; i > secondReflectionPos; i--) {
+		multiplyFresnelAR(computeFresnelAmplitudes(propagated_ray.y, coatingD[i], n[i], coatingN[i], nPrev[i]), wavelengths, false, spectrum);
+		propagated_ray = table.backward[i] * propagated_ray;
+	}
+	multiplyFresnelAR(computeFresnelAmplitudes(propagated_ray.y, coatingD[secondReflectionPos], n[secondReflectionPos], coatingN[secondReflectionPos], nPrev[secondReflectionPos]), wavelengths, true, spectrum);
+	propagated_ray = table.reflectionBack[secondReflectionPos] * propagated_ray;
+	for (int i = secondReflectionPos + 1; i < table.size; i++) {
+		multiplyFresnelAR(computeFresnelAmplitudes(propagated_ray.y, coatingD[i], nPrev[i], coatingN[i], n[i]), wavelengths, false, spectrum);
+		propagated_ray = table.forward[i] * propagated_ray;
+	}
+}
 
-	// Forward propagation until first reflection
-	for (int i = 0; i < firstReflectionPos; ++i) {
-		auto [n1, d1] = computeOpticalParams(i);
-		transmissions *= glm::vec3(1.f) - computeFresnelAR(propagated_ray.y, d1, (i == 0 ? 1.f : effective_ni(i - 1)), n1, effective_ni(i));
-		propagated_ray = rayTransferMatrixBuilder.getTranslationRefractionMatrix(
-			m_lens_interfaces[i].di,
-			(i == 0 ? 1.f : effective_ni(i - 1)),
-			effective_ni(i),
-			effective_Ri(i)) * propagated_ray;
-	}
-
-	// First reflection
-	{
-		auto [n1, d1] = computeOpticalParams(firstReflectionPos);
-		transmissions *= computeFresnelAR(propagated_ray.y, d1, effective_ni(firstReflectionPos - 1), n1, effective_ni(firstReflectionPos));
-		propagated_ray = rayTransferMatrixBuilder.getReflectionMatrix(effective_Ri(firstReflectionPos)) * propagated_ray;
-	}
-
-	// Backward propagation until second reflection
-	for (int i = firstReflectionPos - 1; i > secondReflectionPos; --i) {
-		auto [n1, d1] = computeOpticalParams(i);
-		transmissions *= glm::vec3(1.f) - computeFresnelAR(propagated_ray.y, d1, effective_ni(i), n1, effective_ni(i - 1));
-		propagated_ray = rayTransferMatrixBuilder.getinverseRefractionBackwardsTranslationMatrix(
-			m_lens_interfaces[i].di,
-			effective_ni(i - 1),
-			effective_ni(i),
-			effective_Ri(i)) * propagated_ray;
-	}
-
-	// Second reflection handling
-	{
-		auto [n1_second, d1_second] = computeOpticalParams(secondReflectionPos);
-		transmissions *= computeFresnelAR(
-			propagated_ray.y,
-			d1_second,
-			effective_ni(secondReflectionPos),
-			n1_second,
-			(secondReflectionPos == 0 ? 1.f : effective_ni(secondReflectionPos - 1))
-		);
-
-		propagated_ray = rayTransferMatrixBuilder.getTranslationMatrix(m_lens_interfaces[secondReflectionPos].di) * propagated_ray;
-		propagated_ray = rayTransferMatrixBuilder.getReflectionMatrix(-effective_Ri(secondReflectionPos)) * propagated_ray;
-		propagated_ray = rayTransferMatrixBuilder.getTranslationMatrix(m_lens_interfaces[secondReflectionPos].di) * propagated_ray;
-	}
-
-	// Forward propagation after second reflection
-	for (int i = secondReflectionPos + 1; i < m_lens_interfaces.size(); ++i) {
-		auto [n1, d1] = computeOpticalParams(i);
-		transmissions *= glm::vec3(1.f) - computeFresnelAR(propagated_ray.y, d1, effective_ni(i - 1), n1, effective_ni(i));
-		propagated_ray = rayTransferMatrixBuilder.getTranslationRefractionMatrix(
-			m_lens_interfaces[i].di,
-			effective_ni(i - 1),
-			effective_ni(i),
-			effective_Ri(i)) * propagated_ray;
+//Same as propagateTransmission, but records every crossing. Crossings before fromCrossing are taken from a previous trace of the same path.
+glm::vec3 LensSystem::traceTransmission(int firstReflectionPos, int secondReflectionPos, glm::vec2 ray, bool quarterWaveCoating, TransmissionCrossing* crossings, int fromCrossing) const {
+	int crossingCount = getCrossingCount(firstReflectionPos, secondReflectionPos);
+	glm::vec3 transmissions(1.f);
+	for (int c = 0; c < fromCrossing; c++) {
+		transmissions *= crossings[c].factor;
 	}
+	glm::vec2 propagated_ray = fromCrossing == 0 ? ray : crossings[fromCrossing].ray;
+	for (int c = fromCrossing; c < crossingCount; c++) {
+		crossings[c].ray = propagated_ray;
+		crossings[c].factor = getCrossingFactor(firstReflectionPos, secondReflectionPos, c, propagated_ray, quarterWaveCoating);
+		transmissions *= crossings[c].factor;
+		propagated_ray = propagateCrossing(firstReflectionPos, secondReflectionPos, c, propagated_ray);
+	}
+	return transmissions;
+}
 
+//Coatings do not bend rays, so after a coating change only the factors at the changed interfaces of a trace are recomputed
+glm::vec3 LensSystem::retraceCoatings(int firstReflectionPos, int secondReflectionPos, bool quarterWaveCoating, TransmissionCrossing* crossings, int beginInterface, int endInterface) const {
+	int crossingCount = getCrossingCount(firstReflectionPos, secondReflectionPos);
+	glm::vec3 transmissions(1.f);
+	for (int c = 0; c < crossingCount; c++) {
+		int i = getCrossingInterface(firstReflectionPos, secondReflectionPos, c);
+		if (i >= beginInterface && i < endInterface) {
+			crossings[c].factor = getCrossingFactor(firstReflectionPos, secondReflectionPos, c, crossings[c].ray, quarterWaveCoating);
+		}
+		transmissions *= crossings[c].factor;
+	}
 	return transmissions;
 }
 
 
 
 //Per ghost trace ray through system to get reflectance/transmission of color
-std::vector<glm::vec3> LensSystem::getTransmission(std::vector<glm::vec2> reflectionPos, std::vector<glm::vec2> xRays, std::vector<glm::vec2> yRays, bool quarterWaveCoating) const {
+std::vector<glm::vec3> LensSystem::getTransmission(std::span<const glm::vec2> reflectionPos, std::span<const glm::vec2> xRays, std::span<const glm::vec2> yRays, bool quarterWaveCoating) const {
 	std::vector<glm::vec3> results;
+	results.reserve(reflectionPos.size());
+	TransmissionTree xTree;
+	TransmissionTree yTree;
+	xTree.reset(getTransmissionPathData(getLensTable(), quarterWaveCoating));
+	yTree.reset(getTransmissionPathData(getLensTable(), quarterWaveCoating));
 	for (int i = 0; i < reflectionPos.size(); i++) {
-		results.push_back(propagateTransmission(reflectionPos[i].x, reflectionPos[i].y, xRays[i], quarterWaveCoating) + propagateTransmission(reflectionPos[i].x, reflectionPos[i].y, yRays[i], quarterWaveCoating));
+		results.push_back(xTree.propagate(reflectionPos[i].x, reflectionPos[i].y, xRays[i]) + yTree.propagate(reflectionPos[i].x, reflectionPos[i].y, yRays[i]));
 	}
 	return results;
 }
 
-std::vector<glm::vec3> LensSystem::getTransmission(std::vector<glm::vec2> reflectionPos, glm::vec2 xRay, glm::vec2 yRay, bool quarterWaveCoating) const {
+std::vector<glm::vec3> LensSystem::getTransmission(std::span<const glm::vec2> reflectionPos, glm::vec2 xRay, glm::vec2 yRay, bool quarterWaveCoating) const {
 	std::vector<glm::vec3> results;
+	getTransmission(reflectionPos, xRay, yRay, quarterWaveCoating, results);
+	return results;
+}
+
+void LensSystem::getTransmission(std::span<const glm::vec2> reflectionPos, glm::vec2 xRay, glm::vec2 yRay, bool quarterWaveCoating, std::vector<glm::vec3>& results) const {
+	results.reserve(results.size() + reflectionPos.size());
+	static thread_local TransmissionTree xTree;
+	static thread_local TransmissionTree yTree;
+	xTree.reset(getTransmissionPathData(getLensTable(), quarterWaveCoating));
+	yTree.reset(getTransmissionPathData(getLensTable(), quarterWaveCoating));
 	for (int i = 0; i < reflectionPos.size(); i++) {
-		results.push_back(propagateTransmission(reflectionPos[i].x, reflectionPos[i].y, xRay, quarterWaveCoating) + propagateTransmission(reflectionPos[i].x, reflectionPos[i].y, yRay, quarterWaveCoating));
+		results.push_back(xTree.propagate(reflectionPos[i].x, reflectionPos[i].y, xRay) + yTree.propagate(reflectionPos[i].x, reflectionPos[i].y, yRay));
 	}
-	return results;
 }
 
-std::vector<glm::vec2> LensSystem::getPathIncidentAngleAtReflectionPos(glm::vec2 reflectionPair, glm::vec2 yawAndPitch) {
+std::vector<glm::vec2> LensSystem::getPathIncidentAngleAtReflectionPos(glm::vec2 reflectionPair, glm::vec2 yawAndPitch) const {
+	std::vector<glm::vec2> res(2);
+	getPathIncidentAngleAtReflectionPos(reflectionPair, yawAndPitch, res[0], res[1]);
+	return res;
+}
+
+void LensSystem::getPathIncidentAngleAtReflectionPos(glm::vec2 reflectionPair, glm::vec2 yawAndPitch, glm::vec2& angles_first_interface, glm::vec2& angles_second_interface) const {
 
 	glm::mat2x2 propagationMatrix = glm::mat2(1.0f);
 	RayTransferMatrixBuilder rayTransferMatrixBuilder;
 	glm::vec2 propagated_ray_x = glm::vec2(0, yawAndPitch.x);
 	glm::vec2 propagated_ray_y = glm::vec2(0, yawAndPitch.y);
 
-	glm::vec2 angles_first_interface(0);
-	glm::vec2 angles_second_interface(0);
-	std::vector<glm::vec2> res;
+	angles_first_interface = glm::vec2(0);
+	angles_second_interface = glm::vec2(0);
 
 	//check if reflection makes sense
 	if (reflectionPair.x > reflectionPair.y && reflectionPair.y >= 0 && reflectionPair.x < m_lens_interfaces.size()) {
+		const LensTable& table = getLensTable();
+		int firstReflectionPos = reflectionPair.x;
+		int secondReflectionPos = reflectionPair.y;
 
-		for (int i = 0; i < reflectionPair.x; i++) {
-			if (i == 0) {
-				propagationMatrix = rayTransferMatrixBuilder.getTranslationRefractionMatrix(m_lens_interfaces[i].di, 1.f, m_lens_interfaces[i].ni, m_lens_interfaces[i].Ri) * propagationMatrix;
-			}
-			else {
-				propagationMatrix = rayTransferMatrixBuilder.getTranslationRefractionMatrix(m_lens_interfaces[i].di, m_lens_interfaces[i - 1].ni, m_lens_interfaces[i].ni, m_lens_interfaces[i].Ri) * propagationMatrix;
-			}
+		for (int i = 0; i < firstReflectionPos; i++) {
+			propagationMatrix = table.forward[i] * propagationMatrix;
 		}
 		///get first incident angle here
 		angles_first_interface.x = (propagationMatrix * propagated_ray_x).y;
 		angles_first_interface.y = (propagationMatrix * propagated_ray_y).y;
 
-		propagationMatrix = rayTransferMatrixBuilder.getReflectionMatrix(m_lens_interfaces[reflectionPair.x].Ri) * propagationMatrix; //reflection step
-		for (int i = reflectionPair.x - 1; i > reflectionPair.y; i--) {
-			propagationMatrix = rayTransferMatrixBuilder.getinverseRefractionBackwardsTranslationMatrix(m_lens_interfaces[i].di, m_lens_interfaces[i - 1].ni, m_lens_interfaces[i].ni, m_lens_interfaces[i].Ri) * propagationMatrix;
+		propagationMatrix = table.reflection[firstReflectionPos] * propagationMatrix; //reflection step
+		for (int i = firstReflectionPos - 1; i > secondReflectionPos; i--) {
+			propagationMatrix = table.backward[i] * propagationMatrix;
 		}
-		propagationMatrix = rayTransferMatrixBuilder.getTranslationMatrix(m_lens_interfaces[reflectionPair.x].di) * propagationMatrix;
+		propagationMatrix = rayTransferMatrixBuilder.getTranslationMatrix(table.d[firstReflectionPos]) * propagationMatrix;
 		///get second incident angle
 		angles_second_interface.x = (propagationMatrix * propagated_ray_x).y;
 		angles_second_interface.y = (propagationMatrix * propagated_ray_y).y;
 
 	}
-
-	res.push_back(angles_first_interface);
-	res.push_back(angles_second_interface);
-	return res;
-
 }
-
-
-
@@ -2,6 +2,17 @@
 
 #include <glm/glm.hpp>
 #include <vector>
+#include <span>
+#include <cmath>
+#include <limits>
+#include "lens_table.h"
+
+class SpectralSampling;
+
+//Wavelengths (nm) the RGB reflectivities and transmissions are evaluated at, defined in lens_system.cpp
+extern float RED_WAVELENGTH;
+extern float GREEN_WAVELENGTH;
+extern float BLUE_WAVELENGTH;
 
 struct LensInterface {
 	float di; //positive displacement to the next interface at interface i (from thickness)
@@ -12,6 +23,60 @@ struct LensInterface {
 	float c_ni = 1.3; //Coating refractive index
 };
 
+//Interfaces changed since the last clearDirtyRange(), tracked by setLensInterfaces and setIrisAperturePos
+struct LensDirtyRange {
+	int begin = 0;
+	int end = 0; //exclusive, begin == end when nothing changed
+	bool geometryChanged = false; //di, ni or Ri changed, otherwise only the coatings did
+	bool ghostsChanged = false; //interface count, aperture position or air/glass layout changed, the set of ghosts is different
+	bool empty() const { return begin >= end && !ghostsChanged; }
+};
+
+//One interface crossing along a ghost path, recorded by traceTransmission
+struct TransmissionCrossing {
+	glm::vec2 ray; //ray arriving at the interface
+	glm::vec3 factor; //fraction of the light transmitted (or reflected) at the interface
+};
+
+//Where a ghost lands on the sensor, affine in the light angle and the aperture height. Rows are taken from Ma and M = Ms * Ma.
+//T is float except for derivatives of the layout (see LensSystemProblem::computeSnapshotJacobian).
+template<typename T>
+struct BasicGhostLayout {
+	glm::vec<2, T> apertureRow = glm::vec<2, T>(T(1), T(0)); //(Ma00, Ma01), aperture height of an entrance ray (height, angle)
+	glm::vec<2, T> sensorRow = glm::vec<2, T>(T(1), T(0)); //(M00, M01), sensor height of an entrance ray (height, angle)
+	T centerCoeff = T(0); //projection of the aperture center
+	T heightCoeff = T(0); //projection of the aperture edge, relative to the center
+
+	glm::vec<2, T> getCenter(glm::vec<2, T> lightAngles) const { return centerCoeff * lightAngles; }
+	T getHeight(T apertureHeight) const { return heightCoeff * apertureHeight; }
+	glm::vec<2, T> getEntrancePupilCenter(glm::vec<2, T> lightAngles) const { return sensorRow.y * lightAngles; }
+	T getEntrancePupilHeight(T entrancePupilHeight) const {
+		using std::abs;
+		return abs(sensorRow.x) * (entrancePupilHeight / T(2));
+	}
+};
+
+using GhostLayout = BasicGhostLayout<float>;
+
+//The matrices are fixed per lens, so the ray through the aperture center (entering at -angle * Ma01 / Ma00) and the
+//ray through the aperture edge land linearly in the light angle and the aperture height
+template<typename T>
+BasicGhostLayout<T> makeGhostLayout(const glm::mat<2, 2, T>& Ma, const glm::mat<2, 2, T>& Ms) {
+	using std::abs;
+	glm::mat<2, 2, T> M = Ms * Ma;
+	BasicGhostLayout<T> layout;
+	layout.apertureRow = glm::vec<2, T>(Ma[0][0], Ma[1][0]);
+	layout.sensorRow = glm::vec<2, T>(M[0][0], M[1][0]);
+	if (abs(Ma[0][0]) < 1e-6) {
+		layout.centerCoeff = M[1][0]; //the aperture center is not reachable, fall back to the chief ray
+	}
+	else {
+		layout.centerCoeff = M[1][0] - M[0][0] * Ma[1][0] / Ma[0][0];
+	}
+	layout.heightCoeff = abs(M[0][0] / Ma[0][0]) / T(2);
+	return layout;
+}
+
 class LensSystem {
 public:
 	LensSystem(int irisAperturePos, float apertureHeight, float entrancePupilHeight, std::vector<LensInterface>& lensInterfaces);
@@ -21,30 +86,71 @@ public:
 	float getApertureHeight() const;
 	void setEntrancePupilHeight(float newHeight);
 	float getEntrancePupilHeight() const;
-	std::vector<LensInterface> getLensInterfaces() const;
-	void setLensInterfaces(std::vector<LensInterface> newLensInterfaces);
+	const std::vector<LensInterface>& getLensInterfaces() const;
+	void setLensInterfaces(std::span<const LensInterface> newLensInterfaces);
 	std::vector<glm::mat2x2> getRayTransferMatrices();
 	std::vector<glm::mat2x2> getRayTransferMatricesWithReflection(int firstReflectionPos, int secondReflectionPos);
 	glm::mat2x2 getMa() const;
-	glm::mat2x2 getMs();
+	glm::mat2x2 getMs() const;
 	glm::mat2x2 getMa(int firstReflectionPos, int secondReflectionPos) const;
-	glm::mat2x2 getMs(int firstReflectionPos, int secondReflectionPos);
-	std::vector<glm::vec2> getPreAptReflections();
-	std::vector<glm::vec2> getPostAptReflections();
-	std::vector<glm::mat2x2> getMa(std::vector<glm::vec2> reflectionPos) const;
-	std::vector<glm::mat2x2> getMs(std::vector<glm::vec2> reflectionPos);
+	glm::mat2x2 getMs(int firstReflectionPos, int secondReflectionPos) const;
+	std::vector<glm::vec2> getPreAptReflections() const;
+	std::vector<glm::vec2> getPostAptReflections() const;
+	// Output overloads append to out, so callers can keep the buffers between calls
+	void getPreAptReflections(std::vector<glm::vec2>& out) const;
+	void getPostAptReflections(std::vector<glm::vec2>& out) const;
+	std::vector<glm::mat2x2> getMa(std::span<const glm::vec2> reflectionPos) const;
+	std::vector<glm::mat2x2> getMs(std::span<const glm::vec2> reflectionPos) const;
+	void getMa(std::span<const glm::vec2> reflectionPos, std::vector<glm::mat2x2>& out) const;
+	void getMs(std::span<const glm::vec2> reflectionPos, std::vector<glm::mat2x2>& out) const;
+	GhostLayout getGhostLayout(int firstReflectionPos, int secondReflectionPos) const;
+	static GhostLayout getGhostLayout(const glm::mat2x2& Ma, const glm::mat2x2& Ms);
 	std::vector<float> getInterfacePositions();
 	std::vector<float> getInterfacePositionsWithReflections(int firstReflectionPos, int secondReflectionPos);
-	glm::vec3 computeFresnelAR(float theta0, float d1, float n0, float n1, float n2) const;
+	static glm::vec3 computeFresnelAR(float theta0, float d1, float n0, float n1, float n2);
 	glm::vec3 propagateTransmission(int firstReflectionPos, int secondReflectionPos, glm::vec2 ray, bool quarterWaveCoating) const;
-	std::vector<glm::vec3> getTransmission(std::vector<glm::vec2> reflectionPos, std::vector<glm::vec2> xRays, std::vector<glm::vec2> yRays, bool quarterWaveCoating) const;
-	std::vector<glm::vec3> getTransmission(std::vector<glm::vec2> reflectionPos, glm::vec2 xRay, glm::vec2 yRay, bool quarterWaveCoating) const;
-	std::vector<glm::vec2> getPathIncidentAngleAtReflectionPos(glm::vec2 reflectionPair, glm::vec2 yawAndPitch);
+	//Spectral mode: same path, spectrum holds the transmission at each wavelength bin of sampling
+	void propagateTransmission(int firstReflectionPos, int secondReflectionPos, glm::vec2 ray, bool quarterWaveCoating, const SpectralSampling& sampling, std::span<float> spectrum) const;
+	int getCrossingCount(int firstReflectionPos, int secondReflectionPos) const;
+	int getCrossingInterface(int firstReflectionPos, int secondReflectionPos, int crossing) const;
+	glm::vec3 traceTransmission(int firstReflectionPos, int secondReflectionPos, glm::vec2 ray, bool quarterWaveCoating, TransmissionCrossing* crossings, int fromCrossing = 0) const;
+	glm::vec3 retraceCoatings(int firstReflectionPos, int secondReflectionPos, bool quarterWaveCoating, TransmissionCrossing* crossings, int beginInterface, int endInterface) const;
+	std::vector<glm::vec3> getTransmission(std::span<const glm::vec2> reflectionPos, std::span<const glm::vec2> xRays, std::span<const glm::vec2> yRays, bool quarterWaveCoating) const;
+	std::vector<glm::vec3> getTransmission(std::span<const glm::vec2> reflectionPos, glm::vec2 xRay, glm::vec2 yRay, bool quarterWaveCoating) const;
+	void getTransmission(std::span<const glm::vec2> reflectionPos, glm::vec2 xRay, glm::vec2 yRay, bool quarterWaveCoating, std::vector<glm::vec3>& out) const;
+	std::vector<glm::vec2> getPathIncidentAngleAtReflectionPos(glm::vec2 reflectionPair, glm::vec2 yawAndPitch) const;
+	void getPathIncidentAngleAtReflectionPos(glm::vec2 reflectionPair, glm::vec2 yawAndPitch, glm::vec2& firstAngles, glm::vec2& secondAngles) const;
+	const LensTable& getLensTable() const;
+	const LensDirtyRange& getDirtyRange() const;
+	void clearDirtyRange();
 	float m_aperture_height = 0;
 	float m_entrance_pupil_height = 0;
 
 private:
+	void updateChainCache();
+	void rebuildChainCache();
+	// Recomputes the table entries of the interfaces in [begin, end) and the chain products that contain them
+	void updateChainCache(int begin, int end);
+	glm::mat2x2 getReflectionCore(int firstReflectionPos, int secondReflectionPos) const;
+	glm::vec3 getCrossingFactor(int firstReflectionPos, int secondReflectionPos, int crossing, glm::vec2 ray, bool quarterWaveCoating) const;
+	glm::vec2 propagateCrossing(int firstReflectionPos, int secondReflectionPos, int crossing, glm::vec2 ray) const;
+
 	std::vector<LensInterface> m_lens_interfaces;
 	int m_iris_aperture_pos = 0;
-	
+	LensDirtyRange m_dirty_range = { 0, 0, true, true };
+
+	// Lens table and cached matrix chains, brought up to date by the constructor and the setters, so the const getters
+	// only read them and may be called concurrently. A is the aperture position, T_i the translation-refraction matrix and
+	// B_i the inverse refraction of interface i.
+	bool m_chain_dirty = true; //interface count or aperture position changed, everything is rebuilt
+	int m_chain_dirty_begin = std::numeric_limits<int>::max(); //otherwise only the interfaces in [begin, end) are
+	int m_chain_dirty_end = 0;
+	LensTable m_lens_table;
+	int m_chain_apt_pos = 0; //aperture position clamped to the interface count
+	std::vector<glm::mat2x2> m_chain_prefix; //[k] = T_{k-1} ... T_0, for k <= A
+	std::vector<glm::mat2x2> m_chain_pre_apt_suffix; //[k] = T_{A-1} ... T_k, for k <= A
+	std::vector<glm::mat2x2> m_chain_post_apt_prefix; //[k - A] = T_{k-1} ... T_A, for k >= A
+	std::vector<glm::mat2x2> m_chain_suffix; //[k - A] = T_{N-1} ... T_k, for k >= A
+	std::vector<glm::mat2x2> m_chain_backward; //[s * N + f] = B_{s+1} ... B_{f-1}
+	glm::mat2x2 m_chain_default_Ms = glm::mat2(1.0f);
 };
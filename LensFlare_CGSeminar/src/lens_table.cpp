@@ -0,0 +1,63 @@
+#include "lens_table.h"
+
+#include "lens_system.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+LensTableEntry getLensTableEntry(const LensInterface& lensInterface, float nPrev, bool isFirst, bool isAperture) {
+	LensInterfaceMatrices<float> matrices = getLensInterfaceMatrices(lensInterface.di, lensInterface.ni, lensInterface.Ri, nPrev, isFirst, isAperture);
+	LensTableEntry entry;
+	entry.d = matrices.d;
+	entry.n = matrices.n;
+	entry.nPrev = matrices.nPrev;
+	entry.R = matrices.R;
+
+	//the aperture has no coating to speak of, model it as index 1
+	entry.quarterWaveCoatingN = isAperture ? 1.0f : std::max(std::sqrt(entry.nPrev * entry.n), 1.38f);
+	entry.quarterWaveCoatingD = lensInterface.lambda0 / (4 * entry.quarterWaveCoatingN);
+	entry.customCoatingN = isAperture ? 1.0f : lensInterface.c_ni;
+	entry.customCoatingD = lensInterface.c_di;
+
+	entry.forward = matrices.forward;
+	entry.backward = matrices.backward;
+	entry.reflection = matrices.reflection;
+	entry.reflectionBack = matrices.reflectionBack;
+	return entry;
+}
+
+void LensTable::build(const std::vector<LensInterface>& lensInterfaces, int irisAperturePos) {
+	size = lensInterfaces.size();
+	d.resize(size);
+	n.resize(size);
+	nPrev.resize(size);
+	R.resize(size);
+	quarterWaveCoatingN.resize(size);
+	quarterWaveCoatingD.resize(size);
+	customCoatingN.resize(size);
+	customCoatingD.resize(size);
+	forward.resize(size);
+	backward.resize(size);
+	reflection.resize(size);
+	reflectionBack.resize(size);
+
+	update(lensInterfaces, irisAperturePos, 0, size);
+}
+
+void LensTable::update(const std::vector<LensInterface>& lensInterfaces, int irisAperturePos, int begin, int end) {
+	for (int i = begin; i < end; i++) {
+		LensTableEntry entry = getLensTableEntry(lensInterfaces[i], (i == 0) ? 1.0f : n[i - 1], i == 0, i == irisAperturePos);
+		d[i] = entry.d;
+		n[i] = entry.n;
+		nPrev[i] = entry.nPrev;
+		R[i] = entry.R;
+		quarterWaveCoatingN[i] = entry.quarterWaveCoatingN;
+		quarterWaveCoatingD[i] = entry.quarterWaveCoatingD;
+		customCoatingN[i] = entry.customCoatingN;
+		customCoatingD[i] = entry.customCoatingD;
+		forward[i] = entry.forward;
+		backward[i] = entry.backward;
+		reflection[i] = entry.reflection;
+		reflectionBack[i] = entry.reflectionBack;
+	}
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <limits>
+#include <vector>
+#include "ray_transfer_matrices.h"
+#include "simd_lanes.h"
+
+struct LensInterface;
+
+// Effective values and matrices of one interface over the scalar type T, the geometry part of LensTableEntry
+template<typename T>
+struct LensInterfaceMatrices {
+	T d, n, nPrev, R;
+	glm::mat<2, 2, T> forward, backward, reflection, reflectionBack;
+};
+
+// Same overrides and matrices as getLensTableEntry from the interface's thickness, index and radius
+template<typename T>
+LensInterfaceMatrices<T> getLensInterfaceMatrices(T d, T n, T R, T nPrev, bool isFirst, bool isAperture) {
+	BasicRayTransferMatrixBuilder<T> rayTransferMatrixBuilder;
+	LensInterfaceMatrices<T> entry;
+	entry.d = d;
+	entry.n = isAperture ? T(1) : n;
+	entry.nPrev = nPrev;
+	entry.R = isAperture ? T(std::numeric_limits<float>::infinity()) : R;
+	if (entry.R == T(0)) {
+		entry.R = T(std::numeric_limits<float>::infinity());
+	}
+	entry.forward = rayTransferMatrixBuilder.getTranslationRefractionMatrix(entry.d, entry.nPrev, entry.n, entry.R);
+	entry.backward = isFirst ? glm::mat<2, 2, T>(T(1)) : rayTransferMatrixBuilder.getinverseRefractionBackwardsTranslationMatrix(entry.d, entry.nPrev, entry.n, entry.R);
+	entry.reflection = rayTransferMatrixBuilder.getReflectionMatrix(entry.R);
+	glm::mat<2, 2, T> translation = rayTransferMatrixBuilder.getTranslationMatrix(entry.d);
+	entry.reflectionBack = translation * rayTransferMatrixBuilder.getReflectionMatrix(-entry.R) * translation;
+	return entry;
+}
+
+// Effective values and matrices of one interface, shared by LensTable and FixedLensSystem
+struct LensTableEntry {
+	float d, n, nPrev, R;
+	float quarterWaveCoatingN, quarterWaveCoatingD;
+	float customCoatingN, customCoatingD;
+	glm::mat2x2 forward, backward, reflection, reflectionBack;
+};
+
+// nPrev is the effective index of the previous interface (1 for the first one), backward is left as identity for the first interface
+LensTableEntry getLensTableEntry(const LensInterface& lensInterface, float nPrev, bool isFirst, bool isAperture);
+
+// Structure-of-arrays view of the lens interfaces with the iris aperture overrides baked in (n = 1 and R = inf at the aperture).
+// Rebuilt by LensSystem whenever the interfaces or the aperture position change, so propagation loops read plain arrays.
+// The columns start on a SIMD_ALIGNMENT boundary.
+struct LensTable {
+	void build(const std::vector<LensInterface>& lensInterfaces, int irisAperturePos);
+	// Recomputes the entries in [begin, end) of a table built for the same interface count and aperture position. An entry
+	// reads the index of the one before it, so end must include the interface after a changed one.
+	void update(const std::vector<LensInterface>& lensInterfaces, int irisAperturePos, int begin, int end);
+
+	int size = 0;
+	SimdVector<float> d; //thickness
+	SimdVector<float> n; //effective refractive index
+	SimdVector<float> nPrev; //effective refractive index in front of the interface, 1 for the first one
+	SimdVector<float> R; //effective radius, 0 is stored as infinity
+	SimdVector<float> quarterWaveCoatingN; //coating index and thickness per coating mode
+	SimdVector<float> quarterWaveCoatingD;
+	SimdVector<float> customCoatingN;
+	SimdVector<float> customCoatingD;
+	SimdVector<glm::mat2x2> forward; //translation and refraction into the interface
+	SimdVector<glm::mat2x2> backward; //inverse refraction and backwards translation, identity for the first interface
+	SimdVector<glm::mat2x2> reflection; //first reflection of a ghost
+	SimdVector<glm::mat2x2> reflectionBack; //second reflection of a ghost, including the translations to and from the interface
+};
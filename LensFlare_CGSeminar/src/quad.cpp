@@ -47,7 +47,7 @@ void FlareQuad::uploadDataIfNeeded() {
     }
 }
 
-void FlareQuad::drawQuad(glm::mat2x2& Ma, glm::mat2x2& Ms, glm::vec3& color, AnnotationData& annotationData) {
+void FlareQuad::drawQuad(const GhostLayout& layout, glm::vec3& color, AnnotationData& annotationData) {
     // Upload data if points have changed
     uploadDataIfNeeded();
 
@@ -56,8 +56,8 @@ void FlareQuad::drawQuad(glm::mat2x2& Ma, glm::mat2x2& Ms, glm::vec3& color, Ann
 
     // Set shader uniforms
     glUniform3fv(1, 1, glm::value_ptr(color)); // Color
-    glUniformMatrix2fv(2, 1, GL_FALSE, glm::value_ptr(Ma)); // Projection Matrix
-    glUniformMatrix2fv(3, 1, GL_FALSE, glm::value_ptr(Ms)); // Projection Matrix
+    glUniform4f(2, layout.apertureRow.x, layout.apertureRow.y, layout.sensorRow.x, layout.sensorRow.y); // Ma and Ms * Ma rows
+    glUniform2f(3, layout.centerCoeff, layout.heightCoeff); // Ghost center and height
     glUniform1i(12, m_id); // Quad ID
     glUniform2fv(15, 1, glm::value_ptr(annotationData.posAnnotationTransform));
     glUniform1f(16, annotationData.sizeAnnotationTransform);
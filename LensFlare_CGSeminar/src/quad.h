@@ -4,6 +4,7 @@
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <vector>
+#include "lens_system.h"
 
 struct QuadData {
     int quadID;
@@ -31,7 +32,7 @@ public:
     int getID() const { return m_id; }
     std::vector<glm::vec3> getPoints();
     void releaseArrayAndBuffer();
-    void drawQuad(glm::mat2x2& Ma, glm::mat2x2& Ms, glm::vec3& color, AnnotationData& annotationData);
+    void drawQuad(const GhostLayout& layout, glm::vec3& color, AnnotationData& annotationData);
     void drawQuad(glm::vec3& color, AnnotationData& annotationData);
 
 private:
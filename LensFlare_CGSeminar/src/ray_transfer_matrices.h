@@ -1,15 +1,66 @@
 #pragma once
 
 #include <glm/mat2x2.hpp>
+#include <cmath>
+#include <limits>
+#include <type_traits>
 
 
-class RayTransferMatrixBuilder {
+// Ray transfer matrices over the scalar type T: float for rendering and the optimizers, a Dual (dual.h) for the
+// derivatives of the ghost layout with respect to the lens parameters
+template<typename T>
+class BasicRayTransferMatrixBuilder {
 public:
-	RayTransferMatrixBuilder();
-	glm::mat2x2 getTranslationMatrix(float di);
-	glm::mat2x2 getRefractionMatrix(float n1, float n2, float Ri);
-	glm::mat2x2 getReflectionMatrix(float Ri);
-	glm::mat2x2 getTranslationRefractionMatrix(float di, float n1, float n2, float Ri);
-	glm::mat2x2 getinverseRefractionBackwardsTranslationMatrix(float di, float n1, float n2, float Ri);
+	using Matrix = glm::mat<2, 2, T>;
+
+	Matrix getTranslationMatrix(T di) const;
+	Matrix getRefractionMatrix(T n1, T n2, T Ri) const;
+	Matrix getReflectionMatrix(T Ri) const;
+	Matrix getTranslationRefractionMatrix(T di, T n1, T n2, T Ri) const;
+	Matrix getinverseRefractionBackwardsTranslationMatrix(T di, T n1, T n2, T Ri) const;
 };
-	
+
+using RayTransferMatrixBuilder = BasicRayTransferMatrixBuilder<float>;
+extern template class BasicRayTransferMatrixBuilder<float>;
+
+template<typename T>
+typename BasicRayTransferMatrixBuilder<T>::Matrix BasicRayTransferMatrixBuilder<T>::getTranslationMatrix(T di) const {
+	return Matrix(T(1), T(0), di, T(1));
+}
+template<typename T>
+typename BasicRayTransferMatrixBuilder<T>::Matrix BasicRayTransferMatrixBuilder<T>::getRefractionMatrix(T n1, T n2, T Ri) const {
+	if (Ri == T(0)) {
+		Ri = T(std::numeric_limits<float>::infinity());
+	}
+	// The term of a flat interface is 0, but a Dual would get 0 * inf partials from the infinite radius. Scalars keep the
+	// division and its signed zero.
+	if constexpr (!std::is_floating_point_v<T>) {
+		if (isinf(Ri)) {
+			return Matrix(T(1), T(0), T(0), n1 / n2);
+		}
+	}
+	T thirdTerm = (n1 - n2) / (n2 * Ri);
+	T fourthTerm = n1 / n2;
+	return Matrix(T(1), thirdTerm, T(0), fourthTerm);
+}
+template<typename T>
+typename BasicRayTransferMatrixBuilder<T>::Matrix BasicRayTransferMatrixBuilder<T>::getReflectionMatrix(T Ri) const {
+	if (Ri == T(0)) {
+		Ri = T(std::numeric_limits<float>::infinity());
+	}
+	return Matrix(T(1), (T(2) / Ri), T(0), T(1));
+}
+template<typename T>
+typename BasicRayTransferMatrixBuilder<T>::Matrix BasicRayTransferMatrixBuilder<T>::getTranslationRefractionMatrix(T di, T n1, T n2, T Ri) const {
+	if (Ri == T(0)) {
+		Ri = T(std::numeric_limits<float>::infinity());
+	}
+	return getTranslationMatrix(di) * getRefractionMatrix(n1, n2, Ri);
+}
+template<typename T>
+typename BasicRayTransferMatrixBuilder<T>::Matrix BasicRayTransferMatrixBuilder<T>::getinverseRefractionBackwardsTranslationMatrix(T di, T n1, T n2, T Ri) const {
+	if (Ri == T(0)) {
+		Ri = T(std::numeric_limits<float>::infinity());
+	}
+	return getRefractionMatrix(n2, n1, -Ri) * getTranslationMatrix(di);
+}
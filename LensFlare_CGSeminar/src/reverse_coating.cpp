@@ -6,15 +6,31 @@
 #include <numbers>
 #include <iostream>
 #include "utils.h"
+#include "fresnel_ar.h"
 
 //float RED_WAVELENGTH = 650;
 //float GREEN_WAVELENGTH = 510;
 //float BLUE_WAVELENGTH = 475;
 
+//Summed reflectivity at both incident angles of the ghost path, for every coating thickness
+static void computeSummedReflectivity(glm::vec2 incidentAngles, const std::vector<float>& thicknesses, float n0, float n1, float n2, std::vector<glm::vec3>& reflectivity) {
+    static thread_local std::vector<float> angles;
+    static thread_local std::vector<glm::vec3> secondAngleReflectivity;
+    reflectivity.resize(thicknesses.size());
+    secondAngleReflectivity.resize(thicknesses.size());
+    angles.assign(thicknesses.size(), incidentAngles.x);
+    computeFresnelARBatch(angles, thicknesses, n0, n1, n2, reflectivity);
+    angles.assign(thicknesses.size(), incidentAngles.y);
+    computeFresnelARBatch(angles, thicknesses, n0, n1, n2, secondAngleReflectivity);
+    for (size_t i = 0; i < reflectivity.size(); i++) {
+        reflectivity[i] += secondAngleReflectivity[i];
+    }
+}
 
 void optimizeLensCoatingsGridSearch(LensSystem& lensSystem, glm::vec3 desiredColor, glm::vec2 reflectionPair, glm::vec2 yawAndPitch) {
     std::vector<LensInterface> lensInterfaces = lensSystem.getLensInterfaces();
-    std::vector<glm::vec2> incident_angles = lensSystem.getPathIncidentAngleAtReflectionPos(reflectionPair, yawAndPitch);
+    glm::vec2 incident_angles[2];
+    lensSystem.getPathIncidentAngleAtReflectionPos(reflectionPair, yawAndPitch, incident_angles[0], incident_angles[1]);
 
     float first_n1 = std::max(sqrt(lensInterfaces[reflectionPair.x - 1].ni * lensInterfaces[reflectionPair.x].ni), 1.38f);
     float second_n1 = reflectionPair.y == 0
@@ -30,41 +46,34 @@ void optimizeLensCoatingsGridSearch(LensSystem& lensSystem, glm::vec3 desiredCol
 
     std::cout << "START GRID SEARCH" << std::endl;
 
-    for (float candidateLambda1 = minlambda; candidateLambda1 < maxlambda; candidateLambda1 += 2.0f) {
-
-        float thickness1 = candidateLambda1 / 4.0f / first_n1;
-
-        glm::vec3 reflectivity1 =
-            lensSystem.computeFresnelAR(incident_angles[0].x, thickness1, lensInterfaces[reflectionPair.x - 1].ni, first_n1, lensInterfaces[reflectionPair.x].ni) +
-            lensSystem.computeFresnelAR(incident_angles[0].y, thickness1, lensInterfaces[reflectionPair.x - 1].ni, first_n1, lensInterfaces[reflectionPair.x].ni);
-
-
-        for (float candidateLambda2 = minlambda; candidateLambda2 < maxlambda; candidateLambda2 += 2.0f) {
-
-            float thickness2 = candidateLambda2 / 4.0f / second_n1;
-            glm::vec3 reflectivity2;
-
-            if (reflectionPair.y == 0) {
-                reflectivity2 =
-                    lensSystem.computeFresnelAR(incident_angles[1].x, thickness2, lensInterfaces[reflectionPair.y].ni, second_n1, 1.0f) +
-                    lensSystem.computeFresnelAR(incident_angles[1].y, thickness2, lensInterfaces[reflectionPair.y].ni, second_n1, 1.0f);
-            }
-            else {
-                reflectivity2 =
-                    lensSystem.computeFresnelAR(incident_angles[1].x, thickness2, lensInterfaces[reflectionPair.y].ni, second_n1, lensInterfaces[reflectionPair.y - 1].ni) +
-                    lensSystem.computeFresnelAR(incident_angles[1].y, thickness2, lensInterfaces[reflectionPair.y].ni, second_n1, lensInterfaces[reflectionPair.y - 1].ni);
-            }
+    //Both interfaces are independent, evaluate each candidate thickness once per interface
+    std::vector<float> candidateLambdas;
+    for (float candidateLambda = minlambda; candidateLambda < maxlambda; candidateLambda += 2.0f) {
+        candidateLambdas.push_back(candidateLambda);
+    }
+    std::vector<float> thicknesses1(candidateLambdas.size());
+    std::vector<float> thicknesses2(candidateLambdas.size());
+    for (size_t i = 0; i < candidateLambdas.size(); i++) {
+        thicknesses1[i] = candidateLambdas[i] / 4.0f / first_n1;
+        thicknesses2[i] = candidateLambdas[i] / 4.0f / second_n1;
+    }
+    std::vector<glm::vec3> reflectivities1;
+    std::vector<glm::vec3> reflectivities2;
+    computeSummedReflectivity(incident_angles[0], thicknesses1, lensInterfaces[reflectionPair.x - 1].ni, first_n1, lensInterfaces[reflectionPair.x].ni, reflectivities1);
+    computeSummedReflectivity(incident_angles[1], thicknesses2, lensInterfaces[reflectionPair.y].ni, second_n1, reflectionPair.y == 0 ? 1.0f : lensInterfaces[reflectionPair.y - 1].ni, reflectivities2);
+    glm::vec3 normDesired = normalizeRGB(desiredColor);
 
-            glm::vec3 combinedReflectivity = reflectivity1 * reflectivity2;
+    for (size_t i = 0; i < candidateLambdas.size(); i++) {
+        for (size_t j = 0; j < candidateLambdas.size(); j++) {
+            glm::vec3 combinedReflectivity = reflectivities1[i] * reflectivities2[j];
 
             glm::vec3 normCombined = normalizeRGB(combinedReflectivity);
-            glm::vec3 normDesired = normalizeRGB(desiredColor);
             float error = glm::length(normCombined - normDesired);
 
             if (error < bestError) {
                 bestError = error;
-                bestLambda1 = candidateLambda1;
-                bestLambda2 = candidateLambda2;
+                bestLambda1 = candidateLambdas[i];
+                bestLambda2 = candidateLambdas[j];
             }
         }
     }
@@ -81,8 +90,9 @@ void optimizeLensCoatingsGridSearch(LensSystem& lensSystem, glm::vec3 desiredCol
 }
 
 std::pair<std::vector<std::pair<float, glm::vec3>>, std::vector<std::pair<float, glm::vec3>>> computeReflectivityPerLambda(LensSystem& lensSystem, glm::vec2 reflectionPair, glm::vec2 yawAndPitch) {
-    std::vector<LensInterface> lensInterfaces = lensSystem.getLensInterfaces();
-    std::vector<glm::vec2> incident_angles = lensSystem.getPathIncidentAngleAtReflectionPos(reflectionPair, glm::vec2(0.001));
+    const std::vector<LensInterface>& lensInterfaces = lensSystem.getLensInterfaces();
+    glm::vec2 incident_angles[2];
+    lensSystem.getPathIncidentAngleAtReflectionPos(reflectionPair, glm::vec2(0.001), incident_angles[0], incident_angles[1]);
 
     float first_n1 = std::max(sqrt(lensInterfaces[reflectionPair.x - 1].ni * lensInterfaces[reflectionPair.x].ni), 1.38f);
     float second_n1 = reflectionPair.y == 0
@@ -123,8 +133,17 @@ std::pair<std::vector<std::pair<float, glm::vec3>>, std::vector<std::pair<float,
 
 std::vector<std::vector<glm::vec3>> computeCoatingColorGrid(LensSystem& lensSystem, glm::vec2 reflectionPair, glm::vec2 yawAndPitch)
 {
-    std::vector<LensInterface> lensInterfaces = lensSystem.getLensInterfaces();
-    std::vector<glm::vec2> incident_angles = lensSystem.getPathIncidentAngleAtReflectionPos(reflectionPair, yawAndPitch);
+    std::vector<std::vector<glm::vec3>> colorGrid;
+    computeCoatingColorGrid(lensSystem, reflectionPair, yawAndPitch, colorGrid);
+    return colorGrid;
+}
+
+//Fills colorGrid in place, the rows keep their capacity when the grid is drawn every frame
+void computeCoatingColorGrid(const LensSystem& lensSystem, glm::vec2 reflectionPair, glm::vec2 yawAndPitch, std::vector<std::vector<glm::vec3>>& colorGrid)
+{
+    const std::vector<LensInterface>& lensInterfaces = lensSystem.getLensInterfaces();
+    glm::vec2 incident_angles[2];
+    lensSystem.getPathIncidentAngleAtReflectionPos(reflectionPair, yawAndPitch, incident_angles[0], incident_angles[1]);
 
     float first_n1 = std::max(std::sqrt(lensInterfaces[reflectionPair.x - 1].ni * lensInterfaces[reflectionPair.x].ni), 1.38f);
     float second_n1 = (reflectionPair.y == 0)
@@ -139,36 +158,31 @@ std::vector<std::vector<glm::vec3>> computeCoatingColorGrid(LensSystem& lensSyst
     int numLambda1 = static_cast<int>((maxLambda - minLambda) / stepLambda1) + 1;
     int numLambda2 = static_cast<int>((maxLambda - minLambda) / stepLambda2) + 1;
 
-    std::vector<std::vector<glm::vec3>> colorGrid(numLambda2, std::vector<glm::vec3>(numLambda1, glm::vec3(0.0f)));
+    colorGrid.resize(numLambda2);
+    for (std::vector<glm::vec3>& row : colorGrid) {
+        row.assign(numLambda1, glm::vec3(0.0f));
+    }
 
+    static thread_local std::vector<float> thicknesses1;
+    static thread_local std::vector<float> thicknesses2;
+    static thread_local std::vector<glm::vec3> reflectivities1;
+    static thread_local std::vector<glm::vec3> reflectivities2;
+    thicknesses1.resize(numLambda1);
+    thicknesses2.resize(numLambda2);
     for (int i = 0; i < numLambda1; ++i) {
-        float candidateLambda1 = minLambda + i * stepLambda1;
-        float thickness1 = candidateLambda1 / 4.0f / first_n1;
-
-        glm::vec3 reflectivity1 =
-            lensSystem.computeFresnelAR(incident_angles[0].x, thickness1, lensInterfaces[reflectionPair.x - 1].ni, first_n1, lensInterfaces[reflectionPair.x].ni) +
-            lensSystem.computeFresnelAR(incident_angles[0].y, thickness1, lensInterfaces[reflectionPair.x - 1].ni, first_n1, lensInterfaces[reflectionPair.x].ni);
+        thicknesses1[i] = (minLambda + i * stepLambda1) / 4.0f / first_n1;
+    }
+    for (int j = 0; j < numLambda2; ++j) {
+        thicknesses2[j] = (minLambda + j * stepLambda2) / 4.0f / second_n1;
+    }
+    computeSummedReflectivity(incident_angles[0], thicknesses1, lensInterfaces[reflectionPair.x - 1].ni, first_n1, lensInterfaces[reflectionPair.x].ni, reflectivities1);
+    computeSummedReflectivity(incident_angles[1], thicknesses2, lensInterfaces[reflectionPair.y].ni, second_n1, reflectionPair.y == 0 ? 1.0f : lensInterfaces[reflectionPair.y - 1].ni, reflectivities2);
 
+    for (int i = 0; i < numLambda1; ++i) {
         for (int j = 0; j < numLambda2; ++j) {
-            float candidateLambda2 = minLambda + j * stepLambda2;
-            float thickness2 = candidateLambda2 / 4.0f / second_n1;
-            glm::vec3 reflectivity2;
-
-            if (reflectionPair.y == 0) {
-                reflectivity2 =
-                    lensSystem.computeFresnelAR(incident_angles[1].x, thickness2, lensInterfaces[reflectionPair.y].ni, second_n1, 1.0f) +
-                    lensSystem.computeFresnelAR(incident_angles[1].y, thickness2, lensInterfaces[reflectionPair.y].ni, second_n1, 1.0f);
-            }
-            else {
-                reflectivity2 =
-                    lensSystem.computeFresnelAR(incident_angles[1].x, thickness2, lensInterfaces[reflectionPair.y].ni, second_n1, lensInterfaces[reflectionPair.y - 1].ni) +
-                    lensSystem.computeFresnelAR(incident_angles[1].y, thickness2, lensInterfaces[reflectionPair.y].ni, second_n1, lensInterfaces[reflectionPair.y - 1].ni);
-            }
-
-            glm::vec3 combinedReflectivity = reflectivity1 * reflectivity2;
+            glm::vec3 combinedReflectivity = reflectivities1[i] * reflectivities2[j];
             colorGrid[j][i] = normalizeRGB(combinedReflectivity);
         }
     }
-    return colorGrid;
 }
 
@@ -0,0 +1,509 @@
+#include "rv_gomea.h"
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+#include <pagmo/problem.hpp>
+#include <Eigen/Dense>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+RVGomea::RVGomea(unsigned gen, unsigned seed) : m_gen(gen), m_seed(seed), m_e(seed) {}
+
+void RVGomea::set_seed(unsigned seed) {
+    m_seed = seed;
+    m_e.seed(seed);
+    m_state = State();
+}
+
+void RVGomea::setLinkageGroups(std::vector<std::vector<int>> linkageGroups) {
+    m_linkageGroups = std::move(linkageGroups);
+    m_state = State();
+}
+
+void RVGomea::setPartialEvaluator(PartialEvaluatorFactory partialEvaluatorFactory) {
+    m_partialEvaluatorFactory = std::move(partialEvaluatorFactory);
+}
+
+size_t RVGomea::getPopulationSizeGuideline(size_t dim) {
+    return static_cast<size_t>(17.0 + 3.0 * std::pow(static_cast<double>(dim), 1.5));
+}
+
+std::string RVGomea::get_extra_info() const {
+    std::ostringstream info;
+    info << "\tGenerations: " << m_gen << "\n";
+    info << "\tSelection percentile: " << m_tau << "\n";
+    info << "\tDistribution multiplier decrease: " << m_distributionMultiplierDecrease << "\n";
+    info << "\tSDR threshold: " << m_stDevRatioThreshold << "\n";
+    info << "\tLinkage groups: " << m_linkageGroups.size() << "\n";
+    info << "\tPartial evaluation: " << (m_partialEvaluatorFactory ? "yes" : "no") << "\n";
+    info << "\tSeed: " << m_seed << "\n";
+    return info.str();
+}
+
+std::vector<std::vector<int>> RVGomea::getLinkageGroups(size_t dim) const {
+    std::vector<std::vector<int>> groups;
+    std::vector<bool> grouped(dim, false);
+    for (const std::vector<int>& linkageGroup : m_linkageGroups) {
+        std::vector<int> group;
+        for (int index : linkageGroup) {
+            if (index >= 0 && index < static_cast<int>(dim) && !grouped[index]) {
+                grouped[index] = true;
+                group.push_back(index);
+            }
+        }
+        if (!group.empty()) {
+            std::sort(group.begin(), group.end());
+            groups.push_back(group);
+        }
+    }
+    for (size_t i = 0; i < dim; i++) {
+        if (!grouped[i]) {
+            groups.push_back({ static_cast<int>(i) });
+        }
+    }
+    return groups;
+}
+
+//Lower is better, NaN loses against everything
+static bool isBetterFitness(double f, double other) {
+    return f < other || (std::isnan(other) && !std::isnan(f));
+}
+
+//Mutual information of two variables under the normal distribution of the selection
+static double getMutualInformation(const Eigen::MatrixXd& covariance, int a, int b) {
+    double variances = covariance(a, a) * covariance(b, b);
+    if (!(variances > 0.0)) {
+        return 0.0;
+    }
+    double r2 = covariance(a, b) * covariance(a, b) / variances;
+    return -0.5 * std::log(std::max(1.0 - r2, 1e-12));
+}
+
+//Average linkage clustering of the groups on their mean pairwise mutual information. Every cluster formed on the way is a
+//FOS element except the root, AMS already moves all variables at once.
+static std::vector<std::vector<int>> learnLinkageTree(const Eigen::MatrixXd& covariance, const std::vector<std::vector<int>>& groups) {
+    const int count = groups.size();
+    std::vector<std::vector<int>> fos(groups);
+    if (count <= 2) {
+        return fos;
+    }
+    const int maxElements = 2 * count - 1;
+    std::vector<double> similarity(static_cast<size_t>(maxElements) * maxElements, 0.0);
+    auto getSimilarity = [&](int a, int b) -> double& { return similarity[static_cast<size_t>(a) * maxElements + b]; };
+    for (int i = 0; i < count; i++) {
+        for (int j = i + 1; j < count; j++) {
+            double sum = 0.0;
+            for (int a : groups[i]) {
+                for (int b : groups[j]) {
+                    sum += getMutualInformation(covariance, a, b);
+                }
+            }
+            getSimilarity(i, j) = getSimilarity(j, i) = sum / (groups[i].size() * groups[j].size());
+        }
+    }
+
+    std::vector<int> clusters(count);
+    std::iota(clusters.begin(), clusters.end(), 0);
+    std::vector<int> clusterGroups(maxElements, 1);
+    while (clusters.size() > 2) {
+        int first = 0;
+        int second = 1;
+        for (int i = 0; i < static_cast<int>(clusters.size()); i++) {
+            for (int j = i + 1; j < static_cast<int>(clusters.size()); j++) {
+                if (getSimilarity(clusters[i], clusters[j]) > getSimilarity(clusters[first], clusters[second])) {
+                    first = i;
+                    second = j;
+                }
+            }
+        }
+        int a = clusters[first];
+        int b = clusters[second];
+        int merged = fos.size();
+        std::vector<int> indices = fos[a];
+        indices.insert(indices.end(), fos[b].begin(), fos[b].end());
+        std::sort(indices.begin(), indices.end());
+        fos.push_back(std::move(indices));
+        clusterGroups[merged] = clusterGroups[a] + clusterGroups[b];
+        for (int other : clusters) {
+            if (other != a && other != b) {
+                getSimilarity(merged, other) = getSimilarity(other, merged) =
+                    (clusterGroups[a] * getSimilarity(a, other) + clusterGroups[b] * getSimilarity(b, other)) / clusterGroups[merged];
+            }
+        }
+        clusters.erase(clusters.begin() + second);
+        clusters[first] = merged;
+    }
+    return fos;
+}
+
+pagmo::population RVGomea::evolve(pagmo::population pop) const {
+    const pagmo::problem& prob = pop.get_problem();
+    const size_t dim = prob.get_nx();
+    const size_t n = pop.size();
+    if (prob.get_nf() != 1u || prob.get_nc() != 0u) {
+        throw std::invalid_argument(get_name() + " only handles unconstrained single-objective problems");
+    }
+    if (m_gen == 0u || n < 2) {
+        return pop;
+    }
+    const auto bounds = prob.get_bounds();
+    const pagmo::vector_double& lb = bounds.first;
+    const pagmo::vector_double& ub = bounds.second;
+    auto isInBounds = [&](int index, double value) { return value >= lb[index] && value <= ub[index]; };
+
+    std::vector<pagmo::vector_double> xs = pop.get_x();
+    std::vector<double> fs(n);
+    for (size_t i = 0; i < n; i++) {
+        fs[i] = pop.get_f()[i][0];
+    }
+
+    State& state = m_state;
+    if (state.populationSize != n || state.dim != dim) {
+        state = State();
+        state.populationSize = n;
+        state.dim = dim;
+        state.mean.assign(dim, 0.0);
+        state.meanShift.assign(dim, 0.0);
+        state.noImprovementGenerations.assign(n, 0);
+        for (size_t i = 0; i < n; i++) {
+            state.engines.emplace_back(m_e());
+        }
+    }
+
+    std::unique_ptr<PartialEvaluator> evaluator = m_partialEvaluatorFactory ? m_partialEvaluatorFactory() : nullptr;
+    if (evaluator) {
+        evaluator->resize(n);
+    }
+    auto evaluate = [&](size_t individual, const pagmo::vector_double& x) {
+        if (evaluator) {
+            prob.increment_fevals(1u);
+            return evaluator->evaluate(individual, x);
+        }
+        return prob.fitness(x)[0];
+    };
+    //individuals are varied independently of each other, in parallel when the evaluations allow it
+    const bool parallel = evaluator || prob.get_thread_safety() >= pagmo::thread_safety::constant;
+    auto forIndividuals = [&](size_t begin, size_t end, auto&& f) {
+        if (parallel) {
+            tbb::parallel_for(tbb::blocked_range<size_t>(begin, end), [&](const tbb::blocked_range<size_t>& range) {
+                for (size_t k = range.begin(); k != range.end(); k++) {
+                    f(k);
+                }
+            });
+        }
+        else {
+            for (size_t k = begin; k < end; k++) {
+                f(k);
+            }
+        }
+    };
+    auto uniform = [](std::mt19937& engine) { return std::uniform_real_distribution<double>(0.0, 1.0)(engine); };
+
+    const size_t selectionSize = std::clamp<size_t>(static_cast<size_t>(m_tau * n), 1, n);
+    const int maxNoImprovementStretch = 25 + static_cast<int>(dim);
+    const double distributionMultiplierIncrease = 1.0 / m_distributionMultiplierDecrease;
+    const size_t amsCount = static_cast<size_t>(0.5 * m_tau * n); //alpha_AMS (n - 1) of the reference
+    const std::vector<std::vector<int>> groups = getLinkageGroups(dim);
+
+    std::vector<size_t> order(n);
+    std::vector<char> improved(n);
+    std::vector<int> draws(n);
+    std::vector<int> outOfBoundsDraws(n);
+    std::vector<Eigen::MatrixXd> choleskyFactors;
+
+    //Samples the variables of FOS element j for individual k, the change is kept when it improves and one time in twenty
+    //regardless. The first amsCount individuals also move along the mean shift.
+    auto sampleFosElement = [&](size_t k, size_t j, bool applyAMS) {
+        static thread_local std::vector<double> backup;
+        static thread_local std::vector<double> sample;
+        static thread_local Eigen::VectorXd z;
+        std::mt19937& engine = state.engines[k];
+        const FosElement& element = state.fos[j];
+        const std::vector<int>& indices = element.indices;
+        const size_t m = indices.size();
+        pagmo::vector_double& x = xs[k];
+        backup.resize(m);
+        sample.resize(m);
+        z.resize(m);
+        for (size_t a = 0; a < m; a++) {
+            backup[a] = x[indices[a]];
+        }
+
+        //inside the bounds, uniformly after 100 draws outside them
+        std::normal_distribution<double> normal;
+        for (int tries = 0;; tries++) {
+            draws[k]++;
+            if (tries >= 100) {
+                for (size_t a = 0; a < m; a++) {
+                    sample[a] = lb[indices[a]] + (ub[indices[a]] - lb[indices[a]]) * uniform(engine);
+                }
+            }
+            else {
+                for (size_t a = 0; a < m; a++) {
+                    z[a] = normal(engine);
+                }
+                Eigen::VectorXd y = choleskyFactors[j].triangularView<Eigen::Lower>() * z;
+                for (size_t a = 0; a < m; a++) {
+                    sample[a] = y[a] + state.mean[indices[a]];
+                }
+            }
+            bool inside = true;
+            for (size_t a = 0; a < m && inside; a++) {
+                inside = isInBounds(indices[a], sample[a]);
+            }
+            if (inside) {
+                break;
+            }
+            outOfBoundsDraws[k]++;
+        }
+        for (size_t a = 0; a < m; a++) {
+            x[indices[a]] = sample[a];
+        }
+
+        if (applyAMS && state.generation > 0) {
+            for (double shrink = 1.0; shrink > 1e-10; shrink *= 0.5) {
+                bool inside = true;
+                for (size_t a = 0; a < m && inside; a++) {
+                    sample[a] = x[indices[a]] + shrink * 2.0 * element.distributionMultiplier * state.meanShift[indices[a]];
+                    inside = isInBounds(indices[a], sample[a]);
+                }
+                if (inside) {
+                    for (size_t a = 0; a < m; a++) {
+                        x[indices[a]] = sample[a];
+                    }
+                    break;
+                }
+            }
+        }
+
+        double f = evaluate(k, x);
+        bool improvement = isBetterFitness(f, fs[k]);
+        if (improvement || uniform(engine) < 0.05) {
+            fs[k] = f;
+        }
+        else {
+            for (size_t a = 0; a < m; a++) {
+                x[indices[a]] = backup[a];
+            }
+        }
+        return improvement;
+    };
+
+    //Moves all variables of individual k along the mean shift
+    auto applyAMS = [&](size_t k) {
+        static thread_local pagmo::vector_double shifted;
+        std::mt19937& engine = state.engines[k];
+        shifted.resize(dim);
+        bool inside = false;
+        for (double shrink = 1.0; shrink > 1e-10 && !inside; shrink *= 0.5) {
+            inside = true;
+            for (size_t i = 0; i < dim && inside; i++) {
+                shifted[i] = xs[k][i] + shrink * 2.0 * state.meanShift[i];
+                inside = isInBounds(i, shifted[i]);
+            }
+        }
+        if (!inside) {
+            return false;
+        }
+        double f = evaluate(k, shifted);
+        if (uniform(engine) < 0.05 || isBetterFitness(f, fs[k])) {
+            xs[k] = shifted;
+            fs[k] = f;
+            return true;
+        }
+        return false;
+    };
+
+    //Pulls individual k towards the donor one FOS element at a time, with a shrinking step, until it improves. Without an
+    //improvement it becomes a copy of the donor.
+    auto applyForcedImprovements = [&](size_t k, size_t donor) {
+        static thread_local std::vector<double> backup;
+        static thread_local std::vector<size_t> fosOrder;
+        std::mt19937& engine = state.engines[k];
+        pagmo::vector_double& x = xs[k];
+        fosOrder.resize(state.fos.size());
+        for (double alpha = 1.0; alpha >= 0.01;) {
+            alpha *= 0.5;
+            std::iota(fosOrder.begin(), fosOrder.end(), 0);
+            std::shuffle(fosOrder.begin(), fosOrder.end(), engine);
+            for (size_t j : fosOrder) {
+                const std::vector<int>& indices = state.fos[j].indices;
+                backup.resize(indices.size());
+                for (size_t a = 0; a < indices.size(); a++) {
+                    backup[a] = x[indices[a]];
+                    x[indices[a]] = alpha * x[indices[a]] + (1 - alpha) * xs[donor][indices[a]];
+                }
+                double f = evaluate(k, x);
+                if (isBetterFitness(f, fs[k])) {
+                    fs[k] = f;
+                    return;
+                }
+                for (size_t a = 0; a < indices.size(); a++) {
+                    x[indices[a]] = backup[a];
+                }
+            }
+        }
+        x = xs[donor];
+        fs[k] = fs[donor];
+    };
+
+    for (unsigned gen = 0; gen < m_gen; gen++) {
+        //Truncation selection
+        std::iota(order.begin(), order.end(), 0);
+        std::partial_sort(order.begin(), order.begin() + selectionSize, order.end(), [&](size_t a, size_t b) {
+            return isBetterFitness(fs[a], fs[b]) || (!isBetterFitness(fs[b], fs[a]) && a < b);
+        });
+        const double selectionBestFitness = fs[order[0]];
+
+        //Mean, its shift since the last generation and the covariance of the selection
+        Eigen::MatrixXd selection(selectionSize, dim);
+        for (size_t i = 0; i < selectionSize; i++) {
+            selection.row(i) = Eigen::Map<const Eigen::RowVectorXd>(xs[order[i]].data(), dim);
+        }
+        Eigen::RowVectorXd mean = selection.colwise().mean();
+        for (size_t i = 0; i < dim; i++) {
+            if (state.generation > 0) {
+                state.meanShift[i] = mean[i] - state.mean[i];
+            }
+            state.mean[i] = mean[i];
+        }
+        Eigen::MatrixXd centered = selection.rowwise() - mean;
+        Eigen::MatrixXd covariance = (centered.transpose() * centered) / static_cast<double>(selectionSize);
+
+        //Linkage tree, the elements that are still there keep their distribution multiplier
+        std::map<std::vector<int>, double> distributionMultipliers;
+        for (const FosElement& element : state.fos) {
+            distributionMultipliers[element.indices] = element.distributionMultiplier;
+        }
+        state.fos.clear();
+        for (std::vector<int>& indices : learnLinkageTree(covariance, groups)) {
+            auto found = distributionMultipliers.find(indices);
+            state.fos.push_back({ std::move(indices), found != distributionMultipliers.end() ? found->second : 1.0 });
+        }
+
+        //Sampling distribution per element, centered on the best selected while its multiplier is shrinking
+        choleskyFactors.resize(state.fos.size());
+        for (size_t j = 0; j < state.fos.size(); j++) {
+            const FosElement& element = state.fos[j];
+            const size_t m = element.indices.size();
+            if (element.distributionMultiplier < 1.0) {
+                for (int index : element.indices) {
+                    state.mean[index] = xs[order[0]][index];
+                }
+            }
+            Eigen::MatrixXd elementCovariance(m, m);
+            for (size_t a = 0; a < m; a++) {
+                for (size_t b = 0; b < m; b++) {
+                    elementCovariance(a, b) = element.distributionMultiplier * covariance(element.indices[a], element.indices[b]);
+                }
+            }
+            Eigen::LLT<Eigen::MatrixXd> llt(elementCovariance);
+            if (llt.info() == Eigen::Success) {
+                choleskyFactors[j] = llt.matrixL();
+            }
+            else {
+                //degenerate selection, sample the variables independently
+                choleskyFactors[j] = elementCovariance.diagonal().cwiseMax(0.0).cwiseSqrt().asDiagonal();
+            }
+        }
+
+        //The best selected is kept in slot 0, which is never varied
+        if (order[0] != 0) {
+            xs[0] = xs[order[0]];
+            fs[0] = fs[order[0]];
+        }
+
+        std::fill(improved.begin(), improved.end(), 0);
+        bool generationalImprovement = false;
+        std::vector<size_t> fosOrder(state.fos.size());
+        std::iota(fosOrder.begin(), fosOrder.end(), 0);
+        std::shuffle(fosOrder.begin(), fosOrder.end(), m_e);
+        for (size_t j : fosOrder) {
+            std::fill(draws.begin(), draws.end(), 0);
+            std::fill(outOfBoundsDraws.begin(), outOfBoundsDraws.end(), 0);
+            forIndividuals(1, n, [&](size_t k) {
+                if (sampleFosElement(k, j, k <= amsCount)) {
+                    improved[k] = 1;
+                }
+            });
+
+            //Distribution multiplier, shrunk when most draws left the bounds, widened when the improvements lie far from
+            //the mean (standard deviation ratio) and shrunk back after generations without improvement
+            FosElement& element = state.fos[j];
+            const size_t m = element.indices.size();
+            int sampleCount = std::accumulate(draws.begin(), draws.end(), 0);
+            int outOfBoundsCount = std::accumulate(outOfBoundsDraws.begin(), outOfBoundsDraws.end(), 0);
+            if (sampleCount > 0 && outOfBoundsCount > 0.9 * sampleCount) {
+                element.distributionMultiplier *= 0.5;
+            }
+            Eigen::VectorXd improvementMean = Eigen::VectorXd::Zero(m);
+            int improvements = 0;
+            for (size_t i = 0; i < n; i++) {
+                if (isBetterFitness(fs[i], selectionBestFitness)) {
+                    improvements++;
+                    for (size_t a = 0; a < m; a++) {
+                        improvementMean[a] += xs[i][element.indices[a]];
+                    }
+                }
+            }
+            if (improvements > 0) {
+                generationalImprovement = true;
+                for (size_t a = 0; a < m; a++) {
+                    improvementMean[a] = improvementMean[a] / improvements - state.mean[element.indices[a]];
+                }
+                double stDevRatio = choleskyFactors[j].triangularView<Eigen::Lower>().solve(improvementMean).cwiseAbs().maxCoeff();
+                element.distributionMultiplier = std::max(element.distributionMultiplier, 1.0);
+                if (stDevRatio > m_stDevRatioThreshold) {
+                    element.distributionMultiplier *= distributionMultiplierIncrease;
+                }
+            }
+            else {
+                if (element.distributionMultiplier > 1.0 || state.noImprovementStretch >= maxNoImprovementStretch) {
+                    element.distributionMultiplier *= m_distributionMultiplierDecrease;
+                }
+                if (state.noImprovementStretch < maxNoImprovementStretch && element.distributionMultiplier < 1.0) {
+                    element.distributionMultiplier = 1.0;
+                }
+            }
+        }
+
+        if (state.generation > 0) {
+            forIndividuals(1, amsCount + 1, [&](size_t k) {
+                if (applyAMS(k)) {
+                    improved[k] = 1;
+                }
+            });
+        }
+
+        for (size_t k = 1; k < n; k++) {
+            state.noImprovementGenerations[k] = improved[k] ? 0 : state.noImprovementGenerations[k] + 1;
+        }
+        size_t donor = 0;
+        for (size_t k = 1; k < n; k++) {
+            if (isBetterFitness(fs[k], fs[donor])) {
+                donor = k;
+            }
+        }
+        forIndividuals(1, n, [&](size_t k) {
+            if (k != donor && state.noImprovementGenerations[k] > maxNoImprovementStretch) {
+                applyForcedImprovements(k, donor);
+            }
+        });
+
+        if (generationalImprovement) {
+            state.noImprovementStretch = 0;
+        }
+        else if (std::all_of(state.fos.begin(), state.fos.end(), [](const FosElement& element) { return element.distributionMultiplier <= 1.0; })) {
+            state.noImprovementStretch++;
+        }
+        state.generation++;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        pop.set_xf(i, xs[i], { fs[i] });
+    }
+    return pop;
+}
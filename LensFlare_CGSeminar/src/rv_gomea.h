@@ -0,0 +1,80 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <pagmo/types.hpp>
+#include <pagmo/population.hpp>
+#include <pagmo/rng.hpp>
+
+// Fitness of the individuals RVGomea varies, for problems where changing a few variables is cheaper to evaluate than a
+// whole decision vector. An individual is evaluated over and over with only one linkage group changed since its last
+// evaluation, so an implementation keeps its state per individual. Different individuals may be evaluated concurrently.
+class PartialEvaluator {
+public:
+    virtual ~PartialEvaluator() = default;
+    // Called at the start of every evolve, before any evaluate
+    virtual void resize(size_t populationSize) = 0;
+    virtual double evaluate(size_t individual, const pagmo::vector_double& x) = 0;
+};
+
+using PartialEvaluatorFactory = std::function<std::unique_ptr<PartialEvaluator>()>;
+
+// Real-valued GOMEA as a pagmo user-defined algorithm, a single population version of the reference implementation in
+// src/RV-GOMEA (no interleaved multi-start, the population is the one passed to evolve). Every generation the linkage tree
+// is learned from the mutual information of the selection, merging linkage groups (singletons when none are set) by
+// average linkage. Each individual is then varied one tree node at a time, sampling only that node's variables and
+// keeping the change when it improves the individual. The model, distribution multipliers and random streams carry over
+// from one evolve call to the next while the population size and dimension stay the same.
+class RVGomea {
+public:
+    explicit RVGomea(unsigned gen = 1u, unsigned seed = pagmo::random_device::next());
+
+    pagmo::population evolve(pagmo::population pop) const;
+    void set_seed(unsigned seed);
+    unsigned get_seed() const { return m_seed; }
+    std::string get_name() const { return "RV-GOMEA"; }
+    std::string get_extra_info() const;
+
+    // Variables that always stay together in the linkage tree, e.g. the (d, n, R) of one lens interface. Variables in no
+    // group are a group of their own.
+    void setLinkageGroups(std::vector<std::vector<int>> linkageGroups);
+    // Creates the evaluator of an evolve call, without one every evaluation is a full problem fitness call
+    void setPartialEvaluator(PartialEvaluatorFactory partialEvaluatorFactory);
+    // Population size for a problem of dim variables without restarts, 17 + 3 dim^1.5 as in the reference
+    static size_t getPopulationSizeGuideline(size_t dim);
+
+    double m_tau = 0.35;                              // selection truncation percentile
+    double m_distributionMultiplierDecrease = 0.9;    // the increase is its inverse
+    double m_stDevRatioThreshold = 1.0;               // SDR above which an improving node widens its distribution
+
+private:
+    // Node of the linkage tree (family of subsets)
+    struct FosElement {
+        std::vector<int> indices;
+        double distributionMultiplier = 1.0;
+    };
+    // Everything that carries over between evolve calls
+    struct State {
+        size_t populationSize = 0;
+        size_t dim = 0;
+        unsigned generation = 0;
+        std::vector<double> mean;
+        std::vector<double> meanShift;
+        std::vector<FosElement> fos;
+        std::vector<int> noImprovementGenerations; // per individual
+        int noImprovementStretch = 0;
+        std::vector<std::mt19937> engines; // per individual, so the result does not depend on the thread schedule
+    };
+
+    std::vector<std::vector<int>> getLinkageGroups(size_t dim) const;
+
+    unsigned m_gen;
+    unsigned m_seed;
+    mutable std::mt19937 m_e;
+    std::vector<std::vector<int>> m_linkageGroups;
+    PartialEvaluatorFactory m_partialEvaluatorFactory;
+    mutable State m_state;
+};
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <new>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define LENSFLARE_SIMD_AVX2
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LENSFLARE_SIMD_SSE2
+#endif
+
+// Lane types with the handful of operations the kernels need, the kernels are written once against this interface.
+// +, -, *, /, sqrt and abs are the IEEE operations per lane, so a kernel built from them matches its scalar counterpart bit
+// for bit.
+
+struct ScalarLanes {
+	static constexpr int width = 1;
+	float v;
+	static ScalarLanes set(float x) { return { x }; }
+	static ScalarLanes load(const float* p) { return { *p }; }
+	void store(float* p) const { *p = v; }
+	friend ScalarLanes operator+(ScalarLanes a, ScalarLanes b) { return { a.v + b.v }; }
+	friend ScalarLanes operator-(ScalarLanes a, ScalarLanes b) { return { a.v - b.v }; }
+	friend ScalarLanes operator*(ScalarLanes a, ScalarLanes b) { return { a.v * b.v }; }
+	friend ScalarLanes operator/(ScalarLanes a, ScalarLanes b) { return { a.v / b.v }; }
+	friend ScalarLanes sqrt(ScalarLanes a) { return { std::sqrt(a.v) }; }
+	// minps and maxps: the second operand when either is NaN, unlike std::min and std::max
+	friend ScalarLanes min(ScalarLanes a, ScalarLanes b) { return { a.v < b.v ? a.v : b.v }; }
+	friend ScalarLanes max(ScalarLanes a, ScalarLanes b) { return { a.v > b.v ? a.v : b.v }; }
+	friend ScalarLanes abs(ScalarLanes a) { return { std::abs(a.v) }; }
+	friend ScalarLanes round(ScalarLanes a) { return { std::nearbyint(a.v) }; }
+	//mask is all bits set where a > b, select picks from ifTrue there
+	friend ScalarLanes greater(ScalarLanes a, ScalarLanes b) { return { a.v > b.v ? 1.f : 0.f }; }
+	friend ScalarLanes select(ScalarLanes mask, ScalarLanes ifTrue, ScalarLanes ifFalse) { return mask.v != 0.f ? ifTrue : ifFalse; }
+	friend ScalarLanes operator&(ScalarLanes a, ScalarLanes b) { return { a.v != 0.f && b.v != 0.f ? 1.f : 0.f }; }
+	//bit per lane of a mask
+	friend int laneMask(ScalarLanes mask) { return mask.v != 0.f ? 1 : 0; }
+};
+
+#ifdef LENSFLARE_SIMD_SSE2
+struct SSELanes {
+	static constexpr int width = 4;
+	__m128 v;
+	static SSELanes set(float x) { return { _mm_set1_ps(x) }; }
+	static SSELanes load(const float* p) { return { _mm_loadu_ps(p) }; }
+	void store(float* p) const { _mm_storeu_ps(p, v); }
+	friend SSELanes operator+(SSELanes a, SSELanes b) { return { _mm_add_ps(a.v, b.v) }; }
+	friend SSELanes operator-(SSELanes a, SSELanes b) { return { _mm_sub_ps(a.v, b.v) }; }
+	friend SSELanes operator*(SSELanes a, SSELanes b) { return { _mm_mul_ps(a.v, b.v) }; }
+	friend SSELanes operator/(SSELanes a, SSELanes b) { return { _mm_div_ps(a.v, b.v) }; }
+	friend SSELanes sqrt(SSELanes a) { return { _mm_sqrt_ps(a.v) }; }
+	friend SSELanes min(SSELanes a, SSELanes b) { return { _mm_min_ps(a.v, b.v) }; }
+	friend SSELanes max(SSELanes a, SSELanes b) { return { _mm_max_ps(a.v, b.v) }; }
+	friend SSELanes abs(SSELanes a) { return { _mm_andnot_ps(_mm_set1_ps(-0.f), a.v) }; }
+	//round to nearest through the integer conversion, fine for the phase ranges seen here
+	friend SSELanes round(SSELanes a) { return { _mm_cvtepi32_ps(_mm_cvtps_epi32(a.v)) }; }
+	friend SSELanes greater(SSELanes a, SSELanes b) { return { _mm_cmpgt_ps(a.v, b.v) }; }
+	friend SSELanes select(SSELanes mask, SSELanes ifTrue, SSELanes ifFalse) { return { _mm_or_ps(_mm_and_ps(mask.v, ifTrue.v), _mm_andnot_ps(mask.v, ifFalse.v)) }; }
+	friend SSELanes operator&(SSELanes a, SSELanes b) { return { _mm_and_ps(a.v, b.v) }; }
+	friend int laneMask(SSELanes mask) { return _mm_movemask_ps(mask.v); }
+};
+#endif
+
+#ifdef LENSFLARE_SIMD_AVX2
+struct AVXLanes {
+	static constexpr int width = 8;
+	__m256 v;
+	static AVXLanes set(float x) { return { _mm256_set1_ps(x) }; }
+	static AVXLanes load(const float* p) { return { _mm256_loadu_ps(p) }; }
+	void store(float* p) const { _mm256_storeu_ps(p, v); }
+	friend AVXLanes operator+(AVXLanes a, AVXLanes b) { return { _mm256_add_ps(a.v, b.v) }; }
+	friend AVXLanes operator-(AVXLanes a, AVXLanes b) { return { _mm256_sub_ps(a.v, b.v) }; }
+	friend AVXLanes operator*(AVXLanes a, AVXLanes b) { return { _mm256_mul_ps(a.v, b.v) }; }
+	friend AVXLanes operator/(AVXLanes a, AVXLanes b) { return { _mm256_div_ps(a.v, b.v) }; }
+	friend AVXLanes sqrt(AVXLanes a) { return { _mm256_sqrt_ps(a.v) }; }
+	friend AVXLanes min(AVXLanes a, AVXLanes b) { return { _mm256_min_ps(a.v, b.v) }; }
+	friend AVXLanes max(AVXLanes a, AVXLanes b) { return { _mm256_max_ps(a.v, b.v) }; }
+	friend AVXLanes abs(AVXLanes a) { return { _mm256_andnot_ps(_mm256_set1_ps(-0.f), a.v) }; }
+	friend AVXLanes round(AVXLanes a) { return { _mm256_round_ps(a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC) }; }
+	friend AVXLanes greater(AVXLanes a, AVXLanes b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+	friend AVXLanes select(AVXLanes mask, AVXLanes ifTrue, AVXLanes ifFalse) { return { _mm256_blendv_ps(ifFalse.v, ifTrue.v, mask.v) }; }
+	friend AVXLanes operator&(AVXLanes a, AVXLanes b) { return { _mm256_and_ps(a.v, b.v) }; }
+	friend int laneMask(AVXLanes mask) { return _mm256_movemask_ps(mask.v); }
+};
+#endif
+
+#if defined(LENSFLARE_SIMD_AVX2)
+using WideLanes = AVXLanes;
+using NarrowLanes = SSELanes;
+#elif defined(LENSFLARE_SIMD_SSE2)
+using WideLanes = SSELanes;
+using NarrowLanes = SSELanes;
+#else
+using WideLanes = ScalarLanes;
+using NarrowLanes = ScalarLanes;
+#endif
+
+// Instruction set behind WideLanes, decided by what the compiler targets
+inline const char* getSimdInstructionSet() {
+#if defined(LENSFLARE_SIMD_AVX2)
+	return "AVX2";
+#elif defined(LENSFLARE_SIMD_SSE2)
+	return "SSE2";
+#else
+	return "Scalar";
+#endif
+}
+
+// Alignment of the arrays the kernels read, one cache line, which also covers the 32 bytes of an AVX2 register. The
+// kernels load with loadu, which costs the same as an aligned load on aligned data, and no lane group of an aligned
+// array straddles two cache lines.
+constexpr std::size_t SIMD_ALIGNMENT = 64;
+
+template<typename T>
+struct AlignedAllocator {
+	using value_type = T;
+
+	AlignedAllocator() = default;
+	template<typename U>
+	AlignedAllocator(const AlignedAllocator<U>&) {}
+
+	T* allocate(std::size_t count) {
+		return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t(SIMD_ALIGNMENT)));
+	}
+	void deallocate(T* p, std::size_t) {
+		::operator delete(p, std::align_val_t(SIMD_ALIGNMENT));
+	}
+
+	template<typename U>
+	friend bool operator==(const AlignedAllocator&, const AlignedAllocator<U>&) { return true; }
+	template<typename U>
+	friend bool operator!=(const AlignedAllocator&, const AlignedAllocator<U>&) { return false; }
+};
+
+// std::vector whose data starts on a SIMD_ALIGNMENT boundary
+template<typename T>
+using SimdVector = std::vector<T, AlignedAllocator<T>>;
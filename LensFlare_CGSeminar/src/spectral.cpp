@@ -0,0 +1,66 @@
+#include "spectral.h"
+
+#include <cmath>
+
+namespace {
+
+// Piecewise Gaussian fit of the CIE 1931 2 degree observer (Wyman, Sloan and Shirley, "Simple Analytic Approximations to
+// the CIE XYZ Color Matching Functions", JCGT 2013)
+float piecewiseGaussian(float lambda, float mu, float sigmaLow, float sigmaHigh) {
+	float t = (lambda - mu) / (lambda < mu ? sigmaLow : sigmaHigh);
+	return std::exp(-0.5f * t * t);
+}
+
+glm::vec3 cieXYZ(float lambda) {
+	float x = 1.056f * piecewiseGaussian(lambda, 599.8f, 37.9f, 31.0f)
+		+ 0.362f * piecewiseGaussian(lambda, 442.0f, 16.0f, 26.7f)
+		- 0.065f * piecewiseGaussian(lambda, 501.1f, 20.4f, 26.2f);
+	float y = 0.821f * piecewiseGaussian(lambda, 568.8f, 46.9f, 40.5f)
+		+ 0.286f * piecewiseGaussian(lambda, 530.9f, 16.3f, 31.1f);
+	float z = 1.217f * piecewiseGaussian(lambda, 437.0f, 11.8f, 36.0f)
+		+ 0.681f * piecewiseGaussian(lambda, 459.0f, 26.0f, 13.8f);
+	return glm::vec3(x, y, z);
+}
+
+// XYZ to linear sRGB (D65), glm is column-major so this is the transpose of the usual row layout
+const glm::mat3 XYZ_TO_RGB = glm::mat3(
+	3.2406f, -0.9689f, 0.0557f,
+	-1.5372f, 1.8758f, -0.2040f,
+	-0.4986f, 0.0415f, 1.0570f);
+
+// Sub-samples per bin when integrating the matching functions, so a few wide bins still see the whole curve
+constexpr int SubSamples = 16;
+
+}
+
+SpectralSampling::SpectralSampling(int bins) {
+	if (bins < 1) {
+		bins = 1;
+	}
+	float binWidth = (MaxWavelength - MinWavelength) / bins;
+	m_wavelengths.resize(bins);
+	m_rgbWeights.resize(bins);
+	glm::vec3 white(0.f);
+	for (int k = 0; k < bins; k++) {
+		float binStart = MinWavelength + k * binWidth;
+		m_wavelengths[k] = binStart + 0.5f * binWidth;
+		glm::vec3 xyz(0.f);
+		for (int s = 0; s < SubSamples; s++) {
+			xyz += cieXYZ(binStart + (s + 0.5f) * binWidth / SubSamples);
+		}
+		m_rgbWeights[k] = XYZ_TO_RGB * xyz;
+		white += m_rgbWeights[k];
+	}
+	for (glm::vec3& weight : m_rgbWeights) {
+		weight /= white;
+	}
+}
+
+glm::vec3 SpectralSampling::toRGB(std::span<const float> spectrum) const {
+	glm::vec3 rgb(0.f);
+	for (size_t k = 0; k < m_rgbWeights.size() && k < spectrum.size(); k++) {
+		rgb += spectrum[k] * m_rgbWeights[k];
+	}
+	//narrow band spectra can fall outside the sRGB gamut
+	return glm::max(rgb, glm::vec3(0.f));
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <span>
+#include <vector>
+
+// Wavelength bins evenly spread over 380-740 nm for the spectral transmission mode, and the weights that turn a
+// transmission spectrum sampled at those bins into linear RGB.
+class SpectralSampling {
+public:
+	static constexpr float MinWavelength = 380.f;
+	static constexpr float MaxWavelength = 740.f;
+
+	SpectralSampling() = default;
+	explicit SpectralSampling(int bins);
+
+	int bins() const { return static_cast<int>(m_wavelengths.size()); }
+	// Bin centers in nm
+	std::span<const float> getWavelengths() const { return m_wavelengths; }
+	// CIE 1931 color matching functions integrated over each bin and taken to linear sRGB, scaled so a flat spectrum of 1
+	// maps to (1, 1, 1) like the RGB mode. Negative components are clipped.
+	glm::vec3 toRGB(std::span<const float> spectrum) const;
+
+private:
+	std::vector<float> m_wavelengths;
+	std::vector<glm::vec3> m_rgbWeights;
+};
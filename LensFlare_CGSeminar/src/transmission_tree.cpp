@@ -0,0 +1,113 @@
+#include "transmission_tree.h"
+#include <algorithm>
+
+TransmissionPathData getTransmissionPathData(const LensTable& table, bool quarterWaveCoating) {
+	TransmissionPathData path;
+	path.size = table.size;
+	path.coatingN = quarterWaveCoating ? table.quarterWaveCoatingN.data() : table.customCoatingN.data();
+	path.coatingD = quarterWaveCoating ? table.quarterWaveCoatingD.data() : table.customCoatingD.data();
+	path.n = table.n.data();
+	path.nPrev = table.nPrev.data();
+	path.forward = table.forward.data();
+	path.backward = table.backward.data();
+	path.reflection = table.reflection.data();
+	path.reflectionBack = table.reflectionBack.data();
+	return path;
+}
+
+void TransmissionTree::reset(const TransmissionPathData& path) {
+	m_path = path;
+	m_first = -1;
+	m_second = -1;
+	m_length = 0;
+	m_evaluated_crossings = 0;
+	m_path_crossings = 0;
+	//a ghost path has at most 3 * size crossings
+	m_rays.resize(3 * path.size + 1);
+	m_products.resize(3 * path.size + 1);
+	m_factors.resize(3 * path.size);
+}
+
+//Crossings at the start of the path (first, second) that are the same as in the memoized path
+int TransmissionTree::getSharedCrossings(int firstReflectionPos, int secondReflectionPos) const {
+	int shared;
+	if (m_first < 0) {
+		shared = 0;
+	}
+	else if (firstReflectionPos != m_first) {
+		//both walk forward up to the lower first reflection
+		shared = std::min(firstReflectionPos, m_first);
+	}
+	else if (secondReflectionPos != m_second) {
+		//both walk backward down to the higher second reflection
+		shared = 2 * firstReflectionPos - std::max(secondReflectionPos, m_second);
+	}
+	else {
+		shared = 2 * (firstReflectionPos - secondReflectionPos) + m_path.size;
+	}
+	return std::min(shared, m_length);
+}
+
+//Same factors and matrices as LensSystem::propagateTransmission, crossing c of the path (m_first, m_second)
+void TransmissionTree::evaluateCrossing(int crossing) {
+	const TransmissionPathData& p = m_path;
+	int secondReflectionCrossing = 2 * m_first - m_second;
+	glm::vec2 ray = m_rays[crossing];
+	glm::vec3 factor;
+	glm::vec2 next;
+	if (crossing < m_first) {
+		int i = crossing;
+		factor = glm::vec3(1.f) - LensSystem::computeFresnelAR(ray.y, p.coatingD[i], p.nPrev[i], p.coatingN[i], p.n[i]);
+		next = p.forward[i] * ray;
+	}
+	else if (crossing == m_first) {
+		int i = m_first;
+		factor = LensSystem::computeFresnelAR(ray.y, p.coatingD[i], p.nPrev[i], p.coatingN[i], p.n[i]);
+		next = p.reflection[i] * ray;
+	}
+	else if (crossing < secondReflectionCrossing) {
+		int i = 2 * m_first - crossing;
+		factor = glm::vec3(1.f) - LensSystem::computeFresnelAR(ray.y, p.coatingD[i], p.n[i], p.coatingN[i], p.nPrev[i]);
+		next = p.backward[i] * ray;
+	}
+	else if (crossing == secondReflectionCrossing) {
+		int i = m_second;
+		factor = LensSystem::computeFresnelAR(ray.y, p.coatingD[i], p.n[i], p.coatingN[i], p.nPrev[i]);
+		next = p.reflectionBack[i] * ray;
+	}
+	else {
+		int i = crossing - 2 * (m_first - m_second);
+		factor = glm::vec3(1.f) - LensSystem::computeFresnelAR(ray.y, p.coatingD[i], p.nPrev[i], p.coatingN[i], p.n[i]);
+		next = p.forward[i] * ray;
+	}
+	m_factors[crossing] = factor;
+	m_rays[crossing + 1] = next;
+	m_products[crossing + 1] = m_products[crossing] * factor;
+}
+
+glm::vec3 TransmissionTree::propagate(int firstReflectionPos, int secondReflectionPos, glm::vec2 ray, TransmissionCrossing* crossings) {
+	if (ray != m_ray) {
+		m_first = -1;
+		m_ray = ray;
+	}
+	int shared = getSharedCrossings(firstReflectionPos, secondReflectionPos);
+	int crossingCount = 2 * (firstReflectionPos - secondReflectionPos) + m_path.size;
+	m_rays[0] = ray;
+	m_products[0] = glm::vec3(1.f);
+	m_first = firstReflectionPos;
+	m_second = secondReflectionPos;
+	for (int c = shared; c < crossingCount; c++) {
+		evaluateCrossing(c);
+	}
+	m_length = crossingCount;
+	m_evaluated_crossings += crossingCount - shared;
+	m_path_crossings += crossingCount;
+
+	if (crossings) {
+		for (int c = 0; c < crossingCount; c++) {
+			crossings[c].ray = m_rays[c];
+			crossings[c].factor = m_factors[c];
+		}
+	}
+	return m_products[crossingCount];
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include "lens_system.h"
+#include "lens_table.h"
+
+// Raw view of the per-interface arrays a ghost path is walked over, taken from a LensTable or a FixedLensSystem.
+// The coating arrays are those of one coating mode.
+struct TransmissionPathData {
+	int size = 0;
+	const float* coatingN = nullptr;
+	const float* coatingD = nullptr;
+	const float* n = nullptr;
+	const float* nPrev = nullptr;
+	const glm::mat2x2* forward = nullptr;
+	const glm::mat2x2* backward = nullptr;
+	const glm::mat2x2* reflection = nullptr;
+	const glm::mat2x2* reflectionBack = nullptr;
+};
+
+TransmissionPathData getTransmissionPathData(const LensTable& table, bool quarterWaveCoating);
+
+// Transmission of ghost paths entering with the same ray, memoizing the crossings a path shares with the previous one.
+// A ghost path is the forward walk up to the first reflection, the backward walk down to the second reflection and the
+// forward walk to the sensor. Every ghost shares the first walk with every other ghost of the same ray, and in GhostTable
+// order (first ascending, second descending) it also shares the backward walk with the previous ghost, so only the walk
+// after the second reflection is new. Results are bit-identical to LensSystem::propagateTransmission.
+// Ghosts entering with another ray (the pre-aperture center rays depend on the ghost) start over from the entry ray.
+class TransmissionTree {
+public:
+	// Drops the memoized crossings, path must stay valid while propagate is called
+	void reset(const TransmissionPathData& path);
+	// Transmission of the ghost (firstReflectionPos, secondReflectionPos) for ray. When crossings is given, every crossing of
+	// the path is recorded like LensSystem::traceTransmission does.
+	glm::vec3 propagate(int firstReflectionPos, int secondReflectionPos, glm::vec2 ray, TransmissionCrossing* crossings = nullptr);
+	// Crossings evaluated since the last reset, against the sum of the path lengths without memoization
+	long long getEvaluatedCrossings() const { return m_evaluated_crossings; }
+	long long getPathCrossings() const { return m_path_crossings; }
+
+private:
+	int getSharedCrossings(int firstReflectionPos, int secondReflectionPos) const;
+	void evaluateCrossing(int crossing);
+
+	TransmissionPathData m_path;
+	glm::vec2 m_ray = glm::vec2(0.f);
+	int m_first = -1; //path of the previous ghost, -1 when nothing is memoized
+	int m_second = -1;
+	int m_length = 0; //crossings of that path that are evaluated
+	std::vector<glm::vec2> m_rays; //ray arriving at crossing c, one more entry than m_factors
+	std::vector<glm::vec3> m_products; //transmission before crossing c
+	std::vector<glm::vec3> m_factors;
+	long long m_evaluated_crossings = 0;
+	long long m_path_crossings = 0;
+};
@@ -0,0 +1,80 @@
+#include "test_problems.h"
+#include <catch2/catch_test_macros.hpp>
+#include <thread>
+#include <vector>
+
+// Built as its own executable, LensFlareConcurrencyTests, so the TSan configuration runs it alone. The threads only
+// collect their results, Catch2 checks them after the join.
+
+constexpr int TEST_THREADS = 4;
+constexpr int TEST_ITERATIONS = 3;
+
+// Every thread evaluates the population TEST_ITERATIONS times with batch_fitness and once candidate by candidate with
+// fitness, on the problem problemOf returns for it
+template<typename ProblemOf>
+static std::vector<std::vector<pagmo::vector_double>> evaluateConcurrently(const pagmo::vector_double& population, unsigned int dim, ProblemOf problemOf) {
+    std::vector<std::vector<pagmo::vector_double>> results(TEST_THREADS);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < TEST_THREADS; t++) {
+        threads.emplace_back([&, t]() {
+            const LensSystemProblem& problem = problemOf(t);
+            for (int it = 0; it < TEST_ITERATIONS; it++) {
+                results[t].push_back(problem.batch_fitness(population));
+            }
+            pagmo::vector_double fitness;
+            for (size_t i = 0; i < population.size(); i += dim) {
+                fitness.push_back(problem.fitness(pagmo::vector_double(population.begin() + i, population.begin() + i + dim))[0]);
+            }
+            results[t].push_back(fitness);
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    return results;
+}
+
+static void checkResults(const std::vector<std::vector<pagmo::vector_double>>& results, const pagmo::vector_double& reference) {
+    for (const std::vector<pagmo::vector_double>& threadResults : results) {
+        REQUIRE(threadResults.size() == TEST_ITERATIONS + 1);
+        for (const pagmo::vector_double& result : threadResults) {
+            REQUIRE(result.size() == reference.size());
+            for (size_t i = 0; i < reference.size(); i++) {
+                CHECK(isSameFitness(result[i], reference[i]));
+            }
+        }
+    }
+}
+
+// Copies like pagmo makes for its islands, made before the first evaluation so they race for the OpenCL setup they share.
+// Evaluates with the default evaluator, OpenCL when there is a device, and compares with one copy evaluated alone.
+TEST_CASE("Copies of a LensSystemProblem evaluate concurrently like a single problem", "[concurrency]") {
+    for (const LensSystem& lensSystem : getTestLensSystems()) {
+        LensSystemProblem lensProblem;
+        pagmo::vector_double population = initTestProblem(lensSystem, 512, lensProblem);
+        lensProblem.m_hostThreads = 2;
+        std::vector<LensSystemProblem> islands(TEST_THREADS, lensProblem);
+        auto results = evaluateConcurrently(population, lensProblem.m_dim, [&](int t) -> const LensSystemProblem& { return islands[t]; });
+
+        LensSystemProblem referenceProblem = lensProblem;
+        pagmo::vector_double reference = referenceProblem.batch_fitness(population);
+        INFO(lensProblem.m_num_interfaces << " interfaces, " << getBatchEvaluatorName(referenceProblem.getActiveBatchEvaluator()));
+        checkResults(results, reference);
+    }
+}
+
+// thread_safety::constant lets pagmo call one problem from several threads, here with the host evaluator the copies
+// share
+TEST_CASE("One LensSystemProblem evaluates concurrently like a single thread", "[concurrency]") {
+    for (const LensSystem& lensSystem : getTestLensSystems()) {
+        LensSystemProblem lensProblem;
+        pagmo::vector_double population = initTestProblem(lensSystem, 512, lensProblem);
+        lensProblem.m_batchEvaluator = BatchEvaluator::Host;
+        pagmo::vector_double reference = lensProblem.batch_fitness(population);
+
+        LensSystemProblem copy = lensProblem;
+        auto results = evaluateConcurrently(population, lensProblem.m_dim, [&](int t) -> const LensSystemProblem& { return t % 2 ? copy : lensProblem; });
+        INFO(lensProblem.m_num_interfaces << " interfaces");
+        checkResults(results, reference);
+    }
+}
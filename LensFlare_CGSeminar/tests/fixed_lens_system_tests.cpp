@@ -0,0 +1,42 @@
+#include "test_problems.h"
+#include "fixed_lens_system.h"
+#include <catch2/catch_test_macros.hpp>
+#include <array>
+#include <type_traits>
+
+// FixedLensSystem<N> unrolls the same float operations as LensSystem and GhostTable, so both give the same bits
+TEST_CASE("FixedLensSystem gives the ghosts of LensSystem", "[fixed_lens_system]") {
+    glm::vec2 yawAndPitch = glm::vec2(0.001f);
+    for (const LensSystem& lensSystem : getTestLensSystems()) {
+        int aptPos = lensSystem.getIrisAperturePos();
+        std::vector<LensInterface> lensInterfaces = lensSystem.getLensInterfaces();
+        int num_interfaces = lensInterfaces.size();
+        INFO(num_interfaces << " interfaces");
+        for (int it = 0; it < 2 * num_interfaces; it++) {
+            std::vector<LensInterface> candidate = lensInterfaces;
+            candidate[it % num_interfaces].Ri *= 1.f + 0.001f * (it % 7);
+            LensSystem candidateSystem(aptPos, lensSystem.getApertureHeight(), lensSystem.getEntrancePupilHeight(), candidate);
+            GhostTable ghostTable(candidateSystem);
+            std::vector<glm::vec3> transmissions;
+            ghostTable.computeTransmissions(candidateSystem, yawAndPitch, true, transmissions);
+
+            GhostTable fixedTable;
+            std::vector<glm::vec3> fixedTransmissions;
+            bool hasSpecialization = withFixedLensSystem(aptPos, candidate, [&](const auto& fixedLensSystem) {
+                std::array<GhostLayout, std::decay_t<decltype(fixedLensSystem)>::MaxGhosts> layouts;
+                int ghostCount = fixedLensSystem.getGhostLayouts(layouts);
+                REQUIRE(ghostCount == static_cast<int>(ghostTable.size()));
+                for (int i = 0; i < ghostCount; i++) {
+                    CHECK(layouts[i].centerCoeff == ghostTable.layout[i].centerCoeff);
+                    CHECK(layouts[i].heightCoeff == ghostTable.layout[i].heightCoeff);
+                }
+                fixedLensSystem.fillGhostTable(fixedTable);
+                fixedLensSystem.computeTransmissions(fixedTable, yawAndPitch, true, fixedTransmissions);
+                });
+            REQUIRE(hasSpecialization);
+            REQUIRE(fixedTable.size() == ghostTable.size());
+            CHECK(fixedTable.reflectionPairs == ghostTable.reflectionPairs);
+            CHECK(fixedTransmissions == transmissions);
+        }
+    }
+}
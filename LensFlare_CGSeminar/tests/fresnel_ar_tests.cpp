@@ -0,0 +1,55 @@
+#include "fresnel_ar.h"
+#include "lens_system.h"
+#include <catch2/catch_test_macros.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Coating on a typical glass surface, the angles and quarter wave thicknesses of benchmarkFresnelAR
+static void getFresnelARPairs(std::vector<float>& theta0, std::vector<float>& d1, float n1) {
+    for (int i = 0; i < 1000; i++) {
+        theta0.push_back(-0.5f + (i % 97) / 96.f);
+        d1.push_back((380.f + (i % 181) * 2.f) / 4.f / n1);
+    }
+}
+
+// The batch evaluates the angles with its own sine and cosine polynomials, so it matches up to float rounding
+TEST_CASE("computeFresnelARBatch gives the reflectivity of computeFresnelAR", "[fresnel_ar]") {
+    const float n0 = 1.0f;
+    const float n1 = 1.38f;
+    const float n2 = 1.62f;
+    std::vector<float> theta0;
+    std::vector<float> d1;
+    getFresnelARPairs(theta0, d1, n1);
+    std::vector<glm::vec3> batchReflectivity(theta0.size());
+    computeFresnelARBatch(theta0, d1, n0, n1, n2, batchReflectivity);
+    for (size_t i = 0; i < theta0.size(); i++) {
+        glm::vec3 reflectivity = LensSystem::computeFresnelAR(theta0[i], d1[i], n0, n1, n2);
+        for (int c = 0; c < 3; c++) {
+            CHECK(std::abs(batchReflectivity[i][c] - reflectivity[c]) < 1e-5f);
+        }
+    }
+}
+
+// multiplyFresnelAR with the RGB wavelengths runs the same lanes as computeFresnelAR
+TEST_CASE("multiplyFresnelAR at the RGB wavelengths gives computeFresnelAR", "[fresnel_ar]") {
+    const float n0 = 1.62f;
+    const float n1 = 1.38f;
+    const float n2 = 1.0f;
+    std::vector<float> theta0;
+    std::vector<float> d1;
+    getFresnelARPairs(theta0, d1, n1);
+    const std::vector<float> wavelengths = { RED_WAVELENGTH, GREEN_WAVELENGTH, BLUE_WAVELENGTH };
+    for (size_t i = 0; i < theta0.size(); i++) {
+        FresnelAmplitudes amplitudes = computeFresnelAmplitudes(theta0[i], d1[i], n0, n1, n2);
+        glm::vec3 reflectivity = LensSystem::computeFresnelAR(theta0[i], d1[i], n0, n1, n2);
+        std::vector<float> reflected(3, 1.f);
+        std::vector<float> transmitted(3, 1.f);
+        multiplyFresnelAR(amplitudes, wavelengths, true, reflected);
+        multiplyFresnelAR(amplitudes, wavelengths, false, transmitted);
+        for (int c = 0; c < 3; c++) {
+            CHECK(reflected[c] == reflectivity[c]);
+            CHECK(transmitted[c] == 1.f - reflectivity[c]);
+        }
+    }
+}
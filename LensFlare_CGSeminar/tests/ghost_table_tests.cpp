@@ -0,0 +1,53 @@
+#include "test_problems.h"
+#include <catch2/catch_test_macros.hpp>
+#include <cmath>
+
+static float getRelativeDifference(float a, float b) {
+    return std::abs(a - b) / std::max({ std::abs(a), std::abs(b), 1e-6f });
+}
+
+// Same edits as benchmarkIncrementalGhostUpdate: radius edits move the geometry, lambda0 edits only the coatings
+TEST_CASE("GhostTable::update matches a full rebuild after single-interface edits", "[ghost_table]") {
+    glm::vec2 yawAndPitch = glm::vec2(0.001f);
+    for (LensSystem lensSystem : getTestLensSystems()) {
+        std::vector<LensInterface> lensInterfaces = lensSystem.getLensInterfaces();
+        int num_interfaces = lensInterfaces.size();
+        GhostTable incrementalTable(lensSystem);
+        incrementalTable.refreshTransmissions(lensSystem, yawAndPitch, true);
+        lensSystem.clearDirtyRange();
+
+        for (int it = 0; it < 4 * num_interfaces; it++) {
+            int k = it % num_interfaces;
+            bool geometryEdit = (it / num_interfaces) % 2 == 0;
+            if (geometryEdit) {
+                lensInterfaces[k].Ri *= (it % 2 == 0) ? 1.01f : 1.f / 1.01f;
+            }
+            else {
+                lensInterfaces[k].lambda0 = 380.f + std::fmod(lensInterfaces[k].lambda0 + 7.f - 380.f, 360.f);
+            }
+            lensSystem.setLensInterfaces(lensInterfaces);
+
+            GhostTable fullTable(lensSystem);
+            fullTable.refreshTransmissions(lensSystem, yawAndPitch, true);
+            const LensDirtyRange& dirtyRange = lensSystem.getDirtyRange();
+            if (dirtyRange.ghostsChanged) {
+                incrementalTable = GhostTable(lensSystem);
+                incrementalTable.refreshTransmissions(lensSystem, yawAndPitch, true);
+            }
+            else {
+                incrementalTable.update(lensSystem, dirtyRange);
+            }
+            lensSystem.clearDirtyRange();
+
+            INFO(num_interfaces << " interfaces, edit " << it << " of interface " << k);
+            REQUIRE(incrementalTable.size() == fullTable.size());
+            for (size_t i = 0; i < fullTable.size(); i++) {
+                CHECK(getRelativeDifference(incrementalTable.layout[i].centerCoeff, fullTable.layout[i].centerCoeff) < 1e-4f);
+                CHECK(getRelativeDifference(incrementalTable.layout[i].heightCoeff, fullTable.layout[i].heightCoeff) < 1e-4f);
+                for (int c = 0; c < 3; c++) {
+                    CHECK(getRelativeDifference(incrementalTable.transmission[i][c], fullTable.transmission[i][c]) < 1e-4f);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,183 @@
+#include "test_problems.h"
+#include "fixed_lens_system.h"
+#include <catch2/catch_test_macros.hpp>
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <memory>
+
+TEST_CASE("computeFitnessLanes gives the fitness of computeFitness", "[lens_fitness]") {
+    for (const LensSystem& lensSystem : getTestLensSystems()) {
+        LensSystemProblem lensProblem;
+        const int populationSize = 256;
+        pagmo::vector_double population = initTestProblem(lensSystem, populationSize, lensProblem);
+        const int width = LensSystemProblem::getFitnessLaneWidth();
+        INFO(lensProblem.m_num_interfaces << " interfaces, " << width << " lanes");
+        pagmo::vector_double laneFitness(populationSize);
+        for (int i = 0; i < populationSize; i += width) {
+            lensProblem.computeFitnessLanes(population.data() + static_cast<size_t>(i) * lensProblem.m_dim, std::min(width, populationSize - i), &laneFitness[i]);
+        }
+        for (int i = 0; i < populationSize; i++) {
+            double scalarFitness = lensProblem.computeFitness(population.data() + static_cast<size_t>(i) * lensProblem.m_dim);
+            CHECK(isSameFitness(laneFitness[i], scalarFitness));
+        }
+
+        lensProblem.m_batchEvaluator = BatchEvaluator::Host;
+        lensProblem.m_simdFitness = false;
+        pagmo::vector_double scalarBatch = lensProblem.batch_fitness(population);
+        lensProblem.m_simdFitness = true;
+        pagmo::vector_double laneBatch = lensProblem.batch_fitness(population);
+        for (int i = 0; i < populationSize; i++) {
+            CHECK(isSameFitness(laneBatch[i], scalarBatch[i]));
+        }
+    }
+}
+
+// With the upper bound at the lower quartile most candidates stop early. A stopped candidate must return a value above
+// the bound and at most its fitness, every other candidate exactly its fitness.
+TEST_CASE("FitnessBranchAndBound returns the fitness or a lower bound above upperBound", "[lens_fitness]") {
+    for (const LensSystem& lensSystem : getTestLensSystems()) {
+        LensSystemProblem lensProblem;
+        const int populationSize = 512;
+        pagmo::vector_double population = initTestProblem(lensSystem, populationSize, lensProblem);
+        lensProblem.m_batchEvaluator = BatchEvaluator::Host;
+        pagmo::vector_double exact = lensProblem.batch_fitness(population);
+        std::vector<double> sorted;
+        std::copy_if(exact.begin(), exact.end(), std::back_inserter(sorted), [](double f) { return std::isfinite(f); });
+        if (sorted.empty()) {
+            continue; //no random candidate of the lens renders enough ghosts, there is no bound to set
+        }
+        std::sort(sorted.begin(), sorted.end());
+        const double upperBound = sorted[sorted.size() / 4];
+
+        lensProblem.m_branchAndBound = std::make_shared<FitnessBranchAndBound>();
+        lensProblem.m_branchAndBound->upperBound = upperBound;
+        for (bool simdFitness : { false, true }) {
+            lensProblem.m_simdFitness = simdFitness;
+            INFO(lensProblem.m_num_interfaces << " interfaces, " << (simdFitness ? "computeFitnessLanes" : "computeFitness") << ", upper bound " << upperBound);
+            pagmo::vector_double bounded = lensProblem.batch_fitness(population);
+            for (int i = 0; i < populationSize; i++) {
+                INFO("candidate " << i << ": fitness " << exact[i] << ", bounded " << bounded[i]);
+                if (!(exact[i] > upperBound)) {
+                    CHECK(isSameFitness(bounded[i], exact[i]));
+                }
+                else if (!isSameFitness(bounded[i], exact[i])) {
+                    CHECK(bounded[i] > upperBound);
+                    CHECK(bounded[i] <= exact[i]);
+                }
+            }
+            FitnessBoundStats stats = lensProblem.m_branchAndBound->takeStats();
+            CHECK(stats.candidates == static_cast<unsigned long long>(populationSize));
+            CHECK(stats.stopped > 0);
+        }
+    }
+}
+
+// One individual replaying RV-GOMEA's edits: a single linkage group resampled within the bounds (refractive indices
+// crossing the glass threshold change the set of ghosts), or the aperture moved. Every step only updates what the edit
+// changed, the fitness must still be the one of a full evaluation.
+TEST_CASE("LensPartialEvaluator gives the fitness of computeFitness after every edit", "[lens_fitness]") {
+    for (const LensSystem& lensSystem : getTestLensSystems()) {
+        LensSystemProblem lensProblem;
+        pagmo::vector_double population = initTestProblem(lensSystem, 1, lensProblem);
+        auto problem = std::make_shared<const LensSystemProblem>(lensProblem);
+        LensPartialEvaluator evaluator(problem);
+        evaluator.resize(1);
+        INFO(lensProblem.m_num_interfaces << " interfaces");
+
+        pagmo::vector_double x(population.begin(), population.begin() + lensProblem.m_dim);
+        std::mt19937 rng(7);
+        auto sample = [&](unsigned int d) { return std::uniform_real_distribution<double>(lensProblem.m_lb[d], lensProblem.m_ub[d])(rng); };
+        for (int step = 0; step < 300; step++) {
+            if (step > 0) {
+                int group = rng() % (lensProblem.m_num_interfaces + 1);
+                if (group == 0) {
+                    x[0] = std::round(sample(0));
+                    if (rng() & 1) {
+                        x[1] = sample(1);
+                    }
+                }
+                else {
+                    const unsigned int groupSize = (lensProblem.m_dim - 2) / lensProblem.m_num_interfaces; //(d, n, R)
+                    for (unsigned int d = 2 + groupSize * (group - 1); d < 2 + groupSize * group; d++) {
+                        x[d] = sample(d);
+                    }
+                }
+            }
+            INFO("step " << step);
+            CHECK(isSameFitness(evaluator.evaluate(0, x), lensProblem.computeFitness(x.data())));
+        }
+    }
+}
+
+// Snapshot of every ghost of the candidate at dv in float, the way computeFitness simulates it
+static void getCandidateSnapshot(const LensSystemProblem& lensProblem, const double* dv, std::vector<SnapshotData>& snapshot) {
+    std::vector<LensInterface> lensInterfaces;
+    lensProblem.getLensInterfaces(dv, lensInterfaces);
+    snapshot.clear();
+    withFixedLensSystem(std::round(dv[0]), lensInterfaces, [&](const auto& fixedLensSystem) {
+        fixedLensSystem.forEachGhostLayout([&](const GhostLayout& layout) {
+            snapshot.push_back(lensProblem.simulateDrawQuad(layout, snapshot.size(), lensProblem.m_light_angle_x, lensProblem.m_light_angle_y, dv[1]));
+            return true;
+            });
+        });
+}
+
+// The Jacobian's values are the float snapshot's, its derivatives agree with central differences of the float snapshot
+// up to their truncation and rounding error
+TEST_CASE("computeSnapshotJacobian matches the snapshot and its central differences", "[lens_fitness]") {
+    for (const LensSystem& lensSystem : getTestLensSystems()) {
+        LensSystemProblem lensProblem;
+        const int candidates = 16;
+        pagmo::vector_double population = initTestProblem(lensSystem, candidates, lensProblem);
+        const unsigned int dim = lensProblem.m_dim;
+        INFO(lensProblem.m_num_interfaces << " interfaces");
+
+        std::vector<double> differences;
+        std::vector<SnapshotData> snapshot;
+        std::vector<SnapshotData> jacobianSnapshot;
+        std::vector<SnapshotData> forward;
+        std::vector<SnapshotData> backward;
+        std::vector<double> jacobian;
+        pagmo::vector_double dv(dim);
+        for (int i = 0; i < candidates; i++) {
+            std::copy_n(population.begin() + static_cast<size_t>(i) * dim, dim, dv.begin());
+            REQUIRE(lensProblem.computeSnapshotJacobian(dv.data(), jacobianSnapshot, jacobian));
+            getCandidateSnapshot(lensProblem, dv.data(), snapshot);
+            REQUIRE(jacobianSnapshot.size() == snapshot.size());
+            for (size_t g = 0; g < snapshot.size(); g++) {
+                CHECK(jacobianSnapshot[g].quadCenterPos == snapshot[g].quadCenterPos);
+                CHECK(jacobianSnapshot[g].quadHeight == snapshot[g].quadHeight);
+            }
+
+            //The aperture position is not differentiable, a candidate whose ghost count changes within a step is skipped
+            for (unsigned int j = 1; j < dim; j++) {
+                double step = 1e-3 * (lensProblem.m_ub[j] - lensProblem.m_lb[j]);
+                double x = dv[j];
+                dv[j] = x + step;
+                getCandidateSnapshot(lensProblem, dv.data(), forward);
+                dv[j] = x - step;
+                getCandidateSnapshot(lensProblem, dv.data(), backward);
+                dv[j] = x;
+                if (forward.size() != snapshot.size() || backward.size() != snapshot.size()) {
+                    continue;
+                }
+                for (size_t g = 0; g < snapshot.size(); g++) {
+                    double finiteDifferences[3] = {
+                        (forward[g].quadCenterPos.x - backward[g].quadCenterPos.x) / (2.0 * step),
+                        (forward[g].quadCenterPos.y - backward[g].quadCenterPos.y) / (2.0 * step),
+                        (forward[g].quadHeight - backward[g].quadHeight) / (2.0 * step) };
+                    for (int k = 0; k < 3; k++) {
+                        double exact = jacobian[(3 * g + k) * dim + j];
+                        double scale = std::max({ std::abs(exact), std::abs(finiteDifferences[k]), 1e-3 });
+                        differences.push_back(std::abs(exact - finiteDifferences[k]) / scale);
+                    }
+                }
+            }
+        }
+        REQUIRE(!differences.empty());
+        std::sort(differences.begin(), differences.end());
+        CHECK(differences[differences.size() / 2] < 1e-3);
+        CHECK(differences[differences.size() * 9 / 10] < 1e-2);
+    }
+}
@@ -0,0 +1,64 @@
+#include "test_problems.h"
+#include <catch2/catch_test_macros.hpp>
+#include <cmath>
+
+// Relative difference of two fitness values, zero when both are NaN
+static double getRelativeFitnessDifference(double a, double b) {
+    if (isSameFitness(a, b)) {
+        return 0.0;
+    }
+    return std::abs(a - b) / std::max(std::abs(a), std::abs(b));
+}
+
+// Float transfer rounds the decision vectors the kernel already computes with in float, the fitness is accumulated in
+// float on the device either way. Needs an OpenCL device with fp64 for the double build, passes with a warning otherwise.
+TEST_CASE("batchFitnessOpenCL with a float population gives the fitness of a double population", "[opencl]") {
+    for (const LensSystem& lensSystem : getTestLensSystems()) {
+        pagmo::vector_double fitness[2];
+        for (bool floatPopulation : { false, true }) {
+            LensSystemProblem lensProblem;
+            pagmo::vector_double population = initTestProblem(lensSystem, 2048, lensProblem);
+            lensProblem.m_clFloatPopulation = floatPopulation;
+            if (!lensProblem.isOpenCLAvailable()) {
+                WARN("No OpenCL device, skipped");
+                return;
+            }
+            if (lensProblem.m_clShared->floatTransfer != floatPopulation) {
+                WARN("OpenCL device " << lensProblem.getOpenCLDeviceKey() << " has no fp64, skipped");
+                return;
+            }
+            fitness[floatPopulation] = lensProblem.batchFitnessOpenCL(population);
+        }
+        INFO(lensSystem.getLensInterfaces().size() << " interfaces");
+        REQUIRE(fitness[0].size() == fitness[1].size());
+        for (size_t i = 0; i < fitness[0].size(); i++) {
+            CHECK(getRelativeFitnessDifference(fitness[0][i], fitness[1][i]) < 1e-4);
+        }
+    }
+}
+
+// Chunks of 256 candidates spread over all pipeline queues, against the whole population in one chunk on the first queue.
+// Each candidate is evaluated by the same kernel either way, so the fitness is exactly the same.
+TEST_CASE("batchFitnessOpenCL gives the same fitness pipelined over several queues as on one", "[opencl]") {
+    for (const LensSystem& lensSystem : getTestLensSystems()) {
+        const int populationSize = 2048 + 100;
+        pagmo::vector_double fitness[2];
+        for (int chunkSize : { populationSize, 256 }) {
+            LensSystemProblem lensProblem;
+            pagmo::vector_double population = initTestProblem(lensSystem, populationSize, lensProblem);
+            if (!lensProblem.isOpenCLAvailable()) {
+                WARN("No OpenCL device, skipped");
+                return;
+            }
+            lensProblem.m_clChunkSize = chunkSize;
+            // Twice, so the second call reuses the buffers of the queues
+            lensProblem.batchFitnessOpenCL(population);
+            fitness[chunkSize != populationSize] = lensProblem.batchFitnessOpenCL(population);
+        }
+        INFO(lensSystem.getLensInterfaces().size() << " interfaces");
+        REQUIRE(fitness[0].size() == fitness[1].size());
+        for (size_t i = 0; i < fitness[0].size(); i++) {
+            CHECK(isSameFitness(fitness[0][i], fitness[1][i]));
+        }
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "lens_solver.h"
+#include "ghost_table.h"
+#include "preset_lens_systems.h"
+#include <pagmo/types.hpp>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+// The preset lens systems, 5 to 28 interfaces
+inline std::vector<LensSystem> getTestLensSystems() {
+    return { testLens(), heliarTronerLens(), someCanonLens(), japanesePatent() };
+}
+
+// Lens problem whose render objective is the three biggest ghosts of lensSystem, and populationSize random candidates
+// within its bounds, the setup of the batch fitness benchmarks
+inline pagmo::vector_double initTestProblem(const LensSystem& lensSystem, int populationSize, LensSystemProblem& lensProblem, unsigned seed = 42) {
+    glm::vec2 yawAndPitch = glm::vec2(0.001f);
+    GhostTable ghostTable(lensSystem);
+    lensProblem.init(lensSystem.getLensInterfaces().size(), yawAndPitch.x, yawAndPitch.y);
+    std::vector<SnapshotData> lensObjective;
+    for (int i = 0; i < std::min<int>(3, ghostTable.size()); i++) {
+        lensObjective.push_back(lensProblem.simulateDrawQuad(ghostTable.layout[i], i, yawAndPitch.x, yawAndPitch.y, lensSystem.getApertureHeight()));
+    }
+    lensProblem.setRenderObjective(lensObjective);
+
+    std::mt19937 rng(seed);
+    pagmo::vector_double population(static_cast<size_t>(populationSize) * lensProblem.m_dim);
+    for (int i = 0; i < populationSize; i++) {
+        for (unsigned int d = 0; d < lensProblem.m_dim; d++) {
+            std::uniform_real_distribution<double> dist(lensProblem.m_lb[d], lensProblem.m_ub[d]);
+            population[static_cast<size_t>(i) * lensProblem.m_dim + d] = dist(rng);
+        }
+    }
+    return population;
+}
+
+// Fitness values compare equal, NaN included (a candidate without ghosts)
+inline bool isSameFitness(double a, double b) {
+    return a == b || (std::isnan(a) && std::isnan(b));
+}